@@ -0,0 +1,119 @@
+#include "batch.h"
+#include "utils.h"
+#include "ini.h"
+#include <string.h>
+#include <unistd.h>
+
+static int parse_batch(void *pointer, const char *section, const char *attribute, const char *value);
+
+int load_batch(Batch *batch, const char *path, int (*is_key)(const char *section, const char *key))
+{
+  memset(batch, 0, sizeof(*batch));
+  strncpy(batch->path, path, sizeof(batch->path) - 1);
+  batch->is_key = is_key;
+
+  int status = ini_parse(path, parse_batch, batch);
+  batch->error_line = status > 0 ? status : 0;
+  if (status != 0 && batch->error == NULL)
+    batch->error = status > 0 ? "syntax error" : "could not read the file";
+
+  if (batch->error == NULL && batch->n_sessions == 0)
+    batch->error = "no sessions";
+
+  for (int i = 0; i < batch->n_sessions; i++)
+    batch->n_runs += batch->sessions[i].repeat;
+
+  return batch->error == NULL ? OK : FAIL;
+}
+
+// Session of the run-th capture, NULL once the batch is complete.
+BatchSession *batch_session(Batch *batch, int run)
+{
+  for (int i = 0; i < batch->n_sessions; i++)
+  {
+    if (run < batch->sessions[i].repeat)
+      return &batch->sessions[i];
+    run -= batch->sessions[i].repeat;
+  }
+
+  return NULL;
+}
+
+// The [batch] section of summary.ini.
+void batch_report(Batch *batch, int run, FILE *f)
+{
+  BatchSession *session = batch_session(batch, run);
+
+  fprintf(f, "file              = %s\r\n", batch->path);
+  fprintf(f, "run               = %i; of %i\r\n", run + 1, batch->n_runs);
+  fprintf(f, "session           = %s\r\n", session != NULL ? session->name : "none");
+
+  for (int i = 0; session != NULL && i < session->n_overrides; i++)
+  {
+    char key[2*BATCH_NAME_LEN];
+    snprintf(key, sizeof(key), "%s.%s", session->overrides[i].section, session->overrides[i].key);
+    fprintf(f, "%-17s = %s\r\n", key, session->overrides[i].value);
+  }
+}
+
+static int parse_batch(void *pointer, const char *section, const char *attribute, const char *value)
+{
+  Batch *batch = (Batch *)pointer;
+  BatchSession *session = batch->n_sessions > 0 ? &batch->sessions[batch->n_sessions - 1] : NULL;
+
+  //a section continues the last session if it has the same name, like ini files elsewhere
+  if (session == NULL || strncmp(session->name, section, BATCH_NAME_LEN) != 0)
+  {
+    if (batch->n_sessions == BATCH_MAX_SESSIONS)
+    {
+      batch->error = "too many sessions";
+      return 0;
+    }
+
+    session = &batch->sessions[batch->n_sessions++];
+    strncpy(session->name, section, BATCH_NAME_LEN - 1);
+    session->repeat = 1;
+  }
+
+  if (strcmp(attribute, "repeat") == 0)
+  {
+    session->repeat = atoi(value) > 0 ? atoi(value) : 1;
+    return 1;
+  }
+
+  const char *dot = strchr(attribute, '.');
+  if (dot == NULL || dot == attribute || dot - attribute >= BATCH_NAME_LEN || strlen(dot + 1) >= BATCH_NAME_LEN || strlen(value) >= BATCH_VALUE_LEN)
+  {
+    batch->error = "keys are section.key as in setup.ini";
+    return 0;
+  }
+
+  if (session->n_overrides == BATCH_MAX_OVERRIDES)
+  {
+    batch->error = "too many keys in one session";
+    return 0;
+  }
+
+  //a missing ramp file would only be found half way through the batch
+  if (strncmp(attribute, "files.", 6) == 0 && strstr(attribute, "synthesizer") != NULL && access(value, R_OK) != 0)
+  {
+    batch->error = "ramp file not found";
+    return 0;
+  }
+
+  BatchOverride *o = &session->overrides[session->n_overrides];
+  memcpy(o->section, attribute, dot - attribute);
+  o->section[dot - attribute] = '\0';
+  strcpy(o->key, dot + 1);
+  strcpy(o->value, value);
+
+  //a misspelt key would run its session with the settings it meant to change
+  if (batch->is_key != NULL && !batch->is_key(o->section, o->key))
+  {
+    batch->error = "unknown key";
+    return 0;
+  }
+
+  session->n_overrides++;
+  return 1;
+}
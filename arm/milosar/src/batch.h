@@ -0,0 +1,54 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "constants.h"
+
+#define BATCH_MAX_SESSIONS  32
+#define BATCH_MAX_OVERRIDES 32
+#define BATCH_NAME_LEN      48
+#define BATCH_VALUE_LEN     160
+
+// A list of capture sessions run back-to-back, read from an ini file with one section per session
+// in the order they run. Every key is a setup.ini key written as section.key and replaces that
+// value for this session only, every session starts again from the settings the batch started
+// with. A key the daemon does not take rejects the file. The key repeat runs a session more than
+// once.
+//
+//  [prf_1k]
+//  timing.prf = 1000
+//
+//  [narrow_ramp]
+//  repeat = 2
+//  files.tx_synthesizer = /opt/redpitaya/milosar/ramps/narrow_tx.ini
+typedef struct
+{
+  char section[BATCH_NAME_LEN];
+  char key[BATCH_NAME_LEN];
+  char value[BATCH_VALUE_LEN];
+} BatchOverride;
+
+typedef struct
+{
+  char name[BATCH_NAME_LEN];
+  int repeat;
+  int n_overrides;
+  BatchOverride overrides[BATCH_MAX_OVERRIDES];
+} BatchSession;
+
+typedef struct Batch_S
+{
+  char path[256];
+  int n_sessions;
+  BatchSession sessions[BATCH_MAX_SESSIONS];
+  int n_runs;                       // sessions counted with their repeats
+  const char *error;                // why the file was rejected
+  int error_line;
+  int (*is_key)(const char *section, const char *key);  // whether the daemon takes a setup.ini key
+} Batch;
+
+int load_batch(Batch *batch, const char *path, int (*is_key)(const char *section, const char *key));
+BatchSession *batch_session(Batch *batch, int run);
+void batch_report(Batch *batch, int run, FILE *f);
+
+#endif  // BATCH_H
@@ -14,6 +14,7 @@
 #define BYTES_PER_WRITE     4
 #define FIFO_DEPTH          8192
 #define N_CHANNELS          2
+#define SPEED_OF_LIGHT      299792458.0
 
 //Set Common Data Sizes
 #define S1MB (1 << 20) //2MB
@@ -21,6 +22,8 @@
 #define S4MB (4 << 20) //4MB
 #define SREG (4 << 10) //4KB
 
+#define PROGRESS_PERIOD_MS  250 //terminal progress line update period
+
 //Set Commonly Used Registers
 #define STS_A_BASE_ADDR     0x40000000
 #define TCU_BASE_ADDR       0x40001000
@@ -31,6 +34,7 @@
 #define INT_BASE_ADDR       0x40006000
 #define INDX_BASE_ADDR      0x40007000
 
+#define GPIO_TRIGGER_SWITCH 0x40008000
 #define GPIO_TRIGGER_LED    0x40009000
 #define GPIO_POWER_LED      0   // RED
 #define GPIO_ARMED_LED      1   // YELLOW
@@ -65,13 +69,29 @@ typedef struct Channel_S
 	uint32_t sts_base;
 	char letter[1];	
 	pthread_t thread;
+	volatile int is_stopping;       //request the record thread to finish early
+	volatile int is_done;           //record thread has closed its output
+	volatile int is_ready;          //record thread has read where the DMA writer starts
+	volatile int is_enabled;        //TCU enabled, or the start cancelled, the record thread drains from here
+	int start_position;             //[bytes] DMA writer position when the session started
+	int stream_offset;              //[bytes] of the session's stream in the stale half dropped before the first one stored
+	struct timespec first_block;    //CLOCK_MONOTONIC the first DMA half was drained
+	const char *error;              //why the record thread gave up, reported by the main thread
 } Channel;
 
 typedef struct
 {
 	int is_debug;                   //is debug mode enabled
 	int is_data_transfer;           //is data transfer to host enabled
-	int is_gpsd;
+	int is_gpsd;                    //log gps fixes from gpsd into every capture
+	char* gpsd_host;
+	int gpsd_port;
+	int gps_min_mode;               //fix mode and satellites for a fix to count as locked
+	int gps_min_sats;
+	int is_quicklook;               //range compress a few PRIs on the board while capturing
+	int quicklook_decimation;       //one in this many stored PRIs
+	int quicklook_channel;          //0 A, 1 B
+	double quicklook_cpu;           //cpu budget, fraction of one core
 
 	int channel_a_phase_increment;
 	int channel_b_phase_increment;
@@ -100,12 +120,42 @@ typedef struct
 	char* host_ip;
 	char* host_dir;
 
+	//variables for streaming offload during capture
+	int is_streaming;               //is streaming to the host receiver enabled
+	int stream_port;                //tcp port of milosar_receiver on the host
+	double stream_rate_limit;       //upper bound on the offload rate [MB/s]
+
+	//variables for segmented capture files
+	int segment_mode;               //0=OFF, 1=SIZE, 2=DURATION
+	double segment_mb;              //segment size for SIZE mode [MB]
+	double segment_seconds;         //segment length for DURATION mode [s]
+
+	//variables for pre-trigger capture
+	int is_pretrigger;              //keep a ram ring of data from arming until the trigger
+	double pretrigger_seconds;      //history committed ahead of the trigger [s]
+	double pretrigger_max_mb;       //upper bound on the ring memory [MB]
+	int is_trigger_button;          //is the trigger button used to trigger the capture
+
+	//variables for open-ended capture
+	int is_continuous;              //record until stopped instead of for n_seconds
+	double retention_mb;            //completed segments kept on disk [MB], 0 = unlimited
+	double retention_minutes;       //age of the oldest segment kept [min], 0 = unlimited
+	double min_free_mb;             //free space kept on the storage partition [MB]
+
+	//variables for striped storage
+	char* stripe_dirs;              //comma separated mount points, blocks are striped when 2 or more
+	int stripe_depth;               //queue depth per device [blocks]
+	char* stripe_throttle;          //comma separated bandwidth limits per device [MB/s], testing only
+
 	char* bitstream;                //fpga bitsteam file name
+	int is_force_bitstream;         //reload the bitstream even if it is already running
 
 	//variables for delaying the start of capture
 	//	this is mainly used when a wired ethernet connection is used to initiate the capture
 	//	but disconnected during actual capture sequence
 	unsigned int capture_delay;     //number of seconds to delay capture, from start of capture sequence
+	char* start_time;               //UTC the TCU is enabled at, unix seconds or ISO 8601, empty = on trigger
+	char* operator_comment;         //written to summary.ini, from setup.ini or the control socket
   int is_status_leds;             // is the status LEDs enabled
 
 } Configuration;
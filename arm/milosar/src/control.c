@@ -0,0 +1,143 @@
+#include "control.h"
+#include "utils.h"
+#include "trace.h"
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "colour.h"
+
+#define CONTROL_POLL_MS     200   // how often the socket thread checks for shutdown
+
+static void serve_client(Control *control, int client);
+
+int init_control(Control *control, const char *path, ControlHandler handler)
+{
+  struct sockaddr_un addr;
+
+  control->path = path;
+  control->handler = handler;
+  control->is_running = false;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  if ((control->sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return FAIL;
+
+  //a socket file left behind by a crashed run would block the bind
+  unlink(path);
+
+  if (bind(control->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(control->sock, 4) < 0)
+  {
+    cprint("[!!] ", BRIGHT, RED);
+    printf("Could not open control socket %s: %s\n", path, strerror(errno));
+    close(control->sock);
+    control->sock = -1;
+    return FAIL;
+  }
+
+  control->is_running = true;
+  pthread_create(&control->thread, NULL, *control_worker, (void *)control);
+
+  return OK;
+}
+
+void *control_worker(void *arg)
+{
+  Control *control = (Control *)arg;
+
+  TRACE_THREAD("control");
+
+  //commands are never urgent compared to the capture
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+  //exit_handler() waits for the capture to wind down, it must never run on this thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  while (control->is_running)
+  {
+    struct pollfd pfd = {control->sock, POLLIN, 0};
+
+    if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0)
+      continue;
+
+    int client = accept(control->sock, NULL, NULL);
+    if (client < 0)
+      continue;
+
+    serve_client(control, client);
+    close(client);
+  }
+
+  return NULL;
+}
+
+void dinit_control(Control *control)
+{
+  if (control->sock < 0)
+    return;
+
+  control->is_running = false;
+  pthread_join(control->thread, NULL);
+
+  close(control->sock);
+  control->sock = -1;
+  unlink(control->path);
+}
+
+// One client at a time, any number of commands per connection until it hangs up.
+static void serve_client(Control *control, int client)
+{
+  char line[CONTROL_LINE_LEN];
+  char reply[CONTROL_REPLY_LEN];
+  size_t used = 0;
+
+  //a client that stops talking must not hold the socket thread forever
+  struct timeval timeout = {5, 0};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  while (control->is_running)
+  {
+    ssize_t n = recv(client, line + used, sizeof(line) - 1 - used, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+
+    used += n;
+    line[used] = '\0';
+
+    char *end;
+    while ((end = strchr(line, '\n')) != NULL)
+    {
+      *end = '\0';
+      if (end > line && end[-1] == '\r')
+        end[-1] = '\0';
+
+      reply[0] = '\0';
+      TRACE_BEGIN(TraceControl, line[0], strlen(line));
+      control->handler(line, reply, sizeof(reply));
+      TRACE_END(TraceControl, line[0], strlen(reply));
+
+      if (send(client, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+        return;
+
+      used -= end + 1 - line;
+      memmove(line, end + 1, used + 1);
+    }
+
+    //an overlong line can never complete, drop it
+    if (used == sizeof(line) - 1)
+    {
+      const char *error = "error line too long\n";
+      send(client, error, strlen(error), MSG_NOSIGNAL);
+      return;
+    }
+  }
+}
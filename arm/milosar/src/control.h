@@ -0,0 +1,45 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "constants.h"
+
+// Local control protocol, one text line per command over a Unix stream socket
+//
+//  ping                          round-trip check
+//  status                        live counters of the current session
+//  telemetry                     latency histograms and counters, as in summary.ini
+//  set <section>.<key> <value>   same keys as setup.ini, only while idle
+//  profile <file.ini>            apply a setup.ini style profile, only while idle
+//  comment <text>                operator comment of the next session
+//  arm                           start a session now (daemon)
+//  start <unix time>|+<seconds>  start a session at an absolute or relative time (daemon)
+//                                absolute also as UTC YYYY-MM-DDTHH:MM:SS.sss, TCU enabled on it
+//  stop                          end the running session cleanly, or cancel a scheduled start
+//  shutdown                      leave the daemon once the current session is complete
+//  press [ms]                    simulated trigger button press, held low for ms (default 100)
+//  batch <file.ini>|cancel       run a batch of sessions back-to-back (daemon), or stop it after
+//                                the running session
+//
+// Every reply is zero or more "key = value" lines followed by a line starting with "ok" or
+// "error". The socket thread never takes a lock the record thread holds.
+#define CONTROL_SOCKET      "/tmp/milosar.sock"
+#define CONTROL_LINE_LEN    512
+#define CONTROL_REPLY_LEN   4096
+
+// Executes one command line and fills reply, provided by the application.
+typedef void (*ControlHandler)(char *line, char *reply, size_t reply_len);
+
+typedef struct Control_S
+{
+  const char *path;
+  int sock;
+  ControlHandler handler;
+  volatile int is_running;
+  pthread_t thread;
+} Control;
+
+int init_control(Control *control, const char *path, ControlHandler handler);
+void *control_worker(void *arg);
+void dinit_control(Control *control);
+
+#endif  // CONTROL_H
@@ -1,170 +1,520 @@
 #include "gps.h"
-#include "constants.h"
+#include "timing.h"
+#include "trace.h"
+#include "colour.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <math.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
-void *gps_worker(void *arg)
+#define GPS_WATCH "?WATCH={\"enable\":true,\"json\":true};\n"
+
+static int connect_gpsd(Gps *gps);
+static void push_fix(Gps *gps, GpsFix *fix);
+static int writer_drain(Gps *gps);
+static int json_number(const char *line, const char *key, double *value);
+static int json_string(const char *line, const char *key, char *value, size_t len);
+
+int init_gps(Gps *gps, const char *host, int port, int min_mode, int min_sats)
 {
-    Gps *gps = (Gps *)arg;
-    gps->f = fopen(TMP_FILE, "w");
-    int rc;
+  memset(gps, 0, sizeof(*gps));
+  strncpy(gps->host, host, sizeof(gps->host) - 1);
+  gps->port = port;
+  gps->min_mode = min_mode;
+  gps->min_sats = min_sats;
+  gps->sock = -1;
 
-    if ((rc = gps_open(HOST_IP, HOST_PORT, &gps->data)) == -1) 
-    {
-        printf("Failed to open gpsd daemon socket at %s:%s.\nCode: %d.\nReason: %s.\n",HOST_IP, HOST_PORT, rc, gps_errstr(rc));
-        exit(EXIT_FAILURE);
-    } else
+  gps->slots = calloc(GPS_RING_SLOTS, sizeof(GpsFix));
+  if (gps->slots == NULL || sem_init(&gps->wake, 0, 0) != 0)
+    return FAIL;
+
+  gps->last.time = NAN;
+  gps->last.latitude = NAN;
+  gps->last.longitude = NAN;
+  gps->last.altitude = NAN;
+
+  gps->is_running = true;
+  pthread_create(&gps->reader, NULL, *gps_reader, (void *)gps);
+  pthread_create(&gps->writer, NULL, *gps_writer, (void *)gps);
+
+  cprint("[**] ", BRIGHT, CYAN);
+  printf("GPS from gpsd on %s:%d\n", gps->host, gps->port);
+
+  return OK;
+}
+
+// Fixes read from start_ns on go to path until gps_stop(), the file is opened by the writer.
+int gps_start(Gps *gps, const char *path, int64_t start_ns)
+{
+  strncpy(gps->path, path, sizeof(gps->path) - 1);
+  gps->start_ns = start_ns;
+  memset(&gps->header, 0, sizeof(gps->header));
+  gps->header.magic = GPS_MAGIC;
+  gps->header.version = GPS_VERSION;
+  gps->header.record_size = sizeof(GpsFix);
+  gps->n_written = 0;
+  gps->n_locked = 0;
+
+  __atomic_store_n(&gps->request, GpsOpen, __ATOMIC_RELEASE);
+  sem_post(&gps->wake);
+  return OK;
+}
+
+// The TCU enable of the session goes into the header when the file is closed.
+void gps_set_tcu(Gps *gps, int64_t monotonic_ns, int64_t realtime_ns)
+{
+  gps->header.tcu_monotonic_ns = monotonic_ns;
+  gps->header.tcu_realtime_ns = realtime_ns;
+}
+
+// Returns once every fix read so far is in the file and it is closed.
+void gps_stop(Gps *gps)
+{
+  while (__atomic_load_n(&gps->request, __ATOMIC_ACQUIRE) == GpsOpen)
+    usleep(1000);
+
+  __atomic_store_n(&gps->request, GpsClose, __ATOMIC_RELEASE);
+  sem_post(&gps->wake);
+
+  while (__atomic_load_n(&gps->request, __ATOMIC_ACQUIRE) != GpsNone)
+    usleep(1000);
+}
+
+// Latest fix, safe from any thread. FAIL if there was none yet.
+int gps_last(Gps *gps, GpsFix *fix)
+{
+  uint32_t seq;
+
+  do
+  {
+    while ((seq = __atomic_load_n(&gps->shown_seq, __ATOMIC_ACQUIRE)) & 1)
+      ;
+    memcpy(fix, &gps->shown, sizeof(*fix));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+  while (__atomic_load_n(&gps->shown_seq, __ATOMIC_RELAXED) != seq);
+
+  return seq > 0 ? OK : FAIL;
+}
+
+// The [gps] section of summary.ini.
+void gps_report(Gps *gps, FILE *f)
+{
+  GpsFix fix;
+  int is_fix = gps_last(gps, &fix) == OK;
+
+  fprintf(f, "gpsd              = %s:%d\r\n", gps->host, gps->port);
+  fprintf(f, "connected         = %i\r\n", gps->is_connected);
+  fprintf(f, "n_connects        = %u\r\n", gps->n_connects);
+  fprintf(f, "n_fixes           = %u\r\n", gps->n_written);
+  fprintf(f, "n_locked          = %u\r\n", gps->n_locked);
+  fprintf(f, "n_dropped         = %u; ring full since the reader started\r\n", __atomic_load_n(&gps->n_dropped, __ATOMIC_RELAXED));
+  fprintf(f, "n_errors          = %u; unparsable reports\r\n", gps->n_errors);
+
+  if (is_fix)
+  {
+    fprintf(f, "last_mode         = %u\r\n", fix.mode);
+    fprintf(f, "last_satellites   = %u/%u\r\n", fix.n_used, fix.n_visible);
+    fprintf(f, "last_latitude     = %.8f\r\n", fix.latitude);
+    fprintf(f, "last_longitude    = %.8f\r\n", fix.longitude);
+    fprintf(f, "last_altitude     = %.3f\r\n", fix.altitude);
+  }
+}
+
+void *gps_reader(void *arg)
+{
+  Gps *gps = (Gps *)arg;
+  char *line = malloc(GPS_LINE_LEN);
+  size_t n = 0;
+  int64_t retry_ns = 0;
+
+  //signals belong to the main thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TRACE_THREAD("gps");
+
+  while (gps->is_running && line != NULL)
+  {
+    ClockPair now;
+    clock_pair(&now);
+
+    if (gps->sock < 0)
     {
-        cprint("[**] ", BRIGHT, CYAN);
-        printf("Connected to gpsd on %s:%s\n", HOST_IP, HOST_PORT);
+      if (now.monotonic_ns >= retry_ns && connect_gpsd(gps) == OK)
+      {
+        n = 0;
+        gps->is_gap = true;
+      }
+      else
+      {
+        if (now.monotonic_ns >= retry_ns)
+          retry_ns = now.monotonic_ns + GPS_RETRY_MS*1000000LL;
+        usleep(GPS_POLL_MS*1000);
+        continue;
+      }
     }
 
-    // set watch policy 
-    gps_stream(&gps->data, WATCH_ENABLE | WATCH_JSON, NULL);
+    struct pollfd fds = {gps->sock, POLLIN, 0};
+    if (poll(&fds, 1, GPS_POLL_MS) <= 0)
+      continue;
 
-    while (gps->state != Shutdown)
+    ssize_t status = recv(gps->sock, line + n, GPS_LINE_LEN - 1 - n, 0);
+    if (status <= 0)
     {
-        // blocking check with timeout to see if input is waiting.
-        if (gps_waiting(&gps->data, 2e6)) 
-        {
-            // blocking read for data from the daemon
-            if ((rc = gps_read(&gps->data)) == -1) 
-            {
-                printf("Error occurred reading GPS data.\nCode: %d.\nReason: %s\n", rc, gps_errstr(rc));
-                gps_stream(&gps->data, WATCH_DISABLE, NULL);
-                gps_close (&gps->data);
-	            exit(EXIT_FAILURE);
-            } 
-            else 
-            {      
-                // interpret data from the GPS receiver.
-                if (gps->data.set & PACKET_SET) // at least one complete JSON response has arrived since the last read
-                {
-                    if ((gps->data.fix.mode >= gps->min_mode) && (gps->data.satellites_used >= gps->min_sats))
-                    {                   
-                        gps->is_locked = true;
-                    } 
-                    else
-                    {
-                        gps->is_locked = false;
-                    }      
-
-                    if ((gps->state == Active) && (gps->is_locked))
-                    {
-                        save_data(gps);
-                        gps_clear_dop(&gps->data.dop);
-                        gps_clear_fix(&gps->data.fix);
-                    }                                 
-                }
-                else
-                {
-                    printf("No complete JSON response has arrived since the last read.\n");
-                }
-            }
-        }
-        else
-        {       
-	        // re-enable GPS stream if/when automatic disable occurs
-            gps_stream(&gps->data, WATCH_ENABLE | WATCH_JSON, NULL);
-        }
+      if (status < 0 && (errno == EINTR || errno == EAGAIN))
+        continue;
+
+      //gpsd went away, try again later
+      close(gps->sock);
+      gps->sock = -1;
+      gps->is_connected = false;
+      retry_ns = now.monotonic_ns + GPS_RETRY_MS*1000000LL;
+      continue;
     }
 
-    // all done
-    fclose(gps->f);
+    //every report arrived with this read is stamped with its time
+    clock_pair(&now);
+    n += status;
+    line[n] = '\0';
 
-    char command[100];
-    sprintf(command, "cp %s %s\n", TMP_FILE, gps->experiment_dir);
-    system(command);
+    char *start = line, *end;
+    while ((end = strchr(start, '\n')) != NULL)
+    {
+      *end = '\0';
 
-    gps_stream(&gps->data, WATCH_DISABLE, NULL);
-    gps_close(&gps->data);
-    return NULL;
-}
+      int class = gps_parse(start, &gps->last);
+      if (class < 0)
+        gps->n_errors++;
+      else if (class > 0)
+      {
+        gps->n_reports++;
+        gps->last.monotonic_ns = now.monotonic_ns;
+        gps->last.realtime_ns = now.realtime_ns;
+        gps->last.sequence = gps->n_reports;
+
+        int is_locked = gps->last.mode >= gps->min_mode && gps->last.n_used >= gps->min_sats;
+        gps->last.flags = (gps->last.flags & GpsVelocityNed) | (is_locked ? GpsLocked : 0);
+
+        //a SKY report only updates the satellite counts of the next fix
+        if (class == 1)
+          push_fix(gps, &gps->last);
+      }
 
+      start = end + 1;
+    }
+
+    //keep a partial report for the next read, drop one that can never fit
+    n = line + n - start;
+    memmove(line, start, n);
+    if (n == GPS_LINE_LEN - 1)
+    {
+      gps->n_errors++;
+      n = 0;
+    }
+  }
 
-void print_gps(struct gps_data_t *gps_data)
+  if (gps->sock >= 0)
+    close(gps->sock);
+  gps->sock = -1;
+  free(line);
+  return NULL;
+}
+
+void *gps_writer(void *arg)
 {
-    if (gps_data->set & PACKET_SET) // at least one complete JSON response has arrived since the last read
+  Gps *gps = (Gps *)arg;
+
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  //the capture threads come first, nice is per thread on linux
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), GPS_WRITER_NICE);
+
+  TRACE_THREAD("gps_writer");
+
+  while (gps->is_running)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += GPS_WRITE_PERIOD_MS*1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    sem_timedwait(&gps->wake, &deadline);
+
+    enum GpsRequest request = __atomic_load_n(&gps->request, __ATOMIC_ACQUIRE);
+
+    if (request == GpsOpen)
     {
-        char iso_time[26];
-        char* mode;
-        
-        printf("Status:\t\t%s\n", gps_data->status ? "FIX" : "NO FIX");
-
-        switch (gps_data->fix.mode)
-        {
-            case 0: mode = "UNKNOWN"; break;
-            case 1: mode = "NO FIX"; break;
-            case 2: mode = "2D"; break;
-            case 3: mode = "3D"; break;
-        }
-
-        printf("Mode:\t\t%s\n", mode);
-        printf("Satellites:\t%i/%i\n", gps_data->satellites_used, gps_data->satellites_visible);
-        printf("Latitude:\t%f\n", gps_data->fix.latitude);
-        printf("Longitude:\t%f\n", gps_data->fix.longitude);
-        printf("Speed:\t\t%f\n", gps_data->fix.speed);
-        
-        unix_to_iso8601(gps_data->fix.time, iso_time, 26);
-        printf("GPS Time:\t%s\n", iso_time);
-
-        unix_to_iso8601(time(NULL), iso_time, 26);
-        printf("System Time:\t%s\n", iso_time);
-
-        gps_clear_fix(&gps_data->fix);
+      gps->f = fopen(gps->path, "wb");
+      if (gps->f == NULL || fwrite(&gps->header, sizeof(gps->header), 1, gps->f) != 1)
+      {
+        cprint("[!!] ", BRIGHT, RED);
+        printf("Could not open %s, no GPS log this session\n", gps->path);
+        if (gps->f != NULL)
+          fclose(gps->f);
+        gps->f = NULL;
+      }
+      __atomic_store_n(&gps->request, GpsNone, __ATOMIC_RELEASE);
     }
+
+    writer_drain(gps);
+
+    if (request == GpsClose)
+    {
+      //the header gets the TCU enable, known only after the file was opened
+      if (gps->f != NULL)
+      {
+        if (fseek(gps->f, 0, SEEK_SET) != 0 || fwrite(&gps->header, sizeof(gps->header), 1, gps->f) != 1)
+          gps->n_errors++;
+        fclose(gps->f);
+      }
+      gps->f = NULL;
+      __atomic_store_n(&gps->request, GpsNone, __ATOMIC_RELEASE);
+    }
+  }
+
+  if (gps->f != NULL)
+    fclose(gps->f);
+  gps->f = NULL;
+  return NULL;
 }
 
+// Parses one gpsd report into fix, which holds the previous values. Returns 1 for a TPV report,
+// 2 for SKY, 0 for a class that is not used and -1 if the line is not a report.
+int gps_parse(const char *line, GpsFix *fix)
+{
+  char class[16], text[40];
+  double value, north, east, down;
+
+  if (json_string(line, "class", class, sizeof(class)) != OK)
+    return -1;
+
+  if (strcmp(class, "SKY") == 0)
+  {
+    //newer gpsd counts them, older ones only list the satellites
+    if (json_number(line, "uSat", &value) == OK)
+      fix->n_used = value;
+    else if (strstr(line, "\"satellites\"") != NULL)
+    {
+      int n_used = 0;
+      for (const char *p = line; (p = strstr(p, "\"used\":true")) != NULL; p++)
+        n_used++;
+      fix->n_used = n_used;
+    }
+
+    if (json_number(line, "nSat", &value) == OK)
+      fix->n_visible = value;
+    else if (strstr(line, "\"satellites\"") != NULL)
+    {
+      int n_visible = 0;
+      for (const char *p = line; (p = strstr(p, "\"PRN\":")) != NULL; p++)
+        n_visible++;
+      fix->n_visible = n_visible;
+    }
+
+    return 2;
+  }
+
+  if (strcmp(class, "TPV") != 0)
+    return 0;
+
+  fix->mode = json_number(line, "mode", &value) == OK ? (uint8_t)value : 0;
+
+  struct timespec t;
+  fix->time = json_string(line, "time", text, sizeof(text)) == OK && timing_parse(text, &t) == OK ? t.tv_sec + t.tv_nsec*1e-9 : NAN;
+
+  #define FIELD(key, member) member = json_number(line, key, &value) == OK ? value : NAN
+
+  FIELD("lat", fix->latitude);
+  FIELD("lon", fix->longitude);
+  if (json_number(line, "altHAE", &value) == OK)
+    fix->altitude = value;
+  else
+    FIELD("alt", fix->altitude);
+
+  FIELD("ept", fix->ept);
+  FIELD("epx", fix->epx);
+  FIELD("epy", fix->epy);
+  FIELD("epv", fix->epv);
+  FIELD("eps", fix->eps);
+  FIELD("speed", fix->speed);
+  FIELD("track", fix->track);
+
+  #undef FIELD
+
+  if (json_number(line, "velN", &north) == OK && json_number(line, "velE", &east) == OK && json_number(line, "velD", &down) == OK)
+    fix->flags |= GpsVelocityNed;
+  else
+  {
+    double climb = json_number(line, "climb", &value) == OK ? value : NAN;
+    north = fix->speed*cos(fix->track*M_PI/180);
+    east = fix->speed*sin(fix->track*M_PI/180);
+    down = -climb;
+    fix->flags &= ~GpsVelocityNed;
+  }
+
+  fix->velocity[0] = north;
+  fix->velocity[1] = east;
+  fix->velocity[2] = down;
+
+  return 1;
+}
 
 void dinit_gps(Gps *gps)
 {
-    gps_stream(&gps->data, WATCH_DISABLE, NULL);
-    gps_close(&gps->data);
-    free(gps);
-    fclose(gps->f);
+  if (gps->is_running)
+  {
+    gps->is_running = false;
+    sem_post(&gps->wake);
+    pthread_join(gps->reader, NULL);
+    pthread_join(gps->writer, NULL);
+  }
+
+  sem_destroy(&gps->wake);
+  free(gps->slots);
+  gps->slots = NULL;
 }
 
+// Connects and asks for JSON reports, the connect itself is bounded by GPS_POLL_MS.
+static int connect_gpsd(Gps *gps)
+{
+  struct addrinfo hints, *addresses;
+  char port[8];
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof(port), "%d", gps->port);
 
-void wait_for_fix(Gps *gps)
+  if (getaddrinfo(gps->host, port, &hints, &addresses) != 0)
+    return FAIL;
+
+  for (struct addrinfo *a = addresses; a != NULL; a = a->ai_next)
+  {
+    int sock = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+    if (sock < 0)
+      continue;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    struct pollfd fds = {sock, POLLOUT, 0};
+
+    if ((connect(sock, a->ai_addr, a->ai_addrlen) == 0 || (errno == EINPROGRESS && poll(&fds, 1, GPS_POLL_MS) == 1 &&
+         getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0)) &&
+        send(sock, GPS_WATCH, strlen(GPS_WATCH), MSG_NOSIGNAL) == (ssize_t)strlen(GPS_WATCH))
+    {
+      freeaddrinfo(addresses);
+      gps->sock = sock;
+      gps->is_connected = true;
+      gps->n_connects++;
+      return OK;
+    }
+
+    close(sock);
+  }
+
+  freeaddrinfo(addresses);
+  return FAIL;
+}
+
+static void push_fix(Gps *gps, GpsFix *fix)
 {
-    int displayed_count = 0;
-    printf("\n\n\n\n\n\n\n\n\n");
-    while(displayed_count < 5)
+  int64_t head = gps->head;
+
+  //the seqlock copy for the status and summary readers
+  __atomic_store_n(&gps->shown_seq, gps->shown_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(&gps->shown, fix, sizeof(*fix));
+  __atomic_store_n(&gps->shown_seq, gps->shown_seq + 1, __ATOMIC_RELEASE);
+
+  if (head - __atomic_load_n(&gps->tail, __ATOMIC_ACQUIRE) >= GPS_RING_SLOTS)
+  {
+    __atomic_add_fetch(&gps->n_dropped, 1, __ATOMIC_RELAXED);
+    gps->is_gap = true;
+    return;
+  }
+
+  gps->slots[head & (GPS_RING_SLOTS - 1)] = *fix;
+  if (gps->is_gap)
+    gps->slots[head & (GPS_RING_SLOTS - 1)].flags |= GpsAfterGap;
+  gps->is_gap = false;
+
+  TRACE_INSTANT(TraceGpsFix, fix->mode, fix->n_used);
+  __atomic_store_n(&gps->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Moves everything in the ring to the open file, or drops it outside a session.
+static int writer_drain(Gps *gps)
+{
+  int64_t head = __atomic_load_n(&gps->head, __ATOMIC_ACQUIRE);
+  int64_t tail = gps->tail;
+
+  for (; tail < head; tail++)
+  {
+    GpsFix *fix = &gps->slots[tail & (GPS_RING_SLOTS - 1)];
+
+    if (gps->f == NULL || fix->monotonic_ns < gps->start_ns)
+      continue;
+    if (fwrite(fix, sizeof(*fix), 1, gps->f) != 1)
     {
-        printf("\033[10A\n"); //move cursor up 
-        printf("\033[J"); //clear screen from cursor down
-
-        cprint("[??] ", BRIGHT, BLUE);
-        printf("Waiting for GPS to acquire stable fix ");
-        spin_cursor();
-        printf("\n");	
-
-        print_gps(&gps->data);			
-        sleep(1);
-
-        //display some fix data before moving on
-        if (gps->is_locked)
-        {
-            displayed_count += 1;
-        }
+      gps->n_errors++;
+      continue;
     }
 
-    printf("\033[10A\n"); //move cursor up 
-    printf("\033[J"); //clear screen from cursor down
+    gps->n_written++;
+    if (fix->flags & GpsLocked)
+      gps->n_locked++;
+  }
+
+  __atomic_store_n(&gps->tail, tail, __ATOMIC_RELEASE);
+  if (gps->f != NULL)
+    fflush(gps->f);
+
+  return OK;
 }
 
+// Value of "key":<number> in a flat JSON object, FAIL if it is missing.
+static int json_number(const char *line, const char *key, double *value)
+{
+  char pattern[24];
+  char *end;
 
-void save_data(Gps *gps)
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char *p = strstr(line, pattern);
+  if (p == NULL)
+    return FAIL;
+
+  p += strlen(pattern);
+  *value = strtod(p, &end);
+  return end == p ? FAIL : OK;
+}
+
+// Value of "key":"<string>", FAIL if it is missing or longer than len.
+static int json_string(const char *line, const char *key, char *value, size_t len)
 {
-    fprintf(gps->f, "%lf, %f, %f, %f, %f, %f, %f, %f, %f, %f, %i, %i\n",    
-            gps->data.fix.time, 
-            gps->data.fix.ept,  
-            gps->data.fix.latitude,
-            gps->data.fix.epy, 
-            gps->data.fix.longitude, 
-            gps->data.fix.epx, 
-            gps->data.fix.altitude, 
-            gps->data.fix.epv, 
-            gps->data.fix.speed, 
-            gps->data.fix.eps, 
-            gps->data.satellites_used, 
-            gps->data.satellites_visible);
+  char pattern[24];
+
+  snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+  const char *p = strstr(line, pattern);
+  if (p == NULL)
+    return FAIL;
+
+  p += strlen(pattern);
+  const char *end = strchr(p, '"');
+  if (end == NULL || (size_t)(end - p) >= len)
+    return FAIL;
+
+  memcpy(value, p, end - p);
+  value[end - p] = '\0';
+  return OK;
 }
\ No newline at end of file
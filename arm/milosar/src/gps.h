@@ -1,38 +1,80 @@
 #ifndef GPS_H
 #define GPS_H
 
-#include <gps.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <math.h>
+#include <semaphore.h>
 
-#include "colour.h"
 #include "constants.h"
-#include "utils.h"
+#include "gps_record.h"
 
-enum State {Idle = 0, Active = 1, Shutdown = 2};
+#define GPS_HOST            "localhost"
+#define GPS_PORT            2947
+#define GPS_RING_SLOTS      512     // fixes, power of two, 50 s at 10 Hz
+#define GPS_LINE_LEN        4096    // longest gpsd report, SKY with every satellite
+#define GPS_POLL_MS         200     // longest reader wait, how soon a shutdown is noticed
+#define GPS_RETRY_MS        2000    // between connection attempts
+#define GPS_WRITE_PERIOD_MS 250     // ring drain period of the writer
+#define GPS_WRITER_NICE     19
 
-typedef struct Gps_S 
+enum GpsRequest {GpsNone = 0, GpsOpen = 1, GpsClose = 2};
+
+// GPS position log of the capture, from gpsd's JSON protocol over its TCP socket.
+//
+// The reader thread never blocks on anything but the socket with a timeout. It parses TPV and
+// SKY reports into fixed size GpsFix records stamped with a clock pair on arrival and pushes them
+// into a single producer, single consumer ring; a full ring drops the fix and counts it. A lost
+// connection is retried every GPS_RETRY_MS, neither it nor a malformed report ends the process.
+//
+// The writer thread runs at nice GPS_WRITER_NICE and drains the ring every GPS_WRITE_PERIOD_MS.
+// Between gps_start() and gps_stop() it appends the fixes read since the start to GPS_FILE in
+// the experiment directory, outside a session it only keeps the ring empty. The file is opened
+// and closed on the writer thread, requested through the request word and its semaphore.
+typedef struct Gps_S
 {
-    FILE* f;
-    int is_locked;
-    enum State state;
-    int min_mode;
-    int min_sats;    
-    char* experiment_dir;
-	pthread_t thread;
-    struct gps_data_t data;
+  char host[64];
+  int port;
+  int min_mode;
+  int min_sats;
+  int sock;
+
+  GpsFix *slots;
+  volatile int64_t head;            // written by the reader
+  volatile int64_t tail;            // written by the writer
+
+  GpsFix last;                      // latest fix, reader only
+  GpsFix shown;                     // copy of it for other threads, under seqlock
+  volatile uint32_t shown_seq;      // odd while shown is being written
+
+  volatile enum GpsRequest request;
+  char path[250];
+  int64_t start_ns;                 // CLOCK_MONOTONIC, fixes before it are not written
+  GpsHeader header;
+  FILE *f;
+  sem_t wake;
+
+  volatile int is_connected;
+  volatile int is_running;
+  int is_gap;                       // next fix follows a reconnect or a drop
+  uint32_t n_reports;
+  uint32_t n_connects;
+  uint32_t n_errors;                // reports that could not be parsed
+  volatile uint32_t n_dropped;      // fixes lost to a full ring
+  uint32_t n_written;               // this session
+  uint32_t n_locked;                // this session
+
+  pthread_t reader;
+  pthread_t writer;
 } Gps;
 
-void *gps_worker(void *arg);
-void print_gps(struct gps_data_t *gps_data);
+int init_gps(Gps *gps, const char *host, int port, int min_mode, int min_sats);
+int gps_start(Gps *gps, const char *path, int64_t start_ns);
+void gps_set_tcu(Gps *gps, int64_t monotonic_ns, int64_t realtime_ns);
+void gps_stop(Gps *gps);
+int gps_last(Gps *gps, GpsFix *fix);
+void gps_report(Gps *gps, FILE *f);
+void *gps_reader(void *arg);
+void *gps_writer(void *arg);
+int gps_parse(const char *line, GpsFix *fix);
 void dinit_gps(Gps *gps);
-void wait_for_fix(Gps *gps);
-void save_data(Gps *gps);
-
-#define HOST_IP     "localhost"
-#define HOST_PORT   "2947"
-#define TMP_FILE    "/tmp/gps.txt"
 
-#endif
\ No newline at end of file
+#endif  // GPS_H
\ No newline at end of file
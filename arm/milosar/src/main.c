@@ -10,14 +10,24 @@
 #include <stdlib.h>
 #include <time.h>
 #include <inttypes.h>
+#include <semaphore.h>
 
 #include "reg.h"
 #include "utils.h"
 #include "constants.h"
 #include "synth.h"
-// #include "gps.h"
-#include "led.h"
-#include "trigger.h"
+#include "gps.h"
+#include "quicklook.h"
+#include "panel.h"
+#include "storage.h"
+#include "ring.h"
+#include "transfer.h"
+#include "fpga.h"
+#include "control.h"
+#include "telemetry.h"
+#include "timing.h"
+#include "batch.h"
+#include "trace.h"
 #include "version.h"
 
 //-----------------------------------------------------------------------------------------------
@@ -27,18 +37,87 @@ void *record(void *arg);
 void init_red_pitaya(void);
 void splash(void);
 int parse_setup_file(void* pointer, const char* section, const char* attribute, const char* value);
-void waitFor (unsigned int secs);
+int is_setup_key(const char *section, const char *key);
+int apply_settings(Configuration *c);
+void load_synths(Configuration *c, Synthesizer *tx, Synthesizer *lo);
+int program_synths(Synthesizer *tx, Synthesizer *lo);
+void check_settings(Configuration *c);
+void run_batch(void);
+void stage_batch_run(int run);
+void *prepare_worker(void *arg);
+void control_command(char *line, char *reply, size_t reply_len);
+double read_temperature(void);
+void trigger_handler(int sig);
+void trigger_event(struct timespec *edge, const char *source);
+void run_session(void);
+double elapsed_ms(struct timespec *start, struct timespec *end);
+void print_progress(void);
 
 //-----------------------------------------------------------------------------------------------
 // Global variables
 //-----------------------------------------------------------------------------------------------
 Channel *A, *B;
-// Gps *gps;
+Gps *gps;
+Quicklook *quicklook;
 Synthesizer tx_synth, lo_synth;
 Configuration config;
-Led *power_led;
-Led *armed_led;
-Led *capture_led;
+Panel *panel;
+Transfer *transfer;
+Storage *storage;
+Ring *ring;
+Bitstream bitstream;
+Control *control;
+Timing *timing;
+Batch *batch;
+
+// Where parse_setup_file() writes, the live settings unless the next batch session is being staged.
+// A target without settings only asks whether the key is one it knows.
+typedef struct
+{
+  Configuration *config;
+  Synthesizer *tx_synth, *lo_synth;
+} SetupTarget;
+
+static int is_daemon = false;             //stay resident and run a session per trigger
+static int n_sessions = 0;
+static int is_synth_flashed = false;      //synth registers survive between sessions
+static int tx_flashed[NUM_REGISTERS][MAX_RAMPS], lo_flashed[NUM_REGISTERS][MAX_RAMPS];  //as last written
+static Configuration applied;             //sampling settings as last written to the fpga
+static int is_applied = false;
+static volatile int is_capturing = false; //a record thread is running
+static int is_session_open = false;       //storage, ring and stripe of the session exist, under config_lock
+static volatile int is_session_requested = false;
+static struct timespec session_trigger;   //CLOCK_MONOTONIC of the trigger that started the session
+static const char *trigger_source = "none";
+static sem_t session_wake;                //posted for every session or shutdown request of the daemon
+static struct timespec start_at;          //CLOCK_REALTIME the next session is scheduled for, 0 = now
+static struct timespec tcu_enabled;       //CLOCK_MONOTONIC of the current session's TCU enable
+static volatile int is_shutdown_requested = false;
+static int is_config_changed = false;     //settings changed over the control socket since the last session
+static int is_quicklook = false;          //the quicklook thread looks at the current session
+static struct timespec tcu_stopped;       //CLOCK_MONOTONIC the last session's TCU was disabled, 0 = none yet
+
+//batch mode, the next session is staged while the last one finishes its offload
+static volatile int is_batch_requested = false;
+static volatile int is_batch_cancelled = false;
+static int batch_run = -1;                //run in progress, -1 outside a batch
+static Configuration base_config, staged_config;
+static Synthesizer base_tx, base_lo, staged_tx, staged_lo;
+static pthread_t prepare_thread;
+static int is_preparing = false;
+static int staged_run;                    //run prepare_worker() stages
+static int staged_status;                 //FAIL if the staged run's settings could not be applied
+static int staged_fpga_writes, staged_synth_writes;
+static double staged_ms;
+static int n_fpga_writes = 0;             //register writes bringing the hardware to this session
+static int n_synth_writes = 0;
+static double prepare_ms = 0;             //staging time of this session, overlapped with the last one
+static double prepare_wait_ms = 0;        //part of it the session had to wait for
+
+enum SessionState {Idle = 0, Scheduled = 1, Recording = 2, Finishing = 3};
+static volatile enum SessionState session_state = Idle;
+static const char *session_state_names[] = {"idle", "scheduled", "recording", "finishing"};
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;  //settings vs. session start
 
 static void *reg_integration, *reg_index, *reg_channel_a_phase_inc, *reg_gpio, *reg_tcu, *reg_channel_b_phase_inc;
 
@@ -50,6 +129,21 @@ void exit_handler(int sig)
 	cprint("\n[**] ", BRIGHT, CYAN);
 	printf("Exiting Safely.\n");
 
+	//the first interrupt ends a continuous capture like any other stop, the second one exits
+	if (sig == SIGINT && is_capturing && config.is_continuous && !A->is_stopping)
+	{
+		A->is_stopping = true;
+		return;
+	}
+
+	//let the record thread finish its current block and complete the capture file
+	if (is_capturing && !A->is_done)
+	{
+		A->is_stopping = true;
+		while (!A->is_done)
+			usleep(1000);
+	}
+
 	ASSERT(dnit_mem(), "Failed to deallocate /dev/mem.");
 	ASSERT(destroy_map(SREG, &reg_integration), "Failed to deallocate reg_integration memory.");
 	ASSERT(destroy_map(SREG, &reg_index), "Failed to deallocate reg_index memory.");
@@ -58,17 +152,47 @@ void exit_handler(int sig)
 	ASSERT(destroy_map(SREG, &reg_tcu), "Failed to deallocate reg_tcu memory.");
 	ASSERT(destroy_map(SREG, &reg_channel_b_phase_inc), "Failed to deallocate reg_channel_b_phase_inc memory.");
 
-	// if (config.is_gpsd) dinit_gps(gps);
+	if (config.is_gpsd) dinit_gps(gps);
 
-  if (config.is_status_leds) dinit_leds();
+  dinit_panel(panel);
 
   printf("Done\n");
 	exit(sig == -1 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
-void waitFor (unsigned int secs) {
-    unsigned int retTime = time(0) + secs;   // Get finishing time.
-    while (time(0) < retTime);               // Loop until it arrives.
+void trigger_handler(int sig)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	trigger_event(&now, "signal");
+}
+
+// Acts on a trigger right where it arrives, the panel thread calls this for a button press with
+// the time of its leading edge, which is where the trigger latencies in summary.ini count from.
+// Only async-signal-safe calls, it also runs from the SIGUSR1 handler.
+void trigger_event(struct timespec *edge, const char *source)
+{
+	if (!is_capturing)
+	{
+		//between sessions the daemon starts the next one, timed from this moment
+		if (is_daemon && !is_session_requested)
+		{
+			session_trigger = *edge;
+			trigger_source = source;
+			is_session_requested = true;
+			sem_post(&session_wake);
+		}
+	}
+	else if (ring != NULL && config.is_pretrigger)
+	{
+		trigger_source = source;
+		ring_trigger(ring);
+	}
+	else if (config.is_continuous)
+	{
+		trigger_source = source;
+		A->is_stopping = true;
+	}
 }
 
 //-----------------------------------------------------------------------------------------------
@@ -76,9 +200,33 @@ void waitFor (unsigned int secs) {
 //-----------------------------------------------------------------------------------------------
 int main(int argc, char **argv)
 {
+	//one-shot runs count their latency from process start, as the old relaunch did
+	clock_gettime(CLOCK_MONOTONIC, &session_trigger);
+	trigger_source = "start";
+	sem_init(&session_wake, 0, 0);
+
+	int opt;
+	char *batch_file = NULL;
+	while ((opt = getopt(argc, argv, "dfb:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd': is_daemon = true; break;
+			case 'f': config.is_force_bitstream = true; break;
+			case 'b': batch_file = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-d] [-f] [-b batch.ini]\n  -d  stay resident and run a capture session per trigger\n"
+				                "  -f  reload the bitstream even if it is already running\n"
+				                "  -b  run the sessions of a batch file back-to-back, at once\n", argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
 	signal(SIGINT, exit_handler);
   signal(SIGTSTP, exit_handler);
-	
+  signal(SIGTERM, exit_handler);
+  signal(SIGUSR1, trigger_handler);
+
 	//initialise default values
 	tx_synth.id = 0;
 	lo_synth.id = 1;
@@ -87,139 +235,614 @@ int main(int argc, char **argv)
 	config.storage_dir = SD_STORAGE_DIR;
 	config.is_debug = false;
 	config.is_data_transfer = false;
-	// config.is_gpsd = false;
+	config.is_streaming = false;
+	config.stream_port = 5800;
+	config.stream_rate_limit = 0;
+	config.segment_mode = SEGMENT_OFF;
+	config.segment_mb = 64;
+	config.segment_seconds = 10;
+	config.is_pretrigger = false;
+	config.pretrigger_seconds = 5;
+	config.pretrigger_max_mb = 64;
+	config.is_trigger_button = false;
+	config.is_continuous = false;
+	config.retention_mb = 0;
+	config.retention_minutes = 0;
+	config.min_free_mb = 64;
+	config.stripe_dirs = NULL;
+	config.stripe_depth = 8;
+	config.stripe_throttle = NULL;
+	config.is_gpsd = false;
+	config.gpsd_host = GPS_HOST;
+	config.gpsd_port = GPS_PORT;
+	config.gps_min_mode = 3;
+	config.gps_min_sats = 5;
+	config.is_quicklook = false;
+	config.quicklook_decimation = 16;
+	config.quicklook_channel = 0;
+	config.quicklook_cpu = 0.25;
   config.capture_delay = 0;
-	// gps = malloc(sizeof(*gps));
-  
+  config.start_time = NULL;
+	gps = malloc(sizeof(*gps));
+
   // status LEDs
   config.is_status_leds = false;
-  power_led = malloc(sizeof(*power_led));     
-  armed_led = malloc(sizeof(*armed_led));     
-  capture_led = malloc(sizeof(*capture_led)); 
+  panel = malloc(sizeof(*panel));
+  memset(panel, 0, sizeof(*panel));
+  transfer = malloc(sizeof(*transfer));
+  storage = malloc(sizeof(*storage));
+  batch = malloc(sizeof(*batch));
+  memset(batch, 0, sizeof(*batch));
 
 
 	splash();
 
 	//parse configuration options from setup.ini
-	if (ini_parse(SETUP_FILE, parse_setup_file, NULL) < 0) 
+	if (ini_parse(SETUP_FILE, parse_setup_file, NULL) < 0)
 	{
 		ASSERT(FAIL, "Could not open Setup .ini file.\n");
 		exit(EXIT_FAILURE);
   }
 
+  check_settings(&config);
+
+  //a bad batch file is found before the hardware is touched
+  if (batch_file != NULL)
+  {
+    if (load_batch(batch, batch_file, is_setup_key) != OK)
+    {
+      cprint("[!!] ", BRIGHT, RED);
+      printf("Batch %s line %i: %s\n", batch_file, batch->error_line, batch->error);
+      exit(EXIT_FAILURE);
+    }
+    is_batch_requested = true;
+  }
+
+  //the daemon is started by the trigger button, so it always listens to it
+  if (is_daemon)
+    config.is_trigger_button = true;
+
+  //a start time schedules the capture, or the first session of the daemon
+  if (config.start_time != NULL && config.start_time[0] != '\0')
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    if (timing_parse(config.start_time, &start_at) != OK)
+    {
+      cprint("[!!] ", BRIGHT, YELLOW);
+      printf("Could not read start_time %s, starting on trigger\n", config.start_time);
+      start_at.tv_sec = 0;
+    }
+    else if (start_at.tv_sec < now.tv_sec)
+    {
+      cprint("[!!] ", BRIGHT, YELLOW);
+      printf("start_time %s has passed, starting on trigger\n", config.start_time);
+      start_at.tv_sec = 0;
+    }
+    else if (is_daemon)
+    {
+      trigger_source = "schedule";
+      is_session_requested = true;
+    }
+  }
+
   // Add time delay here for Scarborough trials
-  if (config.capture_delay > 0)
+  if (config.capture_delay > 0 && !is_daemon)
   {
     cprint("[**] ", BRIGHT, CYAN);
     printf("Capture delay starting: %d [s]...\n", config.capture_delay);
     fflush(stdout);
-    waitFor(config.capture_delay);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += config.capture_delay;
+    wait_until(&deadline, &is_shutdown_requested, NULL);
     printf("Capture delay done!...\n");
-    fflush(stdout); 
+    fflush(stdout);
   }
 
 	//mount SD card and load bitstream
 	init_red_pitaya();
 
-  // launch the LED worker threads
+  // one thread serves the status LEDs and the trigger button for the lifetime of the process
   if (config.is_status_leds)
-  {
     printf("Enabling LEDs\n");
-    power_led->state = On;
-    armed_led->state = Off;
-    capture_led->state = Off;
-    pthread_create(&power_led->thread, NULL, *led_worker, (void *)power_led);
-    pthread_create(&armed_led->thread, NULL, *led_worker, (void *)armed_led);
-    pthread_create(&capture_led->thread, NULL, *led_worker, (void *)capture_led);
-  }
+  ASSERT(init_panel(panel, config.is_status_leds, config.is_trigger_button && (is_daemon || config.is_pretrigger || config.is_continuous), trigger_event),
+         "Could not start the status LEDs and trigger button.");
+  panel_set_led(panel, GPIO_POWER_LED, On);
+
+  load_synths(&config, &tx_synth, &lo_synth);
+
+  //set all gpio pins low
+  set_reg(reg_gpio, LOW);
+
+  //init synth pins
+  init_pins(&tx_synth);
+  init_pins(&lo_synth);
+
+  //the capture channel and its dma mappings are reused by every session
+  init_channel(&A, 'A', DMA_A_BASE_ADDR, STS_A_BASE_ADDR);
+
+  ASSERT(init_telemetry(), "Could not allocate the telemetry counters.");
+  timing = malloc(sizeof(*timing));
+  ASSERT(init_timing(timing), "Could not allocate the block timestamps.");
+
+  //the gps reader runs for the lifetime of the process, a session only opens and closes its log
+  if (config.is_gpsd)
+    ASSERT(init_gps(gps, config.gpsd_host, config.gpsd_port, config.gps_min_mode, config.gps_min_sats), "Could not start the GPS reader.");
+
+  TRACE_INIT();
+  TRACE_THREAD("main");
 
   //-----------------------------------------------------------------------------------------------
   // This is the main application loop, allowing for multiple captures using the same configuration
   //-----------------------------------------------------------------------------------------------
 
-    //launch the gps worker thread
-    // if (config.is_gpsd)
-    // {
-    //   gps->state = Idle;
-    //   pthread_create(&gps->thread, NULL, *gps_worker, (void *)gps);
-    // }
+  //commands are served from the start, a one-shot capture can still be stopped or queried
+  control = malloc(sizeof(*control));
+  init_control(control, CONTROL_SOCKET, control_command);
 
-    //parse synth ramp parameters from .ini files
-    parse_ramp_file(&tx_synth);
-    parse_ramp_file(&lo_synth);
+  if (!is_daemon && is_batch_requested)
+    run_batch();
+  else if (!is_daemon)
+    run_session();
 
-    //calculate additional ramp parameters
-    calc_parameters(&tx_synth, &config);
-    calc_parameters(&lo_synth, &config);
+  while (is_daemon && !is_shutdown_requested)
+  {
+    // Indicate that the system is armed and ready for trigger
+    if (config.is_status_leds)
+    {
+      panel_set_led(panel, GPIO_ARMED_LED, On);
+      panel_set_led(panel, GPIO_CAPTURE_LED, Off);
+    }
 
-    //import synth register values from template file
-    load_registers(SYNTH_REG_TEMP_DIR, &tx_synth);
-    load_registers(SYNTH_REG_TEMP_DIR, &lo_synth);
+    cprint("\n[TRIG] ", BRIGHT, GREEN);
+    printf("System Armed, session %d starts on the trigger button, SIGUSR1 or %s\n", n_sessions + 1, CONTROL_SOCKET);
+    fflush(stdout);
 
-    //wait here for gps fix
-    // if (config.is_gpsd) wait_for_fix(gps);
+    //woken by the trigger itself, the button, SIGUSR1 and the control socket all post session_wake
+    while (!is_session_requested && !is_batch_requested && !is_shutdown_requested)
+      sem_wait(&session_wake);
 
-    // Indicate that the system is armed and ready for trigger
-    if (config.is_status_leds)
-      armed_led->state = On;
+    if (is_batch_requested)
+      run_batch();
+    else if (is_session_requested)
+      run_session();
+    is_session_requested = false;
+    is_batch_requested = false;
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  // End of the main application loop. Join all threads
+  //-----------------------------------------------------------------------------------------------
+
+  cprint("\n[!!] ", BRIGHT, CYAN);
+  printf("Shutting down milosar\n\n");
+
+  dinit_control(control);
+  dinit_telemetry();
+  dinit_timing(timing);
+  if (config.is_gpsd)
+    dinit_gps(gps);
+  if (quicklook != NULL)
+    dinit_quicklook(quicklook);
+
+  // stop the status LED and trigger button thread
+  dinit_panel(panel);
+
+  cprint("\n[**] ", BRIGHT, CYAN);
+  printf("Shutdown Complete.\n\n");
+	return EXIT_SUCCESS;
+}
+
+// Runs the loaded batch back-to-back. Every run starts again from the settings the batch started
+// with plus its own overrides, the next run is staged by prepare_worker() while the current one
+// writes its summary and offloads.
+void run_batch(void)
+{
+  struct timespec start, end;
+  int n_runs = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pthread_mutex_lock(&config_lock);
+  base_config = config;
+  base_tx = tx_synth;
+  base_lo = lo_synth;
+  is_config_changed = false;
+  is_batch_cancelled = false;
+  pthread_mutex_unlock(&config_lock);
+
+  cprint("\n[**] ", BRIGHT, CYAN);
+  printf("Batch %s: %i sessions, %i runs\n", batch->path, batch->n_sessions, batch->n_runs);
+
+  for (int run = 0; run < batch->n_runs && !is_batch_cancelled && !is_shutdown_requested; run++)
+  {
+    struct timespec wait_start, wait_end;
+    clock_gettime(CLOCK_MONOTONIC, &wait_start);
+
+    //the first run has no session to hide behind, nor has the run after a skipped one
+    if (is_preparing)
+    {
+      pthread_join(prepare_thread, NULL);
+      is_preparing = false;
+    }
+    else
+      stage_batch_run(run);
+
+    clock_gettime(CLOCK_MONOTONIC, &wait_end);
+
+    if (staged_status != OK)
+    {
+      cprint("\n[!!] ", BRIGHT, RED);
+      printf("Batch run %i/%i: %s skipped, its settings could not be applied\n", run + 1, batch->n_runs, batch_session(batch, run)->name);
+      continue;
+    }
+
+    pthread_mutex_lock(&config_lock);
+    config = staged_config;
+    tx_synth = staged_tx;
+    lo_synth = staged_lo;
+    n_fpga_writes = staged_fpga_writes;
+    n_synth_writes = staged_synth_writes;
+    prepare_ms = staged_ms;
+    prepare_wait_ms = elapsed_ms(&wait_start, &wait_end);
+    batch_run = run;
+    pthread_mutex_unlock(&config_lock);
+
+    cprint("\n[**] ", BRIGHT, CYAN);
+    printf("Batch run %i/%i: %s\n", run + 1, batch->n_runs, batch_session(batch, run)->name);
+
+    clock_gettime(CLOCK_MONOTONIC, &session_trigger);
+    trigger_source = "batch";
+    run_session();
+    n_runs++;
+  }
+
+  //a cancelled batch may have staged a run it will not start
+  if (is_preparing)
+  {
+    pthread_join(prepare_thread, NULL);
+    is_preparing = false;
+  }
+
+  //back to the settings from before the batch, the hardware follows with the next session
+  pthread_mutex_lock(&config_lock);
+  config = base_config;
+  tx_synth = base_tx;
+  lo_synth = base_lo;
+  is_config_changed = true;
+  batch_run = -1;
+  pthread_mutex_unlock(&config_lock);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  cprint("\n[OK] ", BRIGHT, GREEN);
+  printf("Batch complete: %i/%i runs in %.1f [s]\n", n_runs, batch->n_runs, elapsed_ms(&start, &end)*1e-3);
+}
+
+// Brings the staged settings to the given batch run and programs the fpga and the synths with
+// what differs from the last run.
+void stage_batch_run(int run)
+{
+  BatchSession *session = batch_session(batch, run);
+  SetupTarget target = {&staged_config, &staged_tx, &staged_lo};
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  //copies of the live synths keep their pins
+  staged_config = base_config;
+  staged_tx = tx_synth;
+  staged_lo = lo_synth;
+  staged_tx.parameter_file = base_tx.parameter_file;
+  staged_lo.parameter_file = base_lo.parameter_file;
+
+  for (int i = 0; i < session->n_overrides; i++)
+    parse_setup_file(&target, session->overrides[i].section, session->overrides[i].key, session->overrides[i].value);
+  check_settings(&staged_config);
+
+  //the ramps are worked out for the PRI apply_settings() sets
+  staged_fpga_writes = apply_settings(&staged_config);
+  staged_status = staged_fpga_writes == FAIL ? FAIL : OK;
+  if (staged_status == OK)
+  {
+    load_synths(&staged_config, &staged_tx, &staged_lo);
+    staged_synth_writes = program_synths(&staged_tx, &staged_lo);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  staged_ms = elapsed_ms(&start, &end);
+}
+
+// Started by run_session() once the TCU and the ramps are off, so the registers are free while
+// the session finishes.
+void *prepare_worker(void *arg)
+{
+  //signals belong to the main thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TRACE_THREAD("prepare");
+
+  stage_batch_run(staged_run);
+  return NULL;
+}
+
+// One capture from experiment setup to data offload. Hardware, mappings, ramp parameters and
+// the trigger button are set up once in main() and kept across sessions.
+void run_session(void)
+{
+    //settings are frozen from here on, the control socket refuses changes until the session is over
+    pthread_mutex_lock(&config_lock);
+    if (is_config_changed)
+    {
+      int n_writes = apply_settings(&config);
+      if (n_writes == FAIL)
+      {
+        //the settings stay changed, the next session tries them again once they are fixed
+        start_at.tv_sec = 0;
+        start_at.tv_nsec = 0;
+        pthread_mutex_unlock(&config_lock);
+        cprint("[!!] ", BRIGHT, RED);
+        printf("Session not started, its settings could not be applied\n");
+        return;
+      }
+
+      n_fpga_writes += n_writes;
+      load_synths(&config, &tx_synth, &lo_synth);
+      is_config_changed = false;
+    }
+    session_state = start_at.tv_sec > 0 ? Scheduled : Recording;
+    pthread_mutex_unlock(&config_lock);
+
+    n_sessions++;
 
     // Set the Capture Status LED
     if (config.is_status_leds)
     {
       if (config.capture_delay > 0)
-        capture_led->state = Blink;
+        panel_set_led(panel, GPIO_CAPTURE_LED, Blink);
       else
-        capture_led->state = On;
+        panel_set_led(panel, GPIO_CAPTURE_LED, On);
 
-      // switch off the Status Armed LED when capture starts    
-      armed_led->state = Off;
+      // switch off the Status Armed LED when capture starts
+      panel_set_led(panel, GPIO_ARMED_LED, Off);
     }
 
     //get user input for final experiment settings
     config_experiment(&config, &tx_synth, &lo_synth);
 
-    //set all gpio pins low
-    set_reg(reg_gpio, LOW);
+    //gps fixes from here on go into the experiment directory, a session never waits for a fix
+    char gps_path[250];
+    sprintf(gps_path, "%s%s", config.experiment_dir, GPS_FILE);
+    if (config.is_gpsd)
+    {
+      ClockPair now;
+      GpsFix fix;
+      clock_pair(&now);
+      gps_start(gps, gps_path, now.monotonic_ns);
+
+      if (gps_last(gps, &fix) != OK || !(fix.flags & GpsLocked))
+      {
+        cprint("[!!] ", BRIGHT, YELLOW);
+        printf("No GPS lock (mode %i, %i satellites), logging anyway\n", fix.mode, fix.n_used);
+      }
+    }
+
+    //open the capture output
+    if (init_storage(storage, &config) != OK)
+    {
+      ASSERT(FAIL, "Could not open capture file.");
+    }
 
-    //init synth pins
-    init_pins(&tx_synth);
-    init_pins(&lo_synth);
+    //allocate the pre-trigger ring, the TCU runs from arming until the post-trigger data is in
+    if (config.is_pretrigger)
+    {
+      ring = malloc(sizeof(*ring));
+      if (init_ring(ring, &config, storage, config.is_streaming ? transfer : NULL) != OK)
+      {
+        ASSERT(FAIL, "Could not allocate the pre-trigger ring.");
+      }
+      config.n_pulses = (1 << 30) - 1;
+    }
 
-    init_channel(&A, 'A', DMA_A_BASE_ADDR, STS_A_BASE_ADDR);
-    pthread_create(&A->thread, NULL, record, (void *)A);
+    //a continuous capture keeps the TCU running until the record thread is stopped
+    if (config.is_continuous)
+      config.n_pulses = (1 << 30) - 1;
 
-    //software reset the synths
-    reset_synths(reg_gpio, &tx_synth, &lo_synth);
+    //launch the streaming offload thread before any block is recorded
+    if (config.is_streaming)
+    {
+      init_transfer(transfer, &config, storage);
+      if (config.is_pretrigger)
+        transfer->n_blocks = ring->window_slots + ring->post_slots;
+      else if (config.is_continuous)
+        transfer->n_blocks = 0;
+      pthread_create(&transfer->thread, NULL, *transfer_worker, (void *)transfer);
+    }
+
+    //the quicklook thread is started by the first session that wants it and stays for the process
+    is_quicklook = false;
+    if (config.is_quicklook && quicklook == NULL)
+    {
+      quicklook = malloc(sizeof(*quicklook));
+      if (quicklook == NULL || init_quicklook(quicklook, config.quicklook_decimation, config.quicklook_channel, config.quicklook_cpu) != OK)
+      {
+        cprint("[!!] ", BRIGHT, YELLOW);
+        printf("Could not start the quicklook, capturing without it\n");
+        free(quicklook);
+        quicklook = NULL;
+      }
+    }
+    if (config.is_quicklook && quicklook != NULL)
+    {
+      double bandwidth = get_bandwidth(tx_synth.up_ramp_increment, tx_synth.up_ramp_length);
+      double metres_per_hz = bandwidth > 0 ? SPEED_OF_LIGHT*tx_synth.up_ramp_length/PD_CLK/(2*bandwidth) : 0;
+      is_quicklook = quicklook_start(quicklook, &config, A, metres_per_hz, n_sessions) == OK;
+    }
 
-    //write to the synth registers
-    flash_synth(reg_gpio, &tx_synth);
-    flash_synth(reg_gpio, &lo_synth);
+    A->is_stopping = false;
+    A->is_done = false;
+    A->is_ready = false;
+    A->is_enabled = false;
+    A->first_block.tv_sec = 0;
+    A->first_block.tv_nsec = 0;
+    A->error = NULL;
+    telemetry_reset(n_sessions);
+    timing_reset(timing, &config);
+    TRACE_SESSION_START();
+    TRACE_BEGIN(TraceSession, n_sessions, 0);
+    pthread_mutex_lock(&config_lock);
+    is_session_open = true;
+    pthread_mutex_unlock(&config_lock);
+    is_capturing = true;
+    pthread_create(&A->thread, NULL, record, (void *)A);
+
+    //only what changed since the last session, a staged batch session has done this already
+    n_synth_writes += program_synths(&tx_synth, &lo_synth);
 
     //now that synth parameters have been set
     set_ramping(reg_gpio, &tx_synth, &lo_synth, true);
 
-    //enable gps data recording
-    // if (config.is_gpsd) gps->state = Active;
+    //the record thread frames the stream from where the writer stands, it must look before the TCU runs
+    while (!__atomic_load_n(&A->is_ready, __ATOMIC_ACQUIRE) && !A->is_done)
+      usleep(100);
 
-    //enable recording and trigger synths in parallel
-    time_t tcu_trigger_time = start_experiment(reg_gpio, reg_tcu, &config);
+    //a scheduled session is armed ahead and only sets the enable flag at its deadline, its
+    //latency counts from the deadline
+    if (session_state == Scheduled)
+    {
+      char utc[32];
+      strftime(utc, sizeof(utc), "%Y-%m-%dT%H:%M:%S", gmtime(&start_at.tv_sec));
+      cprint("[**] ", BRIGHT, CYAN);
+      printf("Capture scheduled for %s.%06ldZ\n", utc, start_at.tv_nsec/1000);
+      fflush(stdout);
+
+      uint64_t tcu_register = arm_experiment(reg_gpio, reg_tcu, &config);
+      if (wait_until(&start_at, &A->is_stopping, timing) == OK)
+      {
+        enable_experiment(reg_tcu, tcu_register, &timing->tcu);
+        timing->start_error_ns = timing->tcu.realtime_ns - ((int64_t)start_at.tv_sec*1000000000 + start_at.tv_nsec);
+
+        int64_t deadline = timing->tcu.monotonic_ns - timing->start_error_ns;
+        session_trigger.tv_sec = deadline / 1000000000;
+        session_trigger.tv_nsec = deadline % 1000000000;
+
+        cprint("[OK] ", BRIGHT, GREEN);
+        printf("TCU enabled %.1f [us] from the schedule, %.1f [us] spin\n\n", timing->start_error_ns*1e-3, timing->spin_ns*1e-3);
+      }
+
+      start_at.tv_sec = 0;
+      start_at.tv_nsec = 0;
+      session_state = Recording;
+    }
+    //enable recording and trigger synths in parallel, unless the start was cancelled
+    else if (!A->is_stopping)
+      start_experiment(reg_gpio, reg_tcu, &config, &timing->tcu);
+
+    if (timing->tcu.realtime_ns == 0)
+      clock_pair(&timing->tcu);
+    __atomic_store_n(&A->is_enabled, true, __ATOMIC_RELEASE);
+    tcu_enabled.tv_sec = timing->tcu.monotonic_ns / 1000000000;
+    tcu_enabled.tv_nsec = timing->tcu.monotonic_ns % 1000000000;
+    time_t tcu_trigger_time = timing->tcu.realtime_ns / 1000000000;
+    TRACE_INSTANT(TraceTcuEnable, n_sessions, A->is_stopping);
+
+    //a pre-trigger capture holds the last pretrigger_seconds in ram until the operator triggers,
+    //a continuous capture records until the operator stops it
+    if (config.is_pretrigger || config.is_continuous)
+    {
+      if (config.is_pretrigger)
+      {
+        if (config.is_status_leds)
+        {
+          panel_set_led(panel, GPIO_ARMED_LED, On);
+          panel_set_led(panel, GPIO_CAPTURE_LED, Off);
+        }
+
+        cprint("[TRIG] ", BRIGHT, GREEN);
+        printf("Armed with %.1f [s] pre-trigger buffer, waiting for trigger\n\n", ring->window_slots*config.n_seconds/(float)config.n_buffers);
+      }
+      else
+      {
+        cprint("[**] ", BRIGHT, CYAN);
+        printf("Recording continuously, stop with the trigger button, SIGUSR1 or Ctrl-C\n\n");
+      }
+      fflush(stdout);
+
+      while (!A->is_done && (config.is_pretrigger ? !ring->is_triggered : !A->is_stopping))
+      {
+        if (config.is_continuous)
+          print_progress();
+        usleep(1000);
+      }
+
+      if (config.is_pretrigger && config.is_status_leds)
+      {
+        panel_set_led(panel, GPIO_ARMED_LED, Off);
+        panel_set_led(panel, GPIO_CAPTURE_LED, On);
+      }
+    }
+
+    //the record thread stays off the terminal, its progress is printed from here
+    while (!A->is_done)
+    {
+      print_progress();
+      usleep(1000);
+    }
 
     //wait for threads to finish their work
     pthread_join(A->thread, NULL);
+    is_capturing = false;
+    session_state = Finishing;
+    if (is_quicklook)
+      quicklook_stop(quicklook);
+
+    if (A->error != NULL)
+    {
+      cprint("[!!] ", BRIGHT, RED);
+      printf("Capture ended early: %s\n", A->error);
+    }
 
     //clear the enable flag
     set_reg(reg_tcu, LOW);
+    struct timespec last_stopped = tcu_stopped;
+    clock_gettime(CLOCK_MONOTONIC, &tcu_stopped);
 
     //disable ramping once experiment is over
     set_ramping(reg_gpio, &tx_synth, &lo_synth, false);
 
-    //disable gps data recording
-    // if (config.is_gpsd)
-    // {
-    //   gps->experiment_dir = config.experiment_dir;
-    //   gps->state= Shutdown;	
-    //   pthread_join(gps->thread, NULL);
-    // }
+    //the hardware is free, the next batch session is staged while this one writes its summary and
+    //offloads
+    if (batch_run >= 0 && batch_run + 1 < batch->n_runs && !is_batch_cancelled && !is_shutdown_requested)
+    {
+      staged_run = batch_run + 1;
+      is_preparing = true;
+      pthread_create(&prepare_thread, NULL, *prepare_worker, NULL);
+    }
+
+    //the gps log covers the capture and is complete before the summary
+    if (config.is_gpsd)
+    {
+      gps_set_tcu(gps, timing->tcu.monotonic_ns, timing->tcu.realtime_ns);
+      gps_stop(gps);
+    }
+
+    //block timestamps, only the committed part of a pre-trigger ring is in the capture
+    TimingFit timing_fit_result;
+    timing_fit(timing, &timing_fit_result);
+
+    char timing_path[250];
+    sprintf(timing_path, "%s%s", config.experiment_dir, TIMING_FILE);
+    if (timing_write(timing, timing_path, config.is_pretrigger ? ring->first_half : 0, config.is_pretrigger ? ring->commit_end : INT64_MAX) != OK)
+    {
+      cprint("[!!] ", BRIGHT, RED);
+      printf("Could not write %s\n", timing_path);
+    }
+
+    double tcu_latency = elapsed_ms(&session_trigger, &tcu_enabled);
+    double first_block_latency = A->first_block.tv_sec > 0 ? elapsed_ms(&session_trigger, &A->first_block) : -1;
 
     // Update the summary file with the TCU trigger time
     FILE* f;
@@ -232,16 +855,163 @@ int main(int argc, char **argv)
     }
     else
     {
-      //update summary file 
+      //update summary file
       fprintf(f, "\n[TCU]\r\n");
       struct tm* tm_info  = localtime(&tcu_trigger_time);
       char tcu_trigger_time_str[20];
       strftime(tcu_trigger_time_str, 20, "%y_%m_%d_%H_%M_%S", tm_info);
       fprintf(f, "tcu_trigger_timestamp		= %s\r\n", tcu_trigger_time_str);
+      fprintf(f, "tcu_trigger_ns		= %09lld\r\n", (long long)(timing->tcu.realtime_ns % 1000000000));
+
+      fprintf(f, "\n[timing]\r\n");
+      timing_report(timing, &timing_fit_result, f);
+
+      fprintf(f, "\n[fpga]\r\n");
+      fprintf(f, "bitstream_crc     = %08X\r\n", bitstream.crc);
+      fprintf(f, "reloaded          = %i\r\n", bitstream.is_reloaded);
+      fprintf(f, "load_time         = %.1f; [ms]\r\n", bitstream.load_ms);
+
+      fprintf(f, "\n[session]\r\n");
+      fprintf(f, "daemon            = %i\r\n", is_daemon);
+      fprintf(f, "session           = %i\r\n", n_sessions);
+      fprintf(f, "trigger_source    = %s\r\n", trigger_source);
+      fprintf(f, "trigger_to_tcu    = %.3f; [ms]\r\n", tcu_latency);
+      fprintf(f, "trigger_to_block  = %.3f; [ms] first DMA half drained\r\n", first_block_latency);
+      if (panel->n_presses > 0)
+      {
+        fprintf(f, "button_presses    = %i\r\n", panel->n_presses);
+        fprintf(f, "edge_uncertainty  = %.1f; [us] last press, sampling gap before its edge\r\n", panel->edge_uncertainty_us);
+        fprintf(f, "press_detect      = %.1f; [us] last press, edge to trigger\r\n", panel->detect_us);
+      }
+      if (last_stopped.tv_sec > 0)
+        fprintf(f, "dead_time         = %.3f; [ms] last session's TCU stop to this TCU enable\r\n", elapsed_ms(&last_stopped, &tcu_enabled));
+      fprintf(f, "fpga_writes       = %i\r\n", n_fpga_writes);
+      fprintf(f, "synth_writes      = %i\r\n", n_synth_writes);
+
+      if (batch_run >= 0)
+      {
+        fprintf(f, "\n[batch]\r\n");
+        batch_report(batch, batch_run, f);
+        fprintf(f, "prepare_time      = %.3f; [ms] overlapped with the last session\r\n", prepare_ms);
+        fprintf(f, "prepare_wait      = %.3f; [ms] of it this session waited for\r\n", prepare_wait_ms);
+      }
+
+      if (config.is_gpsd)
+      {
+        fprintf(f, "\n[gps]\r\n");
+        gps_report(gps, f);
+      }
+
+      if (is_quicklook)
+      {
+        fprintf(f, "\n[quicklook]\r\n");
+        quicklook_report(quicklook, f);
+      }
+
+      fprintf(f, "\n[telemetry]\r\n");
+      telemetry_report(f);
+
+      fprintf(f, "\n[storage]\r\n");
+      fprintf(f, "segment_mode      = %i\r\n", storage->mode);
+      fprintf(f, "n_segments        = %i\r\n", storage->mode == SEGMENT_OFF ? 0 : storage->n_segments);
+      fprintf(f, "n_blocks          = %i\r\n", storage->n_blocks);
+      fprintf(f, "n_deleted         = %i\r\n", storage->n_deleted);
+
+      if (storage->stripe != NULL)
+      {
+        fprintf(f, "\n[stripe]\r\n");
+        fprintf(f, "n_devices         = %i\r\n", storage->stripe->n_devices);
+        stripe_report(storage->stripe, f);
+      }
+
+      //[dataset] holds the planned size, this is what was actually recorded
+      int64_t bytes = (int64_t)storage->n_blocks * S2MB;
+      int64_t bytes_per_pri = N_CHANNELS*BYTES_PER_WRITE*(config.end_index - config.start_index + 1);
+      int n_retained = storage_retained_blocks(storage);
+      int64_t stream_offset = A->stream_offset + (config.is_pretrigger ? ring->first_half*S2MB : 0);
+
+      //whole PRIs only, the data starts and ends wherever the halves cut the stream
+      int64_t n_pris = (stream_offset + bytes)/bytes_per_pri - (stream_offset + bytes_per_pri - 1)/bytes_per_pri;
+
+      fprintf(f, "\n[capture]\r\n");
+      fprintf(f, "continuous        = %i\r\n", config.is_continuous);
+      fprintf(f, "bytes             = %lld\r\n", (long long)bytes);
+      fprintf(f, "n_pris            = %lld\r\n", (long long)n_pris);
+      fprintf(f, "n_samples         = %lld\r\n", (long long)(n_pris*(config.end_index - config.start_index + 1)));
+      fprintf(f, "duration          = %.3f\r\n", n_pris*(double)config.presum_factor/config.prf);
+      fprintf(f, "first_block       = %i\r\n", storage->n_blocks - n_retained);
+      fprintf(f, "retained_blocks   = %i\r\n", n_retained);
+      fprintf(f, "start_position    = %i; [bytes] DMA writer when the session started\r\n", A->start_position);
+      fprintf(f, "stream_offset     = %lld; [bytes] of the session's stream, PRI 0 on, before block 0\r\n", (long long)stream_offset);
+
+      if (config.is_pretrigger)
+      {
+        char trigger_time_str[20];
+        strftime(trigger_time_str, 20, "%y_%m_%d_%H_%M_%S", localtime(&ring->trigger_time.tv_sec));
+        fprintf(f, "\n[pretrigger]\r\n");
+        fprintf(f, "trigger_timestamp = %s\r\n", trigger_time_str);
+        fprintf(f, "trigger_time_ns   = %09ld\r\n", ring->trigger_time.tv_nsec);
+        fprintf(f, "pretrigger_blocks = %i\r\n", ring->pretrigger_blocks);
+        fprintf(f, "n_overruns        = %i\r\n", ring->n_overruns);
+        fprintf(f, "n_filled          = %i; blocks of zeros in place of the dropped ones\r\n", ring->n_filled);
+      }
       fclose(f);
     }
 
-    if (config.is_data_transfer)
+    cprint("[OK] ", BRIGHT, GREEN);
+    printf("Trigger to first sample: %.1f [ms], first block: %.1f [ms]\n", tcu_latency, first_block_latency);
+    if (last_stopped.tv_sec > 0)
+    {
+      cprint("[OK] ", BRIGHT, GREEN);
+      printf("Dead time since the last session: %.1f [ms], %i fpga and %i synth register writes\n",
+             elapsed_ms(&last_stopped, &tcu_enabled), n_fpga_writes, n_synth_writes);
+    }
+    n_fpga_writes = 0;
+    n_synth_writes = 0;
+    prepare_ms = 0;
+    prepare_wait_ms = 0;
+
+    //everything up to here, the stream and scp copy are not part of the capture timeline
+    TRACE_END(TraceSession, n_sessions, 0);
+#ifdef TRACE
+    char trace_path[250];
+    sprintf(trace_path, "%s%s", config.experiment_dir, TRACE_FILE);
+    TRACE_DUMP(trace_path);
+#endif
+
+    if (config.is_streaming)
+    {
+      cprint("[**] ", BRIGHT, CYAN);
+      printf("Completing Stream to Host:\n");
+
+      //send the metadata once the summary is final, then wait for the outstanding blocks
+      char path[250];
+      sprintf(path, "%ssummary.ini", config.experiment_dir);
+      transfer_add_file(transfer, path);
+      sprintf(path, "%ssetup.ini", config.experiment_dir);
+      transfer_add_file(transfer, path);
+      sprintf(path, "%sregister_template.txt", config.experiment_dir);
+      transfer_add_file(transfer, path);
+      transfer_add_file(transfer, timing_path);
+      if (config.is_gpsd)
+        transfer_add_file(transfer, gps_path);
+#ifdef TRACE
+      transfer_add_file(transfer, trace_path);
+#endif
+
+      char *ramp_files[2] = {tx_synth.parameter_file, lo_synth.parameter_file};
+      for (int i = 0; i < 2; i++)
+      {
+        char *base = strrchr(ramp_files[i], '/');
+        sprintf(path, "%s%s", config.experiment_dir, base ? base + 1 : ramp_files[i]);
+        transfer_add_file(transfer, path);
+      }
+
+      transfer->state = Draining;
+      pthread_join(transfer->thread, NULL);
+      dinit_transfer(transfer);
+    }
+    else if (config.is_data_transfer)
     {
       cprint("[**] ", BRIGHT, CYAN);
       printf("Copying Measurement Data to Host:\n");
@@ -257,68 +1027,407 @@ int main(int argc, char **argv)
       printf("Auto Data Transfer Disabled.\n");
     }
 
+    //status reads the storage and ring under the lock, they are only freed once it no longer can
+    pthread_mutex_lock(&config_lock);
+    is_session_open = false;
+    pthread_mutex_unlock(&config_lock);
+
+    dinit_storage(storage);
+
+    if (config.is_pretrigger)
+    {
+      dinit_ring(ring);
+      free(ring);
+      ring = NULL;
+    }
+
     cprint("\n[OK] ", BRIGHT, GREEN);
     printf("Measurement Complete: %s\n", config.time_stamp);
 
     // reset some parameters for the next loop
     if (config.is_status_leds)
     {
-      armed_led->state = Off;
-      capture_led->state = Off;
+      panel_set_led(panel, GPIO_ARMED_LED, Off);
+      panel_set_led(panel, GPIO_CAPTURE_LED, Off);
     }
 
-  //-----------------------------------------------------------------------------------------------
-  // End of the main application loop. Join all threads
-  //-----------------------------------------------------------------------------------------------
+    session_state = Idle;
+}
 
-  cprint("\n[!!] ", BRIGHT, CYAN);
-  printf("Shutting down milosar\n\n");
+double elapsed_ms(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec)*1e3 + (end->tv_nsec - start->tv_nsec)*1e-6;
+}
 
-  // stop the status LED thread
-  if (config.is_status_leds)
-  {
-    power_led->state = Stopped;
-    capture_led->state = Stopped;
-    armed_led->state = Stopped;
-    pthread_join(power_led->thread, NULL);
-    pthread_join(armed_led->thread, NULL);
-    pthread_join(capture_led->thread, NULL);
-  }	
+// Progress line of the running capture, at most every PROGRESS_PERIOD_MS. Only reads counters
+// the record thread publishes, so a slow terminal can never hold up the drain.
+void print_progress(void)
+{
+	static struct timespec last;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-  cprint("\n[**] ", BRIGHT, CYAN);
-  printf("Shutdown Complete.\n\n");
-	return EXIT_SUCCESS;
+	if (elapsed_ms(&last, &now) < PROGRESS_PERIOD_MS)
+		return;
+	last = now;
+
+	int n_blocks = __atomic_load_n(&storage->n_blocks, __ATOMIC_RELAXED);
+	uint64_t n_overruns = __atomic_load_n(&telemetry->overruns, __ATOMIC_RELAXED);
+
+	if (config.is_pretrigger)
+	{
+		if (!ring->is_committing)
+			return;
+
+		int done = ring->next_half - ring->first_half;
+		int total = ring->commit_end - ring->first_half;
+		cprint("\033[A\033[J[**] ", BRIGHT, CYAN);
+		printf("%i/%i MB (%3.0f %%)", 2*done, 2*total, (float)(done*100.0/total));
+	}
+	else if (config.is_continuous)
+	{
+		cprint("\033[A\033[J[**] ", BRIGHT, CYAN);
+		printf("%i MB, %i MB on disk", 2*n_blocks, 2*storage_retained_blocks(storage));
+	}
+	else
+	{
+		cprint("\033[A\033[J[**] ", BRIGHT, CYAN);
+		printf("%i/%i MB (%3.0f %%)", 2*n_blocks, 2*config.n_buffers, (float)(n_blocks*100.0/config.n_buffers));
+	}
+
+	if (n_overruns > 0)
+		printf(", %llu overruns", (unsigned long long)n_overruns);
+	printf("\n");
+	fflush(stdout);
+}
+
+// Runs on the control socket thread. Status only reads counters the capture threads publish, and
+// those of the storage and ring under config_lock while the session has them. Settings are only
+// accepted while no session is being set up or running.
+void control_command(char *line, char *reply, size_t reply_len)
+{
+	char *command = strtok(line, " \t");
+	char *args = strtok(NULL, "");
+	size_t n = 0;
+
+	#define REPLY(...) n += snprintf(reply + n, n < reply_len ? reply_len - n : 0, __VA_ARGS__)
+
+	if (command == NULL)
+		REPLY("error empty command\n");
+	else if (strcmp(command, "ping") == 0)
+		REPLY("ok pong\n");
+	else if (strcmp(command, "status") == 0)
+	{
+		enum SessionState state = session_state;
+
+		REPLY("state             = %s\n", session_state_names[state]);
+		REPLY("daemon            = %i\n", is_daemon);
+		REPLY("session           = %i\n", n_sessions);
+
+		pthread_mutex_lock(&config_lock);
+		if ((state == Recording || state == Finishing) && is_session_open)
+		{
+			int n_blocks = __atomic_load_n(&storage->n_blocks, __ATOMIC_RELAXED);
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			REPLY("time_stamp        = %s\n", config.time_stamp);
+			REPLY("elapsed           = %.1f\n", elapsed_ms(&tcu_enabled, &now)*1e-3);
+			REPLY("blocks            = %i\n", n_blocks);
+			REPLY("bytes             = %lld\n", (long long)n_blocks * S2MB);
+			REPLY("dma_overruns      = %llu\n", (unsigned long long)__atomic_load_n(&telemetry->overruns, __ATOMIC_RELAXED));
+
+			if (config.is_pretrigger && ring != NULL)
+			{
+				int64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+				int64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+				REPLY("triggered         = %i\n", ring->is_triggered);
+				REPLY("queue_depth       = %lld\n", (long long)(ring->is_committing ? head - tail : 0));
+				REPLY("overruns          = %i\n", ring->n_overruns);
+			}
+
+			if (storage->stripe != NULL)
+			{
+				for (int i = 0; i < storage->stripe->n_devices; i++)
+				{
+					StripeDevice *device = &storage->stripe->devices[i];
+					REPLY("stripe_%d_queue    = %lld\n", i, (long long)(__atomic_load_n(&device->head, __ATOMIC_RELAXED) - __atomic_load_n(&device->tail, __ATOMIC_RELAXED)));
+				}
+				REPLY("stripe_stalls     = %i\n", storage->stripe->n_stalls);
+			}
+
+			if (config.is_streaming)
+				REPLY("stream_backlog    = %i\n", transfer->n_ready - transfer->n_acked);
+
+			if (is_quicklook)
+			{
+				QuicklookImage *image = quicklook->image;
+				REPLY("quicklook_lines   = %llu\n", (unsigned long long)__atomic_load_n(&image->n_lines, __ATOMIC_ACQUIRE));
+				REPLY("quicklook_snr     = %.1f %.1f %.1f\n", image->snr_db, image->mean_snr_db, image->max_snr_db);
+				REPLY("quicklook_peak    = %.1f %.1f\n", image->peak_range, image->peak_db);
+				REPLY("quicklook_cpu     = %.1f\n", image->cpu_load*100);
+				REPLY("quicklook_late    = %llu\n", (unsigned long long)image->n_late);
+				REPLY("quicklook_skipped = %llu\n", (unsigned long long)(image->n_throttled + image->n_missed));
+			}
+		}
+		else if (state == Scheduled)
+			REPLY("start_at          = %ld.%09ld\n", (long)start_at.tv_sec, start_at.tv_nsec);
+		pthread_mutex_unlock(&config_lock);
+
+		if (batch_run >= 0)
+		{
+			BatchSession *session = batch_session(batch, batch_run);
+			REPLY("batch             = %s\n", batch->path);
+			REPLY("batch_run         = %i/%i\n", batch_run + 1, batch->n_runs);
+			REPLY("batch_session     = %s\n", session != NULL ? session->name : "none");
+		}
+
+		GpsFix fix;
+		if (config.is_gpsd && gps_last(gps, &fix) == OK)
+		{
+			REPLY("gps_connected     = %i\n", gps->is_connected);
+			REPLY("gps_mode          = %i\n", fix.mode);
+			REPLY("gps_satellites    = %i/%i\n", fix.n_used, fix.n_visible);
+			REPLY("gps_position      = %.7f %.7f %.1f\n", fix.latitude, fix.longitude, fix.altitude);
+			REPLY("gps_locked        = %i\n", (fix.flags & GpsLocked) != 0);
+		}
+		else if (config.is_gpsd)
+			REPLY("gps_connected     = %i\n", gps->is_connected);
+
+		double temperature = read_temperature();
+		if (!isnan(temperature))
+			REPLY("temperature       = %.1f\n", temperature);
+
+		REPLY("ok\n");
+	}
+	else if (strcmp(command, "telemetry") == 0)
+	{
+		//same lines as the [telemetry] section of summary.ini
+		FILE *f = fmemopen(reply, reply_len, "w");
+		if (f == NULL)
+			REPLY("error out of memory\n");
+		else
+		{
+			telemetry_report(f);
+			fprintf(f, "ok\n");
+			fclose(f);
+		}
+	}
+	else if (strcmp(command, "set") == 0 || strcmp(command, "profile") == 0 || strcmp(command, "comment") == 0)
+	{
+		pthread_mutex_lock(&config_lock);
+
+		if (session_state != Idle || batch_run >= 0)
+			REPLY("error session in progress\n");
+		else if (args == NULL)
+			REPLY("error missing argument\n");
+		else if (strcmp(command, "comment") == 0)
+		{
+			free(config.operator_comment);
+			config.operator_comment = strdup(args);
+			REPLY("ok\n");
+		}
+		else if (strcmp(command, "profile") == 0)
+		{
+			if (ini_parse(args, parse_setup_file, NULL) < 0)
+				REPLY("error could not read %s\n", args);
+			else
+			{
+				is_config_changed = true;
+				REPLY("ok\n");
+			}
+		}
+		else
+		{
+			char *key = strtok(args, " \t");
+			char *value = strtok(NULL, "");
+			char *dot = key != NULL ? strchr(key, '.') : NULL;
+
+			if (dot == NULL || value == NULL)
+				REPLY("error usage: set <section>.<key> <value>\n");
+			else
+			{
+				*dot = '\0';
+				if (parse_setup_file(NULL, key, dot + 1, value))
+				{
+					is_config_changed = true;
+					REPLY("ok\n");
+				}
+				else
+					REPLY("error unknown key %s.%s\n", key, dot + 1);
+			}
+		}
+
+		pthread_mutex_unlock(&config_lock);
+	}
+	else if (strcmp(command, "arm") == 0 || strcmp(command, "start") == 0)
+	{
+		struct timespec at = {0, 0};
+
+		if (args != NULL && timing_parse(args, &at) != OK)
+			REPLY("error usage: start <unix time>|<YYYY-MM-DDTHH:MM:SS.sss>|+<seconds>\n");
+		else if (!is_daemon)
+			REPLY("error sessions are only started in daemon mode (milosar -d)\n");
+		else if (session_state != Idle || is_session_requested || is_batch_requested || batch_run >= 0)
+			REPLY("error session in progress\n");
+		else
+		{
+			start_at = at;
+			clock_gettime(CLOCK_MONOTONIC, &session_trigger);
+			trigger_source = "control";
+			is_session_requested = true;
+			sem_post(&session_wake);
+			REPLY("ok session %d\n", n_sessions + 1);
+		}
+	}
+	else if (strcmp(command, "batch") == 0)
+	{
+		if (args != NULL && strcmp(args, "cancel") == 0)
+		{
+			if (batch_run < 0)
+				REPLY("error no batch running\n");
+			else
+			{
+				//the running session completes, no further one starts
+				is_batch_cancelled = true;
+				REPLY("ok\n");
+			}
+		}
+		else if (args == NULL)
+			REPLY("error usage: batch <file>|cancel\n");
+		else if (!is_daemon)
+			REPLY("error sessions are only started in daemon mode (milosar -d)\n");
+		else if (session_state != Idle || is_session_requested || is_batch_requested || batch_run >= 0)
+			REPLY("error session in progress\n");
+		else if (load_batch(batch, args, is_setup_key) != OK)
+			REPLY("error %s line %i: %s\n", args, batch->error_line, batch->error);
+		else
+		{
+			clock_gettime(CLOCK_MONOTONIC, &session_trigger);
+			trigger_source = "control";
+			is_batch_requested = true;
+			sem_post(&session_wake);
+			REPLY("ok batch of %i runs\n", batch->n_runs);
+		}
+	}
+	else if (strcmp(command, "stop") == 0)
+	{
+		if (!is_capturing)
+			REPLY("error no session running\n");
+		else
+		{
+			A->is_stopping = true;
+			REPLY("ok\n");
+		}
+	}
+	else if (strcmp(command, "shutdown") == 0)
+	{
+		is_shutdown_requested = true;
+		sem_post(&session_wake);
+		REPLY("ok\n");
+	}
+	else if (strcmp(command, "press") == 0)
+	{
+		int ms = args != NULL ? atoi(args) : 100;
+
+		if (!panel->is_button)
+			REPLY("error trigger button not enabled\n");
+		else if (ms <= 0)
+			REPLY("error usage: press [ms]\n");
+		else
+		{
+			panel_simulate_press(panel, ms);
+			REPLY("ok\n");
+		}
+	}
+	else
+		REPLY("error unknown command %s\n", command);
+
+	#undef REPLY
+}
+
+// Zynq XADC die temperature [degC], NAN if the iio driver is not there.
+double read_temperature(void)
+{
+	const char *names[3] = {"in_temp0_raw", "in_temp0_offset", "in_temp0_scale"};
+	double values[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		char path[100];
+		sprintf(path, "/sys/bus/iio/devices/iio:device0/%s", names[i]);
+
+		FILE *f = fopen(path, "r");
+		if (f == NULL)
+			return NAN;
+
+		int status = fscanf(f, "%lf", &values[i]);
+		fclose(f);
+		if (status != 1)
+			return NAN;
+	}
+
+	return (values[0] + values[1])*values[2]/1000.0;
 }
 
 void *record(void *arg)
 {
 	Channel *channel = (Channel *)arg;
 
-	ASSERT(create_map(SREG, MAP_SHARED, &channel->sts, channel->sts_base), "Failed to allocate map for STS register.");
-	ASSERT(create_map(S4MB, MAP_SHARED, &channel->dma, channel->dma_base), "Failed to allocate map for DMA RAM.");
+	//the mappings outlive the session, only the first one creates them
+	if (channel->dma == NULL)
+	{
+		ASSERT(create_map(SREG, MAP_SHARED, &channel->sts, channel->sts_base), "Failed to allocate map for STS register.");
+		ASSERT(create_map(S4MB, MAP_SHARED, &channel->dma, channel->dma_base), "Failed to allocate map for DMA RAM.");
+	}
 
 	//clear fpga buffer
 	memset(channel->dma, 0x0, S4MB);
 
 	int position, limit, offset;
 
-	char *path = malloc(strlen(config.experiment_dir) + strlen(config.time_stamp) + 1 + 4);
-	strcpy(path, config.experiment_dir);
-	strcat(path, config.time_stamp);
-	strcat(path, ".bin");
+	//exit_handler() waits for this thread to complete the capture file, so it must not run here
+	sigset_t signals;
+	sigfillset(&signals);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-	FILE *f = fopen(path, "w");
-	limit = S2MB;
+	TRACE_THREAD("record");
 
 	void *buf;
 
 	if (!(buf = malloc(S2MB)))
 	{
-		fprintf(stderr, "no memory for temp buffer\n");
-		exit(EXIT_FAILURE);
+		channel->error = "no memory for temp buffer";
+		storage_close(storage);
+		channel->is_done = true;
+		return NULL;
 	}
 
-	for (int i = 0; i < config.n_buffers;)
+	//in pre-trigger mode the ring's commit thread does the writing
+	if (config.is_pretrigger)
+		pthread_create(&ring->thread, NULL, *ring_worker, (void *)ring);
+
+	//a fresh bitstream starts the writer at 0, a later session picks up wherever the last one
+	//stopped, so wait for the next half boundary and drop a half that started before the session.
+	//The session's stream, PRI 0 on, begins at the position, the stored data stream_offset later
+	position = get_reg(channel->sts) * BYTES_PER_WRITE;
+	limit = position < S2MB ? S2MB : 0;
+	int is_stale = position % S2MB != 0;
+	uint32_t half = 0;
+	int64_t n_drained = 0;                 //halves of the session's stream, dropped ones included
+	channel->start_position = position;
+	channel->stream_offset = is_stale ? S2MB - position % S2MB : 0;
+	if (is_quicklook)
+		quicklook->stream_offset = channel->stream_offset;
+	__atomic_store_n(&channel->is_ready, true, __ATOMIC_RELEASE);
+
+	//nothing is written before the TCU runs, and a scheduled start can be minutes away
+	while (!__atomic_load_n(&channel->is_enabled, __ATOMIC_ACQUIRE) && !channel->is_stopping)
+		usleep(1000);
+
+	//no terminal output from here on, the main thread prints progress from the telemetry
+	for (int i = 0; !channel->is_stopping && !storage->is_full &&
+	                (config.is_pretrigger ? !ring_is_complete(ring) : config.is_continuous || i < config.n_buffers);)
 	{
 		//get location of the DMA writer in terms of number of bytes written.
 		//fpga ram writer only writes in 32 bit chunks, so each pointer location represents 4 bytes.
@@ -327,25 +1436,125 @@ void *record(void *arg)
 		//safe to read bottom                 //safe to read top
 		if ((limit > 0 && position > limit) || (limit == 0 && position < S2MB))
 		{
+			struct timespec ready, copied;
+			ClockPair seen;
+			clock_pair(&seen);
+			ready.tv_sec = seen.monotonic_ns / 1000000000;
+			ready.tv_nsec = seen.monotonic_ns % 1000000000;
+			uint32_t sts = position / BYTES_PER_WRITE;
+			half++;
+
 			offset = limit > 0 ? 0 : S2MB;
 			limit = limit > 0 ? 0 : S2MB;
+			TRACE_BEGIN(TraceDrain, offset, i);
+
+			if (channel->first_block.tv_sec == 0)
+				channel->first_block = ready;
+
+			if (is_stale)
+			{
+				is_stale = false;
+				telemetry_add(&telemetry->stale, 1);
+				TRACE_INSTANT(TraceStale, offset, i);
+				TRACE_END(TraceDrain, offset, i);
+				continue;
+			}
+
+			//the quicklook reads its PRIs straight out of the half, until the writer comes back to it
+			if (is_quicklook)
+				quicklook_block(quicklook, n_drained, offset);
+			n_drained++;
+
+			void *dst = buf;
+			if (config.is_pretrigger)
+			{
+				//copy straight into the ring, a full ring drops the block rather than stall the drain
+				dst = ring_claim(ring, n_drained - 1);
+				if (dst == NULL)
+					telemetry_add(&telemetry->dropped, 1);
+			}
+			else if (storage->stripe != NULL)
+			{
+				//copy straight into a device queue, this only waits when every queue is full
+				dst = storage_claim(storage);
+			}
 
 			//copy data from fpga buffer to cpu ram
-			memcpy(buf, channel->dma + offset, S2MB);
-
-			//write data from cpu ram to sd card
-			fwrite(buf, 1, S2MB, f);
-
-			i++;
-
-			cprint("\033[A\033[J[**] ", BRIGHT, CYAN);	
-			printf("%i/%i MB (%3.0f %%)\n", 2*i, 2*config.n_buffers, (float)(i*100.0/config.n_buffers));
+			TRACE_BEGIN(TraceCopy, offset, dst != NULL);
+			if (dst != NULL)
+				memcpy(dst, channel->dma + offset, S2MB);
+			clock_gettime(CLOCK_MONOTONIC, &copied);
+			TRACE_END(TraceCopy, offset, dst != NULL);
+			telemetry_sample_since(&telemetry->copy, &ready);
+
+			//the writer got back into the half while it was being copied, part of it is newer data
+			position = get_reg(channel->sts) * BYTES_PER_WRITE;
+			if (offset == 0 ? position < S2MB : position >= S2MB)
+			{
+				telemetry_add(&telemetry->overruns, 1);
+				TRACE_INSTANT(TraceOverrun, offset, position);
+			}
+
+			TRACE_BEGIN(TraceWrite, offset, i);
+			if (config.is_pretrigger)
+			{
+				if (dst != NULL)
+				{
+					timing_block(timing, n_drained - 1, half, sts, &seen);
+					ring_publish(ring);
+					telemetry_add(&telemetry->bytes, S2MB);
+					telemetry_sample(&telemetry->queue, ring->head - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED));
+				}
+			}
+			else
+			{
+				//write data from cpu ram to sd card, a striped block is already queued in place
+				if ((storage->stripe != NULL ? storage_publish(storage) : storage_write(storage, buf, S2MB)) != OK)
+				{
+					telemetry_add(&telemetry->write_errors, 1);
+					channel->error = "capture write failed";
+					TRACE_END(TraceWrite, offset, -1);
+					TRACE_END(TraceDrain, offset, i);
+					break;
+				}
+
+				timing_block(timing, i, half, sts, &seen);
+				i++;
+				telemetry_add(&telemetry->bytes, S2MB);
+				if (storage->stripe != NULL)
+					telemetry_sample(&telemetry->queue, stripe_queued(storage->stripe));
+
+				//hand the completed block to the streaming offload
+				if (config.is_streaming)
+				{
+					transfer_block_ready(transfer, i);
+					telemetry_sample(&telemetry->stream, i - __atomic_load_n(&transfer->n_acked, __ATOMIC_RELAXED));
+				}
+			}
+
+			TRACE_END(TraceWrite, offset, i);
+			TRACE_END(TraceDrain, offset, i);
+			telemetry_sample_since(&telemetry->write, &copied);
+			telemetry_sample_since(&telemetry->drain, &ready);
+			telemetry_add(&telemetry->blocks, 1);
+			telemetry_add(&telemetry->heartbeat, 1);
+			telemetry_cpu(TeleRecord);
 		}
 	}
 
-	fclose(f);
-	free(path);
+	if (config.is_pretrigger)
+	{
+		ring->is_draining = false;
+		pthread_join(ring->thread, NULL);
+	}
+
+	//complete the last segment and the manifest before anyone reads the capture
+	if (storage_close(storage) != OK && channel->error == NULL)
+		channel->error = "capture file could not be completed";
+	telemetry_cpu(TeleRecord);
+
 	free(buf);
+	channel->is_done = true;
 
 	return EXIT_SUCCESS;
 }
@@ -353,36 +1562,80 @@ void *record(void *arg)
 
 int parse_setup_file(void* pointer, const char* section, const char* attribute, const char* value)
 {
-	#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(attribute, n) == 0
+	SetupTarget live = {&config, &tx_synth, &lo_synth};
+	SetupTarget *target = pointer != NULL ? (SetupTarget *)pointer : &live;
+	Configuration *c = target->config;
+	int is_known = false;
+
+	//a key is known whether or not there is anywhere to write it
+	#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(attribute, n) == 0 && (is_known = true) && c != NULL
 	
-	if (MATCH("misc", "debug")) config.is_debug = atoi(value);
-	if (MATCH("misc", "enable_transfer")) config.is_data_transfer = atoi(value);
-	if (MATCH("misc", "hostname")) config.host_name = strdup(value);
-	if (MATCH("misc", "host_ip")) config.host_ip = strdup(value);	
-	if (MATCH("misc", "directory")) config.host_dir = strdup(value);
-	if (MATCH("misc", "capture_delay")) config.capture_delay = atoi(value);
-	if (MATCH("misc", "enable_status_leds")) config.is_status_leds = atoi(value);
-
-	if (MATCH("files", "bitstream")) config.bitstream = strdup(value);	
-	if (MATCH("files", "tx_synthesizer")) tx_synth.parameter_file = strdup(value);
-	if (MATCH("files", "dx_synthesizer")) lo_synth.parameter_file = strdup(value);
-
-	if (MATCH("timing", "switch_mode")) config.switch_mode = atoi(value);
-	if (MATCH("timing", "n_seconds")) config.n_seconds = atoi(value);
-	if (MATCH("timing", "prf")) config.prf = atoi(value);
-	if (MATCH("timing", "channel_a_phase_increment")) config.channel_a_phase_increment = atoi(value);
-	if (MATCH("timing", "channel_b_phase_increment")) config.channel_b_phase_increment = atoi(value);
-
-	// if (MATCH("gpsd", "enabled")) config.is_gpsd = atoi(value);
-	// if (MATCH("gpsd", "min_mode")) gps->min_mode = atoi(value);
-	// if (MATCH("gpsd", "min_sats")) gps->min_sats = atoi(value);
-
-	if (MATCH("sampling", "decimation_factor")) config.decimation_factor = atoi(value);
-	if (MATCH("sampling", "presum_factor")) config.presum_factor = atoi(value);
-	if (MATCH("sampling", "start_index")) config.start_index = atoi(value);
-	if (MATCH("sampling", "end_index")) config.end_index = atoi(value);
-
-	return 1;	//TODO: Improve error handling.
+	if (MATCH("misc", "debug")) c->is_debug = atoi(value);
+	if (MATCH("misc", "enable_transfer")) c->is_data_transfer = atoi(value);
+	if (MATCH("misc", "hostname")) c->host_name = strdup(value);
+	if (MATCH("misc", "host_ip")) c->host_ip = strdup(value);	
+	if (MATCH("misc", "directory")) c->host_dir = strdup(value);
+	if (MATCH("misc", "enable_streaming")) c->is_streaming = atoi(value);
+	if (MATCH("misc", "stream_port")) c->stream_port = atoi(value);
+	if (MATCH("misc", "stream_rate_limit")) c->stream_rate_limit = atof(value);
+	if (MATCH("misc", "capture_delay")) c->capture_delay = atoi(value);
+	if (MATCH("misc", "start_time")) c->start_time = strdup(value);
+	if (MATCH("misc", "operator_comment")) c->operator_comment = strdup(value);
+	if (MATCH("misc", "enable_status_leds")) c->is_status_leds = atoi(value);
+	if (MATCH("misc", "enable_trigger_button")) c->is_trigger_button = atoi(value);
+
+	if (MATCH("storage", "segment_mode")) c->segment_mode = atoi(value);
+	if (MATCH("storage", "segment_mb")) c->segment_mb = atof(value);
+	if (MATCH("storage", "segment_seconds")) c->segment_seconds = atof(value);
+	if (MATCH("storage", "min_free_mb")) c->min_free_mb = atof(value);
+	if (MATCH("storage", "stripe_dirs")) c->stripe_dirs = strdup(value);
+	if (MATCH("storage", "stripe_depth")) c->stripe_depth = atoi(value);
+	if (MATCH("storage", "stripe_throttle")) c->stripe_throttle = strdup(value);
+
+	if (MATCH("continuous", "enabled")) c->is_continuous = atoi(value);
+	if (MATCH("continuous", "retention_mb")) c->retention_mb = atof(value);
+	if (MATCH("continuous", "retention_minutes")) c->retention_minutes = atof(value);
+
+	if (MATCH("pretrigger", "enabled")) c->is_pretrigger = atoi(value);
+	if (MATCH("pretrigger", "seconds")) c->pretrigger_seconds = atof(value);
+	if (MATCH("pretrigger", "max_mb")) c->pretrigger_max_mb = atof(value);
+
+	if (MATCH("files", "bitstream")) c->bitstream = strdup(value);	
+	if (MATCH("files", "force_bitstream_load")) c->is_force_bitstream |= atoi(value);
+	if (MATCH("files", "tx_synthesizer")) target->tx_synth->parameter_file = strdup(value);
+	if (MATCH("files", "dx_synthesizer")) target->lo_synth->parameter_file = strdup(value);
+
+	if (MATCH("timing", "switch_mode")) c->switch_mode = atoi(value);
+	if (MATCH("timing", "n_seconds")) c->n_seconds = atoi(value);
+	if (MATCH("timing", "prf")) c->prf = atoi(value);
+	if (MATCH("timing", "channel_a_phase_increment")) c->channel_a_phase_increment = atoi(value);
+	if (MATCH("timing", "channel_b_phase_increment")) c->channel_b_phase_increment = atoi(value);
+
+	if (MATCH("gpsd", "enabled")) c->is_gpsd = atoi(value);
+	if (MATCH("gpsd", "host")) c->gpsd_host = strdup(value);
+	if (MATCH("gpsd", "port")) c->gpsd_port = atoi(value);
+	if (MATCH("gpsd", "min_mode")) c->gps_min_mode = atoi(value);
+	if (MATCH("gpsd", "min_sats")) c->gps_min_sats = atoi(value);
+
+	if (MATCH("quicklook", "enabled")) c->is_quicklook = atoi(value);
+	if (MATCH("quicklook", "decimation")) c->quicklook_decimation = atoi(value);
+	if (MATCH("quicklook", "channel")) c->quicklook_channel = value[0] == 'b' || value[0] == 'B';
+	if (MATCH("quicklook", "cpu_budget")) c->quicklook_cpu = atof(value);
+
+	if (MATCH("sampling", "decimation_factor")) c->decimation_factor = atoi(value);
+	if (MATCH("sampling", "presum_factor")) c->presum_factor = atoi(value);
+	if (MATCH("sampling", "start_index")) c->start_index = atoi(value);
+	if (MATCH("sampling", "end_index")) c->end_index = atoi(value);
+
+	//keys of setup.ini the daemon does not use are an error to ini_parse(), which carries on
+	return is_known;
+}
+
+// Whether parse_setup_file() takes section.key, for batch files.
+int is_setup_key(const char *section, const char *key)
+{
+	SetupTarget check = {NULL, NULL, NULL};
+	return parse_setup_file(&check, section, key, NULL);
 }
 
 
@@ -410,19 +1663,8 @@ void init_red_pitaya(void)
 	system("df -T -h /media/storage/");
 	printf("\n");
 
-	// if (config.is_debug)
-	// {
-	// 	cprint("[**] ", BRIGHT, CYAN);
-	// 	printf("Loading Bitstream:\n%s\n", config.bitstream);
-	// }
-
-	// clear bitstream
-	system("fpgautil -R\n");
-
-	// load bitstream
-	char cmd[100];
-	sprintf(cmd, "fpgautil -b %s\n", config.bitstream);
-	system(cmd);
+	// load bitstream, unless the PL already runs this exact design
+	ASSERT(fpga_load(&bitstream, config.bitstream, config.is_force_bitstream), "Failed to load bitstream.");
 
 	//increase program priority 
 	setpriority(PRIO_PROCESS, 0, -20);
@@ -439,34 +1681,106 @@ void init_red_pitaya(void)
 	ASSERT(create_map(SREG, MAP_SHARED, &reg_tcu, TCU_BASE_ADDR), "Failed to allocate map for tcu register.");
 	ASSERT(create_map(SREG, MAP_SHARED, &reg_channel_b_phase_inc, REF_LO_BASE_ADDR), "Failed to allocate map for cancellation phase increment register.");
 
+	ASSERT(apply_settings(&config), "Could not apply the sampling settings.");
+}
+
+// Writes the sampling settings to the fpga, only the registers that differ from what they were
+// last set to. Returns the number of register writes, FAIL without writing any if a PRI would not
+// fit the FIFO.
+int apply_settings(Configuration *c)
+{
+	int n_writes = 0;
+
+	//set number of samples in chunk and integration factor
+	c->n_samples_per_pri = floor(1.0/c->prf * ADC_RATE/c->decimation_factor);
+
+	if (c->n_samples_per_pri >= FIFO_DEPTH) 
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Number of samples in PRI exceeds FIFO depth!\n");
+		return FAIL;
+	}
+
 	//set dds phase increment for main channel local oscillator
-	set_reg(reg_channel_a_phase_inc, config.channel_a_phase_increment);
+	if (!is_applied || c->channel_a_phase_increment != applied.channel_a_phase_increment)
+	{
+		set_reg(reg_channel_a_phase_inc, c->channel_a_phase_increment);
+		n_writes++;
+	}
 
 	//set dds phase increment for reference channel local oscillator
-	set_reg(reg_channel_b_phase_inc, config.channel_b_phase_increment);
+	if (!is_applied || c->channel_b_phase_increment != applied.channel_b_phase_increment)
+	{
+		set_reg(reg_channel_b_phase_inc, c->channel_b_phase_increment);
+		n_writes++;
+	}
 
 	//set chunk start and stop index
 	//note that indexing starts from 1!
-	uint32_t chunk_index = (config.start_index << 0) + (config.end_index << 16);
-	set_reg(reg_index, chunk_index);
-
-	//set number of samples in chunk and integration factor
-	config.n_samples_per_pri = floor(1.0/config.prf * ADC_RATE/config.decimation_factor);
+	if (!is_applied || c->start_index != applied.start_index || c->end_index != applied.end_index)
+	{
+		uint32_t chunk_index = (c->start_index << 0) + (c->end_index << 16);
+		set_reg(reg_index, chunk_index);
+		n_writes++;
+	}
 
-	if (config.n_samples_per_pri >= FIFO_DEPTH) 
+	if (!is_applied || c->n_samples_per_pri != applied.n_samples_per_pri || c->presum_factor != applied.presum_factor)
 	{
-		printf("Number of samples in PRI exceeds FIFO depth!\n");
-		exit(0);
+		uint32_t integration = (c->n_samples_per_pri << 0) + (c->presum_factor << 16);
+		set_reg(reg_integration, integration);
+		n_writes++;
 	}
 
-	uint32_t integration = (config.n_samples_per_pri << 0) + (config.presum_factor << 16);
-	set_reg(reg_integration, integration);
+	applied = *c;
+	is_applied = true;
+	return n_writes;
+}
+
+void load_synths(Configuration *c, Synthesizer *tx, Synthesizer *lo)
+{
+  //parse synth ramp parameters from .ini files
+  parse_ramp_file(tx);
+  parse_ramp_file(lo);
+
+  //calculate additional ramp parameters
+  calc_parameters(tx, c);
+  calc_parameters(lo, c);
 
-  // init the Status LEDs
-  init_leds();
-  power_led->led_id = GPIO_POWER_LED;
-  armed_led->led_id = GPIO_ARMED_LED;
-  capture_led->led_id = GPIO_CAPTURE_LED;
+  //import synth register values from template file
+  load_registers(SYNTH_REG_TEMP_DIR, tx);
+  load_registers(SYNTH_REG_TEMP_DIR, lo);
+}
+
+// The synths keep their registers between sessions, the first session programs them completely
+// and later ones only write the registers that changed. Returns the number of registers written.
+int program_synths(Synthesizer *tx, Synthesizer *lo)
+{
+  if (is_synth_flashed)
+    return update_synth(reg_gpio, tx, tx_flashed) + update_synth(reg_gpio, lo, lo_flashed);
+
+  //software reset the synths
+  reset_synths(reg_gpio, tx, lo);
+
+  //write to the synth registers
+  flash_synth(reg_gpio, tx);
+  flash_synth(reg_gpio, lo);
+
+  memcpy(tx_flashed, tx->registers, sizeof(tx_flashed));
+  memcpy(lo_flashed, lo->registers, sizeof(lo_flashed));
+  is_synth_flashed = true;
+
+  return 2*NUM_REGISTERS;
+}
+
+// Settings that cannot be combined, at startup and for every batch session.
+void check_settings(Configuration *c)
+{
+  if (c->is_continuous && c->is_pretrigger)
+  {
+    cprint("[!!] ", BRIGHT, YELLOW);
+    printf("Pre-trigger capture is not available in continuous mode, disabling it\n");
+    c->is_pretrigger = false;
+  }
 }
 
 void splash(void)
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE   // ppoll, for a sub-millisecond button poll
+#include "panel.h"
+#include "utils.h"
+#include "reg.h"
+#include "trace.h"
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "colour.h"
+
+static int open_uio(void);
+static void sample_button(Panel *panel, int64_t now);
+static uint32_t led_value(Panel *panel, int is_blink_on);
+static int64_t monotonic_ns(void);
+
+int init_panel(Panel *panel, int is_leds, int is_button, PressHandler on_press)
+{
+  memset(panel, 0, sizeof(*panel));
+  panel->is_leds = is_leds;
+  panel->is_button = is_button;
+  panel->on_press = on_press;
+  panel->uio = -1;
+  panel->wake = -1;
+
+  if (!is_leds && !is_button)
+    return OK;
+
+  if (is_leds)
+  {
+    ASSERT(create_map(SREG, MAP_SHARED, &panel->led_reg, GPIO_TRIGGER_LED), "Failed to allocate map for gpio trigger led register.");
+    set_reg(panel->led_reg, LOW); // clear all LEDs
+  }
+
+  if (is_button)
+  {
+    ASSERT(create_map(SREG, MAP_SHARED, &panel->button_reg, GPIO_TRIGGER_SWITCH), "Failed to allocate map for gpio trigger switch register.");
+    set_reg(panel->button_reg, HIGH);
+
+    panel->uio = open_uio();
+    cprint("[**] ", BRIGHT, CYAN);
+    if (panel->uio >= 0)
+      printf("Trigger button on its interrupt (%s)\n", PANEL_UIO_NAME);
+    else
+      printf("Trigger button polled every %d-%d [us]\n", PANEL_POLL_MIN_US, PANEL_POLL_MAX_US);
+  }
+
+  if ((panel->wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+  {
+    cprint("[!!] ", BRIGHT, RED);
+    printf("Could not create the front panel wake up\n");
+    return FAIL;
+  }
+
+  //released from the start, a button held down while starting up is not a press
+  panel->level = 1;
+  panel->is_locked = true;
+  panel->changed_ns = monotonic_ns();
+  panel->last_sample_ns = panel->changed_ns;
+  panel->poll_ns = PANEL_POLL_MAX_US*1000L;
+
+  panel->is_running = true;
+  pthread_create(&panel->thread, NULL, *panel_worker, (void *)panel);
+
+  return OK;
+}
+
+// Safe from any thread, the loop picks the change up on its next tick.
+void panel_set_led(Panel *panel, int led, enum LedState state)
+{
+  uint32_t old = __atomic_load_n(&panel->led_states, __ATOMIC_RELAXED);
+  uint32_t new;
+
+  do
+    new = (old & ~(3u << 2*led)) | ((uint32_t)state << 2*led);
+  while (!__atomic_compare_exchange_n(&panel->led_states, &old, new, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Holds the input low for ms as if the button was pressed, it goes through the same debounce
+// and handler as a real press.
+void panel_simulate_press(Panel *panel, int ms)
+{
+  uint64_t one = 1;
+
+  __atomic_store_n(&panel->sim_until_ns, monotonic_ns() + ms*1000000LL, __ATOMIC_RELEASE);
+  if (write(panel->wake, &one, sizeof(one)) < 0)
+    return;
+}
+
+void *panel_worker(void *arg)
+{
+  Panel *panel = (Panel *)arg;
+  int64_t tick_ns = PANEL_TICK_MS*1000000LL;
+  int64_t next_tick = monotonic_ns();
+  uint32_t written = 0;
+
+  //signals belong to the main thread, exit_handler() joins this one
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TRACE_THREAD("panel");
+
+  while (panel->is_running)
+  {
+    int64_t now = monotonic_ns();
+
+    if (now >= next_tick)
+    {
+      if (panel->is_leds)
+      {
+        uint32_t value = led_value(panel, (now / (PANEL_BLINK_MS*1000000LL)) % 2 == 0);
+        if (value != written || panel->n_writes == 0)
+        {
+          set_reg(panel->led_reg, value);
+          TRACE_INSTANT(TraceLed, value, __atomic_load_n(&panel->led_states, __ATOMIC_RELAXED));
+          written = value;
+          panel->n_writes++;
+        }
+      }
+
+      next_tick += tick_ns;
+      if (next_tick <= now)
+        next_tick = now + tick_ns;
+    }
+
+    //a released, settled button on an interrupt needs no sampling, anything else is polled
+    int64_t wait = next_tick - now;
+    int is_settled = panel->level == 1 && !panel->is_locked && panel->edge_ns == 0;
+    if (panel->is_button && !(panel->uio >= 0 && is_settled) && panel->poll_ns < wait)
+      wait = panel->poll_ns;
+
+    struct pollfd fds[2] = {{panel->wake, POLLIN, 0}, {panel->uio, POLLIN, 0}};
+    struct timespec timeout = {wait / 1000000000, wait % 1000000000};
+
+    if (ppoll(fds, panel->uio >= 0 ? 2 : 1, &timeout, NULL) > 0)
+    {
+      uint64_t count;
+      uint32_t irq_count, unmask = 1;
+
+      if (fds[0].revents & POLLIN)
+        if (read(panel->wake, &count, sizeof(count)) < 0)
+          count = 0;
+
+      //acknowledge and re-enable the interrupt
+      if (fds[1].revents & POLLIN)
+        if (read(panel->uio, &irq_count, sizeof(irq_count)) != sizeof(irq_count) || write(panel->uio, &unmask, sizeof(unmask)) != sizeof(unmask))
+          irq_count = 0;
+    }
+
+    if (panel->is_button)
+      sample_button(panel, monotonic_ns());
+  }
+
+  return NULL;
+}
+
+void dinit_panel(Panel *panel)
+{
+  if (panel->is_running)
+  {
+    panel->is_running = false;
+    pthread_join(panel->thread, NULL);
+  }
+
+  if (panel->wake >= 0)
+    close(panel->wake);
+  if (panel->uio >= 0)
+    close(panel->uio);
+  panel->wake = -1;
+  panel->uio = -1;
+
+  if (panel->is_leds && panel->led_reg != NULL)
+  {
+    set_reg(panel->led_reg, LOW); // clear all LEDs
+    ASSERT(destroy_map(SREG, &panel->led_reg), "Failed to deallocate gpio_trigger_led memory.");
+  }
+
+  if (panel->is_button && panel->button_reg != NULL)
+  {
+    set_reg(panel->button_reg, HIGH);
+    ASSERT(destroy_map(SREG, &panel->button_reg), "Failed to deallocate gpio_trigger_switch memory.");
+  }
+
+  panel->led_reg = NULL;
+  panel->button_reg = NULL;
+}
+
+// The bitstream names the interrupt of the button input PANEL_UIO_NAME, older ones have none.
+static int open_uio(void)
+{
+  for (int i = 0; i < 10; i++)
+  {
+    char path[64], name[32] = "";
+    snprintf(path, sizeof(path), "/sys/class/uio/uio%d/name", i);
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+      continue;
+    if (fgets(name, sizeof(name), f) == NULL)
+      name[0] = '\0';
+    fclose(f);
+
+    if (strncmp(name, PANEL_UIO_NAME, strlen(PANEL_UIO_NAME)) != 0)
+      continue;
+
+    snprintf(path, sizeof(path), "/dev/uio%d", i);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    uint32_t unmask = 1;
+
+    if (fd >= 0 && write(fd, &unmask, sizeof(unmask)) == sizeof(unmask))
+      return fd;
+    if (fd >= 0)
+      close(fd);
+  }
+
+  return -1;
+}
+
+// Time based debounce, see panel.h. The button pulls the input low.
+static void sample_button(Panel *panel, int64_t now)
+{
+  int level = now < __atomic_load_n(&panel->sim_until_ns, __ATOMIC_ACQUIRE) ? 0 : get_reg(panel->button_reg) & 1;
+
+  if (level != panel->level)
+  {
+    if (level == 0 && !panel->is_locked && panel->edge_ns == 0)
+    {
+      panel->edge_ns = now;
+      panel->edge_gap_ns = now - panel->last_sample_ns;
+    }
+
+    panel->level = level;
+    panel->changed_ns = now;
+    panel->poll_ns = PANEL_POLL_MIN_US*1000L;
+  }
+  else if (panel->edge_ns == 0 && panel->poll_ns < PANEL_POLL_MAX_US*1000L)
+    panel->poll_ns *= 2;
+
+  panel->last_sample_ns = now;
+
+  //the press counts from its first low sample, contact bounce before the glitch time is absorbed
+  if (level == 0 && panel->edge_ns > 0 && now - panel->changed_ns >= PANEL_GLITCH_US*1000L)
+  {
+    struct timespec edge = {panel->edge_ns / 1000000000, panel->edge_ns % 1000000000};
+
+    panel->n_presses++;
+    panel->edge_uncertainty_us = panel->edge_gap_ns*1e-3;
+    panel->detect_us = (now - panel->edge_ns)*1e-3;
+    panel->is_locked = true;
+    panel->edge_ns = 0;
+
+    TRACE_INSTANT(TraceButton, panel->n_presses, (int32_t)panel->detect_us);
+
+    if (panel->on_press != NULL)
+      panel->on_press(&edge, now < panel->sim_until_ns ? "simulated" : panel->uio >= 0 ? "button_irq" : "button");
+  }
+
+  //released long enough, the next low is a new press and a pending one was a glitch
+  if (level == 1 && now - panel->changed_ns >= PANEL_DEBOUNCE_MS*1000000L)
+  {
+    panel->is_locked = false;
+    panel->edge_ns = 0;
+  }
+}
+
+static uint32_t led_value(Panel *panel, int is_blink_on)
+{
+  uint32_t states = __atomic_load_n(&panel->led_states, __ATOMIC_ACQUIRE);
+  uint32_t value = 0;
+
+  for (int led = 0; led < PANEL_N_LEDS; led++)
+  {
+    enum LedState state = (states >> 2*led) & 3;
+    if (state == On || (state == Blink && is_blink_on))
+      value |= 1u << led;
+  }
+
+  return value;
+}
+
+static int64_t monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec*1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,68 @@
+#ifndef PANEL_H
+#define PANEL_H
+
+#include <time.h>
+#include "constants.h"
+
+#define PANEL_N_LEDS        3
+#define PANEL_TICK_MS       100   // LED update period
+#define PANEL_BLINK_MS      200   // half period of a blinking LED
+#define PANEL_POLL_MIN_US   250   // button sampling right after the input changed
+#define PANEL_POLL_MAX_US   2000  // button sampling once the input has been stable for a while
+#define PANEL_GLITCH_US     1000  // a press must stay low this long to count
+#define PANEL_DEBOUNCE_MS   20    // and follow at least this long released, rejects contact bounce
+#define PANEL_UIO_NAME      "trigger_switch"  // uio device of the button interrupt, if the bitstream has one
+
+enum LedState {Off = 0, On = 1, Blink = 2};
+
+// Called on the panel thread for every press, with the CLOCK_MONOTONIC time of its leading edge.
+typedef void (*PressHandler)(struct timespec *edge, const char *source);
+
+// Status LEDs and trigger button on the extension connector, served by one thread.
+//
+// LED states are packed two bits per LED into one word that any thread may change through
+// panel_set_led(). Every tick the loop derives the LED register value from that word and the
+// blink phase and writes it only if it changed, so there is at most one register write per tick.
+//
+// The button is waited for on its UIO interrupt where the bitstream provides one, otherwise it is
+// sampled with a period that drops to PANEL_POLL_MIN_US whenever the input moves and backs off to
+// PANEL_POLL_MAX_US while it is still. Debouncing is by time: a press is the first low sample
+// after PANEL_DEBOUNCE_MS released, confirmed once it has stayed low for PANEL_GLITCH_US, and is
+// timestamped at that first low sample. The handler is called directly from the panel thread.
+typedef struct Panel_S
+{
+  void *led_reg;
+  void *button_reg;
+  int is_leds;
+  int is_button;
+  int uio;                          // button interrupt, -1 when polling
+  PressHandler on_press;
+
+  volatile uint32_t led_states;     // 2 bits per LED, enum LedState
+  volatile int64_t sim_until_ns;    // simulated press, the input reads low until then
+  volatile int is_running;
+  uint32_t n_writes;                // LED register writes, at most one per tick
+
+  int wake;                         // eventfd, interrupts the wait for a simulated press
+  int level;                        // last sampled input, 1 = released
+  int64_t changed_ns;               // time of the last input change
+  int64_t edge_ns;                  // first low sample of a press being confirmed, 0 if none
+  int64_t edge_gap_ns;              // sampling gap before edge_ns, the uncertainty of the edge time
+  int is_locked;                    // press reported, no other until released for PANEL_DEBOUNCE_MS
+  int64_t poll_ns;                  // current sampling period
+  int64_t last_sample_ns;
+
+  int n_presses;
+  double edge_uncertainty_us;       // last press: time between its edge and the sample before it
+  double detect_us;                 // last press: edge to handler call
+
+  pthread_t thread;
+} Panel;
+
+int init_panel(Panel *panel, int is_leds, int is_button, PressHandler on_press);
+void panel_set_led(Panel *panel, int led, enum LedState state);
+void panel_simulate_press(Panel *panel, int ms);
+void *panel_worker(void *arg);
+void dinit_panel(Panel *panel);
+
+#endif  // PANEL_H
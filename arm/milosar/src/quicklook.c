@@ -0,0 +1,466 @@
+#include "quicklook.h"
+#include "reg.h"
+#include "trace.h"
+#include "colour.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+static int is_shared = false;
+
+static void look_at_block(Quicklook *ql, int64_t published);
+static void range_line(Quicklook *ql, int64_t pri);
+static void fft(Quicklook *ql);
+static int is_over_budget(Quicklook *ql);
+static int64_t now_ns(clockid_t clock);
+
+// Starts the thread and shares the image, the buffers are sized for the longest PRI so a session
+// only recomputes its tables. Without /dev/shm the metrics still reach the status reply.
+int init_quicklook(Quicklook *ql, int decimation, int channel, double cpu_budget)
+{
+  memset(ql, 0, sizeof(*ql));
+  ql->decimation = decimation > 0 ? decimation : 1;
+  ql->channel = channel;
+  ql->cpu_budget = cpu_budget > 0 && cpu_budget < 1 ? cpu_budget : 1;
+  ql->published = -1;
+
+  int fd = shm_open(QUICKLOOK_SHM, O_RDWR | O_CREAT, 0644);
+  if (fd >= 0 && ftruncate(fd, sizeof(QuicklookImage)) == 0)
+  {
+    ql->image = mmap(NULL, sizeof(QuicklookImage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    is_shared = ql->image != MAP_FAILED;
+  }
+
+  if (fd >= 0)
+    close(fd);
+
+  if (!is_shared)
+  {
+    cprint("[!!] ", BRIGHT, YELLOW);
+    printf("Could not share the quicklook image as %s: %s\n", QUICKLOOK_SHM, strerror(errno));
+    ql->image = calloc(1, sizeof(QuicklookImage));
+  }
+
+  ql->window = malloc(QUICKLOOK_MAX_FFT*sizeof(float));
+  ql->twiddle_re = malloc(QUICKLOOK_MAX_FFT*sizeof(float));
+  ql->twiddle_im = malloc(QUICKLOOK_MAX_FFT*sizeof(float));
+  ql->reverse = malloc(QUICKLOOK_MAX_FFT*sizeof(uint32_t));
+  ql->re = malloc(QUICKLOOK_MAX_FFT*sizeof(float));
+  ql->im = malloc(QUICKLOOK_MAX_FFT*sizeof(float));
+  ql->power = malloc(QUICKLOOK_MAX_FFT*sizeof(float));
+  ql->words = malloc(N_CHANNELS*QUICKLOOK_MAX_FFT*sizeof(uint32_t));
+
+  if (ql->image == NULL || ql->window == NULL || ql->twiddle_re == NULL || ql->twiddle_im == NULL || ql->reverse == NULL ||
+      ql->re == NULL || ql->im == NULL || ql->power == NULL || ql->words == NULL || sem_init(&ql->wake, 0, 0) != 0)
+    return FAIL;
+
+  ql->is_running = true;
+  pthread_create(&ql->thread, NULL, *quicklook_worker, (void *)ql);
+
+  cprint("[**] ", BRIGHT, CYAN);
+  printf("Quicklook of one in %d PRIs on channel %c, at most %.0f%% of a core\n", ql->decimation, 'A' + ql->channel, ql->cpu_budget*100);
+
+  return OK;
+}
+
+// Sets up the tables for the PRIs of this session and clears the image, called before the record
+// thread starts while the quicklook thread is idle. metres_per_hz is the range of a beat frequency
+// of 1 Hz, c*sweep_time/(2*bandwidth), 0 if the ramp is not known.
+int quicklook_start(Quicklook *ql, Configuration *config, Channel *channel, double metres_per_hz, int session)
+{
+  int n_samples = config->end_index - config->start_index + 1;
+  int n_fft = 2, log2n = 1;
+
+  while (n_fft < n_samples)
+  {
+    n_fft *= 2;
+    log2n++;
+  }
+
+  if (n_fft > QUICKLOOK_MAX_FFT)
+  {
+    cprint("[!!] ", BRIGHT, YELLOW);
+    printf("PRIs of %d samples are too long for the quicklook, none this session\n", n_samples);
+    return FAIL;
+  }
+
+  ql->channel_source = channel;
+  ql->n_samples = n_samples;
+  ql->bytes_per_pri = N_CHANNELS*BYTES_PER_WRITE*n_samples;
+  ql->n_fft = n_fft;
+  ql->log2n = log2n;
+
+  //hann, scaled so a full scale tone peaks at 0 dBFS
+  double sum = 0;
+  for (int i = 0; i < n_samples; i++)
+  {
+    ql->window[i] = 0.5 - 0.5*cos(2*M_PI*(i + 0.5)/n_samples);
+    sum += ql->window[i];
+  }
+  for (int i = 0; i < n_samples; i++)
+    ql->window[i] /= sum*32768;
+
+  //stage of half size h has its twiddles e^(-i pi j/h) at h - 1
+  for (int h = 1; h < n_fft; h *= 2)
+  {
+    for (int j = 0; j < h; j++)
+    {
+      ql->twiddle_re[h - 1 + j] = cos(M_PI*j/h);
+      ql->twiddle_im[h - 1 + j] = -sin(M_PI*j/h);
+    }
+  }
+
+  for (int i = 0; i < n_fft; i++)
+  {
+    uint32_t r = 0;
+    for (int b = 0; b < log2n; b++)
+      r |= ((i >> b) & 1) << (log2n - 1 - b);
+    ql->reverse[i] = r;
+  }
+
+  QuicklookImage *image = ql->image;
+  int n_bins = n_fft/2;
+
+  //the magic goes last, a reader never sees a valid image half cleared
+  __atomic_store_n(&image->magic, 0, __ATOMIC_RELEASE);
+  memset((uint8_t *)image + sizeof(image->magic), 0, sizeof(QuicklookImage) - sizeof(image->magic));
+
+  image->version = QUICKLOOK_VERSION;
+  image->size = sizeof(QuicklookImage);
+  image->session = session;
+  image->n_columns = n_bins < QUICKLOOK_COLUMNS ? n_bins : QUICKLOOK_COLUMNS;
+  image->bins_per_column = n_bins/image->n_columns;
+  image->n_fft = n_fft;
+  image->decimation = ql->decimation;
+  image->range_bin = metres_per_hz*ADC_RATE/config->decimation_factor/n_fft;
+  image->line_period = ql->decimation*(double)config->presum_factor/config->prf;
+  image->last_pri = -1;
+  __atomic_store_n(&image->magic, QUICKLOOK_MAGIC, __ATOMIC_RELEASE);
+
+  ql->seen = -1;
+  ql->stream_offset = 0;
+  ql->snr_sum = 0;
+  ql->cpu_start_ns = -1;
+  __atomic_store_n(&ql->published, -1, __ATOMIC_RELEASE);
+  __atomic_store_n(&ql->is_active, true, __ATOMIC_SEQ_CST);
+
+  return OK;
+}
+
+// Called by the record thread for every DMA half it drains, block counts the halves of the
+// session's stream and offset is where the half is in the DMA buffer. Never waits.
+void quicklook_block(Quicklook *ql, int64_t block, int offset)
+{
+  __atomic_store_n(&ql->published, 2*block + (offset != 0), __ATOMIC_RELEASE);
+  sem_post(&ql->wake);
+}
+
+// Returns once the thread has let go of the DMA buffer, called after the record thread ended.
+void quicklook_stop(Quicklook *ql)
+{
+  __atomic_store_n(&ql->is_active, false, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&ql->is_busy, __ATOMIC_SEQ_CST))
+    usleep(1000);
+}
+
+void quicklook_report(Quicklook *ql, FILE *f)
+{
+  QuicklookImage *image = ql->image;
+
+  fprintf(f, "decimation        = %u\r\n", image->decimation);
+  fprintf(f, "channel           = %c\r\n", 'a' + ql->channel);
+  fprintf(f, "n_fft             = %u\r\n", image->n_fft);
+  fprintf(f, "n_lines           = %llu\r\n", (unsigned long long)image->n_lines);
+  fprintf(f, "n_late            = %llu; PRIs overwritten by the DMA writer before they were read\r\n", (unsigned long long)image->n_late);
+  fprintf(f, "n_throttled       = %llu; PRIs passed over to keep within the CPU budget\r\n", (unsigned long long)image->n_throttled);
+  fprintf(f, "n_missed          = %llu; blocks passed over\r\n", (unsigned long long)image->n_missed);
+  fprintf(f, "cpu_budget        = %.3f; of one core\r\n", ql->cpu_budget);
+  fprintf(f, "cpu               = %.3f; [s]\r\n", image->cpu_ns*1e-9);
+  fprintf(f, "max_snr           = %.1f; [dB]\r\n", image->max_snr_db);
+  fprintf(f, "mean_snr          = %.1f; [dB]\r\n", image->mean_snr_db);
+  fprintf(f, "last_peak         = %.1f; [dBFS]\r\n", image->peak_db);
+  fprintf(f, "last_peak_range   = %.1f; %s\r\n", image->peak_range, image->range_bin > 0 ? "[m]" : "[bin]");
+}
+
+void *quicklook_worker(void *arg)
+{
+  Quicklook *ql = (Quicklook *)arg;
+
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  //the capture threads always come first, nice is per thread on linux
+#ifdef SCHED_IDLE
+  struct sched_param param = {0};
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), QUICKLOOK_NICE);
+
+  TRACE_THREAD("quicklook");
+
+  while (ql->is_running)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += QUICKLOOK_POLL_MS*1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    sem_timedwait(&ql->wake, &deadline);
+
+    //busy before active is checked, quicklook_stop() clears active before it checks busy
+    __atomic_store_n(&ql->is_busy, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ql->is_active, __ATOMIC_SEQ_CST))
+    {
+      int64_t published = __atomic_load_n(&ql->published, __ATOMIC_ACQUIRE);
+      if (published >= 0 && published/2 != ql->seen)
+        look_at_block(ql, published);
+    }
+    __atomic_store_n(&ql->is_busy, false, __ATOMIC_SEQ_CST);
+  }
+
+  return NULL;
+}
+
+void dinit_quicklook(Quicklook *ql)
+{
+  if (ql->is_running)
+  {
+    ql->is_running = false;
+    sem_post(&ql->wake);
+    pthread_join(ql->thread, NULL);
+  }
+
+  sem_destroy(&ql->wake);
+
+  //leave the shared image in place, a monitor may still want the last one
+  if (is_shared)
+    munmap(ql->image, sizeof(QuicklookImage));
+  else
+    free(ql->image);
+  ql->image = NULL;
+
+  free(ql->window);
+  free(ql->twiddle_re);
+  free(ql->twiddle_im);
+  free(ql->reverse);
+  free(ql->re);
+  free(ql->im);
+  free(ql->power);
+  free(ql->words);
+}
+
+// Range compresses the PRIs of the block that are due and lie wholly inside it, the stream starts
+// on a PRI boundary with block 0. Stops at the first PRI that was overwritten before it was read.
+static void look_at_block(Quicklook *ql, int64_t published)
+{
+  QuicklookImage *image = ql->image;
+  int64_t block = published/2;
+  int offset = (published & 1) ? S2MB : 0;
+  int64_t first_byte = ql->stream_offset + block*S2MB, end_byte = first_byte + S2MB;
+  int64_t step = ql->decimation;
+
+  //the thread's own clock, read on the thread
+  if (ql->cpu_start_ns < 0)
+  {
+    ql->cpu_start_ns = ql->cpu_mark_ns = ql->last_cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    ql->wall_mark_ns = ql->last_wall_ns = now_ns(CLOCK_MONOTONIC);
+    ql->credit_ns = QUICKLOOK_BURST_MS*1000000LL;
+  }
+
+  if (ql->seen >= 0 && block > ql->seen + 1)
+    __atomic_fetch_add(&image->n_missed, block - ql->seen - 1, __ATOMIC_RELAXED);
+  ql->seen = block;
+
+  int64_t pri = (first_byte + ql->bytes_per_pri - 1)/ql->bytes_per_pri;
+  pri = (pri + step - 1)/step*step;
+
+  TRACE_BEGIN(TraceQuicklook, block, pri);
+
+  for (; (pri + 1)*ql->bytes_per_pri <= end_byte; pri += step)
+  {
+    if (is_over_budget(ql))
+    {
+      int64_t n_left = (end_byte/ql->bytes_per_pri - 1 - pri)/step + 1;
+      __atomic_fetch_add(&image->n_throttled, n_left, __ATOMIC_RELAXED);
+      break;
+    }
+
+    //a copy of the PRI alone, then check the writer had not come back to the half meanwhile
+    uint8_t *dma = (uint8_t *)ql->channel_source->dma;
+    memcpy(ql->words, dma + offset + (pri*ql->bytes_per_pri - first_byte), ql->bytes_per_pri);
+
+    int position = get_reg(ql->channel_source->sts) * BYTES_PER_WRITE;
+    if (__atomic_load_n(&ql->published, __ATOMIC_ACQUIRE) != published || (offset == 0 ? position < S2MB : position >= S2MB))
+    {
+      __atomic_fetch_add(&image->n_late, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+    range_line(ql, pri);
+  }
+
+  TRACE_END(TraceQuicklook, block, pri);
+
+  image->cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID) - ql->cpu_start_ns;
+}
+
+// Windowed FFT of the PRI in ql->words, its positive beat frequencies max pooled into the next
+// row of the image, and the peak and noise of the line.
+static void range_line(Quicklook *ql, int64_t pri)
+{
+  QuicklookImage *image = ql->image;
+  int n_bins = ql->n_fft/2;
+  int n_columns = image->n_columns, per_column = image->bins_per_column;
+
+  //words interleave the channels, each I in the low and Q in the high half
+  for (int i = 0; i < ql->n_samples; i++)
+  {
+    uint32_t word = ql->words[N_CHANNELS*i + ql->channel];
+    ql->re[ql->reverse[i]] = (int16_t)(word & 0xFFFF)*ql->window[i];
+    ql->im[ql->reverse[i]] = (int16_t)(word >> 16)*ql->window[i];
+  }
+  for (int i = ql->n_samples; i < ql->n_fft; i++)
+  {
+    ql->re[ql->reverse[i]] = 0;
+    ql->im[ql->reverse[i]] = 0;
+  }
+
+  fft(ql);
+
+  for (int k = 0; k < n_bins; k++)
+    ql->power[k] = ql->re[k]*ql->re[k] + ql->im[k]*ql->im[k];
+
+  int peak = QUICKLOOK_MIN_BIN;
+  for (int k = QUICKLOOK_MIN_BIN; k < n_bins; k++)
+    if (ql->power[k] > ql->power[peak])
+      peak = k;
+
+  //rows in 1/255ths of the dB range, the median column of the row is the noise
+  uint8_t *row = image->image[image->n_lines % QUICKLOOK_ROWS];
+  uint32_t histogram[256];
+  memset(histogram, 0, sizeof(histogram));
+
+  for (int c = 0; c < n_columns; c++)
+  {
+    float max = 0;
+    for (int k = c*per_column; k < (c + 1)*per_column; k++)
+      max = ql->power[k] > max ? ql->power[k] : max;
+
+    float value = (10*log10f(max + 1e-30f) + QUICKLOOK_DB_RANGE)*255/QUICKLOOK_DB_RANGE;
+    row[c] = value < 0 ? 0 : value > 255 ? 255 : (uint8_t)value;
+    histogram[row[c]]++;
+  }
+
+  int median = 0;
+  for (uint32_t count = 0; median < 255 && (count += histogram[median]) < (uint32_t)(n_columns + 1)/2; median++);
+
+  float peak_db = 10*log10f(ql->power[peak] + 1e-30f);
+  float noise_db = median*QUICKLOOK_DB_RANGE/255 - QUICKLOOK_DB_RANGE;
+  float snr_db = peak_db - noise_db;
+
+  image->peak_db = peak_db;
+  image->noise_db = noise_db;
+  image->snr_db = snr_db;
+  image->peak_range = image->range_bin > 0 ? peak*image->range_bin : peak;
+  image->max_snr_db = image->n_lines == 0 || snr_db > image->max_snr_db ? snr_db : image->max_snr_db;
+  ql->snr_sum += snr_db;
+  image->mean_snr_db = ql->snr_sum/(image->n_lines + 1);
+  image->last_pri = pri;
+  __atomic_store_n(&image->n_lines, image->n_lines + 1, __ATOMIC_RELEASE);
+}
+
+// Radix-2 decimation in time on split re and im arrays loaded in bit reversed order. From the
+// third stage on the butterflies of a group are four wide on NEON.
+static void fft(Quicklook *ql)
+{
+  float *re = ql->re, *im = ql->im;
+  int n = ql->n_fft;
+
+  for (int h = 1; h < n; h *= 2)
+  {
+    const float *wr = ql->twiddle_re + h - 1, *wi = ql->twiddle_im + h - 1;
+
+    for (int s = 0; s < n; s += 2*h)
+    {
+      float *ar = re + s, *ai = im + s, *br = re + s + h, *bi = im + s + h;
+      int j = 0;
+
+#ifdef __ARM_NEON
+      for (; j + 4 <= h; j += 4)
+      {
+        float32x4_t w_r = vld1q_f32(wr + j), w_i = vld1q_f32(wi + j);
+        float32x4_t b_r = vld1q_f32(br + j), b_i = vld1q_f32(bi + j);
+        float32x4_t a_r = vld1q_f32(ar + j), a_i = vld1q_f32(ai + j);
+        float32x4_t t_r = vmlsq_f32(vmulq_f32(b_r, w_r), b_i, w_i);
+        float32x4_t t_i = vmlaq_f32(vmulq_f32(b_r, w_i), b_i, w_r);
+
+        vst1q_f32(ar + j, vaddq_f32(a_r, t_r));
+        vst1q_f32(ai + j, vaddq_f32(a_i, t_i));
+        vst1q_f32(br + j, vsubq_f32(a_r, t_r));
+        vst1q_f32(bi + j, vsubq_f32(a_i, t_i));
+      }
+#endif
+
+      for (; j < h; j++)
+      {
+        float t_r = br[j]*wr[j] - bi[j]*wi[j];
+        float t_i = br[j]*wi[j] + bi[j]*wr[j];
+
+        br[j] = ar[j] - t_r;
+        bi[j] = ai[j] - t_i;
+        ar[j] += t_r;
+        ai[j] += t_i;
+      }
+    }
+  }
+}
+
+// Keeps the thread within cpu_budget of one core with a credit of CPU time that grows by the
+// budget of the time passed and shrinks by the CPU used, up to QUICKLOOK_BURST_MS. Once it is
+// spent the thread sleeps towards it being paid back, QUICKLOOK_POLL_MS at most, and the caller
+// passes over the rest of the block. The load of every QUICKLOOK_LOAD_MS window is published.
+static int is_over_budget(Quicklook *ql)
+{
+  QuicklookImage *image = ql->image;
+  int64_t cpu = now_ns(CLOCK_THREAD_CPUTIME_ID), wall = now_ns(CLOCK_MONOTONIC);
+
+  ql->credit_ns += (int64_t)(ql->cpu_budget*(wall - ql->last_wall_ns)) - (cpu - ql->last_cpu_ns);
+  ql->credit_ns = ql->credit_ns < QUICKLOOK_BURST_MS*1000000LL ? ql->credit_ns : QUICKLOOK_BURST_MS*1000000LL;
+  ql->last_cpu_ns = cpu;
+  ql->last_wall_ns = wall;
+
+  if (wall - ql->wall_mark_ns >= QUICKLOOK_LOAD_MS*1000000LL)
+  {
+    image->cpu_load = (float)(cpu - ql->cpu_mark_ns)/(wall - ql->wall_mark_ns);
+    ql->cpu_mark_ns = cpu;
+    ql->wall_mark_ns = wall;
+  }
+
+  if (ql->credit_ns >= 0)
+    return false;
+
+  //never long enough to hold up quicklook_stop()
+  int64_t sleep_ns = (int64_t)(-ql->credit_ns/ql->cpu_budget);
+  sleep_ns = sleep_ns < QUICKLOOK_POLL_MS*1000000LL ? sleep_ns : QUICKLOOK_POLL_MS*1000000LL;
+  struct timespec pause = {sleep_ns / 1000000000, sleep_ns % 1000000000};
+  nanosleep(&pause, NULL);
+  return true;
+}
+
+static int64_t now_ns(clockid_t clock)
+{
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (int64_t)now.tv_sec*1000000000 + now.tv_nsec;
+}
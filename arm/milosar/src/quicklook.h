@@ -0,0 +1,112 @@
+#ifndef QUICKLOOK_H
+#define QUICKLOOK_H
+
+#include <stdio.h>
+#include <semaphore.h>
+
+#include "constants.h"
+
+#define QUICKLOOK_SHM       "/milosar_quicklook"  // shm_open name, /dev/shm/milosar_quicklook
+#define QUICKLOOK_MAGIC     0x4B4C4951            // "QILK" little endian
+#define QUICKLOOK_VERSION   1
+#define QUICKLOOK_ROWS      256     // lines of the rolling image
+#define QUICKLOOK_COLUMNS   256     // range columns, at most, FFT bins are max pooled into them
+#define QUICKLOOK_MAX_FFT   16384   // two FIFO_DEPTH PRIs
+#define QUICKLOOK_MIN_BIN   2       // bins next to DC hold the feedthrough, the peak is looked for above
+#define QUICKLOOK_DB_RANGE  120.0   // [dB] below full scale mapped to image values 255 down to 0
+#define QUICKLOOK_NICE      19
+#define QUICKLOOK_POLL_MS   200     // longest wait for a block, how soon a shutdown is noticed
+#define QUICKLOOK_LOAD_MS   1000    // CPU load window
+#define QUICKLOOK_BURST_MS  20      // [ms] of CPU the thread may run ahead of its budget
+
+// Rolling range-time intensity image and peak metrics of the running session, mapped into shared
+// memory like the telemetry so a monitor can poll it with plain loads. Row n_lines - 1 modulo
+// QUICKLOOK_ROWS is the newest line, each is the range profile of one PRI in 1/255ths of
+// QUICKLOOK_DB_RANGE above -QUICKLOOK_DB_RANGE dBFS. There is a single writer and no lock, a
+// reader may see the oldest row being replaced.
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;                        // sizeof(QuicklookImage)
+  uint32_t session;
+  uint32_t n_columns;                   // used of QUICKLOOK_COLUMNS
+  uint32_t bins_per_column;
+  uint32_t n_fft;
+  uint32_t decimation;                  // stored PRIs per line
+  double range_bin;                     // [m] per FFT bin, 0 without the ramp
+  double line_period;                   // [s] between lines at full rate
+
+  uint64_t n_lines;                     // range lines added this session
+  int64_t last_pri;                     // stored PRI of the newest line
+  uint64_t n_late;                      // PRIs the DMA writer came back to before they were read
+  uint64_t n_throttled;                 // PRIs passed over to keep within the CPU budget
+  uint64_t n_missed;                    // blocks passed over while a block was still being looked at
+  uint64_t cpu_ns;                      // CLOCK_THREAD_CPUTIME_ID this session
+  float cpu_load;                       // fraction of one core over the last QUICKLOOK_LOAD_MS
+  float peak_db;                        // [dBFS] strongest bin of the newest line
+  float noise_db;                       // [dBFS] median column of the newest line
+  float snr_db;                         // peak over noise of the newest line
+  float peak_range;                     // [m] of the peak, its bin if range_bin is 0
+  float max_snr_db;                     // best line this session
+  float mean_snr_db;                    // average over the lines of this session
+  float reserved;
+
+  uint8_t image[QUICKLOOK_ROWS][QUICKLOOK_COLUMNS];
+} QuicklookImage;
+
+// Optional range compression of every decimation-th stored PRI while the capture runs.
+//
+// The record thread only announces each DMA half it drains, the quicklook thread reads the PRIs
+// it wants straight out of that half and never touches a copy the capture path made. It has until
+// the DMA writer comes back to the half, a block time later; a PRI is only used if the half was
+// still the latest one announced and the writer still in the other half once it has been read.
+//
+// The thread runs at nice QUICKLOOK_NICE, SCHED_IDLE where there is one, so the drain and writer
+// threads always preempt it and it takes nothing from them but memory bandwidth. Its own CPU time
+// is measured, once it has used more than cpu_budget of one core and QUICKLOOK_BURST_MS on top it
+// sleeps and passes over the PRIs announced meanwhile.
+typedef struct Quicklook_S
+{
+  int decimation;
+  int channel;                      // 0 A, 1 B
+  double cpu_budget;                // fraction of one core
+
+  Channel *channel_source;          // its dma and sts mappings, made by the record thread
+  int n_samples;
+  int bytes_per_pri;
+  int stream_offset;                // [bytes] of the session's stream before block 0, set by the record thread
+  int n_fft;
+  int log2n;
+  float *window;                    // n_samples, scaled to dBFS
+  float *twiddle_re, *twiddle_im;   // every stage, n_fft - 1 of each
+  uint32_t *reverse;                // bit reversed index of every sample
+  float *re, *im;
+  float *power;
+  uint32_t *words;                  // one PRI copied out of the DMA half
+
+  volatile int64_t published;       // 2*block + half of the latest DMA half, -1 none
+  volatile int is_active;           // between quicklook_start() and quicklook_stop()
+  volatile int is_busy;             // the thread is looking at a block
+  volatile int is_running;
+  int64_t seen;                     // last block looked at
+  int64_t cpu_start_ns;             // thread CPU time at the first block of the session, -1 before
+  int64_t cpu_mark_ns, wall_mark_ns;  // start of the load window
+  int64_t last_cpu_ns, last_wall_ns;  // last budget check
+  int64_t credit_ns;                // CPU time the thread may still use
+  double snr_sum;
+  sem_t wake;
+
+  QuicklookImage *image;
+  pthread_t thread;
+} Quicklook;
+
+int init_quicklook(Quicklook *ql, int decimation, int channel, double cpu_budget);
+int quicklook_start(Quicklook *ql, Configuration *config, Channel *channel, double metres_per_hz, int session);
+void quicklook_block(Quicklook *ql, int64_t block, int offset);
+void quicklook_stop(Quicklook *ql);
+void quicklook_report(Quicklook *ql, FILE *f);
+void *quicklook_worker(void *arg);
+void dinit_quicklook(Quicklook *ql);
+
+#endif  // QUICKLOOK_H
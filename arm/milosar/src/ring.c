@@ -0,0 +1,186 @@
+#include "ring.h"
+#include "utils.h"
+#include "telemetry.h"
+#include "trace.h"
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include "colour.h"
+
+int init_ring(Ring *ring, Configuration *config, Storage *storage, Transfer *transfer)
+{
+  double blocks_per_second = (double)config->n_buffers/config->n_seconds;
+  int max_slots = (int)(config->pretrigger_max_mb * S1MB / S2MB);
+
+  ring->slot_size = S2MB;
+  ring->window_slots = (int)ceil(config->pretrigger_seconds * blocks_per_second);
+  ring->post_slots = config->n_buffers;
+
+  //whatever memory the window does not need is headroom for the commit thread, up to the window again
+  ring->n_slots = 2*ring->window_slots + RING_MIN_HEADROOM;
+  if (ring->n_slots > max_slots)
+    ring->n_slots = max_slots;
+
+  if (ring->n_slots < RING_MIN_HEADROOM + 1)
+  {
+    cprint("[!!] ", BRIGHT, RED);
+    printf("pretrigger_max_mb must allow at least %d MB\n", 2*(RING_MIN_HEADROOM + 1));
+    return FAIL;
+  }
+
+  if (ring->window_slots > ring->n_slots - RING_MIN_HEADROOM)
+  {
+    ring->window_slots = ring->n_slots - RING_MIN_HEADROOM;
+    cprint("[!!] ", BRIGHT, YELLOW);
+    printf("Pre-trigger window limited to %.1f [s] by pretrigger_max_mb\n", ring->window_slots/blocks_per_second);
+  }
+
+  ring->halves = malloc(ring->n_slots * sizeof(int64_t));
+  if (!(ring->slots = malloc((size_t)ring->n_slots * ring->slot_size)) || ring->halves == NULL)
+  {
+    fprintf(stderr, "no memory for pre-trigger ring\n");
+    free(ring->slots);
+    free(ring->halves);
+    return FAIL;
+  }
+
+  //touch and pin every page now, a page fault in the drain path costs more than the copy
+  memset(ring->slots, 0, (size_t)ring->n_slots * ring->slot_size);
+  mlock(ring->slots, (size_t)ring->n_slots * ring->slot_size);
+
+  ring->head = 0;
+  ring->tail = 0;
+  ring->commit_start = 0;
+  ring->first_half = 0;
+  ring->commit_end = 0;
+  ring->next_half = 0;
+  ring->is_triggered = false;
+  ring->is_committing = false;
+  ring->is_draining = true;
+  ring->n_overruns = 0;
+  ring->n_filled = 0;
+  ring->pretrigger_blocks = 0;
+  ring->storage = storage;
+  ring->transfer = transfer;
+
+  return OK;
+}
+
+// Called from the trigger button poll or a SIGUSR1 handler, so only flags may be touched here.
+void ring_trigger(Ring *ring)
+{
+  if (ring->is_triggered)
+    return;
+
+  clock_gettime(CLOCK_REALTIME, &ring->trigger_time);
+  ring->is_triggered = true;
+}
+
+// Returns the slot the drain thread should copy half of the session's stream into, or NULL if
+// the commit thread has fallen a full ring behind and the block has to be dropped.
+uint8_t *ring_claim(Ring *ring, int64_t half)
+{
+  int64_t head = ring->head;
+
+  //nothing is dropped before the trigger, so the window is every slot back from head
+  if (ring->is_triggered && !ring->is_committing)
+  {
+    int64_t start = head - ring->window_slots;
+
+    ring->commit_start = start > 0 ? start : 0;
+    ring->first_half = head > 0 ? ring->halves[ring->commit_start % ring->n_slots] : half;
+    ring->commit_end = half + ring->post_slots;
+    ring->pretrigger_blocks = head - ring->commit_start;
+    ring->tail = ring->commit_start;
+    __atomic_store_n(&ring->is_committing, true, __ATOMIC_RELEASE);
+  }
+
+  ring->next_half = half + 1;
+  if (ring->is_committing && head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->n_slots)
+  {
+    ring->n_overruns++;
+    return NULL;
+  }
+
+  ring->halves[head % ring->n_slots] = half;
+  return ring->slots + (size_t)(head % ring->n_slots) * ring->slot_size;
+}
+
+void ring_publish(Ring *ring)
+{
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+int ring_is_complete(Ring *ring)
+{
+  return ring->is_committing && ring->next_half >= ring->commit_end;
+}
+
+void *ring_worker(void *arg)
+{
+  Ring *ring = (Ring *)arg;
+
+  //exit_handler() waits for the capture to wind down, it must never run on this thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TRACE_THREAD("ring");
+
+  uint8_t *zeros = NULL;
+  int64_t committed = 0;
+
+  while (!__atomic_load_n(&ring->is_committing, __ATOMIC_ACQUIRE))
+  {
+    if (!ring->is_draining)
+      return NULL;
+    usleep(1000);
+  }
+
+  while (true)
+  {
+    int64_t tail = ring->tail;
+
+    if (tail < __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+    {
+      //halves the drain dropped keep their place in the file
+      int64_t half = ring->halves[tail % ring->n_slots];
+      int status = OK;
+      if (half > ring->first_half + committed && zeros == NULL && (zeros = calloc(1, ring->slot_size)) == NULL)
+        status = FAIL;
+      for (; status == OK && ring->first_half + committed < half; committed++, ring->n_filled++)
+        status = storage_write(ring->storage, zeros, ring->slot_size);
+
+      TRACE_BEGIN(TraceCommit, committed, 0);
+      if (status != OK || storage_write(ring->storage, ring->slots + (size_t)(tail % ring->n_slots) * ring->slot_size, ring->slot_size) != OK)
+      {
+        telemetry_add(&telemetry->write_errors, 1);
+        break;
+      }
+
+      __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+      committed++;
+      telemetry_cpu(TeleRing);
+      TRACE_END(TraceCommit, committed - 1, 0);
+
+      if (ring->transfer != NULL)
+        transfer_block_ready(ring->transfer, committed);
+    }
+    else if (!ring->is_draining)
+      break;
+    else
+      usleep(1000);
+  }
+
+  free(zeros);
+  return NULL;
+}
+
+void dinit_ring(Ring *ring)
+{
+  munlock(ring->slots, (size_t)ring->n_slots * ring->slot_size);
+  free(ring->slots);
+  free(ring->halves);
+  ring->slots = NULL;
+  ring->halves = NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef RING_H
+#define RING_H
+
+#include "constants.h"
+#include "storage.h"
+#include "transfer.h"
+
+#define RING_MIN_HEADROOM   4   // slots kept free of pre-trigger data for commit latency
+
+// Pre-trigger ring of S2MB blocks between the DMA drain and the storage writer.
+//
+// Until the trigger only the drain thread touches the ring and it keeps the last window_slots
+// blocks. Once triggered the drain thread fixes the commit start and hands the tail to the
+// commit thread, after which the drain thread only advances head and the commit thread only
+// advances tail. A full ring never blocks the drain; the block is dropped and counted instead.
+// Every slot keeps the half of the session's stream it holds, the commit thread writes a block of
+// zeros for every half dropped, so the committed file is the stream from first_half without gaps.
+typedef struct Ring_S
+{
+  uint8_t *slots;
+  int64_t *halves;                  // per slot, half of the session's stream it holds
+  int n_slots;
+  int slot_size;
+  int window_slots;                 // blocks of pre-trigger history kept
+  int post_slots;                   // blocks committed after the trigger
+
+  volatile int64_t head;            // blocks drained into the ring
+  volatile int64_t tail;            // blocks committed to storage
+  int64_t commit_start;             // first slot sequence committed
+  int64_t first_half;               // half of the session's stream in it, block 0 of the file
+  int64_t commit_end;               // half at which the capture is complete
+  volatile int64_t next_half;       // after the last half claimed or dropped
+
+  volatile int is_triggered;        // set by the trigger source, async-signal-safe
+  volatile int is_committing;       // commit start fixed, tail owned by the commit thread
+  volatile int is_draining;         // cleared once the drain thread has stopped
+  int n_overruns;                   // blocks dropped because the ring was full
+  int n_filled;                     // blocks of zeros committed in their place
+  int pretrigger_blocks;            // pre-trigger blocks actually committed
+  struct timespec trigger_time;     // CLOCK_REALTIME of the trigger
+
+  Storage *storage;
+  Transfer *transfer;               // optional streaming offload
+  pthread_t thread;
+} Ring;
+
+int init_ring(Ring *ring, Configuration *config, Storage *storage, Transfer *transfer);
+void ring_trigger(Ring *ring);
+uint8_t *ring_claim(Ring *ring, int64_t half);
+void ring_publish(Ring *ring);
+int ring_is_complete(Ring *ring);
+void *ring_worker(void *arg);
+void dinit_ring(Ring *ring);
+
+#endif  // RING_H
@@ -0,0 +1,616 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "storage.h"
+#include "utils.h"
+#include "telemetry.h"
+#include "trace.h"
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/statvfs.h>
+#include "colour.h"
+
+typedef char segment_header_size_check[(sizeof(SegmentHeader) == SEGMENT_HEADER_SIZE) ? 1 : -1];
+
+static int open_segment(Storage *storage);
+static int complete_segment(Storage *storage, int index);
+static int payload_crc(Storage *storage, int fd, uint64_t bytes, uint32_t *crc);
+static int write_manifest(Storage *storage);
+static void enforce_retention(Storage *storage);
+static int64_t free_bytes(const char *dir);
+static void segment_path(Storage *storage, int index, int is_part, char *path, size_t path_len);
+static int sync_dir(const char *dir);
+static int64_t realtime_ns(void);
+
+int init_storage(Storage *storage, Configuration *config)
+{
+  storage->mode = config->segment_mode;
+  storage->block_size = S2MB;
+  storage->segment_blocks = (int)ceil(config->segment_mb * S1MB / (double)S2MB);
+  storage->segment_seconds = config->segment_seconds;
+  storage->dir = config->experiment_dir;
+  storage->name = config->time_stamp;
+  storage->n_blocks = 0;
+  storage->fd = -1;
+  storage->is_closing = false;
+  storage->is_rolling = config->is_continuous;
+  storage->retention_bytes = (int64_t)(config->retention_mb * S1MB);
+  storage->retention_seconds = config->retention_minutes * 60.0;
+  storage->min_free_bytes = (int64_t)(config->min_free_mb * S1MB);
+  storage->retained_bytes = 0;
+  storage->first_retained = 0;
+  storage->n_deleted = 0;
+  storage->is_full = false;
+
+  //a continuous capture is only bounded by the card, so it always rotates
+  if (storage->is_rolling && storage->mode == SEGMENT_OFF)
+    storage->mode = SEGMENT_SIZE;
+
+  if (storage->segment_blocks < 1)
+    storage->segment_blocks = 1;
+
+  storage->n_segments = 0;
+  storage->max_segments = 64;
+  storage->segments = malloc(storage->max_segments * sizeof(Segment));
+  pthread_mutex_init(&storage->lock, NULL);
+  pthread_cond_init(&storage->wake, NULL);
+
+  storage->stripe = NULL;
+
+  //striped captures write one file per device and leave rotation and retention to the devices
+  if (config->stripe_dirs != NULL && strchr(config->stripe_dirs, ',') != NULL)
+  {
+    if (storage->mode != SEGMENT_OFF || storage->is_rolling)
+    {
+      cprint("[!!] ", BRIGHT, YELLOW);
+      printf("Segments and retention are not available on striped storage, disabling them\n");
+    }
+
+    storage->mode = SEGMENT_OFF;
+    storage->is_rolling = false;
+    storage->stripe = malloc(sizeof(Stripe));
+    return init_stripe(storage->stripe, config);
+  }
+
+  if (storage->mode == SEGMENT_OFF)
+  {
+    char path[256];
+    segment_path(storage, 0, false, path, sizeof(path));
+    storage->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return storage->fd < 0 ? FAIL : OK;
+  }
+
+  pthread_create(&storage->thread, NULL, *storage_worker, (void *)storage);
+
+  return open_segment(storage);
+}
+
+int storage_write(Storage *storage, const void *buf, size_t len)
+{
+  if (storage->stripe != NULL)
+  {
+    if (stripe_write(storage->stripe, buf, len) != OK)
+      return FAIL;
+
+    pthread_mutex_lock(&storage->lock);
+    storage->n_blocks++;
+    pthread_mutex_unlock(&storage->lock);
+    return OK;
+  }
+
+  int fd = storage->mode == SEGMENT_OFF ? storage->fd : storage->segments[storage->n_segments - 1].fd;
+  const uint8_t *p = buf;
+  size_t remaining = len;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (remaining > 0)
+  {
+    ssize_t n = write(fd, p, remaining);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FAIL;
+    p += n;
+    remaining -= n;
+  }
+
+  telemetry_sample_since(&telemetry->disk, &start);
+
+  if (storage->mode == SEGMENT_OFF)
+  {
+    pthread_mutex_lock(&storage->lock);
+    storage->n_blocks++;
+    pthread_mutex_unlock(&storage->lock);
+    return OK;
+  }
+
+  Segment *segment = &storage->segments[storage->n_segments - 1];
+
+  pthread_mutex_lock(&storage->lock);
+  storage->n_blocks++;
+  segment->header.n_blocks++;
+  segment->header.bytes += len;
+  pthread_mutex_unlock(&storage->lock);
+
+  //rotate at block boundaries only, so blocks never straddle two segments
+  int is_full = false;
+
+  if (storage->mode == SEGMENT_SIZE)
+    is_full = segment->header.n_blocks >= storage->segment_blocks;
+  else
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    is_full = (now.tv_sec - storage->opened.tv_sec) + (now.tv_nsec - storage->opened.tv_nsec)*1e-9 >= storage->segment_seconds;
+  }
+
+  if (is_full)
+  {
+    //hand the full segment to the storage worker and carry on in a fresh one
+    pthread_mutex_lock(&storage->lock);
+    segment->state = Closing;
+    pthread_cond_signal(&storage->wake);
+    pthread_mutex_unlock(&storage->lock);
+
+    return open_segment(storage);
+  }
+
+  return OK;
+}
+
+// A striped capture takes blocks without a copy: the record thread fills the slot it claims and
+// publishes it. NULL if the capture is not striped or every device has failed.
+uint8_t *storage_claim(Storage *storage)
+{
+  return storage->stripe != NULL ? stripe_claim(storage->stripe) : NULL;
+}
+
+int storage_publish(Storage *storage)
+{
+  if (storage->stripe == NULL || storage->stripe->claimed == NULL)
+    return FAIL;
+
+  stripe_publish(storage->stripe);
+
+  pthread_mutex_lock(&storage->lock);
+  storage->n_blocks++;
+  pthread_mutex_unlock(&storage->lock);
+  return OK;
+}
+
+int storage_close(Storage *storage)
+{
+  if (storage->stripe != NULL)
+    return stripe_close(storage->stripe);
+
+  if (storage->mode == SEGMENT_OFF)
+  {
+    if (storage->fd < 0)
+      return OK;
+
+    int status = fdatasync(storage->fd) == 0 ? OK : FAIL;
+    close(storage->fd);
+    storage->fd = -1;
+    return status;
+  }
+
+  if (storage->is_closing)
+    return OK;
+
+  pthread_mutex_lock(&storage->lock);
+
+  Segment *segment = storage->n_segments > 0 ? &storage->segments[storage->n_segments - 1] : NULL;
+  if (segment != NULL && segment->state == Open)
+  {
+    //an empty trailing segment is only left behind by a rotation on the last block
+    if (segment->header.n_blocks == 0)
+    {
+      char path[256];
+      segment_path(storage, segment->header.index, true, path, sizeof(path));
+      close(segment->fd);
+      unlink(path);
+      storage->n_segments--;
+    }
+    else
+      segment->state = Closing;
+  }
+
+  storage->is_closing = true;
+  pthread_cond_signal(&storage->wake);
+  pthread_mutex_unlock(&storage->lock);
+
+  pthread_join(storage->thread, NULL);
+
+  int status = OK;
+  for (int i = 0; i < storage->n_segments; i++)
+    if (storage->segments[i].state != Complete && storage->segments[i].state != Deleted)
+      status = FAIL;
+
+  return status;
+}
+
+// Find the file and byte offset holding a capture block, for readers such as the streaming
+// offload. Returns FAIL if the block has not been written yet and STORAGE_EXPIRED if the
+// retention policy has already deleted it.
+int storage_locate(Storage *storage, int block, char *path, size_t path_len, off_t *offset)
+{
+  int status = FAIL;
+
+  if (storage->stripe != NULL)
+    return stripe_locate(storage->stripe, block, path, path_len, offset);
+
+  pthread_mutex_lock(&storage->lock);
+
+  if (storage->mode == SEGMENT_OFF)
+  {
+    if (block < storage->n_blocks)
+    {
+      segment_path(storage, 0, false, path, path_len);
+      *offset = (off_t)block * storage->block_size;
+      status = OK;
+    }
+  }
+  else if (storage->first_retained > 0 && block < (int)storage->segments[storage->first_retained].header.first_block)
+    status = STORAGE_EXPIRED;
+  else
+  {
+    for (int i = storage->first_retained; i < storage->n_segments; i++)
+    {
+      SegmentHeader *header = &storage->segments[i].header;
+      if (block >= (int)header->first_block && block < (int)(header->first_block + header->n_blocks))
+      {
+        segment_path(storage, i, storage->segments[i].state != Complete, path, path_len);
+        *offset = SEGMENT_HEADER_SIZE + (off_t)(block - header->first_block) * storage->block_size;
+        status = OK;
+        break;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&storage->lock);
+  return status;
+}
+
+// Blocks still on disk, i.e. written and not yet deleted by the retention policy.
+int storage_retained_blocks(Storage *storage)
+{
+  pthread_mutex_lock(&storage->lock);
+
+  int first_block = 0;
+  if (storage->mode != SEGMENT_OFF && storage->first_retained < storage->n_segments)
+    first_block = storage->segments[storage->first_retained].header.first_block;
+  int n_retained = storage->n_blocks - first_block;
+
+  pthread_mutex_unlock(&storage->lock);
+  return n_retained;
+}
+
+// Completes segments in order: flush, final header, rename into place and manifest update.
+// In a continuous capture it also applies the retention policy and watches the free space.
+// None of this may run on the record thread, a slow card would overrun the DMA buffer.
+void *storage_worker(void *arg)
+{
+  Storage *storage = (Storage *)arg;
+  int next = 0;
+
+  //exit_handler() waits for the capture to wind down, it must never run on this thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TRACE_THREAD("storage");
+
+  pthread_mutex_lock(&storage->lock);
+
+  while (true)
+  {
+    if (next < storage->n_segments && storage->segments[next].state == Closing)
+    {
+      pthread_mutex_unlock(&storage->lock);
+      TRACE_BEGIN(TraceSegmentComplete, next, 0);
+      complete_segment(storage, next);
+      TRACE_END(TraceSegmentComplete, next, 0);
+      next++;
+      enforce_retention(storage);
+      telemetry_cpu(TeleStorage);
+      pthread_mutex_lock(&storage->lock);
+    }
+    else if (storage->is_closing && (next >= storage->n_segments || storage->segments[next].state != Closing))
+      break;
+    else
+    {
+      //wake up regularly, the card can fill up between two segments
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += STORAGE_POLL_S;
+
+      if (pthread_cond_timedwait(&storage->wake, &storage->lock, &deadline) == ETIMEDOUT)
+      {
+        pthread_mutex_unlock(&storage->lock);
+        enforce_retention(storage);
+        pthread_mutex_lock(&storage->lock);
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&storage->lock);
+  return NULL;
+}
+
+void dinit_storage(Storage *storage)
+{
+  storage_close(storage);
+
+  if (storage->stripe != NULL)
+  {
+    dinit_stripe(storage->stripe);
+    free(storage->stripe);
+    storage->stripe = NULL;
+  }
+
+  pthread_cond_destroy(&storage->wake);
+  pthread_mutex_destroy(&storage->lock);
+  free(storage->segments);
+  storage->segments = NULL;
+}
+
+static int open_segment(Storage *storage)
+{
+  char path[256];
+  int index = storage->n_segments;
+
+  segment_path(storage, index, true, path, sizeof(path));
+
+  //read back by the storage worker for the payload checksum
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    cprint("[!!] ", BRIGHT, RED);
+    printf("Could not open segment %s\n", path);
+    return FAIL;
+  }
+
+  SegmentHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SEGMENT_MAGIC;
+  header.version = SEGMENT_VERSION;
+  header.header_size = SEGMENT_HEADER_SIZE;
+  header.index = index;
+  header.first_block = storage->n_blocks;
+  header.block_size = storage->block_size;
+  header.open_time_ns = realtime_ns();
+  header.header_crc = crc32(0, &header, offsetof(SegmentHeader, header_crc));
+
+  if (write(fd, &header, SEGMENT_HEADER_SIZE) != SEGMENT_HEADER_SIZE)
+  {
+    close(fd);
+    return FAIL;
+  }
+
+  pthread_mutex_lock(&storage->lock);
+
+  if (storage->n_segments == storage->max_segments)
+  {
+    storage->max_segments *= 2;
+    storage->segments = realloc(storage->segments, storage->max_segments * sizeof(Segment));
+  }
+
+  Segment *segment = &storage->segments[storage->n_segments++];
+  segment->state = Open;
+  segment->fd = fd;
+  segment->header = header;
+
+  pthread_mutex_unlock(&storage->lock);
+
+  clock_gettime(CLOCK_MONOTONIC, &storage->opened);
+  return OK;
+}
+
+static int complete_segment(Storage *storage, int index)
+{
+  char part[256], path[256];
+
+  segment_path(storage, index, true, part, sizeof(part));
+  segment_path(storage, index, false, path, sizeof(path));
+
+  //the record thread no longer touches a closing segment, take a private copy
+  pthread_mutex_lock(&storage->lock);
+  int fd = storage->segments[index].fd;
+  SegmentHeader header = storage->segments[index].header;
+  pthread_mutex_unlock(&storage->lock);
+
+  header.complete = 1;
+  header.close_time_ns = realtime_ns();
+
+  //the payload is still in the page cache, checksumming it here keeps it off the record thread
+  int status = payload_crc(storage, fd, header.bytes, &header.crc);
+  header.header_crc = crc32(0, &header, offsetof(SegmentHeader, header_crc));
+
+  //the header only claims completeness once the payload is on the card
+  status = status == OK && fdatasync(fd) == 0 &&
+           pwrite(fd, &header, SEGMENT_HEADER_SIZE, 0) == SEGMENT_HEADER_SIZE &&
+           fdatasync(fd) == 0 ? OK : FAIL;
+  close(fd);
+
+  pthread_mutex_lock(&storage->lock);
+
+  if (status == OK && rename(part, path) != 0)
+    status = FAIL;
+
+  storage->segments[index].fd = -1;
+  storage->segments[index].header = header;
+  storage->segments[index].state = status == OK ? Complete : Failed;
+  if (status == OK)
+    storage->retained_bytes += header.bytes;
+
+  pthread_mutex_unlock(&storage->lock);
+
+  if (status != OK)
+  {
+    cprint("[!!] ", BRIGHT, RED);
+    printf("Could not complete segment %s\n", part);
+    return FAIL;
+  }
+
+  return write_manifest(storage);
+}
+
+// crc32 of the payload following the segment header, read back block by block.
+static int payload_crc(Storage *storage, int fd, uint64_t bytes, uint32_t *crc)
+{
+  uint8_t *buf = malloc(storage->block_size);
+  if (buf == NULL)
+    return FAIL;
+
+  off_t offset = SEGMENT_HEADER_SIZE;
+  *crc = 0;
+
+  while (bytes > 0)
+  {
+    size_t len = bytes < (uint64_t)storage->block_size ? (size_t)bytes : (size_t)storage->block_size;
+    ssize_t n = pread(fd, buf, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    *crc = crc32(*crc, buf, n);
+    offset += n;
+    bytes -= n;
+  }
+
+  free(buf);
+  return bytes == 0 ? OK : FAIL;
+}
+
+// Deletes the oldest completed segments while the capture exceeds the retention budget or the
+// card runs low on space. The open segment is never touched, so if space runs out with nothing
+// left to delete the capture is stopped instead.
+static void enforce_retention(Storage *storage)
+{
+  int64_t free_space = storage->min_free_bytes > 0 ? free_bytes(storage->dir) : INT64_MAX;
+  int is_changed = false;
+
+  while (true)
+  {
+    char path[256];
+    int is_low = free_space < storage->min_free_bytes;
+
+    pthread_mutex_lock(&storage->lock);
+
+    int index = storage->first_retained;
+    Segment *oldest = &storage->segments[index];
+    int is_deletable = storage->is_rolling && index < storage->n_segments && (oldest->state == Complete || oldest->state == Failed);
+    int is_exhausted = !storage->is_rolling || index >= storage->n_segments - 1;
+
+    int is_over = is_deletable && (is_low ||
+                  (storage->retention_bytes > 0 && storage->retained_bytes > storage->retention_bytes) ||
+                  (storage->retention_seconds > 0 && (realtime_ns() - oldest->header.close_time_ns)*1e-9 > storage->retention_seconds));
+
+    if (!is_over)
+    {
+      pthread_mutex_unlock(&storage->lock);
+
+      if (is_low && is_exhausted && !storage->is_full)
+      {
+        storage->is_full = true;
+        cprint("[!!] ", BRIGHT, RED);
+        printf("Storage below %lld MB free, stopping capture\n", (long long)(storage->min_free_bytes / S1MB));
+      }
+      break;
+    }
+
+    //readers resolve blocks under the lock, once first_retained moves on nobody opens this file
+    segment_path(storage, index, oldest->state == Failed, path, sizeof(path));
+    if (oldest->state == Complete)
+      storage->retained_bytes -= oldest->header.bytes;
+    oldest->state = Deleted;
+    storage->first_retained++;
+    storage->n_deleted++;
+
+    pthread_mutex_unlock(&storage->lock);
+
+    unlink(path);
+    TRACE_INSTANT(TraceSegmentDeleted, index, 0);
+    is_changed = true;
+
+    if (is_low)
+      free_space = free_bytes(storage->dir);
+  }
+
+  if (is_changed)
+    write_manifest(storage);
+}
+
+static int64_t free_bytes(const char *dir)
+{
+  struct statvfs fs;
+
+  if (statvfs(dir, &fs) != 0)
+    return INT64_MAX;
+
+  return (int64_t)fs.f_bavail * fs.f_frsize;
+}
+
+// The manifest is rewritten in full and renamed into place, so it always lists exactly the
+// segments that have been completed and not yet deleted, even across a power loss.
+static int write_manifest(Storage *storage)
+{
+  char path[256], tmp[256];
+  sprintf(path, "%s%s", storage->dir, MANIFEST_FILE);
+  sprintf(tmp, "%s.tmp", path);
+
+  FILE *f = fopen(tmp, "w");
+  if (f == NULL)
+    return FAIL;
+
+  fprintf(f, "# index first_block n_blocks bytes crc32 file\n");
+
+  pthread_mutex_lock(&storage->lock);
+  for (int i = 0; i < storage->n_segments; i++)
+  {
+    if (storage->segments[i].state != Complete)
+      continue;
+
+    SegmentHeader *header = &storage->segments[i].header;
+    char name[256];
+    segment_path(storage, i, false, name, sizeof(name));
+    fprintf(f, "%u %u %u %llu %08X %s\n", header->index, header->first_block, header->n_blocks,
+            (unsigned long long)header->bytes, header->crc, strrchr(name, '/') + 1);
+  }
+  pthread_mutex_unlock(&storage->lock);
+
+  fflush(f);
+  fdatasync(fileno(f));
+  fclose(f);
+
+  if (rename(tmp, path) != 0)
+    return FAIL;
+
+  return sync_dir(storage->dir);
+}
+
+static void segment_path(Storage *storage, int index, int is_part, char *path, size_t path_len)
+{
+  if (storage->mode == SEGMENT_OFF)
+    snprintf(path, path_len, "%s%s.bin", storage->dir, storage->name);
+  else
+    snprintf(path, path_len, "%s%s_%04d.bin%s", storage->dir, storage->name, index, is_part ? ".part" : "");
+}
+
+static int sync_dir(const char *dir)
+{
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return FAIL;
+
+  int status = fsync(fd) == 0 ? OK : FAIL;
+  close(fd);
+  return status;
+}
+
+static int64_t realtime_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
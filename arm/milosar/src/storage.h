@@ -0,0 +1,94 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <sys/types.h>
+#include "constants.h"
+#include "stripe.h"
+
+#define SEGMENT_OFF         0   // single <time_stamp>.bin, raw data only
+#define SEGMENT_SIZE        1   // rotate after segment_mb
+#define SEGMENT_DURATION    2   // rotate after segment_seconds
+
+#define SEGMENT_MAGIC       0x4753454D  // "MESG" little endian
+#define SEGMENT_VERSION     1
+#define SEGMENT_HEADER_SIZE 64
+#define MANIFEST_FILE       "manifest.txt"
+
+#define STORAGE_EXPIRED     1   // storage_locate(): block was deleted by the retention policy
+#define STORAGE_POLL_S      1   // period of the free space check
+
+// Every segment starts with this header (little endian, as written by the ARM core). It is
+// written with complete = 0 when the segment is opened and rewritten with the final block count
+// and payload checksum just before the segment is renamed from .part to .bin.
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t index;           // segment number within the capture
+  uint32_t first_block;     // capture block index of the first block in this segment
+  uint32_t n_blocks;
+  uint32_t block_size;
+  uint64_t bytes;           // payload bytes following the header
+  uint32_t crc;             // crc32 of the payload
+  uint32_t complete;
+  int64_t open_time_ns;     // CLOCK_REALTIME
+  int64_t close_time_ns;
+  uint32_t header_crc;      // crc32 of the preceding header bytes
+  uint8_t reserved[4];
+} SegmentHeader;
+
+enum SegmentState {Open = 0, Closing = 1, Complete = 2, Failed = 3, Deleted = 4};
+
+typedef struct
+{
+  enum SegmentState state;
+  int fd;
+  SegmentHeader header;
+} Segment;
+
+typedef struct Storage_S
+{
+  int mode;
+  int segment_blocks;             // rotation size for SEGMENT_SIZE
+  double segment_seconds;         // rotation period for SEGMENT_DURATION
+  int block_size;
+  char *dir;                      // experiment directory, with trailing '/'
+  char *name;                     // capture time stamp
+
+  int fd;                         // output file of SEGMENT_OFF
+  struct timespec opened;         // CLOCK_MONOTONIC time the open segment was started
+  int n_blocks;                   // blocks written over all segments
+
+  Segment *segments;              // every segment of the capture, the last one is open
+  int n_segments;
+  int max_segments;
+  int is_closing;                 // no more segments will be handed to the worker
+
+  int is_rolling;                 // continuous capture, oldest segments may be deleted
+  int64_t retention_bytes;        // completed segments kept on disk, 0 = unlimited
+  double retention_seconds;       // age of the oldest segment kept, 0 = unlimited
+  int64_t min_free_bytes;         // free space kept on the storage partition
+  int64_t retained_bytes;         // payload of the completed segments still on disk
+  int first_retained;             // oldest segment not deleted by the retention policy
+  int n_deleted;
+  volatile int is_full;           // out of space with nothing left to delete, stop the capture
+
+  Stripe *stripe;                 // blocks striped over several devices instead, NULL otherwise
+
+  pthread_mutex_t lock;           // guards the segment list for the worker and readers
+  pthread_cond_t wake;
+  pthread_t thread;               // completes closed segments off the record thread
+} Storage;
+
+int init_storage(Storage *storage, Configuration *config);
+int storage_write(Storage *storage, const void *buf, size_t len);
+uint8_t *storage_claim(Storage *storage);
+int storage_publish(Storage *storage);
+int storage_close(Storage *storage);
+int storage_locate(Storage *storage, int block, char *path, size_t path_len, off_t *offset);
+int storage_retained_blocks(Storage *storage);
+void *storage_worker(void *arg);
+void dinit_storage(Storage *storage);
+
+#endif  // STORAGE_H
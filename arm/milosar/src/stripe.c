@@ -0,0 +1,466 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "stripe.h"
+#include "utils.h"
+#include "telemetry.h"
+#include "trace.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "colour.h"
+
+static int split_list(const char *list, char items[][STRIPE_DIR_LEN], int max_items);
+static int write_block(StripeDevice *device, const uint8_t *buf, size_t len);
+static int write_manifest(Stripe *stripe);
+static double seconds_since(struct timespec *start);
+
+int init_stripe(Stripe *stripe, Configuration *config)
+{
+  char dirs[STRIPE_MAX_DEVICES][STRIPE_DIR_LEN];
+  char throttles[STRIPE_MAX_DEVICES][STRIPE_DIR_LEN];
+  int n_throttles = config->stripe_throttle ? split_list(config->stripe_throttle, throttles, STRIPE_MAX_DEVICES) : 0;
+
+  stripe->n_devices = split_list(config->stripe_dirs, dirs, STRIPE_MAX_DEVICES);
+  stripe->depth = config->stripe_depth > 0 ? config->stripe_depth : 1;
+  stripe->block_size = S2MB;
+  stripe->dir = config->experiment_dir;
+  stripe->name = config->time_stamp;
+  stripe->next = 0;
+  stripe->claimed = NULL;
+  stripe->n_blocks = 0;
+  stripe->n_redirected = 0;
+  stripe->n_stalls = 0;
+  stripe->is_closing = false;
+  stripe->max_blocks = 1024;
+  stripe->placement = malloc(stripe->max_blocks * sizeof(Placement));
+
+  pthread_mutex_init(&stripe->lock, NULL);
+  pthread_cond_init(&stripe->space, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &stripe->opened);
+
+  for (int i = 0; i < stripe->n_devices; i++)
+  {
+    StripeDevice *device = &stripe->devices[i];
+
+    snprintf(device->dir, sizeof(device->dir), "%s/%s/", dirs[i], config->time_stamp);
+    snprintf(device->path, sizeof(device->path), "%s/%s/%s_d%d.bin", dirs[i], config->time_stamp, config->time_stamp, i);
+    mkdir(device->dir, 0755);
+
+    device->fd = open(device->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    device->slots = malloc((size_t)stripe->depth * stripe->block_size);
+    device->queued = malloc(stripe->depth * sizeof(int));
+    device->head = 0;
+    device->tail = 0;
+    device->bytes = 0;
+    device->busy_seconds = 0;
+    device->throttle = i < n_throttles ? atof(throttles[i]) * S1MB : 0;
+    device->is_failed = false;
+    device->stripe = stripe;
+    pthread_cond_init(&device->wake, NULL);
+
+    if (device->fd < 0 || device->slots == NULL || device->queued == NULL)
+    {
+      cprint("[!!] ", BRIGHT, RED);
+      printf("Could not open stripe device %s\n", device->path);
+      device->is_failed = true;
+      continue;
+    }
+
+    //the queue memory is written by the record thread, fault it in before the capture
+    memset(device->slots, 0, (size_t)stripe->depth * stripe->block_size);
+    mlock(device->slots, (size_t)stripe->depth * stripe->block_size);
+
+    pthread_create(&device->thread, NULL, *stripe_worker, (void *)device);
+  }
+
+  for (int i = 0; i < stripe->n_devices; i++)
+    if (!stripe->devices[i].is_failed)
+      return OK;
+
+  return FAIL;
+}
+
+// Queue slot for the next block, the caller fills it and hands it on with stripe_publish(). NULL
+// once every device has failed.
+uint8_t *stripe_claim(Stripe *stripe)
+{
+  StripeDevice *device = NULL;
+
+  pthread_mutex_lock(&stripe->lock);
+
+  while (device == NULL)
+  {
+    int n_failed = 0;
+
+    //round-robin, but never wait on a device while another one has room
+    for (int i = 0; i < stripe->n_devices && device == NULL; i++)
+    {
+      StripeDevice *candidate = &stripe->devices[(stripe->next + i) % stripe->n_devices];
+
+      if (candidate->is_failed)
+        n_failed++;
+      else if (candidate->head - candidate->tail < stripe->depth)
+      {
+        device = candidate;
+        if (i > 0)
+          stripe->n_redirected++;
+      }
+    }
+
+    if (n_failed == stripe->n_devices)
+    {
+      pthread_mutex_unlock(&stripe->lock);
+      return NULL;
+    }
+
+    if (device == NULL)
+    {
+      stripe->n_stalls++;
+      telemetry_add(&telemetry->stalls, 1);
+      pthread_cond_wait(&stripe->space, &stripe->lock);
+    }
+  }
+
+  if (stripe->n_blocks == stripe->max_blocks)
+  {
+    stripe->max_blocks *= 2;
+    stripe->placement = realloc(stripe->placement, stripe->max_blocks * sizeof(Placement));
+  }
+
+  int block = stripe->n_blocks++;
+  int slot = device->head % stripe->depth;
+  Placement *placement = &stripe->placement[block];
+
+  placement->device = device - stripe->devices;
+  placement->index = device->head;
+  placement->is_written = false;
+  stripe->next = (placement->device + 1) % stripe->n_devices;
+  stripe->claimed = device;
+  stripe->claimed_block = block;
+
+  pthread_mutex_unlock(&stripe->lock);
+
+  //the slot is ours until head moves on, filling it does not need the lock
+  return device->slots + (size_t)slot * stripe->block_size;
+}
+
+// Queue the block claimed last for its device's writer.
+void stripe_publish(Stripe *stripe)
+{
+  StripeDevice *device = stripe->claimed;
+
+  pthread_mutex_lock(&stripe->lock);
+  device->queued[device->head % stripe->depth] = stripe->claimed_block;
+  device->head++;
+  stripe->claimed = NULL;
+  pthread_cond_signal(&device->wake);
+  pthread_mutex_unlock(&stripe->lock);
+}
+
+// Copying stripe_claim() and stripe_publish(), for blocks that already sit in another buffer.
+int stripe_write(Stripe *stripe, const void *buf, size_t len)
+{
+  uint8_t *slot = stripe_claim(stripe);
+  if (slot == NULL)
+    return FAIL;
+
+  memcpy(slot, buf, len);
+  stripe_publish(stripe);
+  return OK;
+}
+
+int stripe_close(Stripe *stripe)
+{
+  pthread_mutex_lock(&stripe->lock);
+
+  if (stripe->is_closing)
+  {
+    pthread_mutex_unlock(&stripe->lock);
+    return OK;
+  }
+
+  stripe->is_closing = true;
+  for (int i = 0; i < stripe->n_devices; i++)
+    pthread_cond_signal(&stripe->devices[i].wake);
+
+  pthread_mutex_unlock(&stripe->lock);
+
+  int status = OK;
+
+  for (int i = 0; i < stripe->n_devices; i++)
+  {
+    StripeDevice *device = &stripe->devices[i];
+
+    if (device->fd < 0)
+      continue;
+
+    if (device->slots != NULL && device->queued != NULL)
+      pthread_join(device->thread, NULL);
+
+    if (fdatasync(device->fd) != 0 || device->is_failed)
+      status = FAIL;
+    close(device->fd);
+    device->fd = -1;
+  }
+
+  for (int i = 0; i < stripe->n_blocks; i++)
+    if (!stripe->placement[i].is_written)
+      status = FAIL;
+
+  if (write_manifest(stripe) != OK)
+    status = FAIL;
+
+  stripe_report(stripe, stdout);
+
+  return status;
+}
+
+// Find the device file and byte offset of a capture block. Returns FAIL until the block is on disk.
+int stripe_locate(Stripe *stripe, int block, char *path, size_t path_len, off_t *offset)
+{
+  int status = FAIL;
+
+  pthread_mutex_lock(&stripe->lock);
+
+  if (block < stripe->n_blocks && stripe->placement[block].is_written)
+  {
+    Placement *placement = &stripe->placement[block];
+    snprintf(path, path_len, "%s", stripe->devices[placement->device].path);
+    *offset = (off_t)placement->index * stripe->block_size;
+    status = OK;
+  }
+
+  pthread_mutex_unlock(&stripe->lock);
+  return status;
+}
+
+// Per device share and throughput, as ini lines when f is the summary file.
+void stripe_report(Stripe *stripe, FILE *f)
+{
+  double elapsed = seconds_since(&stripe->opened);
+
+  for (int i = 0; i < stripe->n_devices; i++)
+  {
+    StripeDevice *device = &stripe->devices[i];
+    double mb = device->bytes / (double)S1MB;
+
+    if (f == stdout)
+    {
+      cprint(device->is_failed ? "[!!] " : "[OK] ", BRIGHT, device->is_failed ? RED : GREEN);
+      printf("Stripe %d %s: %.0f MB, %.2f MB/s write, %.2f MB/s average\n", i, device->dir, mb,
+             device->busy_seconds > 0 ? mb/device->busy_seconds : 0.0, elapsed > 0 ? mb/elapsed : 0.0);
+    }
+    else
+    {
+      fprintf(f, "device_%d          = %s\r\n", i, device->dir);
+      fprintf(f, "device_%d_blocks   = %lld\r\n", i, (long long)device->tail);
+      fprintf(f, "device_%d_rate     = %.3f\r\n", i, device->busy_seconds > 0 ? mb/device->busy_seconds : 0.0);
+      fprintf(f, "device_%d_failed   = %i\r\n", i, device->is_failed);
+    }
+  }
+
+  if (f == stdout && (stripe->n_redirected > 0 || stripe->n_stalls > 0))
+  {
+    cprint("[!!] ", BRIGHT, YELLOW);
+    printf("%d blocks redirected from a full queue, %d record stalls\n", stripe->n_redirected, stripe->n_stalls);
+  }
+  else if (f != stdout)
+  {
+    fprintf(f, "n_redirected      = %i\r\n", stripe->n_redirected);
+    fprintf(f, "n_stalls          = %i\r\n", stripe->n_stalls);
+  }
+}
+
+// Blocks waiting in all device queues. Read without the lock, only for monitoring.
+int stripe_queued(Stripe *stripe)
+{
+  int n_queued = 0;
+
+  for (int i = 0; i < stripe->n_devices; i++)
+    n_queued += __atomic_load_n(&stripe->devices[i].head, __ATOMIC_RELAXED) - __atomic_load_n(&stripe->devices[i].tail, __ATOMIC_RELAXED);
+
+  return n_queued;
+}
+
+// Writer thread of one device: drains its queue in order, throttled for testing if requested.
+void *stripe_worker(void *arg)
+{
+  StripeDevice *device = (StripeDevice *)arg;
+  Stripe *stripe = device->stripe;
+
+  //exit_handler() waits for the capture to wind down, it must never run on this thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  char name[16];
+  snprintf(name, sizeof(name), "stripe_%d", (int)(device - stripe->devices));
+  TRACE_THREAD(name);
+
+  pthread_mutex_lock(&stripe->lock);
+
+  while (true)
+  {
+    if (device->tail < device->head)
+    {
+      int slot = device->tail % stripe->depth;
+      int block = device->queued[slot];
+      uint8_t *buf = device->slots + (size_t)slot * stripe->block_size;
+
+      pthread_mutex_unlock(&stripe->lock);
+      TRACE_BEGIN(TraceDiskWrite, device - stripe->devices, block);
+      uint32_t crc = crc32(0, buf, stripe->block_size);
+      int status = write_block(device, buf, stripe->block_size);
+      TRACE_END(TraceDiskWrite, device - stripe->devices, block);
+      pthread_mutex_lock(&stripe->lock);
+
+      stripe->placement[block].crc = crc;
+
+      if (status != OK)
+      {
+        //leave the queue to the other devices, the blocks already queued here are lost
+        device->is_failed = true;
+        cprint("[!!] ", BRIGHT, RED);
+        printf("Stripe device %s failed\n", device->dir);
+        pthread_cond_broadcast(&stripe->space);
+        break;
+      }
+
+      stripe->placement[block].is_written = true;
+      device->tail++;
+      telemetry_cpu(TeleStripe + (device - stripe->devices));
+      pthread_cond_broadcast(&stripe->space);
+    }
+    else if (stripe->is_closing)
+      break;
+    else
+      pthread_cond_wait(&device->wake, &stripe->lock);
+  }
+
+  pthread_mutex_unlock(&stripe->lock);
+  return NULL;
+}
+
+void dinit_stripe(Stripe *stripe)
+{
+  stripe_close(stripe);
+
+  for (int i = 0; i < stripe->n_devices; i++)
+  {
+    StripeDevice *device = &stripe->devices[i];
+
+    if (device->slots != NULL)
+      munlock(device->slots, (size_t)stripe->depth * stripe->block_size);
+    free(device->slots);
+    free(device->queued);
+    device->slots = NULL;
+    device->queued = NULL;
+    pthread_cond_destroy(&device->wake);
+  }
+
+  free(stripe->placement);
+  stripe->placement = NULL;
+  pthread_cond_destroy(&stripe->space);
+  pthread_mutex_destroy(&stripe->lock);
+}
+
+static int split_list(const char *list, char items[][STRIPE_DIR_LEN], int max_items)
+{
+  int n_items = 0;
+  const char *p = list;
+
+  while (*p != '\0' && n_items < max_items)
+  {
+    size_t len = strcspn(p, ",");
+    const char *start = p;
+    const char *end = p + len;
+
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '/')) end--;
+
+    if (end > start)
+    {
+      snprintf(items[n_items], STRIPE_DIR_LEN, "%.*s", (int)(end - start), start);
+      n_items++;
+    }
+
+    p += len;
+    if (*p == ',')
+      p++;
+  }
+
+  return n_items;
+}
+
+static int write_block(StripeDevice *device, const uint8_t *buf, size_t len)
+{
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  const uint8_t *p = buf;
+  size_t remaining = len;
+
+  while (remaining > 0)
+  {
+    ssize_t n = write(device->fd, p, remaining);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FAIL;
+    p += n;
+    remaining -= n;
+  }
+
+  telemetry_sample_since(&telemetry->disk, &start);
+
+  //emulate a slower card by holding the writer for the rest of the block time
+  if (device->throttle > 0)
+  {
+    double ahead = len/device->throttle - seconds_since(&start);
+    if (ahead > 0)
+      usleep((useconds_t)(ahead*1e6));
+  }
+
+  device->busy_seconds += seconds_since(&start);
+  device->bytes += len;
+
+  return OK;
+}
+
+// Lists every block with the device and position it was written to, so a reader can put the
+// capture back in order without knowing anything about the queue state during the capture.
+static int write_manifest(Stripe *stripe)
+{
+  char path[256], tmp[256];
+  sprintf(path, "%s%s", stripe->dir, STRIPE_MANIFEST);
+  sprintf(tmp, "%s.tmp", path);
+
+  FILE *f = fopen(tmp, "w");
+  if (f == NULL)
+    return FAIL;
+
+  fprintf(f, "# block_size %d\n", stripe->block_size);
+  for (int i = 0; i < stripe->n_devices; i++)
+    fprintf(f, "# device %d %s\n", i, stripe->devices[i].path);
+
+  fprintf(f, "# block device index crc32\n");
+  for (int i = 0; i < stripe->n_blocks; i++)
+  {
+    Placement *placement = &stripe->placement[i];
+    if (placement->is_written)
+      fprintf(f, "%d %d %d %08X\n", i, placement->device, placement->index, placement->crc);
+  }
+
+  fflush(f);
+  fdatasync(fileno(f));
+  fclose(f);
+
+  return rename(tmp, path) == 0 ? OK : FAIL;
+}
+
+static double seconds_since(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)*1e-9;
+}
@@ -0,0 +1,84 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "constants.h"
+
+#define STRIPE_MAX_DEVICES  4
+#define STRIPE_MANIFEST     "stripe.txt"
+#define STRIPE_DIR_LEN      160 // mount point given in stripe_dirs
+
+// Where a capture block ended up, recorded for the reassembly manifest and for readers.
+typedef struct
+{
+  int8_t device;
+  uint8_t is_written;
+  int32_t index;                    // block position within the device file
+  uint32_t crc;                     // crc32 of the block
+} Placement;
+
+typedef struct StripeDevice_S
+{
+  char dir[STRIPE_DIR_LEN + 32];    // capture directory on this device, with trailing '/'
+  char path[STRIPE_DIR_LEN + 64];   // output file
+  int fd;
+
+  uint8_t *slots;                   // queue of depth blocks waiting for this device
+  int *queued;                      // capture block index of every queued slot
+  int64_t head;                     // blocks queued, guarded by the stripe lock
+  int64_t tail;                     // blocks written, guarded by the stripe lock
+  pthread_cond_t wake;              // signalled when a block is queued or the capture closes
+
+  int64_t bytes;                    // payload written to this device
+  double busy_seconds;              // time spent inside write()
+  double throttle;                  // artificial bandwidth limit [bytes/s] for testing, 0 = none
+  int is_failed;                    // a write failed, the device takes no further blocks
+
+  struct Stripe_S *stripe;
+  pthread_t thread;
+} StripeDevice;
+
+// Round-robin striping of capture blocks over two or more storage devices.
+//
+// The record thread claims a free queue slot of the next device, copies the block from the DMA
+// buffer straight into it and publishes it; each device has its own writer thread, which also
+// checksums the block. A block whose round-robin device has a full queue goes to the next device
+// with room instead, so a slow card only ever holds back its own queue. The record thread waits
+// only if every queue is full, which is the aggregate bandwidth running out.
+typedef struct Stripe_S
+{
+  StripeDevice devices[STRIPE_MAX_DEVICES];
+  int n_devices;
+  int depth;                        // queue depth per device [blocks]
+  int block_size;
+  char *dir;                        // experiment directory holding the manifest
+  char *name;                       // capture time stamp
+
+  int next;                         // round-robin cursor
+  StripeDevice *claimed;            // device of the slot handed out by stripe_claim(), NULL if none
+  int claimed_block;
+  int n_blocks;                     // blocks handed in by the record thread
+  int n_redirected;                 // blocks moved off a device with a full queue
+  int n_stalls;                     // times the record thread found every queue full
+  Placement *placement;
+  int max_blocks;
+  int is_closing;
+  struct timespec opened;           // CLOCK_MONOTONIC
+
+  pthread_mutex_t lock;
+  pthread_cond_t space;             // signalled whenever a queue slot frees up
+} Stripe;
+
+int init_stripe(Stripe *stripe, Configuration *config);
+uint8_t *stripe_claim(Stripe *stripe);
+void stripe_publish(Stripe *stripe);
+int stripe_write(Stripe *stripe, const void *buf, size_t len);
+int stripe_close(Stripe *stripe);
+int stripe_locate(Stripe *stripe, int block, char *path, size_t path_len, off_t *offset);
+int stripe_queued(Stripe *stripe);
+void stripe_report(Stripe *stripe, FILE *f);
+void *stripe_worker(void *arg);
+void dinit_stripe(Stripe *stripe);
+
+#endif  // STRIPE_H
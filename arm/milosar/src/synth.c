@@ -1,4 +1,5 @@
 #include "synth.h"
+#include "trace.h"
 #include <time.h>
 
 
@@ -23,7 +24,7 @@ void parse_ramp_file(Synthesizer *synth)
 	
 	//char* dir = "ramps/";
 	char* dir = "";
-	char* path = (char*)malloc(strlen(dir) + strlen(synth->parameter_file));
+	char* path = (char*)malloc(strlen(dir) + strlen(synth->parameter_file) + 1);
 	strcpy(path, dir);
 	strcat(path, synth->parameter_file);	
 	
@@ -33,6 +34,9 @@ void parse_ramp_file(Synthesizer *synth)
 		ASSERT(FAIL, "Could not open Synth .ini file.\n");
 		exit(EXIT_FAILURE);
 	}   
+
+	//the daemon parses the ramp files again for every changed session
+	free(path);
 }
 
 
@@ -40,7 +44,7 @@ void parse_ramp_file(Synthesizer *synth)
 //current implementation is inefficient, but no alternative could be found
 int handler(void* pointer, const char* section, const char* attribute, const char* value)
 {			
-	char* rampSection = (char*)malloc(50*sizeof(char));
+	char rampSection[50];
 	Synthesizer* synth = (Synthesizer*)pointer;
 	
 	#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(attribute, n) == 0
@@ -144,17 +148,12 @@ void calc_parameters(Synthesizer *synth, Configuration *config)
 		printf("\n");
 	}
 
-	//calculate the equivalent binary values
-	synth->bin_fractional_numerator = (int*)malloc(24*sizeof(int));
+	//calculate the equivalent binary values, in place as the synths are recalculated every session
 	memset(synth->bin_fractional_numerator, 0, 24*sizeof(int));
 	decimal_to_binary(synth->fractional_numerator, synth->bin_fractional_numerator);	
 	
 	for (int i = 0; i < MAX_RAMPS; i++)
 	{	
-		synth->ramps[i].binIncrement     = (int*)malloc(32*sizeof(int));
-		synth->ramps[i].binLength        = (int*)malloc(16*sizeof(int));	
-		synth->ramps[i].binNextTrigReset = (int*)malloc(8*sizeof(int));		
-		
 		memset(synth->ramps[i].binIncrement, 	 0, 32*sizeof(int));
 		memset(synth->ramps[i].binLength, 		 0, 16*sizeof(int));
 		memset(synth->ramps[i].binNextTrigReset, 0,  8*sizeof(int));		
@@ -168,12 +167,15 @@ void calc_parameters(Synthesizer *synth, Configuration *config)
 
 void reset_synths(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth)
 {
+	TRACE_INSTANT(TraceSynthReset, tx_synth->id, lo_synth->id);
 	set_register_parallel(gpio, tx_synth, lo_synth, 2, 0b00000100);
 }
 
 
 void set_ramping(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth, int is_ramping)
 {
+	TRACE_INSTANT(TraceRamping, is_ramping, 0);
+
 	if (is_ramping)
 		set_register_parallel(gpio, tx_synth, lo_synth, 58, 0b00010001); //note: this value assumes RAMP_TRIG_A = TRIG1 terminal rising edge
 	else
@@ -319,6 +321,8 @@ void set_register(void* gpio, Synthesizer *synth, int address, int value)
 	int binAddress[16];
 	int binValue[8];
 	
+	TRACE_INSTANT(TraceSynthRegister, address, value);
+
 	memset(binAddress, 0, 16*sizeof(int));
 	memset(binValue, 0, 8*sizeof(int));
 	
@@ -376,6 +380,8 @@ void set_register_parallel(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_sy
 	int binAddress[16];
 	int binValue[8];
 	
+	TRACE_INSTANT(TraceSynthRegister, address, value);
+
 	memset(binAddress, 0, 16*sizeof(int));
 	memset(binValue, 0, 8*sizeof(int));
 	
@@ -435,6 +441,8 @@ void flash_synth(void* gpio, Synthesizer *synth)
 	
 	int address_flag = false;
 	
+	TRACE_BEGIN(TraceSynthFlash, synth->id, NUM_REGISTERS);
+
 	for (int i = (NUM_REGISTERS - 1); i >= 0; i--)
 	{
 		if (address_flag == false)
@@ -487,9 +495,50 @@ void flash_synth(void* gpio, Synthesizer *synth)
 	set_pin(gpio, synth->latch, HIGH); 					//set latch high
 	usleep(1);
 	set_pin(gpio, synth->data, LOW); 					//set data low
+
+	TRACE_END(TraceSynthFlash, synth->id, NUM_REGISTERS);
 }
  
  
+// Brings a synth from flashed, the register image last written to it, up to its current
+// registers. Only registers that differ are written, highest address first like flash_synth(),
+// unless a full flash is fewer bits. Returns the number of registers written.
+int update_synth(void* gpio, Synthesizer *synth, int flashed[NUM_REGISTERS][MAX_RAMPS])
+{
+	int n_changed = 0;
+
+	for (int i = 0; i < NUM_REGISTERS; i++)
+		if (memcmp(synth->registers[i], flashed[i], sizeof(synth->registers[i])) != 0)
+			n_changed++;
+
+	if (n_changed == 0)
+		return 0;
+
+	//every single write sends its own 16 bit address
+	if (n_changed*(16 + 8) >= 16 + 8*NUM_REGISTERS)
+	{
+		flash_synth(gpio, synth);
+		n_changed = NUM_REGISTERS;
+	}
+	else
+	{
+		for (int i = NUM_REGISTERS - 1; i >= 0; i--)
+		{
+			if (memcmp(synth->registers[i], flashed[i], sizeof(synth->registers[i])) == 0)
+				continue;
+
+			int value = 0;
+			for (int j = 0; j < 8; j++)
+				value |= synth->registers[i][j] << j;
+			set_register(gpio, synth, i, value);
+		}
+	}
+
+	memcpy(flashed, synth->registers, sizeof(synth->registers));
+	return n_changed;
+}
+
+
 void flash_synths(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth)
 {
 	int start_address[16];
@@ -567,7 +616,9 @@ void flash_synths(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth)
 } 
  
  
-time_t start_experiment(void* gpio, void* tcu, Configuration *config)
+// Writes every TCU setting except the enable flag, so a scheduled start only has one register
+// write left at its deadline. Returns the TCU register value to enable with.
+uint64_t arm_experiment(void* gpio, void* tcu, Configuration *config)
 {
 	//clock cycles per PRI
 	float cycles_per_pri = ADC_RATE/config->prf;
@@ -595,7 +646,7 @@ time_t start_experiment(void* gpio, void* tcu, Configuration *config)
 		exit(0);
 	}
 	
-	//set all values without enable %TODO: move earlier to reduce time offset
+	//set all values without enable
 	uint64_t tcu_register = 0;
 	tcu_register |= (0 << 0); //clear enable flag
 	tcu_register |= (0 << 1); //clear is_sync flag
@@ -603,15 +654,22 @@ time_t start_experiment(void* gpio, void* tcu, Configuration *config)
 	tcu_register |= ((uint64_t)config->switch_mode << 32); //set pulse_width
 	set_reg(tcu, tcu_register);
 
+	return tcu_register;
+}
+
+void enable_experiment(void* tcu, uint64_t tcu_register, ClockPair *enabled)
+{
 	tcu_register |= (1 << 0); //set enable flag
 	set_reg(tcu, tcu_register);
-	time_t timer;
-	time_t tcu_trigger_time = time(&timer);	// time the TCU is triggered
+	clock_pair(enabled);	// time the TCU is triggered, before anything else can delay it
 
 	cprint("\n[OK] ", BRIGHT, GREEN);
 	printf("Experiment Progress:\n\n");
+}
 
-	return tcu_trigger_time;
+void start_experiment(void* gpio, void* tcu, Configuration *config, ClockPair *enabled)
+{
+	enable_experiment(tcu, arm_experiment(gpio, tcu, config), enabled);
 }
 
 
@@ -650,10 +708,11 @@ void config_experiment(Configuration *config, Synthesizer *tx_synth, Synthesizer
 	
 	printf("\n");	
 	
-	//allocate memory 
-	config->time_stamp = (char*)malloc(20*sizeof(char));
-	config->experiment_dir = (char*)malloc(100*sizeof(char));
-	config->path_summary = (char*)malloc(100*sizeof(char));
+	//one set of buffers for every session, the copies of config made for staging share them
+	static char time_stamp[20], experiment_dir[100], path_summary[100];
+	config->time_stamp = time_stamp;
+	config->experiment_dir = experiment_dir;
+	config->path_summary = path_summary;
 	
 	//get the experiment time stamp
 	time_t timer = time(&timer);
@@ -707,14 +766,8 @@ void config_experiment(Configuration *config, Synthesizer *tx_synth, Synthesizer
 		//print summary file 
 		fprintf(f, "[general]\r\n");		
 
-		//ask for operator comment
-		cprint("[??] ", BRIGHT, BLUE);
-		printf("Operator Comment [512]: ");
-		
-		char comment[512] = "\0";
-		// scanf("%[^\n]s", comment);
-		if (comment[0] == '\0') strcpy(comment, "none");
-    printf("\n");
+		//operator comment comes from setup.ini or the control socket, never from stdin
+		const char *comment = config->operator_comment != NULL && config->operator_comment[0] != '\0' ? config->operator_comment : "none";
 
 		//get time just before experiment start
 		char time_now[20];
@@ -725,6 +778,7 @@ void config_experiment(Configuration *config, Synthesizer *tx_synth, Synthesizer
 		fprintf(f, "time_stamp        = %s\r\n", time_now);
 		fprintf(f, "operator_comment  = %s\r\n", comment);
 		fprintf(f, "capture_delay     = %u\r\n", config->capture_delay);
+		fprintf(f, "start_time        = %s\r\n", config->start_time != NULL && config->start_time[0] != '\0' ? config->start_time : "trigger");
 
 		fprintf(f, "\n[dataset]\r\n");
 		fprintf(f, "switch_mode       = %i\r\n", config->switch_mode);
@@ -16,8 +16,8 @@
 #include "utils.h"
 #include "colour.h"
 #include "reg.h"
+#include "timing.h"
 // #include "gps.h"
-#include "led.h"
 
 #define MAX_RAMPS 				8
 #define NUM_REGISTERS 			142
@@ -48,15 +48,15 @@ typedef struct
 	char* hexLength;
 	char* hexNextTrigReset;
 	
-	int* binIncrement;
-	int* binLength;
-	int* binNextTrigReset;	
+	int binIncrement[32];
+	int binLength[16];
+	int binNextTrigReset[8];
 } Ramp;
 
 typedef struct
 {
 	int id;
-	int *bin_fractional_numerator;
+	int bin_fractional_numerator[24];
 	int registers[NUM_REGISTERS][MAX_RAMPS];
 	char *parameter_file;
 	Ramp ramps[MAX_RAMPS];
@@ -75,12 +75,15 @@ void reset_synths(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth);
 void set_ramping(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth, int is_ramping);
 void flash_synth(void* gpio, Synthesizer *synth);
 void flash_synths(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth);
+int update_synth(void* gpio, Synthesizer *synth, int flashed[NUM_REGISTERS][MAX_RAMPS]);
 void init_pins(Synthesizer *synth);
 void set_register(void* gpio, Synthesizer *synth, int address, int value);
 void set_register_parallel(void* gpio, Synthesizer *tx_synth, Synthesizer *lo_synth, int address, int value);
 //void start_experiment(void* gpio, void* tcu, Configuration *config);
 // time_t start_experiment(void* gpio, void* tcu, Configuration *config);
-time_t start_experiment(void* gpio, void* tcu, Configuration *config);
+uint64_t arm_experiment(void* gpio, void* tcu, Configuration *config);
+void enable_experiment(void* tcu, uint64_t tcu_register, ClockPair *enabled);
+void start_experiment(void* gpio, void* tcu, Configuration *config, ClockPair *enabled);
 void config_experiment(Configuration *config, Synthesizer *tx_synth, Synthesizer *lo_synth);
 void decimal_to_binary(uint64_t decimalValue, int* binaryValue);
 void print_binary(int* binaryValue, int paddedSize);
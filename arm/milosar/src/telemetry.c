@@ -0,0 +1,178 @@
+#include "telemetry.h"
+#include "utils.h"
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "colour.h"
+
+Telemetry *telemetry = NULL;
+
+static int is_shared = false;
+
+static const char *thread_names[N_TELE_THREADS] = {"record", "ring", "storage", "transfer", "stripe_0", "stripe_1", "stripe_2", "stripe_3"};
+
+static void report_histogram(FILE *f, const char *name, const char *unit, Histogram *histogram);
+
+// Maps the telemetry block into shared memory. Without /dev/shm the counters still feed the
+// summary, they just cannot be polled from outside.
+int init_telemetry(void)
+{
+  int fd = shm_open(TELEMETRY_SHM, O_RDWR | O_CREAT, 0644);
+
+  if (fd >= 0 && ftruncate(fd, sizeof(Telemetry)) == 0)
+  {
+    telemetry = mmap(NULL, sizeof(Telemetry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    is_shared = telemetry != MAP_FAILED;
+  }
+
+  if (fd >= 0)
+    close(fd);
+
+  if (!is_shared)
+  {
+    cprint("[!!] ", BRIGHT, YELLOW);
+    printf("Could not share telemetry as %s: %s\n", TELEMETRY_SHM, strerror(errno));
+    telemetry = malloc(sizeof(Telemetry));
+    if (telemetry == NULL)
+      return FAIL;
+  }
+
+  telemetry_reset(0);
+  return OK;
+}
+
+// Called before the session's threads start, so no writer is active.
+void telemetry_reset(int session)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  //the magic goes last, a reader never sees a valid block half cleared
+  __atomic_store_n(&telemetry->magic, 0, __ATOMIC_RELEASE);
+  memset((uint8_t *)telemetry + sizeof(telemetry->magic), 0, sizeof(Telemetry) - sizeof(telemetry->magic));
+
+  telemetry->version = TELEMETRY_VERSION;
+  telemetry->size = sizeof(Telemetry);
+  telemetry->session = session;
+  telemetry->session_start_ns = (int64_t)now.tv_sec*1000000000 + now.tv_nsec;
+  __atomic_store_n(&telemetry->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+}
+
+void telemetry_add(uint64_t *counter, uint64_t n)
+{
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+void telemetry_sample(Histogram *histogram, uint64_t value)
+{
+  int bin = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  if (bin >= TELEMETRY_BINS)
+    bin = TELEMETRY_BINS - 1;
+
+  __atomic_fetch_add(&histogram->bins[bin], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+
+  //several writer threads share the disk histogram
+  uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Samples the time since start in us.
+void telemetry_sample_since(Histogram *histogram, struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  int64_t us = (now.tv_sec - start->tv_sec)*1000000 + (now.tv_nsec - start->tv_nsec)/1000;
+  telemetry_sample(histogram, us > 0 ? us : 0);
+}
+
+// Publishes the CPU time of the calling thread, each thread only ever writes its own slot.
+void telemetry_cpu(int thread)
+{
+  struct timespec cpu;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  __atomic_store_n(&telemetry->cpu_ns[thread], (uint64_t)cpu.tv_sec*1000000000 + cpu.tv_nsec, __ATOMIC_RELAXED);
+}
+
+// Writes the counters as summary.ini keys, also used for the control socket's reply.
+void telemetry_report(FILE *f)
+{
+  fprintf(f, "heartbeat         = %llu\r\n", (unsigned long long)telemetry->heartbeat);
+  fprintf(f, "blocks            = %llu\r\n", (unsigned long long)telemetry->blocks);
+  fprintf(f, "bytes             = %llu\r\n", (unsigned long long)telemetry->bytes);
+  fprintf(f, "overruns          = %llu; DMA halves overwritten while being copied\r\n", (unsigned long long)telemetry->overruns);
+  fprintf(f, "stale             = %llu\r\n", (unsigned long long)telemetry->stale);
+  fprintf(f, "dropped           = %llu; full pre-trigger ring\r\n", (unsigned long long)telemetry->dropped);
+  fprintf(f, "write_errors      = %llu\r\n", (unsigned long long)telemetry->write_errors);
+  fprintf(f, "stalls            = %llu\r\n", (unsigned long long)telemetry->stalls);
+
+  report_histogram(f, "drain", "us", &telemetry->drain);
+  report_histogram(f, "copy", "us", &telemetry->copy);
+  report_histogram(f, "write", "us", &telemetry->write);
+  report_histogram(f, "disk", "us", &telemetry->disk);
+  report_histogram(f, "queue", "blocks", &telemetry->queue);
+  report_histogram(f, "stream", "blocks", &telemetry->stream);
+
+  for (int i = 0; i < N_TELE_THREADS; i++)
+  {
+    uint64_t ns = __atomic_load_n(&telemetry->cpu_ns[i], __ATOMIC_RELAXED);
+    if (ns > 0)
+      fprintf(f, "cpu_%-13s = %.3f; [s]\r\n", thread_names[i], ns*1e-9);
+  }
+}
+
+void dinit_telemetry(void)
+{
+  if (telemetry == NULL)
+    return;
+
+  //leave the shared block in place, a monitor may still want the final values
+  if (is_shared)
+    munmap(telemetry, sizeof(Telemetry));
+  else
+    free(telemetry);
+
+  telemetry = NULL;
+}
+
+// Count, mean, max and the upper edge of the bin holding the 99th percentile, then the raw bins
+// up to the highest one used so the full distribution can be rebuilt offline.
+static void report_histogram(FILE *f, const char *name, const char *unit, Histogram *histogram)
+{
+  uint64_t bins[TELEMETRY_BINS];
+  uint64_t count = 0;
+  int last = 0;
+
+  for (int i = 0; i < TELEMETRY_BINS; i++)
+  {
+    bins[i] = __atomic_load_n(&histogram->bins[i], __ATOMIC_RELAXED);
+    count += bins[i];
+    if (bins[i] > 0)
+      last = i;
+  }
+
+  uint64_t p99 = 0, seen = 0;
+  for (int i = 0; i < TELEMETRY_BINS && count > 0; i++)
+  {
+    seen += bins[i];
+    if (seen*100 >= count*99)
+    {
+      p99 = i == 0 ? 0 : 1ULL << i;
+      break;
+    }
+  }
+
+  char key[32];
+  snprintf(key, sizeof(key), "%s_%s", name, unit);
+  fprintf(f, "%-17s = %llu/%.0f/%llu/%llu; count/mean/p99/max\r\n", key, (unsigned long long)count,
+          count > 0 ? (double)histogram->sum/count : 0.0, (unsigned long long)p99, (unsigned long long)histogram->max);
+
+  snprintf(key, sizeof(key), "%s_hist", name);
+  fprintf(f, "%-17s = ", key);
+  for (int i = 0; i <= last; i++)
+    fprintf(f, i < last ? "%llu," : "%llu", (unsigned long long)bins[i]);
+  fprintf(f, "; log2 bins\r\n");
+}
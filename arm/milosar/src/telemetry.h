@@ -0,0 +1,68 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include "constants.h"
+#include "stripe.h"
+
+#define TELEMETRY_SHM       "/milosar_telemetry"  // shm_open name, /dev/shm/milosar_telemetry
+#define TELEMETRY_MAGIC     0x4C454554            // "TELE" little endian
+#define TELEMETRY_VERSION   1
+#define TELEMETRY_BINS      24                    // bin 0 holds 0, bin k holds [2^(k-1), 2^k)
+
+// Log2 histogram, latencies in us and queue depths in blocks share the same binning.
+typedef struct
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t bins[TELEMETRY_BINS];
+} Histogram;
+
+// Threads whose CPU time is published, one slot per thread so every slot has a single writer.
+enum TelemetryThread {TeleRecord = 0, TeleRing, TeleStorage, TeleTransfer, TeleStripe, N_TELE_THREADS = TeleStripe + STRIPE_MAX_DEVICES};
+
+// Live counters of the running session, mapped into shared memory so a monitor can poll them
+// with plain loads. Fields are only updated with relaxed atomics, nothing on the capture path
+// ever takes a lock or waits for a reader. Counters are zeroed when a session starts and keep
+// their final values until the next one. heartbeat is bumped after every drained block, a
+// reader that sees it unchanged over two polls of more than a block time knows the drain stalled.
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;                        // sizeof(Telemetry), for readers built from another header
+  uint32_t session;
+  int64_t session_start_ns;             // CLOCK_REALTIME of the reset
+  uint64_t heartbeat;
+
+  uint64_t blocks;                      // DMA halves drained by the record thread
+  uint64_t bytes;                       // bytes handed to storage, the ring or the stripe queues
+  uint64_t overruns;                    // halves the DMA writer lapped while they were being copied
+  uint64_t stale;                       // halves dropped because they began before the session
+  uint64_t dropped;                     // blocks dropped by a full pre-trigger ring
+  uint64_t write_errors;
+  uint64_t stalls;                      // record thread waited for storage queue space
+
+  Histogram drain;                      // [us] half ready to handed off, the whole drain budget
+  Histogram copy;                       // [us] memcpy out of the DMA buffer
+  Histogram write;                      // [us] storage_write() or the ring publish
+  Histogram disk;                       // [us] write() of one block on any writer thread
+  Histogram queue;                      // [blocks] ring or stripe queues at hand-off
+  Histogram stream;                     // [blocks] not yet acknowledged by the stream receiver
+
+  uint64_t cpu_ns[N_TELE_THREADS];      // CLOCK_THREAD_CPUTIME_ID of every capture thread
+} Telemetry;
+
+extern Telemetry *telemetry;
+
+int init_telemetry(void);
+void telemetry_reset(int session);
+void telemetry_add(uint64_t *counter, uint64_t n);
+void telemetry_sample(Histogram *histogram, uint64_t value);
+void telemetry_sample_since(Histogram *histogram, struct timespec *start);
+void telemetry_cpu(int thread);
+void telemetry_report(FILE *f);
+void dinit_telemetry(void);
+
+#endif  // TELEMETRY_H
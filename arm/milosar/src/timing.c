@@ -0,0 +1,337 @@
+#include "timing.h"
+#include "utils.h"
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+
+static int64_t to_ns(struct timespec *t);
+static struct timespec from_ns(int64_t ns);
+static void fit_line(double *x, double *y, int n, double *slope, double *rms, double *max);
+static BlockTime *block_time(Timing *timing, int i);
+static int add_chunk(Timing *timing);
+
+void clock_pair(ClockPair *pair)
+{
+  struct timespec before, realtime, after;
+
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &after);
+
+  pair->realtime_ns = to_ns(&realtime);
+  pair->monotonic_ns = to_ns(&before) + (to_ns(&after) - to_ns(&before))/2;
+  pair->gap_ns = to_ns(&after) - to_ns(&before);
+}
+
+int init_timing(Timing *timing)
+{
+  memset(timing, 0, sizeof(*timing));
+  return add_chunk(timing);
+}
+
+// Called before the record thread starts. The chunks are kept from the last session and those the
+// planned capture needs are added here, so the record thread only allocates past it.
+void timing_reset(Timing *timing, Configuration *config)
+{
+  double bytes_per_pri = N_CHANNELS*BYTES_PER_WRITE*(config->end_index - config->start_index + 1);
+
+  timing->n_blocks = 0;
+  timing->n_missed = 0;
+  timing->max_gap_ns = 0;
+  timing->bytes_per_second = bytes_per_pri*config->prf/config->presum_factor;
+  timing->nominal_period_ms = S2MB/timing->bytes_per_second*1e3;
+  memset(&timing->tcu, 0, sizeof(timing->tcu));
+  memset(&timing->scheduled, 0, sizeof(timing->scheduled));
+  timing->start_error_ns = 0;
+  timing->wake_ns = 0;
+  timing->spin_ns = 0;
+
+  while (timing->n_chunks*TIMING_CHUNK < config->n_buffers && add_chunk(timing) == OK)
+    ;
+}
+
+// Record thread only. Past the chunks timing_reset() made, a continuous or pre-trigger capture
+// adds one every TIMING_CHUNK blocks, nothing recorded is ever copied, and a failure only loses
+// timestamps, never data.
+void timing_block(Timing *timing, int64_t block, uint32_t half, uint32_t sts, ClockPair *seen)
+{
+  if (timing->n_blocks == timing->n_chunks*TIMING_CHUNK && add_chunk(timing) != OK)
+  {
+    timing->n_missed++;
+    return;
+  }
+
+  BlockTime *b = block_time(timing, timing->n_blocks);
+  b->block = block;
+  b->half = half;
+  b->sts = sts;
+  b->realtime_ns = seen->realtime_ns;
+  b->monotonic_ns = seen->monotonic_ns;
+
+  if (seen->gap_ns > timing->max_gap_ns)
+    timing->max_gap_ns = seen->gap_ns;
+
+  __atomic_store_n(&timing->n_blocks, timing->n_blocks + 1, __ATOMIC_RELEASE);
+}
+
+// After the record thread has been joined.
+void timing_fit(Timing *timing, TimingFit *fit)
+{
+  int n = timing->n_blocks;
+
+  memset(fit, 0, sizeof(*fit));
+  fit->n_points = n;
+  if (n < 3)
+    return;
+
+  double *x = malloc(n * sizeof(double));
+  double *y = malloc(n * sizeof(double));
+  if (x == NULL || y == NULL)
+  {
+    free(x);
+    free(y);
+    return;
+  }
+
+  //relative to the first block, doubles keep nanoseconds over days that way
+  BlockTime *b0 = block_time(timing, 0);
+  double slope;
+
+  for (int i = 0; i < n; i++)
+  {
+    x[i] = (block_time(timing, i)->monotonic_ns - b0->monotonic_ns)*1e-9;
+    y[i] = (block_time(timing, i)->realtime_ns - b0->realtime_ns)*1e-9;
+  }
+  fit_line(x, y, n, &slope, &fit->clock_residual_us, &fit->clock_residual_max_us);
+  fit->clock_drift_ppm = (slope - 1)*1e6;
+  fit->clock_residual_us *= 1e6;
+  fit->clock_residual_max_us *= 1e6;
+
+  //the half completed when the writer crossed the boundary, the overshoot earlier at the nominal rate
+  for (int i = 0; i < n; i++)
+  {
+    BlockTime *b = block_time(timing, i);
+    double overshoot = (b->sts*(uint64_t)BYTES_PER_WRITE % S2MB)/timing->bytes_per_second;
+    x[i] = b->half - b0->half;
+    y[i] = (b->monotonic_ns - b0->monotonic_ns)*1e-9 - overshoot;
+  }
+  fit_line(x, y, n, &slope, &fit->block_jitter_us, &fit->block_jitter_max_us);
+  fit->block_period_ms = slope*1e3;
+  fit->block_jitter_us *= 1e6;
+  fit->block_jitter_max_us *= 1e6;
+  fit->adc_drift_ppm = fit->block_period_ms > 0 ? (timing->nominal_period_ms/fit->block_period_ms - 1)*1e6 : 0;
+
+  free(x);
+  free(y);
+}
+
+// Blocks from first up to end, renumbered from first so they match the capture block index.
+int timing_write(Timing *timing, const char *path, int64_t first, int64_t end)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+    return FAIL;
+
+  fprintf(f, "block,half,sts,realtime_ns,monotonic_ns\n");
+  fprintf(f, "tcu,,,%lld,%lld\n", (long long)timing->tcu.realtime_ns, (long long)timing->tcu.monotonic_ns);
+
+  for (int i = 0; i < timing->n_blocks; i++)
+  {
+    BlockTime *b = block_time(timing, i);
+    if (b->block >= first && b->block < end)
+      fprintf(f, "%lld,%u,%u,%lld,%lld\n", (long long)(b->block - first), b->half, b->sts, (long long)b->realtime_ns, (long long)b->monotonic_ns);
+  }
+
+  return fclose(f) == 0 ? OK : FAIL;
+}
+
+// The [timing] section of summary.ini.
+void timing_report(Timing *timing, TimingFit *fit, FILE *f)
+{
+  fprintf(f, "tcu_realtime_ns   = %lld\r\n", (long long)timing->tcu.realtime_ns);
+  fprintf(f, "tcu_monotonic_ns  = %lld\r\n", (long long)timing->tcu.monotonic_ns);
+  fprintf(f, "tcu_pair_gap      = %i; [ns]\r\n", timing->tcu.gap_ns);
+  fprintf(f, "n_blocks          = %i\r\n", timing->n_blocks);
+  fprintf(f, "n_missed          = %i\r\n", timing->n_missed);
+  fprintf(f, "max_pair_gap      = %i; [ns]\r\n", timing->max_gap_ns);
+
+  if (timing->scheduled.tv_sec > 0)
+  {
+    fprintf(f, "scheduled_start   = %ld.%09ld\r\n", (long)timing->scheduled.tv_sec, timing->scheduled.tv_nsec);
+    fprintf(f, "start_error       = %.3f; [us] TCU enable against the schedule, late is positive\r\n", timing->start_error_ns*1e-3);
+    fprintf(f, "start_wake        = %.1f; [us] left when the sleep returned\r\n", timing->wake_ns*1e-3);
+    fprintf(f, "start_spin        = %.1f; [us] busy-waited\r\n", timing->spin_ns*1e-3);
+  }
+
+  if (fit->n_points < 3)
+    return;
+
+  fprintf(f, "clock_drift       = %.3f; [ppm] CLOCK_REALTIME against CLOCK_MONOTONIC\r\n", fit->clock_drift_ppm);
+  fprintf(f, "clock_residual    = %.1f; [us] rms\r\n", fit->clock_residual_us);
+  fprintf(f, "clock_residual_pk = %.1f; [us] largest\r\n", fit->clock_residual_max_us);
+  fprintf(f, "nominal_period    = %.6f; [ms]\r\n", timing->nominal_period_ms);
+  fprintf(f, "block_period      = %.6f; [ms] fitted\r\n", fit->block_period_ms);
+  fprintf(f, "block_jitter      = %.1f; [us] rms\r\n", fit->block_jitter_us);
+  fprintf(f, "block_jitter_pk   = %.1f; [us] largest\r\n", fit->block_jitter_max_us);
+  fprintf(f, "adc_drift         = %.3f; [ppm] ADC clock against CLOCK_MONOTONIC\r\n", fit->adc_drift_ppm);
+}
+
+// Unix seconds with an optional fraction, "+seconds" from now, or UTC as
+// YYYY-MM-DDTHH:MM:SS[.fraction][Z], a space in place of the T is accepted.
+int timing_parse(const char *text, struct timespec *t)
+{
+  struct tm tm;
+  double seconds, fraction = 0;
+  char *end;
+  int n = 0;
+
+  while (*text == ' ')
+    text++;
+
+  if (text[0] == '+')
+  {
+    seconds = strtod(text + 1, &end);
+    if (end == text + 1 || seconds < 0)
+      return FAIL;
+    clock_gettime(CLOCK_REALTIME, t);
+    *t = from_ns(to_ns(t) + (int64_t)(seconds*1e9));
+    return OK;
+  }
+
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(text, "%4d-%2d-%2d%*1[T ]%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &n) == 6)
+  {
+    if (text[n] == '.')
+      fraction = strtod(text + n, &end);
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    t->tv_sec = timegm(&tm);
+    t->tv_nsec = (long)(fraction*1e9);
+    return t->tv_sec > 0 ? OK : FAIL;
+  }
+
+  seconds = strtod(text, &end);
+  if (end == text || seconds <= 0)
+    return FAIL;
+  t->tv_sec = (time_t)seconds;
+  t->tv_nsec = (long)((seconds - t->tv_sec)*1e9);
+  return OK;
+}
+
+// Sleeps until a CLOCK_REALTIME deadline on absolute deadlines in steps of at most
+// TIMING_SLEEP_STEP_MS so a cancel is noticed, and busy-waits the last TIMING_SPIN_US. The final
+// sleep runs at realtime priority where permitted, to wake up on time. Returns FAIL if cancelled.
+int wait_until(struct timespec *deadline, volatile int *is_cancelled, Timing *timing)
+{
+  int64_t target = to_ns(deadline);
+  int64_t spin_from = target - TIMING_SPIN_US*1000L;
+  struct sched_param saved_param, param;
+  int saved_policy, is_raised = false;
+  struct timespec now, at;
+
+  while (!*is_cancelled)
+  {
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t remaining = spin_from - to_ns(&now);
+    if (remaining <= 0)
+      break;
+
+    if (remaining <= TIMING_SLEEP_STEP_MS*1000000L && !is_raised)
+    {
+      pthread_getschedparam(pthread_self(), &saved_policy, &saved_param);
+      param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+      is_raised = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+    }
+
+    at = from_ns(remaining > TIMING_SLEEP_STEP_MS*1000000L ? to_ns(&now) + TIMING_SLEEP_STEP_MS*1000000L : spin_from);
+    clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &at, NULL);
+  }
+
+  if (is_raised)
+    pthread_setschedparam(pthread_self(), saved_policy, &saved_param);
+
+  if (*is_cancelled)
+    return FAIL;
+
+  //spin on the clock alone, nothing else between the deadline and the caller
+  struct timespec woke;
+  clock_gettime(CLOCK_REALTIME, &woke);
+  now = woke;
+  while (to_ns(&now) < target && !*is_cancelled)
+    clock_gettime(CLOCK_REALTIME, &now);
+
+  if (timing != NULL)
+  {
+    timing->scheduled = *deadline;
+    timing->wake_ns = target - to_ns(&woke);
+    timing->spin_ns = to_ns(&now) - to_ns(&woke);
+  }
+
+  return *is_cancelled ? FAIL : OK;
+}
+
+void dinit_timing(Timing *timing)
+{
+  for (int i = 0; i < timing->n_chunks; i++)
+    free(timing->chunks[i]);
+  timing->n_chunks = 0;
+  timing->n_blocks = 0;
+}
+
+static BlockTime *block_time(Timing *timing, int i)
+{
+  return &timing->chunks[i / TIMING_CHUNK][i % TIMING_CHUNK];
+}
+
+static int add_chunk(Timing *timing)
+{
+  if (timing->n_chunks == TIMING_MAX_CHUNKS || (timing->chunks[timing->n_chunks] = malloc(TIMING_CHUNK * sizeof(BlockTime))) == NULL)
+    return FAIL;
+
+  timing->n_chunks++;
+  return OK;
+}
+
+static int64_t to_ns(struct timespec *t)
+{
+  return (int64_t)t->tv_sec*1000000000 + t->tv_nsec;
+}
+
+static struct timespec from_ns(int64_t ns)
+{
+  struct timespec t = {ns / 1000000000, ns % 1000000000};
+  return t;
+}
+
+// Least squares y = a + slope*x, with the rms and largest absolute residual.
+static void fit_line(double *x, double *y, int n, double *slope, double *rms, double *max)
+{
+  double mx = 0, my = 0, sxx = 0, sxy = 0, ss = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    mx += x[i];
+    my += y[i];
+  }
+  mx /= n;
+  my /= n;
+
+  for (int i = 0; i < n; i++)
+  {
+    sxx += (x[i] - mx)*(x[i] - mx);
+    sxy += (x[i] - mx)*(y[i] - my);
+  }
+
+  *slope = sxx > 0 ? sxy/sxx : 0;
+  *max = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    double r = y[i] - (my + *slope*(x[i] - mx));
+    ss += r*r;
+    if (fabs(r) > *max)
+      *max = fabs(r);
+  }
+
+  *rms = sqrt(ss/n);
+}
@@ -0,0 +1,84 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include "constants.h"
+
+#define TIMING_FILE         "timestamps.csv"
+#define TIMING_CHUNK        4096    // block times per chunk, a full one is followed by a new one
+#define TIMING_MAX_CHUNKS   4096    // 32 TB of capture at S2MB a block
+#define TIMING_SLEEP_STEP_MS 100    // longest sleep of wait_until(), how soon a cancel is noticed
+#define TIMING_SPIN_US      300     // last part of a scheduled start that is busy-waited
+
+// Wall time of the capture. Every completed DMA half gets a CLOCK_REALTIME and CLOCK_MONOTONIC
+// pair and the STS pointer at the moment it was seen complete, written to TIMING_FILE in the
+// experiment directory with the capture block index. The TCU enable gets a pair of its own. The
+// writer wraps at the end of the double buffer, so the STS position modulo one half is how far
+// past the block boundary it already was when the block was seen.
+//
+// A pair is read as monotonic, realtime, monotonic and stamped at the middle of the two
+// monotonic reads, half their gap is its uncertainty. At the end of a capture two lines are fitted
+// by least squares: realtime against monotonic gives the drift of the system clock (NTP, GPS)
+// against the CPU crystal, monotonic against the half count gives the real block period, and
+// with it the drift of the ADC clock against the CPU crystal.
+//
+// A scheduled start sleeps on absolute CLOCK_REALTIME deadlines, so a clock step while waiting is
+// followed, and only spins for the last TIMING_SPIN_US. The achieved error is the realtime of the
+// TCU enable pair against the deadline.
+typedef struct
+{
+  int64_t realtime_ns;
+  int64_t monotonic_ns;
+  int32_t gap_ns;                   // between the two monotonic reads
+} ClockPair;
+
+typedef struct
+{
+  int64_t block;                    // half of the session's stream, the capture block index once renumbered
+  uint32_t half;                    // DMA halves completed since the session started
+  uint32_t sts;                     // DMA writer position [32 bit words] when seen complete
+  int64_t realtime_ns;
+  int64_t monotonic_ns;
+} BlockTime;
+
+typedef struct
+{
+  int n_points;
+  double clock_drift_ppm;           // realtime rate against monotonic
+  double clock_residual_us;         // rms
+  double clock_residual_max_us;
+  double block_period_ms;           // monotonic per block, corrected for the STS overshoot
+  double block_jitter_us;           // rms residual of the block times
+  double block_jitter_max_us;
+  double adc_drift_ppm;             // nominal against fitted block period
+} TimingFit;
+
+typedef struct Timing_S
+{
+  ClockPair tcu;                    // TCU enable
+  BlockTime *chunks[TIMING_MAX_CHUNKS];  // TIMING_CHUNK block times each, kept across sessions
+  volatile int n_blocks;
+  int n_chunks;
+  int n_missed;                     // blocks not recorded, out of memory
+  int32_t max_gap_ns;
+  double bytes_per_second;          // nominal DMA rate, for the STS overshoot correction
+  double nominal_period_ms;
+
+  struct timespec scheduled;        // CLOCK_REALTIME deadline of a scheduled start, 0 if none
+  int64_t start_error_ns;           // TCU enable against the deadline, late is positive
+  int64_t wake_ns;                  // left to the deadline when the last sleep returned
+  int64_t spin_ns;                  // busy-waited after it
+} Timing;
+
+void clock_pair(ClockPair *pair);
+int init_timing(Timing *timing);
+void timing_reset(Timing *timing, Configuration *config);
+void timing_block(Timing *timing, int64_t block, uint32_t half, uint32_t sts, ClockPair *seen);
+void timing_fit(Timing *timing, TimingFit *fit);
+int timing_write(Timing *timing, const char *path, int64_t first, int64_t end);
+void timing_report(Timing *timing, TimingFit *fit, FILE *f);
+int timing_parse(const char *text, struct timespec *t);
+int wait_until(struct timespec *deadline, volatile int *is_cancelled, Timing *timing);
+void dinit_timing(Timing *timing);
+
+#endif  // TIMING_H
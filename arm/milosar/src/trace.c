@@ -0,0 +1,193 @@
+#include "trace.h"
+
+#ifdef TRACE
+
+#include "utils.h"
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include "colour.h"
+
+#define TRACE_CALIBRATION   100000  // events timed at startup
+#define TRACE_DUMP_MARGIN   256     // records left out of a dump so a live writer cannot lap it
+
+__thread TraceRing *trace_ring = NULL;
+
+static TraceRing rings[TRACE_MAX_THREADS];
+static int n_rings = 0;
+static double ns_per_event = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *event_names[N_TRACE_EVENTS] = {
+#define TRACE_NAME(name) #name,
+  TRACE_EVENTS(TRACE_NAME)
+#undef TRACE_NAME
+};
+
+static void fatal_handler(int sig);
+static int write_all(int fd, const void *buf, size_t len);
+
+// Measures the cost of an event and installs the crash dump on the fatal signals. Called once
+// from the main thread before any other thread exists.
+int init_trace(void)
+{
+  TraceRing calibration = {"calibration", NULL, 0, 0};
+  struct timespec start, end;
+
+  if ((calibration.records = malloc(TRACE_RING_EVENTS * sizeof(TraceRecord))) == NULL)
+    return FAIL;
+
+  trace_ring = &calibration;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < TRACE_CALIBRATION; i++)
+    trace_event(TraceSession, TRACE_INSTANT_PHASE, i, 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  trace_ring = NULL;
+  free(calibration.records);
+
+  ns_per_event = ((end.tv_sec - start.tv_sec)*1e9 + (end.tv_nsec - start.tv_nsec))/TRACE_CALIBRATION;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = fatal_handler;
+  action.sa_flags = SA_RESETHAND;
+  sigaction(SIGSEGV, &action, NULL);
+  sigaction(SIGBUS, &action, NULL);
+  sigaction(SIGILL, &action, NULL);
+  sigaction(SIGFPE, &action, NULL);
+  sigaction(SIGABRT, &action, NULL);
+
+  cprint("[**] ", BRIGHT, CYAN);
+  printf("Event trace enabled, %.1f [ns] per event, %d events per thread\n", ns_per_event, TRACE_RING_EVENTS);
+
+  return OK;
+}
+
+// Gives the calling thread its ring. Threads recreated every session use the same name and get
+// their previous ring back, so the rings never run out in a long running daemon.
+void trace_thread(const char *name)
+{
+  TraceRing *ring = NULL;
+
+  pthread_mutex_lock(&lock);
+
+  for (int i = 0; i < n_rings && ring == NULL; i++)
+    if (strncmp(rings[i].name, name, TRACE_NAME_LEN) == 0)
+      ring = &rings[i];
+
+  if (ring == NULL && n_rings < TRACE_MAX_THREADS)
+  {
+    TraceRecord *records = calloc(TRACE_RING_EVENTS, sizeof(TraceRecord));
+    if (records != NULL)
+    {
+      ring = &rings[n_rings];
+      strncpy(ring->name, name, TRACE_NAME_LEN - 1);
+      ring->records = records;
+      ring->head = 0;
+      ring->start = 0;
+      __atomic_store_n(&n_rings, n_rings + 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  trace_ring = ring;
+}
+
+// Later dumps only hold what happened from here on.
+void trace_session_start(void)
+{
+  int n = __atomic_load_n(&n_rings, __ATOMIC_ACQUIRE);
+
+  for (int i = 0; i < n; i++)
+    rings[i].start = __atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE);
+}
+
+// Only uses async-signal-safe calls, it also runs from the fatal signal handler.
+int trace_dump(const char *path, int cause)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return FAIL;
+
+  int n = __atomic_load_n(&n_rings, __ATOMIC_ACQUIRE);
+  struct timespec realtime, monotonic;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+  TraceFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(TraceRecord);
+  header.n_threads = n;
+  header.n_events = N_TRACE_EVENTS;
+  header.cause = cause;
+  header.realtime_offset_ns = (int64_t)(realtime.tv_sec - monotonic.tv_sec)*1000000000 + (realtime.tv_nsec - monotonic.tv_nsec);
+  header.ns_per_event = ns_per_event;
+
+  int status = write_all(fd, &header, sizeof(header));
+
+  for (int i = 0; i < N_TRACE_EVENTS && status == OK; i++)
+  {
+    char name[TRACE_EVENT_LEN];
+    memset(name, 0, sizeof(name));
+    strncpy(name, event_names[i], TRACE_EVENT_LEN - 1);
+    status = write_all(fd, name, sizeof(name));
+  }
+
+  for (int i = 0; i < n && status == OK; i++)
+  {
+    TraceRing *ring = &rings[i];
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_RING_EVENTS - TRACE_DUMP_MARGIN ? head - (TRACE_RING_EVENTS - TRACE_DUMP_MARGIN) : 0;
+    if (first < ring->start)
+      first = ring->start;
+
+    TraceThreadHeader thread;
+    memset(&thread, 0, sizeof(thread));
+    memcpy(thread.name, ring->name, TRACE_NAME_LEN);
+    thread.n_records = head - first;
+    thread.n_lost = first - ring->start;
+    status = write_all(fd, &thread, sizeof(thread));
+
+    //oldest first, the part up to the end of the ring and then the wrapped part
+    uint64_t begin = first & (TRACE_RING_EVENTS - 1);
+    uint64_t count = head - first;
+    uint64_t to_end = TRACE_RING_EVENTS - begin < count ? TRACE_RING_EVENTS - begin : count;
+
+    if (status == OK)
+      status = write_all(fd, ring->records + begin, to_end * sizeof(TraceRecord));
+    if (status == OK && count > to_end)
+      status = write_all(fd, ring->records, (count - to_end) * sizeof(TraceRecord));
+  }
+
+  close(fd);
+  return status;
+}
+
+static void fatal_handler(int sig)
+{
+  trace_dump(TRACE_CRASH_FILE, sig);
+
+  //SA_RESETHAND restored the default action, let it terminate the process
+  raise(sig);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FAIL;
+    p += n;
+    len -= n;
+  }
+
+  return OK;
+}
+
+#endif  // TRACE
@@ -0,0 +1,376 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "transfer.h"
+#include "utils.h"
+#include "telemetry.h"
+#include "trace.h"
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "colour.h"
+
+#define STREAM_TIMEOUT_S      5   // socket timeout used to detect a dead link
+#define STREAM_DRAIN_RETRIES  30  // reconnect attempts once the capture is over
+
+static int send_all(int sock, const void *data, size_t len);
+static int recv_all(int sock, void *data, size_t len);
+static int stream_connect(Transfer *transfer);
+static int stream_block(Transfer *transfer, int sock, int fd, off_t offset, int index, uint8_t *buf);
+static int stream_file(Transfer *transfer, int sock, const char *path);
+static int stream_end(Transfer *transfer, int sock);
+static int wait_ack(int sock, uint32_t index);
+static void throttle(Transfer *transfer, size_t bytes);
+
+static struct timespec window_start;
+static double window_bytes;
+
+void *transfer_worker(void *arg)
+{
+  Transfer *transfer = (Transfer *)arg;
+  int sock = -1, fd = -1, retries = 0, expired_until = 0;
+  char path[256], fd_path[256] = "";
+  off_t offset;
+  uint8_t *buf;
+
+  // the SD writer always takes precedence over the offload
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+  //exit_handler() waits for the offload to wind down, it must never run on this thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TRACE_THREAD("transfer");
+
+  if (!(buf = malloc(transfer->block_size)))
+  {
+    fprintf(stderr, "no memory for transfer buffer\n");
+    return NULL;
+  }
+
+  while (transfer->state != Done)
+  {
+    int n_ready = __atomic_load_n(&transfer->n_ready, __ATOMIC_ACQUIRE);
+
+    if (sock < 0)
+    {
+      if ((sock = stream_connect(transfer)) < 0)
+      {
+        if (transfer->state == Draining && ++retries > STREAM_DRAIN_RETRIES)
+        {
+          cprint("[!!] ", BRIGHT, RED);
+          printf("Streaming aborted, %d/%d blocks on host. Data remains in %s\n", transfer->n_acked, transfer->n_blocks, transfer->storage->dir);
+          break;
+        }
+        sleep(1);
+      }
+      continue;
+    }
+
+    if (transfer->n_acked < n_ready)
+    {
+      int located = storage_locate(transfer->storage, transfer->n_acked, path, sizeof(path), &offset);
+
+      //a link outage longer than the retention window loses the oldest blocks, skip past them
+      if (located == STORAGE_EXPIRED)
+      {
+        //a resume may walk over blocks that were already counted
+        if (transfer->n_acked >= expired_until)
+        {
+          transfer->n_expired++;
+          expired_until = transfer->n_acked + 1;
+        }
+        transfer->n_acked++;
+        continue;
+      }
+      else if (located != OK)
+      {
+        usleep(10000);
+        continue;
+      }
+
+      //a segment may be renamed from .part between the lookup and the open, then look again
+      if (strcmp(path, fd_path) != 0)
+      {
+        if (fd >= 0) close(fd);
+        if ((fd = open(path, O_RDONLY)) < 0)
+        {
+          fd_path[0] = '\0';
+          usleep(10000);
+          continue;
+        }
+        strcpy(fd_path, path);
+      }
+
+      TRACE_BEGIN(TraceStreamBlock, transfer->n_acked, 0);
+      int status = stream_block(transfer, sock, fd, offset, transfer->n_acked, buf);
+      TRACE_END(TraceStreamBlock, transfer->n_acked, status);
+
+      if (status == STREAM_STATUS_OK)
+        __atomic_store_n(&transfer->n_acked, transfer->n_acked + 1, __ATOMIC_RELAXED);
+      else if (status != STREAM_STATUS_CRC)
+      {
+        close(sock);
+        sock = -1;
+      }
+      telemetry_cpu(TeleTransfer);
+    }
+    else if (transfer->state == Draining)
+    {
+      int status = OK;
+
+      for (int i = 0; i < transfer->n_files && status == OK; i++)
+        status = stream_file(transfer, sock, transfer->files[i]);
+
+      if (status == OK && stream_end(transfer, sock) == OK)
+      {
+        cprint("[OK] ", BRIGHT, GREEN);
+        printf("Streamed %d blocks to %s:%s/%s\n", transfer->n_acked - transfer->n_expired, transfer->host_ip, transfer->directory, transfer->name);
+        if (transfer->n_expired > 0)
+        {
+          cprint("[!!] ", BRIGHT, YELLOW);
+          printf("%d blocks expired from storage before they could be streamed\n", transfer->n_expired);
+        }
+        break;
+      }
+
+      close(sock);
+      sock = -1;
+    }
+    else
+      usleep(10000);
+  }
+
+  transfer->state = Done;
+
+  if (sock >= 0) close(sock);
+  if (fd >= 0) close(fd);
+  free(buf);
+
+  return NULL;
+}
+
+void init_transfer(Transfer *transfer, Configuration *config, Storage *storage)
+{
+  transfer->state = Streaming;
+  transfer->host_ip = config->host_ip;
+  transfer->port = config->stream_port;
+  transfer->rate_limit = config->stream_rate_limit * S1MB;
+  transfer->block_size = S2MB;
+  transfer->n_blocks = config->n_buffers;
+  transfer->n_ready = 0;
+  transfer->n_acked = 0;
+  transfer->n_expired = 0;
+  transfer->name = config->time_stamp;
+  transfer->directory = config->host_dir;
+  transfer->n_files = 0;
+  transfer->storage = storage;
+}
+
+void transfer_add_file(Transfer *transfer, const char *path)
+{
+  if (transfer->n_files < STREAM_MAX_FILES)
+    transfer->files[transfer->n_files++] = strdup(path);
+}
+
+void transfer_block_ready(Transfer *transfer, int n_ready)
+{
+  __atomic_store_n(&transfer->n_ready, n_ready, __ATOMIC_RELEASE);
+}
+
+void dinit_transfer(Transfer *transfer)
+{
+  for (int i = 0; i < transfer->n_files; i++)
+    free(transfer->files[i]);
+
+  transfer->n_files = 0;
+}
+
+static int send_all(int sock, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+
+  while (len > 0)
+  {
+    ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FAIL;
+    p += n;
+    len -= n;
+  }
+  return OK;
+}
+
+static int recv_all(int sock, void *data, size_t len)
+{
+  uint8_t *p = data;
+
+  while (len > 0)
+  {
+    ssize_t n = recv(sock, p, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FAIL;
+    p += n;
+    len -= n;
+  }
+  return OK;
+}
+
+static int stream_connect(Transfer *transfer)
+{
+  struct sockaddr_in addr;
+  struct timeval timeout = {STREAM_TIMEOUT_S, 0};
+  int one = 1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(transfer->port);
+  if (inet_pton(AF_INET, transfer->host_ip, &addr.sin_addr) != 1)
+    return FAIL;
+
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0)
+    return FAIL;
+
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(sock);
+    return FAIL;
+  }
+
+  uint32_t hello[4] = {htonl(STREAM_HELLO), htonl(STREAM_VERSION), htonl(transfer->block_size), htonl(transfer->n_blocks)};
+  char name[STREAM_NAME_LEN] = {0};
+  char directory[STREAM_DIR_LEN] = {0};
+  strncpy(name, transfer->name, STREAM_NAME_LEN - 1);
+  strncpy(directory, transfer->directory ? transfer->directory : "", STREAM_DIR_LEN - 1);
+
+  uint32_t resume[2];
+
+  if (send_all(sock, hello, sizeof(hello)) != OK || send_all(sock, name, sizeof(name)) != OK ||
+      send_all(sock, directory, sizeof(directory)) != OK || recv_all(sock, resume, sizeof(resume)) != OK ||
+      ntohl(resume[0]) != STREAM_RESUME)
+  {
+    close(sock);
+    return FAIL;
+  }
+
+  // never resume past what has actually been captured
+  int next_block = ntohl(resume[1]);
+  int n_ready = __atomic_load_n(&transfer->n_ready, __ATOMIC_ACQUIRE);
+  transfer->n_acked = next_block < n_ready ? next_block : n_ready;
+
+  clock_gettime(CLOCK_MONOTONIC, &window_start);
+  window_bytes = 0;
+
+  cprint("[**] ", BRIGHT, CYAN);
+  printf("Streaming to %s:%d, resuming at block %d\n", transfer->host_ip, transfer->port, transfer->n_acked);
+
+  return sock;
+}
+
+static int stream_block(Transfer *transfer, int sock, int fd, off_t offset, int index, uint8_t *buf)
+{
+  ssize_t length = pread(fd, buf, transfer->block_size, offset);
+  if (length <= 0)
+    return STREAM_STATUS_IO;
+
+  uint32_t header[4] = {htonl(STREAM_BLOCK), htonl(index), htonl(length), htonl(crc32(0, buf, length))};
+  if (send_all(sock, header, sizeof(header)) != OK)
+    return STREAM_STATUS_IO;
+
+  for (ssize_t sent = 0; sent < length; sent += STREAM_CHUNK)
+  {
+    size_t chunk = length - sent < STREAM_CHUNK ? length - sent : STREAM_CHUNK;
+    if (send_all(sock, buf + sent, chunk) != OK)
+      return STREAM_STATUS_IO;
+    throttle(transfer, chunk);
+  }
+
+  int status = wait_ack(sock, index);
+  return status == FAIL ? STREAM_STATUS_IO : status;
+}
+
+static int stream_file(Transfer *transfer, int sock, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return OK;  // optional files (e.g. a second ramp file) may not exist
+
+  fseek(f, 0, SEEK_END);
+  long length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t *data = malloc(length > 0 ? length : 1);
+  if (fread(data, 1, length, f) != (size_t)length)
+    length = 0;
+  fclose(f);
+
+  const char *base = strrchr(path, '/');
+  char name[STREAM_NAME_LEN] = {0};
+  strncpy(name, base ? base + 1 : path, STREAM_NAME_LEN - 1);
+
+  uint32_t header[3] = {htonl(STREAM_FILE), htonl(length), htonl(crc32(0, data, length))};
+  int status = FAIL;
+
+  if (send_all(sock, header, sizeof(header)) == OK && send_all(sock, name, sizeof(name)) == OK &&
+      send_all(sock, data, length) == OK)
+    status = wait_ack(sock, 0) == STREAM_STATUS_OK ? OK : FAIL;
+
+  free(data);
+  return status;
+}
+
+static int stream_end(Transfer *transfer, int sock)
+{
+  uint32_t end[2] = {htonl(STREAM_END), htonl(transfer->n_acked)};
+
+  if (send_all(sock, end, sizeof(end)) != OK)
+    return FAIL;
+
+  return wait_ack(sock, transfer->n_acked) == STREAM_STATUS_OK ? OK : FAIL;
+}
+
+static int wait_ack(int sock, uint32_t index)
+{
+  uint32_t ack[3];
+
+  if (recv_all(sock, ack, sizeof(ack)) != OK || ntohl(ack[0]) != STREAM_ACK || ntohl(ack[1]) != index)
+    return FAIL;
+
+  return ntohl(ack[2]);
+}
+
+static void throttle(Transfer *transfer, size_t bytes)
+{
+  if (transfer->rate_limit <= 0)
+    return;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  window_bytes += bytes;
+  double elapsed = (now.tv_sec - window_start.tv_sec) + (now.tv_nsec - window_start.tv_nsec)*1e-9;
+  double ahead = window_bytes/transfer->rate_limit - elapsed;
+
+  if (ahead > 0)
+    usleep((useconds_t)(ahead*1e6));
+
+  // restart the window every few seconds so an idle period does not build up burst credit
+  if (elapsed > 4.0)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &window_start);
+    window_bytes = 0;
+  }
+}
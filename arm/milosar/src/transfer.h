@@ -0,0 +1,64 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "constants.h"
+#include "storage.h"
+
+// Streaming offload protocol (all fields in network byte order)
+//
+//  sender -> receiver   HELLO  {magic, version, block_size, n_blocks, name[64], directory[192]}
+//  receiver -> sender   RESUME {magic, next_block}
+//  sender -> receiver   BLOCK  {magic, index, length, crc32} + payload
+//  receiver -> sender   ACK    {magic, index, status}
+//  sender -> receiver   FILE   {magic, length, crc32, name[64]} + payload
+//  receiver -> sender   ACK    {magic, 0, status}
+//  sender -> receiver   END    {magic, n_blocks}
+//  receiver -> sender   ACK    {magic, n_blocks, status}
+//
+// The receiver acknowledges a block only once it has been verified and written, so after a link
+// loss the sender reconnects and resumes from the RESUME index.
+#define STREAM_VERSION      1
+#define STREAM_HELLO        0x4D534830  // "MSH0"
+#define STREAM_RESUME       0x4D535230  // "MSR0"
+#define STREAM_BLOCK        0x4D534230  // "MSB0"
+#define STREAM_FILE         0x4D534630  // "MSF0"
+#define STREAM_END          0x4D534530  // "MSE0"
+#define STREAM_ACK          0x4D534130  // "MSA0"
+
+#define STREAM_STATUS_OK    0
+#define STREAM_STATUS_CRC   1
+#define STREAM_STATUS_IO    2
+
+#define STREAM_NAME_LEN     64
+#define STREAM_DIR_LEN      192
+#define STREAM_CHUNK        (64 << 10)  // granularity of the rate limiter
+#define STREAM_MAX_FILES    8
+
+enum TransferState {Streaming = 0, Draining = 1, Done = 2};
+
+typedef struct Transfer_S
+{
+  enum TransferState state;
+  char *host_ip;
+  int port;
+  double rate_limit;                // [bytes/s], 0 = unlimited
+  int block_size;
+  int n_blocks;                     // expected number of blocks
+  volatile int n_ready;             // blocks flushed to storage by the record thread
+  int n_acked;                      // blocks confirmed by the receiver
+  int n_expired;                    // blocks deleted by the retention policy before they were sent
+  Storage *storage;                 // capture output the blocks are read back from
+  char *name;                       // capture name, used by the receiver as folder name
+  char *directory;                  // destination directory on the host
+  char *files[STREAM_MAX_FILES];    // small files sent once the capture is complete
+  int n_files;
+  pthread_t thread;
+} Transfer;
+
+void *transfer_worker(void *arg);
+void init_transfer(Transfer *transfer, Configuration *config, Storage *storage);
+void transfer_add_file(Transfer *transfer, const char *path);
+void transfer_block_ready(Transfer *transfer, int n_ready);
+void dinit_transfer(Transfer *transfer);
+
+#endif  // TRANSFER_H
@@ -1,6 +1,7 @@
 #include "utils.h"
 #include <ctype.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 static int fd = 0;
 static FILE *fd_prop = 0;
@@ -66,6 +67,11 @@ void init_channel(Channel **channel, char letter, uint32_t dma_base, uint32_t st
 	(*channel)->letter[0] = letter;
 	(*channel)->dma_base = dma_base;
 	(*channel)->sts_base = sts_base;
+	(*channel)->dma = NULL;
+	(*channel)->sts = NULL;
+	(*channel)->is_stopping = false;
+	(*channel)->is_done = false;
+	(*channel)->error = NULL;
 }
 
 void dnit_channel(Channel **channel){
@@ -148,6 +154,36 @@ double elapsed_us(struct timeval start_time, struct timeval end_time)
 }
 
 
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+//reflected IEEE 802.3 polynomial, same as zlib
+static void crc_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	//the storage, stripe and transfer threads may make the first call together
+	pthread_once(&crc_once, crc_init);
+
+	crc = ~crc;
+	while (len--)
+		crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+
 void spin_cursor(void) 
 {
     static int pos=0;
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "colour.h"
+#include "version.h"
+
+#define DEFAULT_SOCKET  "/tmp/milosar.sock"
+#define REPLY_LEN       4096
+
+//-----------------------------------------------------------------------------------------------
+// Local function definitions
+//-----------------------------------------------------------------------------------------------
+void usage(void);
+int connect_socket(const char *path);
+int send_command(int sock, const char *command, char *reply, size_t reply_len);
+double elapsed_us(struct timespec *start, struct timespec *end);
+
+//-----------------------------------------------------------------------------------------------
+// Sends one command to a running milosar over its control socket and prints the reply.
+// With -n the command is repeated and the round-trip spread is reported, which is a direct
+// measure of how responsive the control path is while a capture is running.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	const char *path = DEFAULT_SOCKET;
+	int n_repeats = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:hv")) != -1)
+	{
+		switch (opt)
+		{
+			case 's': path = optarg; break;
+			case 'n': n_repeats = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+			case 'v': printf("milosar_ctl %s\n", MILOSAR_VERSION); return 0;
+			default: usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		usage();
+		return 1;
+	}
+
+	//join the remaining arguments into one command line
+	char command[512] = "";
+	for (int i = optind; i < argc; i++)
+	{
+		if (strlen(command) + strlen(argv[i]) + 2 >= sizeof(command))
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			printf("Command too long\n");
+			return 1;
+		}
+		if (i > optind) strcat(command, " ");
+		strcat(command, argv[i]);
+	}
+
+	int sock = connect_socket(path);
+	if (sock < 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not connect to %s: %s (is milosar running?)\n", path, strerror(errno));
+		return 1;
+	}
+
+	char reply[REPLY_LEN];
+	double min = 1e12, max = 0, sum = 0;
+	int status = 0;
+
+	for (int i = 0; i < n_repeats; i++)
+	{
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		status = send_command(sock, command, reply, sizeof(reply));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (status < 0)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			printf("Connection lost\n");
+			close(sock);
+			return 1;
+		}
+
+		double us = elapsed_us(&start, &end);
+		min = us < min ? us : min;
+		max = us > max ? us : max;
+		sum += us;
+	}
+
+	close(sock);
+
+	printf("%s", reply);
+
+	if (n_repeats > 1)
+		printf("round trip [us]: min %.0f, avg %.0f, max %.0f over %d commands\n", min, sum/n_repeats, max, n_repeats);
+	else
+		printf("round trip [us]: %.0f\n", sum);
+
+	return status == 0 ? 0 : 2;
+}
+
+void usage(void)
+{
+	printf("usage: milosar_ctl [-s socket] [-n repeats] <command> [arguments]\n\n");
+	printf("  ping                          round-trip check\n");
+	printf("  status                        live counters of the current session\n");
+	printf("  telemetry                     latency histograms and counters, as in summary.ini\n");
+	printf("  set <section>.<key> <value>   change a setup.ini key, only while idle\n");
+	printf("  profile <file.ini>            apply a setup.ini style profile, only while idle\n");
+	printf("  comment <text>                operator comment of the next session\n");
+	printf("  arm                           start a session now\n");
+	printf("  start <unix time>|+<seconds>  start a session at an absolute or relative time\n");
+	printf("                                absolute also as UTC YYYY-MM-DDTHH:MM:SS.sss\n");
+	printf("  stop                          end the running session cleanly\n");
+	printf("  shutdown                      leave the daemon once the current session is complete\n");
+	printf("  press [ms]                    simulated trigger button press, held low for ms (default 100)\n");
+	printf("  batch <file.ini>|cancel       run a batch of sessions back-to-back, or stop it after the\n");
+	printf("                                running session\n");
+}
+
+int connect_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		int error = errno;
+		close(sock);
+		errno = error;
+		return -1;
+	}
+
+	return sock;
+}
+
+// Returns 0 for an "ok" reply, 1 for "error" and -1 if the connection dropped.
+int send_command(int sock, const char *command, char *reply, size_t reply_len)
+{
+	char line[520];
+	int n = snprintf(line, sizeof(line), "%s\n", command);
+
+	if (send(sock, line, n, MSG_NOSIGNAL) != n)
+		return -1;
+
+	//the reply ends with the line starting with ok or error
+	size_t used = 0;
+	char *last = reply;
+	reply[0] = '\0';
+
+	while (used < reply_len - 1)
+	{
+		ssize_t r = recv(sock, reply + used, reply_len - 1 - used, 0);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+
+		used += r;
+		reply[used] = '\0';
+
+		char *end;
+		while ((end = strchr(last, '\n')) != NULL)
+		{
+			if (strncmp(last, "ok", 2) == 0)
+				return 0;
+			if (strncmp(last, "error", 5) == 0)
+				return 1;
+			last = end + 1;
+		}
+	}
+
+	return -1;
+}
+
+double elapsed_us(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec)*1e6 + (end->tv_nsec - start->tv_nsec)*1e-3;
+}
@@ -42,6 +42,7 @@
 
 #define SD_STORAGE_DIR      "/media/storage"
 #define SYNTH_REG_TEMP_DIR  "template/register_template.txt"
+#define MILOSAR_APP         "/opt/redpitaya/milosar/milosar"
 #define SETUP_FILE          "setup.ini"
 #define LOG_FILE            "log.txt"
 
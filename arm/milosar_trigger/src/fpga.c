@@ -0,0 +1,161 @@
+#include "fpga.h"
+#include "utils.h"
+#include "reg.h"
+#include <string.h>
+#include <time.h>
+#include "colour.h"
+
+static int hash_file(Bitstream *bitstream);
+static int is_operating(void);
+static int probe_registers(void);
+static int read_cache(uint32_t *crc, long *size);
+static void write_cache(Bitstream *bitstream);
+
+// Loads the bitstream unless the PL already runs this exact file. A reload costs a few hundred
+// ms and resets every register, so it is skipped when the cached content hash matches, the FPGA
+// manager reports the PL as operating and a known register reads back what is written to it.
+int fpga_load(Bitstream *bitstream, const char *path, int is_forced)
+{
+  uint32_t cached_crc;
+  long cached_size;
+
+  bitstream->path = path;
+  bitstream->is_reloaded = false;
+  bitstream->load_ms = 0;
+
+  if (hash_file(bitstream) != OK)
+  {
+    cprint("[!!] ", BRIGHT, RED);
+    printf("Could not read bitstream %s\n", path);
+    return FAIL;
+  }
+
+  if (!is_forced && read_cache(&cached_crc, &cached_size) == OK &&
+      cached_crc == bitstream->crc && cached_size == bitstream->size &&
+      is_operating() && probe_registers() == OK)
+  {
+    cprint("[OK] ", BRIGHT, GREEN);
+    printf("Bitstream %s already loaded (crc %08X), skipping reload\n", path, bitstream->crc);
+    return OK;
+  }
+
+  cprint("[**] ", BRIGHT, CYAN);
+  printf("Loading Bitstream: %s (crc %08X)%s\n", path, bitstream->crc, is_forced ? ", forced" : "");
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  char cmd[300];
+  snprintf(cmd, sizeof(cmd), "fpgautil -b %s", path);
+  int status = system("fpgautil -R") == 0 && system(cmd) == 0 ? OK : FAIL;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  bitstream->load_ms = (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)*1e-6;
+  bitstream->is_reloaded = true;
+
+  //only remember a design that is demonstrably up, a failed load must not be skipped next time
+  if (status == OK && is_operating() && probe_registers() == OK)
+    write_cache(bitstream);
+  else
+  {
+    remove(FPGA_CACHE_FILE);
+    status = FAIL;
+  }
+
+  cprint(status == OK ? "[OK] " : "[!!] ", BRIGHT, status == OK ? GREEN : RED);
+  printf("Bitstream %s in %.1f [ms]\n", status == OK ? "loaded" : "failed to load", bitstream->load_ms);
+
+  return status;
+}
+
+static int hash_file(Bitstream *bitstream)
+{
+  FILE *f = fopen(bitstream->path, "rb");
+  if (f == NULL)
+    return FAIL;
+
+  uint8_t buf[64 << 10];
+  size_t n;
+
+  bitstream->crc = 0;
+  bitstream->size = 0;
+
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+  {
+    bitstream->crc = crc32(bitstream->crc, buf, n);
+    bitstream->size += n;
+  }
+
+  fclose(f);
+  return bitstream->size > 0 ? OK : FAIL;
+}
+
+// Touching the AXI ports of an unconfigured PL stalls the bus, so ask the FPGA manager first.
+static int is_operating(void)
+{
+  char state[32] = "";
+  FILE *f = fopen(FPGA_STATE_FILE, "r");
+
+  if (f == NULL)
+    return false;
+
+  if (fgets(state, sizeof(state), f) == NULL)
+    state[0] = '\0';
+  fclose(f);
+
+  return strncmp(state, "operating", 9) == 0;
+}
+
+// The index register is plain read/write, a design that is up returns both patterns. Uses its
+// own mapping so it can run before the application's /dev/mem mappings exist.
+static int probe_registers(void)
+{
+  int fd = open("/dev/mem", O_RDWR | O_SYNC);
+  if (fd < 0)
+    return FAIL;
+
+  void *reg = mmap(NULL, SREG, PROT_READ | PROT_WRITE, MAP_SHARED, fd, FPGA_PROBE_ADDR);
+  if (reg == MAP_FAILED)
+  {
+    close(fd);
+    return FAIL;
+  }
+
+  uint32_t saved = get_reg(reg);
+  int status = OK;
+
+  set_reg(reg, 0x5A5AA5A5);
+  if ((uint32_t)get_reg(reg) != 0x5A5AA5A5)
+    status = FAIL;
+
+  set_reg(reg, 0xA5A55A5A);
+  if ((uint32_t)get_reg(reg) != 0xA5A55A5A)
+    status = FAIL;
+
+  set_reg(reg, saved);
+
+  munmap(reg, SREG);
+  close(fd);
+  return status;
+}
+
+static int read_cache(uint32_t *crc, long *size)
+{
+  FILE *f = fopen(FPGA_CACHE_FILE, "r");
+  if (f == NULL)
+    return FAIL;
+
+  int status = fscanf(f, "%x %ld", crc, size) == 2 ? OK : FAIL;
+  fclose(f);
+  return status;
+}
+
+static void write_cache(Bitstream *bitstream)
+{
+  FILE *f = fopen(FPGA_CACHE_FILE, "w");
+  if (f == NULL)
+    return;
+
+  fprintf(f, "%08X %ld %s\n", bitstream->crc, bitstream->size, bitstream->path);
+  fclose(f);
+}
@@ -0,0 +1,21 @@
+#ifndef FPGA_H
+#define FPGA_H
+
+#include "constants.h"
+
+#define FPGA_STATE_FILE     "/sys/class/fpga_manager/fpga0/state"
+#define FPGA_CACHE_FILE     "/tmp/milosar_bitstream"  // tmpfs, forgotten on power cycle like the PL
+#define FPGA_PROBE_ADDR     INDX_BASE_ADDR            // read/write register used as a sanity check
+
+typedef struct
+{
+  const char *path;
+  uint32_t crc;                     // crc32 of the bitstream file
+  long size;
+  int is_reloaded;                  // false if the loaded design already matched
+  double load_ms;                   // time spent in fpgautil
+} Bitstream;
+
+int fpga_load(Bitstream *bitstream, const char *path, int is_forced);
+
+#endif  // FPGA_H
@@ -11,10 +11,12 @@
 #include <fcntl.h>
 #include <time.h>
 #include <inttypes.h>
+#include <errno.h>
 
 #include "utils.h"
 #include "colour.h"
 #include "trigger.h"
+#include "fpga.h"
 #include "version.h"
 
 //-----------------------------------------------------------------------------------------------
@@ -23,7 +25,7 @@
 void splash(void);
 void init_rp_trigger(Trigger *trigger);
 void dinit_rp_trigger(Trigger *trigger);
-void load_bitstream(void);
+void load_bitstream(int is_forced);
 void exit_handler(int sig);
 
 //-----------------------------------------------------------------------------------------------
@@ -55,18 +57,12 @@ void exit_handler(int sig)
 	exit(sig == -1 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
-void load_bitstream(void)
+void load_bitstream(int is_forced)
 {
-  cprint("[**] ", BRIGHT, CYAN);
-  printf("Loading Bitstream: system_wrapper.bit.bin");
-
-  // clear bitstream
-  system("fpgautil -R");
+  Bitstream bitstream;
 
-  // load bitstream
-	char cmd[100];
-	sprintf(cmd, "fpgautil -b system_wrapper.bit.bin");
-	system(cmd);
+  // skipped when the PL already runs this exact design
+  ASSERT(fpga_load(&bitstream, "system_wrapper.bit.bin", is_forced), "Failed to load bitstream.");
 }
 
 void init_rp_trigger(Trigger *trigger)
@@ -99,12 +95,37 @@ void dinit_rp_trigger(Trigger *trigger)
 int main(int argc, char **argv)
 {
   uint8_t capture_count = 0;
+  int is_relaunch = false, is_forced = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-l") == 0) is_relaunch = true;
+    if (strcmp(argv[i], "-f") == 0) is_forced = true;
+  }
+
   signal(SIGINT, exit_handler);
   signal(SIGTSTP, exit_handler);
 
   // Display splash screen
   splash();
 
+  // The capture daemon owns the trigger button and keeps the bitstream, mappings and synths
+  // initialised between captures. Relaunching milosar per press (-l) is only the fallback.
+  if (!is_relaunch)
+  {
+    cprint("[**] ", BRIGHT, CYAN);
+    printf("Starting capture daemon: %s -d\n", MILOSAR_APP);
+    fflush(stdout);
+
+    if (is_forced)
+      execl(MILOSAR_APP, MILOSAR_APP, "-d", "-f", (char *)NULL);
+    else
+      execl(MILOSAR_APP, MILOSAR_APP, "-d", (char *)NULL);
+
+    cprint("[!!] ", BRIGHT, RED);
+    printf("Could not start the capture daemon (%s), relaunching per trigger instead\n", strerror(errno));
+  }
+
    while (1)
   {
      // Trigger Button
@@ -112,7 +133,8 @@ int main(int argc, char **argv)
 
     // #pragma region SpinUp
     // init system
-    load_bitstream();
+    load_bitstream(is_forced);
+    is_forced = false;
     init_rp_trigger(trigger);
 
     // start trigger thread
@@ -124,10 +146,8 @@ int main(int argc, char **argv)
     // #pragma endregion SpinUp
     
     // Wait for Trigger button press to start capture
-    while(trigger->state != Pressed)
-    {
-      usleep(100000); // service other threads
-    }
+    while (sem_wait(&trigger->pressed) != 0)
+      ; // interrupted by a signal, keep waiting
 
     // Tigger button pressed
     // Disable the trigger, while servicing the rest of the main loop
@@ -151,7 +171,7 @@ int main(int argc, char **argv)
     cprint("\n\n[!!] ", BRIGHT, MAGENTA);
     printf("Calling Milosar Application...\n");
 
-    if ( system("/opt/redpitaya/milosar/milosar") != 0 )
+    if ( system(MILOSAR_APP) != 0 )
       printf("ERROR executing system() command\n");
 
     cprint("[XX] ", BRIGHT, MAGENTA);
@@ -6,24 +6,53 @@
 
 static void *gpio_trigger_switch;
 
-uint8_t debounce(void);
+static int64_t monotonic_ns(void);
 
+// Same time based debounce as the panel thread of milosar: a press is the first low sample after
+// TRIGGER_DEBOUNCE_MS released, confirmed once it stayed low for TRIGGER_GLITCH_US. The input is
+// sampled fast while it moves and backs off while it is still.
 void *trigger_worker(void *arg)
 {
   Trigger *trigger = (Trigger *)arg;
+  int level = 1, is_locked = true;
+  int64_t changed_ns = monotonic_ns(), edge_ns = 0;
+  int64_t poll_us = TRIGGER_POLL_MAX_US;
 
   while (trigger->state != Disabled)
   {
-    if (debounce())
+    int64_t now = monotonic_ns();
+    int sample = get_reg(gpio_trigger_switch) & 1;
+
+    if (sample != level)
+    {
+      if (sample == 0 && !is_locked && edge_ns == 0)
+        edge_ns = now;
+      level = sample;
+      changed_ns = now;
+      poll_us = TRIGGER_POLL_MIN_US;
+    }
+    else if (edge_ns == 0 && poll_us < TRIGGER_POLL_MAX_US)
+      poll_us *= 2;
+
+    if (level == 0 && edge_ns > 0 && now - changed_ns >= TRIGGER_GLITCH_US*1000L)
     {
       cprint("[!!] ", BRIGHT, YELLOW);
-      printf("Trigger Button pressed!\n");
+      printf("Trigger Button pressed! (%.1f [ms] after its edge)\n", (now - edge_ns)*1e-6);
       trigger->state = Pressed;
+      is_locked = true;
+      edge_ns = 0;
+      sem_post(&trigger->pressed);
     }
-    else
-      if (trigger->reset)
+
+    if (level == 1 && now - changed_ns >= TRIGGER_DEBOUNCE_MS*1000000L)
+    {
+      is_locked = false;
+      edge_ns = 0;
+      if (trigger->reset && trigger->state == Pressed)
         trigger->state = Unpressed;
-    usleep(10000);
+    }
+
+    usleep(poll_us);
   }
 
   // printf("Shutting down trigger\n");
@@ -38,6 +67,8 @@ void init_trigger(Trigger *trigger)
   ASSERT(create_map(SREG, MAP_SHARED, &gpio_trigger_switch, GPIO_TRIGGER_SWITCH), "Failed to allocate map for gpio trigger switch register.");
   set_reg(gpio_trigger_switch, HIGH);
   trigger->state = Unpressed;
+  trigger->reset = 0;
+  sem_init(&trigger->pressed, 0, 0);
 }
 
 void dinit_trigger(Trigger *trigger)
@@ -46,11 +77,12 @@ void dinit_trigger(Trigger *trigger)
   trigger->state = Unpressed;
   trigger->reset = 0;
   ASSERT(destroy_map(SREG, &gpio_trigger_switch), "Failed to deallocate gpio_trigger_switch memory.");
+  sem_destroy(&trigger->pressed);
 }
 
-uint8_t debounce(void) {
-  static uint16_t state = 0;
-  state = (state<<1) | (uint16_t)get_reg(gpio_trigger_switch) | 0xfe00;
-  //printf("Trigegr State: %d\n", state);
-  return (state == 0xff00);
+static int64_t monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec*1000000000 + now.tv_nsec;
 }
@@ -2,6 +2,12 @@
 #define TRIGGER_H
 
 #include "constants.h"
+#include <semaphore.h>
+
+#define TRIGGER_POLL_MIN_US   250   // sampling right after the input changed
+#define TRIGGER_POLL_MAX_US   2000  // sampling once the input has been stable for a while
+#define TRIGGER_GLITCH_US     1000  // a press must stay low this long to count
+#define TRIGGER_DEBOUNCE_MS   20    // and follow at least this long released
 
 enum TriggerState {Unpressed = 0, Pressed = 1, Disabled = 2};
 
@@ -10,6 +16,7 @@ typedef struct Trigger_S
   enum TriggerState state;
   pthread_t thread;
   uint8_t reset;
+  sem_t pressed;                // posted once per press, the main loop waits on it
 } Trigger;
 
 void *trigger_worker(void *arg);
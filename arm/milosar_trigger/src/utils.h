@@ -35,6 +35,8 @@ uint32_t get_phase_offset(double desired_offset);
 
 double elapsed_us(struct timeval start_time, struct timeval end_time);
 
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
+
 void spin_cursor(void); 
 void start_countdown(int delay);
 
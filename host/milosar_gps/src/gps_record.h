@@ -0,0 +1,58 @@
+#ifndef GPS_RECORD_H
+#define GPS_RECORD_H
+
+#include <stdint.h>
+
+// Layout of gps.bin in the experiment directory, one GpsHeader followed by GpsFix records in the
+// order they were received. Little endian, no padding. host/milosar_gps has a copy of this file,
+// keep the two in step.
+//
+// monotonic_ns is CLOCK_MONOTONIC when the report was read from gpsd, the same clock as the block
+// times in timestamps.csv, so a fix is placed against the capture without going through the
+// system clock. time is the fix time the receiver reported. Values gpsd did not send are NAN.
+
+#define GPS_MAGIC           0x53504747  // "GGPS" little endian
+#define GPS_VERSION         1
+#define GPS_FILE            "gps.bin"
+
+enum GpsFlag
+{
+  GpsLocked = 1,                    // mode and satellites met min_mode and min_sats
+  GpsVelocityNed = 2,               // velocity from velN/velE/velD, otherwise from speed, track, climb
+  GpsAfterGap = 4                   // first fix after a reconnect or a dropped record
+};
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;             // sizeof(GpsFix)
+  uint32_t reserved;
+  int64_t tcu_monotonic_ns;         // TCU enable of the session, 0 if not known yet
+  int64_t tcu_realtime_ns;
+} GpsHeader;
+
+typedef struct
+{
+  int64_t monotonic_ns;             // report read
+  int64_t realtime_ns;
+  double time;                      // fix time [s] since the unix epoch
+  double latitude;                  // [deg]
+  double longitude;                 // [deg]
+  double altitude;                  // [m] above the ellipsoid, above msl if gpsd has no altHAE
+  float velocity[3];                // north, east, down [m/s]
+  float ept;                        // time error estimate [s], 95 %
+  float epx;                        // longitude error estimate [m]
+  float epy;                        // latitude error estimate [m]
+  float epv;                        // altitude error estimate [m]
+  float eps;                        // speed error estimate [m/s]
+  float speed;                      // over ground [m/s]
+  float track;                      // course over ground [deg] from true north
+  uint32_t sequence;                // reports read since the reader started
+  uint8_t mode;                     // 0 unknown, 1 no fix, 2 2D, 3 3D
+  uint8_t n_used;                   // satellites in the solution, from the last SKY report
+  uint8_t n_visible;
+  uint8_t flags;                    // enum GpsFlag
+} GpsFix;
+
+#endif  // GPS_RECORD_H
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "colour.h"
+#include "gps_record.h"
+#include "version.h"
+
+#define GPSD_PORT       2947
+#define LINE_LEN        8192
+#define WATCH_WAIT_MS   2000
+
+//-----------------------------------------------------------------------------------------------
+// Local function definitions
+//-----------------------------------------------------------------------------------------------
+void usage(void);
+int convert(FILE *in, FILE *out);
+int replay(int sock, FILE *log, double speed, int is_loop, int is_now);
+int report_time(const char *line, double *time);
+void restamp(const char *line, char *out, size_t len);
+int send_line(int sock, const char *line);
+double now_seconds(int clock);
+
+//-----------------------------------------------------------------------------------------------
+// Converts a milosar gps.bin to CSV, or stands in for gpsd by replaying a JSON log recorded with
+// gpspipe -w to every client that connects, paced by the time of its TPV reports.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	const char *log_path = NULL;
+	int port = GPSD_PORT;
+	double speed = 1;
+	int is_loop = 0;
+	int is_now = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:g:p:x:lnh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o': output = optarg; break;
+		case 'g': log_path = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'x': speed = atof(optarg); break;
+		case 'l': is_loop = 1; break;
+		case 'n': is_now = 1; break;
+		default:  usage(); return EXIT_FAILURE;
+		}
+	}
+
+	if (log_path == NULL)
+	{
+		if (optind != argc - 1)
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+
+		FILE *in = fopen(argv[optind], "rb");
+		FILE *out = output != NULL ? fopen(output, "w") : stdout;
+		if (in == NULL || out == NULL)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			printf("Could not open %s\n", in == NULL ? argv[optind] : output);
+			return EXIT_FAILURE;
+		}
+
+		int status = convert(in, out);
+		fclose(in);
+		if (out != stdout)
+			fclose(out);
+		return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	FILE *log = fopen(log_path, "r");
+	if (log == NULL || speed <= 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not open %s\n", log_path);
+		return EXIT_FAILURE;
+	}
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, 1) < 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not listen on port %d\n", port);
+		return EXIT_FAILURE;
+	}
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("MiloSAR gpsd replay %s of %s on port %d, %.1fx\n", MILOSAR_VERSION, log_path, port, speed);
+	fflush(stdout);
+
+	//one client at a time, every client gets the log from its start
+	while (1)
+	{
+		int sock = accept(server, NULL, NULL);
+		if (sock < 0)
+			continue;
+
+		cprint("[OK] ", BRIGHT, GREEN);
+		printf("Client connected\n");
+		fflush(stdout);
+
+		rewind(log);
+		int n_sent = replay(sock, log, speed, is_loop, is_now);
+		close(sock);
+
+		cprint("[**] ", BRIGHT, CYAN);
+		printf("Client gone after %d reports\n", n_sent);
+		fflush(stdout);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_gps %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_gps [-o gps.csv] gps.bin\n");
+	fprintf(stderr, "       milosar_gps -g log.json [-p port] [-x speed] [-l] [-n]\n");
+	fprintf(stderr, "  -o  write the CSV here instead of stdout\n");
+	fprintf(stderr, "  -g  serve a gpspipe -w log like gpsd does\n");
+	fprintf(stderr, "  -p  tcp port to listen on (default %d)\n", GPSD_PORT);
+	fprintf(stderr, "  -x  replay speed (default 1)\n");
+	fprintf(stderr, "  -l  start the log again at its end\n");
+	fprintf(stderr, "  -n  replace the report times with the current time\n");
+}
+
+int convert(FILE *in, FILE *out)
+{
+	GpsHeader header;
+	GpsFix fix;
+
+	if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != GPS_MAGIC)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Not a milosar gps log\n");
+		return -1;
+	}
+
+	if (header.version != GPS_VERSION || header.record_size != sizeof(GpsFix))
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Unsupported gps log version %d, record size %d\n", header.version, header.record_size);
+		return -1;
+	}
+
+	//seconds from the TCU enable, the same origin as the capture data
+	fprintf(out, "tcu_s,monotonic_ns,realtime_ns,time,latitude,longitude,altitude,vel_n,vel_e,vel_d,"
+	             "ept,epx,epy,epv,eps,speed,track,mode,n_used,n_visible,flags,sequence\n");
+
+	while (fread(&fix, sizeof(fix), 1, in) == 1)
+	{
+		double tcu_s = header.tcu_monotonic_ns != 0 ? (fix.monotonic_ns - header.tcu_monotonic_ns)*1e-9 : 0;
+
+		fprintf(out, "%.6f,%lld,%lld,%.3f,%.9f,%.9f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%u,%u,%u,%u,%u\n",
+		        tcu_s, (long long)fix.monotonic_ns, (long long)fix.realtime_ns, fix.time, fix.latitude, fix.longitude, fix.altitude,
+		        fix.velocity[0], fix.velocity[1], fix.velocity[2], fix.ept, fix.epx, fix.epy, fix.epv, fix.eps, fix.speed, fix.track,
+		        fix.mode, fix.n_used, fix.n_visible, fix.flags, fix.sequence);
+	}
+
+	return 0;
+}
+
+// Sends the log to one client until it disconnects or the log ends. Returns the lines sent.
+int replay(int sock, FILE *log, double speed, int is_loop, int is_now)
+{
+	char line[LINE_LEN], stamped[LINE_LEN];
+	double log_start = -1, wall_start = now_seconds(CLOCK_MONOTONIC);
+	int n_sent = 0;
+
+	//gpsd greets first and starts reporting once it is watched
+	if (send_line(sock, "{\"class\":\"VERSION\",\"release\":\"replay\",\"rev\":\"" MILOSAR_VERSION "\",\"proto_major\":3,\"proto_minor\":14}\n") != 0)
+		return 0;
+
+	struct pollfd fds = {sock, POLLIN, 0};
+	if (poll(&fds, 1, WATCH_WAIT_MS) == 1 && recv(sock, line, sizeof(line), 0) <= 0)
+		return 0;
+
+	while (1)
+	{
+		if (fgets(line, sizeof(line), log) == NULL)
+		{
+			if (!is_loop)
+				return n_sent;
+
+			//the next pass continues from where the time of this one ended
+			rewind(log);
+			log_start = -1;
+			wall_start = now_seconds(CLOCK_MONOTONIC);
+			continue;
+		}
+
+		double time;
+		if (report_time(line, &time) == 0)
+		{
+			if (log_start < 0)
+				log_start = time;
+
+			double wait = wall_start + (time - log_start)/speed - now_seconds(CLOCK_MONOTONIC);
+			if (wait > 0)
+				usleep((useconds_t)(wait*1e6));
+		}
+
+		if (is_now)
+		{
+			restamp(line, stamped, sizeof(stamped));
+			strcpy(line, stamped);
+		}
+
+		if (send_line(sock, line) != 0)
+			return n_sent;
+		n_sent++;
+	}
+}
+
+// Time of a TPV report, the one report class that paces the replay.
+int report_time(const char *line, double *time)
+{
+	const char *p = strstr(line, "\"time\":\"");
+	struct tm tm;
+	double seconds;
+
+	if (strstr(line, "\"class\":\"TPV\"") == NULL || p == NULL)
+		return -1;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(p + 8, "%4d-%2d-%2dT%2d:%2d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &seconds) != 6)
+		return -1;
+
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	*time = timegm(&tm) + seconds;
+	return 0;
+}
+
+// Copies line with its time replaced by the current UTC time.
+void restamp(const char *line, char *out, size_t len)
+{
+	const char *p = strstr(line, "\"time\":\"");
+	const char *end = p != NULL ? strchr(p + 8, '"') : NULL;
+
+	if (end == NULL)
+	{
+		snprintf(out, len, "%s", line);
+		return;
+	}
+
+	double now = now_seconds(CLOCK_REALTIME);
+	time_t seconds = (time_t)now;
+	char utc[32];
+	strftime(utc, sizeof(utc), "%Y-%m-%dT%H:%M:%S", gmtime(&seconds));
+
+	snprintf(out, len, "%.*s%s.%03dZ%s", (int)(p + 8 - line), line, utc, (int)((now - seconds)*1000), end);
+}
+
+int send_line(int sock, const char *line)
+{
+	size_t n = strlen(line);
+	return send(sock, line, n, MSG_NOSIGNAL) == (ssize_t)n ? 0 : -1;
+}
+
+double now_seconds(int clock)
+{
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
@@ -0,0 +1,16 @@
+#ifndef __VERSION_H
+#define __VERSION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef MILOSAR_VERSION
+#define MILOSAR_VERSION "1.2.0"
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
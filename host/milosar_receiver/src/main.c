@@ -0,0 +1,325 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "colour.h"
+#include "stream.h"
+#include "utils.h"
+#include "version.h"
+
+//-----------------------------------------------------------------------------------------------
+// Local function definitions
+//-----------------------------------------------------------------------------------------------
+void usage(void);
+int serve(int sock, const char *root);
+int read_next_block(const char *path);
+int write_next_block(const char *path, int next_block);
+int reply(int sock, uint32_t index, uint32_t status);
+void sanitise(char *name);
+
+//-----------------------------------------------------------------------------------------------
+// Main
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	int port = STREAM_PORT;
+	int is_once = 0;
+	char *root = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:d:1h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p': port = atoi(optarg); break;
+		case 'd': root = optarg; break;
+		case '1': is_once = 1; break;
+		default:  usage(); return EXIT_FAILURE;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, 1) < 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not listen on port %d\n", port);
+		return EXIT_FAILURE;
+	}
+
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("MiloSAR Receiver %s listening on port %d\n", MILOSAR_VERSION, port);
+
+	while (1)
+	{
+		struct sockaddr_in peer;
+		socklen_t peer_len = sizeof(peer);
+		int sock = accept(server, (struct sockaddr *)&peer, &peer_len);
+		if (sock < 0)
+			continue;
+
+		cprint("[**] ", BRIGHT, CYAN);
+		printf("Connection from %s\n", inet_ntoa(peer.sin_addr));
+
+		int is_complete = serve(sock, root) == OK;
+		close(sock);
+
+		if (is_once && is_complete)
+			break;
+	}
+
+	close(server);
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	printf("usage: milosar_receiver [-p port] [-d directory] [-1]\n");
+	printf("  -p  tcp port to listen on (default %d)\n", STREAM_PORT);
+	printf("  -d  store captures here instead of the directory requested by the radar\n");
+	printf("  -1  exit after the first completed capture\n");
+}
+
+// Serve one connection. Returns OK once the capture has been completed with END, FAIL if the
+// link dropped, in which case the radar reconnects and resumes from the last acknowledged block.
+int serve(int sock, const char *root)
+{
+	uint32_t hello[4];
+	char name[STREAM_NAME_LEN];
+	char directory[STREAM_DIR_LEN];
+
+	if (recv_all(sock, hello, sizeof(hello)) != OK || recv_all(sock, name, sizeof(name)) != OK ||
+	    recv_all(sock, directory, sizeof(directory)) != OK)
+		return FAIL;
+
+	name[STREAM_NAME_LEN - 1] = '\0';
+	directory[STREAM_DIR_LEN - 1] = '\0';
+	sanitise(name);
+
+	uint32_t block_size = ntohl(hello[2]);
+	uint32_t n_blocks = ntohl(hello[3]);
+
+	if (ntohl(hello[0]) != STREAM_HELLO || ntohl(hello[1]) != STREAM_VERSION || block_size == 0 || block_size > STREAM_MAX_BLOCK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Rejected connection: unsupported stream header\n");
+		return FAIL;
+	}
+
+	char capture_dir[512], data_path[640], ack_path[640];
+	snprintf(capture_dir, sizeof(capture_dir), "%s/%s", root ? root : (directory[0] ? directory : "."), name);
+	snprintf(data_path, sizeof(data_path), "%s/%s.bin", capture_dir, name);
+	snprintf(ack_path, sizeof(ack_path), "%s/%s.bin.ack", capture_dir, name);
+
+	if (make_path(capture_dir) != OK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not create %s\n", capture_dir);
+		return FAIL;
+	}
+
+	int fd = open(data_path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return FAIL;
+
+	int next_block = read_next_block(ack_path);
+	uint32_t resume[2] = {htonl(STREAM_RESUME), htonl(next_block)};
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Capture %s: %u blocks of %u bytes, resuming at block %d\n", name, n_blocks, block_size, next_block);
+
+	uint8_t *buf = malloc(block_size > STREAM_MAX_FILE ? block_size : STREAM_MAX_FILE);
+	int status = send_all(sock, resume, sizeof(resume));
+	int is_complete = 0;
+	long long bytes = 0;
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (status == OK && !is_complete)
+	{
+		uint32_t magic;
+		if ((status = recv_all(sock, &magic, sizeof(magic))) != OK)
+			break;
+
+		switch (ntohl(magic))
+		{
+		case STREAM_BLOCK:
+		{
+			uint32_t header[3];
+			if ((status = recv_all(sock, header, sizeof(header))) != OK)
+				break;
+
+			uint32_t index = ntohl(header[0]);
+			uint32_t length = ntohl(header[1]);
+			uint32_t crc = ntohl(header[2]);
+
+			if (length > block_size || (status = recv_all(sock, buf, length)) != OK)
+			{
+				status = FAIL;
+				break;
+			}
+
+			uint32_t result = STREAM_STATUS_OK;
+
+			if (crc32(0, buf, length) != crc)
+			{
+				cprint("[!!] ", BRIGHT, YELLOW);
+				printf("Block %u failed checksum, requesting resend\n", index);
+				result = STREAM_STATUS_CRC;
+			}
+			else if (pwrite(fd, buf, length, (off_t)index * block_size) != (ssize_t)length || fdatasync(fd) != 0)
+				result = STREAM_STATUS_IO;
+			else
+			{
+				if ((int)index + 1 > next_block)
+					next_block = index + 1;
+				if (write_next_block(ack_path, next_block) != OK)
+					result = STREAM_STATUS_IO;
+				bytes += length;
+			}
+
+			status = reply(sock, index, result);
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec)*1e-9;
+			printf("\r%d/%u blocks (%.2f MB/s)", next_block, n_blocks, elapsed > 0 ? bytes/elapsed/(1 << 20) : 0.0);
+			fflush(stdout);
+			break;
+		}
+		case STREAM_FILE:
+		{
+			uint32_t header[2];
+			char file_name[STREAM_NAME_LEN];
+
+			if ((status = recv_all(sock, header, sizeof(header))) != OK || (status = recv_all(sock, file_name, sizeof(file_name))) != OK)
+				break;
+
+			uint32_t length = ntohl(header[0]);
+			uint32_t crc = ntohl(header[1]);
+			file_name[STREAM_NAME_LEN - 1] = '\0';
+			sanitise(file_name);
+
+			if (length > STREAM_MAX_FILE || (status = recv_all(sock, buf, length)) != OK)
+			{
+				status = FAIL;
+				break;
+			}
+
+			uint32_t result = STREAM_STATUS_CRC;
+			if (crc32(0, buf, length) == crc)
+			{
+				char file_path[640];
+				snprintf(file_path, sizeof(file_path), "%s/%s", capture_dir, file_name);
+				FILE *f = fopen(file_path, "wb");
+				result = f && fwrite(buf, 1, length, f) == length ? STREAM_STATUS_OK : STREAM_STATUS_IO;
+				if (f) fclose(f);
+			}
+
+			status = reply(sock, 0, result);
+			break;
+		}
+		case STREAM_END:
+		{
+			uint32_t n_sent;
+			if ((status = recv_all(sock, &n_sent, sizeof(n_sent))) != OK)
+				break;
+
+			n_sent = ntohl(n_sent);
+			status = reply(sock, n_sent, (int)n_sent == next_block ? STREAM_STATUS_OK : STREAM_STATUS_IO);
+			is_complete = status == OK && (int)n_sent == next_block;
+			break;
+		}
+		default:
+			status = FAIL;
+			break;
+		}
+	}
+
+	printf("\n");
+	if (is_complete)
+	{
+		unlink(ack_path);
+		cprint("[OK] ", BRIGHT, GREEN);
+		printf("Capture %s complete: %d blocks in %s\n", name, next_block, capture_dir);
+	}
+	else
+	{
+		cprint("[!!] ", BRIGHT, YELLOW);
+		printf("Link lost at block %d, waiting for the radar to resume\n", next_block);
+	}
+
+	free(buf);
+	close(fd);
+	return is_complete ? OK : FAIL;
+}
+
+int read_next_block(const char *path)
+{
+	int next_block = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f)
+	{
+		if (fscanf(f, "%d", &next_block) != 1)
+			next_block = 0;
+		fclose(f);
+	}
+	return next_block;
+}
+
+// the acknowledged block count is written to a temporary file and renamed into place so a
+// crash of the receiver never leaves a count that is ahead of the data
+int write_next_block(const char *path, int next_block)
+{
+	char tmp[700];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	FILE *f = fopen(tmp, "w");
+	if (f == NULL)
+		return FAIL;
+
+	fprintf(f, "%d\n", next_block);
+	fclose(f);
+
+	return rename(tmp, path) == 0 ? OK : FAIL;
+}
+
+int reply(int sock, uint32_t index, uint32_t status)
+{
+	uint32_t ack[3] = {htonl(STREAM_ACK), htonl(index), htonl(status)};
+	return send_all(sock, ack, sizeof(ack));
+}
+
+// names come from the network, never let them escape the capture directory
+void sanitise(char *name)
+{
+	for (char *p = name; *p; p++)
+		if (*p == '/' || *p == '\\')
+			*p = '_';
+
+	if (name[0] == '\0')
+		strcpy(name, "capture");
+	else if (name[0] == '.')
+		name[0] = '_';
+}
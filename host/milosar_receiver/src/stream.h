@@ -0,0 +1,24 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+// Streaming offload protocol, must match arm/milosar/src/transfer.h
+#define STREAM_VERSION      1
+#define STREAM_HELLO        0x4D534830  // "MSH0"
+#define STREAM_RESUME       0x4D535230  // "MSR0"
+#define STREAM_BLOCK        0x4D534230  // "MSB0"
+#define STREAM_FILE         0x4D534630  // "MSF0"
+#define STREAM_END          0x4D534530  // "MSE0"
+#define STREAM_ACK          0x4D534130  // "MSA0"
+
+#define STREAM_STATUS_OK    0
+#define STREAM_STATUS_CRC   1
+#define STREAM_STATUS_IO    2
+
+#define STREAM_NAME_LEN     64
+#define STREAM_DIR_LEN      192
+#define STREAM_MAX_BLOCK    (16 << 20)
+#define STREAM_MAX_FILE     (1 << 20)
+
+#define STREAM_PORT         5800
+
+#endif  // STREAM_H
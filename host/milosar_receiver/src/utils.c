@@ -0,0 +1,81 @@
+#include "utils.h"
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+	static uint32_t table[256];
+	static int is_table = 0;
+	const uint8_t *p = data;
+
+	//reflected IEEE 802.3 polynomial, same as zlib
+	if (!is_table)
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		is_table = 1;
+	}
+
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+int send_all(int sock, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len > 0)
+	{
+		ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return FAIL;
+		p += n;
+		len -= n;
+	}
+	return OK;
+}
+
+int recv_all(int sock, void *data, size_t len)
+{
+	uint8_t *p = data;
+
+	while (len > 0)
+	{
+		ssize_t n = recv(sock, p, len, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return FAIL;
+		p += n;
+		len -= n;
+	}
+	return OK;
+}
+
+int make_path(const char *path)
+{
+	char tmp[512];
+	strncpy(tmp, path, sizeof(tmp) - 1);
+	tmp[sizeof(tmp) - 1] = '\0';
+
+	for (char *p = tmp + 1; *p; p++)
+	{
+		if (*p == '/')
+		{
+			*p = '\0';
+			if (mkdir(tmp, 0755) < 0 && errno != EEXIST) return FAIL;
+			*p = '/';
+		}
+	}
+	if (mkdir(tmp, 0755) < 0 && errno != EEXIST) return FAIL;
+
+	return OK;
+}
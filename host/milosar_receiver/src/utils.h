@@ -0,0 +1,15 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define OK    0
+#define FAIL  -1
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
+int send_all(int sock, const void *data, size_t len);
+int recv_all(int sock, void *data, size_t len);
+int make_path(const char *path);
+
+#endif
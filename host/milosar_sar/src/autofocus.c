@@ -0,0 +1,508 @@
+#include "autofocus.h"
+#include "colour.h"
+#include "pool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define FALL_DB             10      // [dB] below the peak, the width of the mean peak
+#define LANES               8       // partial sums of a reduction, one vector of them
+#define SCRATCH             12      // floats per pulse per thread
+
+typedef struct
+{
+	double power;
+	int line, pixel;
+} Bright;
+
+static int brighter(const void *a, const void *b);
+static float complex pixel(const Autofocus *af, int line, int along);
+static void frequencies(const Autofocus *af, int t, int along, float *f);
+static void phasors(const float *f, int n_pulses, int first, float dx, int sign, float *p);
+static inline void step(float *p, int n_pulses);
+static void forward(const float complex *x, int n, int first, float dx, const float *f, int n_pulses, float *scratch, float complex *out);
+static void inverse(const float *g_re, const float *g_im, const float *f, int n_pulses, int n, int first, float dx, float *scratch,
+                    float complex *y);
+static void history_task(void *context, int64_t begin, int64_t end, int thread);
+static void window_task(void *context, int64_t begin, int64_t end, int thread);
+static void gradient_task(void *context, int64_t begin, int64_t end, int thread);
+static int narrow(Autofocus *af);
+
+// Picks the lines along the track with the brightest peaks. The windows run along the image
+// lines when the track is nearer east than north. The pixels along them must be finer than
+// 1/band for autofocus_run() to work.
+int autofocus_init(Autofocus *af, Backproject *bp, AutofocusOptions *options, const double *position, int n_pulses)
+{
+	BackprojectGrid *g = &bp->grid;
+	const double *last = position + 3*(n_pulses - 1);
+
+	memset(af, 0, sizeof(*af));
+	af->bp = bp;
+	af->options = *options;
+	af->position = position;
+	af->n_pulses = n_pulses;
+	af->n_threads = bp->n_threads;
+	af->is_rows = fabs(last[0] - position[0]) >= fabs(last[1] - position[1]);
+
+	int n_lines = af->is_rows ? g->n_rows : g->n_columns, n_along = af->is_rows ? g->n_columns : g->n_rows;
+	af->options.window = options->window < n_along ? options->window : n_along;
+	af->options.min_window = options->min_window < af->options.window ? options->min_window : af->options.window;
+	af->n_targets = options->targets < n_lines ? options->targets : n_lines;
+	af->width = af->options.window;
+
+	int w = af->options.window;
+	Bright *bright = calloc(n_lines, sizeof(Bright));
+	af->centre = calloc(2*(size_t)af->n_targets, sizeof(int));
+	af->peak = calloc(af->n_targets, sizeof(int));
+	af->history = alloc_aligned((size_t)af->n_targets*n_pulses*sizeof(float complex));
+	af->windows = alloc_aligned((size_t)af->n_targets*w*sizeof(float complex));
+	af->phase = alloc_aligned(n_pulses*sizeof(double));
+	af->gradient = alloc_aligned((size_t)af->n_threads*2*n_pulses*sizeof(double));
+	af->scratch = alloc_aligned((size_t)af->n_threads*SCRATCH*n_pulses*sizeof(float));
+	if (bright == NULL || af->centre == NULL || af->peak == NULL || af->history == NULL || af->windows == NULL || af->phase == NULL ||
+	    af->gradient == NULL || af->scratch == NULL)
+	{
+		free(bright);
+		autofocus_free(af);
+		return FAIL;
+	}
+
+	for (int i = 0; i < n_lines; i++)
+	{
+		bright[i].line = i;
+		for (int j = 0; j < n_along; j++)
+		{
+			float complex v = pixel(af, i, j);
+			double power = crealf(v)*crealf(v) + cimagf(v)*cimagf(v);
+			if (power > bright[i].power)
+			{
+				bright[i].power = power;
+				bright[i].pixel = j;
+			}
+		}
+	}
+
+	qsort(bright, n_lines, sizeof(Bright), brighter);
+	for (int t = 0; t < af->n_targets; t++)
+	{
+		af->centre[2*t] = bright[t].line;
+		af->centre[2*t + 1] = bright[t].pixel;
+	}
+
+	//the windows only go back to the pulses unambiguously if the pixels sample their band
+	for (int t = 0; t < af->n_targets; t++)
+	{
+		float low = INFINITY, high = -INFINITY;
+		frequencies(af, t, af->centre[2*t + 1], af->scratch);
+		for (int k = 0; k < n_pulses; k++)
+		{
+			low = af->scratch[k] < low ? af->scratch[k] : low;
+			high = af->scratch[k] > high ? af->scratch[k] : high;
+		}
+		af->band = high - low > af->band ? high - low : af->band;
+	}
+
+	free(bright);
+	return OK;
+}
+
+// Iterates to convergence, the phase error in af->phase. FAIL if it did not converge, af->phase then
+// holds the estimate of the smallest correction.
+int autofocus_run(Autofocus *af)
+{
+	int n = af->n_pulses;
+
+	af->iterations = 0;
+	af->correction = INFINITY;
+	pool_run(af->n_threads, af->n_targets, 1, history_task, af);
+
+	for (int iteration = 1; iteration <= af->options.max_iterations; iteration++)
+	{
+		double start = now_seconds();
+
+		pool_run(af->n_threads, af->n_targets, 1, window_task, af);
+		if (iteration > 1)
+			narrow(af);
+		memset(af->gradient, 0, (size_t)af->n_threads*2*n*sizeof(double));
+		pool_run(af->n_threads, af->n_targets, 1, gradient_task, af);
+
+		//the gradient summed over the threads and integrated, in place behind the sums still to read
+		double *correction = af->gradient;
+		double sum = 0, sum_k = 0, sum_kk = 0, sum_k_phase = 0;
+		correction[0] = 0;
+		for (int k = 1; k < n; k++)
+		{
+			double re = 0, im = 0;
+			for (int t = 0; t < af->n_threads; t++)
+			{
+				re += af->gradient[(size_t)t*2*n + 2*k];
+				im += af->gradient[(size_t)t*2*n + 2*k + 1];
+			}
+			correction[k] = correction[k - 1] + atan2(im, re);
+		}
+
+		//less its mean and trend
+		for (int k = 0; k < n; k++)
+		{
+			sum += correction[k];
+			sum_k += k;
+			sum_kk += (double)k*k;
+			sum_k_phase += k*correction[k];
+		}
+		double slope = (n*sum_k_phase - sum_k*sum)/(n*sum_kk - sum_k*sum_k);
+		double mean = (sum - slope*sum_k)/n;
+		double rms = 0;
+		for (int k = 0; k < n; k++)
+		{
+			correction[k] -= mean + slope*k;
+			rms += correction[k]*correction[k];
+		}
+		rms = sqrt(rms/n);
+
+		cprint("[**] ", BRIGHT, rms > af->correction ? YELLOW : CYAN);
+		printf("Autofocus iteration %d: window %d pixels, correction %.4f [rad] rms, %.3f [s]\n", iteration, af->width, rms,
+		       now_seconds() - start);
+
+		//a correction larger than the last one is the estimate wandering off, keep the last
+		if (rms > af->correction)
+			return FAIL;
+
+		for (int k = 0; k < n; k++)
+			af->phase[k] += correction[k];
+		af->iterations = iteration;
+		af->correction = rms;
+
+		if (rms < af->options.tolerance)
+			return OK;
+	}
+
+	return FAIL;
+}
+
+void autofocus_free(Autofocus *af)
+{
+	free(af->centre);
+	free(af->peak);
+	free(af->history);
+	free(af->windows);
+	free(af->phase);
+	free(af->gradient);
+	free(af->scratch);
+	memset(af, 0, sizeof(*af));
+}
+
+// pri,phase per pulse, the phase in radians found on its line.
+int autofocus_write(const char *path, const double *phase, int64_t n_pulses, int64_t first_pri, int pri_step)
+{
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not create %s\n", path);
+		return FAIL;
+	}
+
+	fprintf(f, "pri,phase\n");
+	for (int64_t k = 0; k < n_pulses; k++)
+		fprintf(f, "%lld,%.6f\n", (long long)(first_pri + k*pri_step), phase[k]);
+
+	fclose(f);
+	return OK;
+}
+
+// The phases of a file of autofocus_write() for the pulses first_pri on in pri_step, the number
+// found. Pulses the file does not have keep what phase held.
+int autofocus_read(const char *path, double *phase, int64_t n_pulses, int64_t first_pri, int pri_step)
+{
+	FILE *f = fopen(path, "r");
+	char line[128];
+	int n = 0;
+
+	if (f == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not open %s\n", path);
+		return FAIL;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		long long pri;
+		double value;
+		if (sscanf(line, "%lld,%lf", &pri, &value) != 2 || (pri - first_pri) % pri_step != 0)
+			continue;
+
+		int64_t k = (pri - first_pri)/pri_step;
+		if (k >= 0 && k < n_pulses)
+		{
+			phase[k] = value;
+			n++;
+		}
+	}
+
+	fclose(f);
+	return n;
+}
+
+static int brighter(const void *a, const void *b)
+{
+	double pa = ((const Bright *)a)->power, pb = ((const Bright *)b)->power;
+	return pa < pb ? 1 : pa > pb ? -1 : 0;
+}
+
+// Pixel along of an image line along the track, zero off the image.
+static float complex pixel(const Autofocus *af, int line, int along)
+{
+	const Backproject *bp = af->bp;
+	int n_along = af->is_rows ? bp->grid.n_columns : bp->grid.n_rows;
+
+	if (along < 0 || along >= n_along)
+		return 0;
+	return af->is_rows ? bp->image[line*bp->image_stride + along] : bp->image[along*bp->image_stride + line];
+}
+
+// The phase of every pulse at a distance x along the track from pixel along of target t's line, to
+// second order, alpha (R(x) - R(0)) = f x + c x^2: f [cycles/m] in f[k], c [cycles/m^2] in f[n_pulses + k].
+static void frequencies(const Autofocus *af, int t, int along, float *f)
+{
+	const Backproject *bp = af->bp;
+	const BackprojectGrid *g = &bp->grid;
+	int line = af->centre[2*t];
+	int axis = af->is_rows ? 0 : 1;
+	double p[3] = {g->origin[0] + (af->is_rows ? along : line)*g->spacing[0], g->origin[1] + (af->is_rows ? line : along)*g->spacing[1],
+	               g->origin[2]};
+
+	for (int k = 0; k < af->n_pulses; k++)
+	{
+		const double *a = af->position + 3*k;
+		double v[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+		double r = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+		double along_r = v[axis]/r, rate = bp->alpha - 2*bp->beta*r;
+		f[k] = rate*along_r;
+		f[af->n_pulses + k] = rate*(1 - along_r*along_r)/(2*r);
+	}
+}
+
+// Phasors of every pulse at pixel first of a line, sign 1 or -1, the step on to the next pixel and
+// the step's own step, so the chirp of frequencies() runs as products alone.
+static void phasors(const float *f, int n_pulses, int first, float dx, int sign, float *p)
+{
+	float *p_re = p, *p_im = p_re + n_pulses, *s_re = p_im + n_pulses, *s_im = s_re + n_pulses;
+	float *q_re = s_im + n_pulses, *q_im = q_re + n_pulses;
+	const float *c = f + n_pulses;
+
+	for (int k = 0; k < n_pulses; k++)
+	{
+		double x = first*dx;
+		double cycles = f[k]*x + c[k]*x*x;
+		double step = f[k]*dx + c[k]*dx*dx*(2*first + 1);
+		double chirp = 2*c[k]*dx*dx;
+		p_re[k] = cos(2*M_PI*cycles);
+		p_im[k] = sign*sin(2*M_PI*cycles);
+		s_re[k] = cos(2*M_PI*step);
+		s_im[k] = sign*sin(2*M_PI*step);
+		q_re[k] = cos(2*M_PI*chirp);
+		q_im[k] = sign*sin(2*M_PI*chirp);
+	}
+}
+
+// One pixel on for every pulse's phasor.
+static inline void step(float *p, int n_pulses)
+{
+	float *p_re = p, *p_im = p_re + n_pulses, *s_re = p_im + n_pulses, *s_im = s_re + n_pulses;
+	float *q_re = s_im + n_pulses, *q_im = q_re + n_pulses;
+
+	for (int k = 0; k < n_pulses; k++)
+	{
+		float next = p_re[k]*s_re[k] - p_im[k]*s_im[k];
+		p_im[k] = p_re[k]*s_im[k] + p_im[k]*s_re[k];
+		p_re[k] = next;
+		next = s_re[k]*q_re[k] - s_im[k]*q_im[k];
+		s_im[k] = s_re[k]*q_im[k] + s_im[k]*q_re[k];
+		s_re[k] = next;
+	}
+}
+
+// out[k] = sum over i of x[i] exp(i 2 pi phase_k((first + i) dx)), the phase of frequencies().
+static void forward(const float complex *x, int n, int first, float dx, const float *f, int n_pulses, float *scratch, float complex *out)
+{
+	float *p_re = scratch, *p_im = p_re + n_pulses;
+	float *a_re = scratch + 6*n_pulses, *a_im = a_re + n_pulses;
+
+	phasors(f, n_pulses, first, dx, 1, scratch);
+	for (int k = 0; k < n_pulses; k++)
+		a_re[k] = a_im[k] = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		float re = crealf(x[i]), im = cimagf(x[i]);
+
+		for (int k = 0; k < n_pulses; k++)
+		{
+			a_re[k] += re*p_re[k] - im*p_im[k];
+			a_im[k] += re*p_im[k] + im*p_re[k];
+		}
+		step(scratch, n_pulses);
+	}
+
+	for (int k = 0; k < n_pulses; k++)
+		out[k] = a_re[k] + I*a_im[k];
+}
+
+// y[i] = sum over k of g[k] exp(-i 2 pi phase_k((first + i) dx))/n_pulses, the sum over the pulses
+// in LANES partial sums so it vectorizes without reassociating.
+static void inverse(const float *g_re, const float *g_im, const float *f, int n_pulses, int n, int first, float dx, float *scratch,
+                    float complex *y)
+{
+	float *p_re = scratch, *p_im = p_re + n_pulses;
+
+	phasors(f, n_pulses, first, dx, -1, scratch);
+
+	for (int i = 0; i < n; i++)
+	{
+		float sum_re[LANES] = {0}, sum_im[LANES] = {0};
+		int k = 0;
+
+		for (; k + LANES <= n_pulses; k += LANES)
+		{
+			for (int l = 0; l < LANES; l++)
+			{
+				sum_re[l] += g_re[k + l]*p_re[k + l] - g_im[k + l]*p_im[k + l];
+				sum_im[l] += g_re[k + l]*p_im[k + l] + g_im[k + l]*p_re[k + l];
+			}
+		}
+		for (; k < n_pulses; k++)
+		{
+			sum_re[0] += g_re[k]*p_re[k] - g_im[k]*p_im[k];
+			sum_im[0] += g_re[k]*p_im[k] + g_im[k]*p_re[k];
+		}
+
+		step(scratch, n_pulses);
+
+		float re = 0, im = 0;
+		for (int l = 0; l < LANES; l++)
+		{
+			re += sum_re[l];
+			im += sum_im[l];
+		}
+		y[i] = (re + I*im)/n_pulses;
+	}
+}
+
+// The first window of every target back to its pulses.
+static void history_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Autofocus *af = (Autofocus *)context;
+	int n = af->n_pulses, w = af->options.window;
+	float *f = af->scratch + (size_t)thread*SCRATCH*n, *scratch = f + 2*n;
+	float dx = af->is_rows ? af->bp->grid.spacing[0] : af->bp->grid.spacing[1];
+
+	for (int64_t t = begin; t < end; t++)
+	{
+		float complex *x = af->windows + t*w;
+		int first = -w/2;
+
+		for (int i = 0; i < w; i++)
+			x[i] = pixel(af, af->centre[2*t], af->centre[2*t + 1] + first + i);
+
+		frequencies(af, t, af->centre[2*t + 1], f);
+		forward(x, w, first, dx, f, n, scratch, af->history + t*n);
+	}
+}
+
+// The histories with the phase found so far taken off, back to their windows, and the peak of each.
+static void window_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Autofocus *af = (Autofocus *)context;
+	int n = af->n_pulses, w = af->options.window;
+	float *f = af->scratch + (size_t)thread*SCRATCH*n, *g_re = f + 2*n, *g_im = g_re + n, *scratch = g_im + n;
+	float dx = af->is_rows ? af->bp->grid.spacing[0] : af->bp->grid.spacing[1];
+
+	for (int64_t t = begin; t < end; t++)
+	{
+		const float complex *h = af->history + t*n;
+		float complex *x = af->windows + t*w;
+
+		for (int k = 0; k < n; k++)
+		{
+			float complex v = h[k]*cexp(-I*af->phase[k]);
+			g_re[k] = crealf(v);
+			g_im[k] = cimagf(v);
+		}
+
+		frequencies(af, t, af->centre[2*t + 1], f);
+		inverse(g_re, g_im, f, n, w, -w/2, dx, scratch, x);
+
+		float best = -1;
+		for (int i = 0; i < w; i++)
+		{
+			float power = crealf(x[i])*crealf(x[i]) + cimagf(x[i])*cimagf(x[i]);
+			if (power > best)
+			{
+				best = power;
+				af->peak[t] = i;
+			}
+		}
+	}
+}
+
+// Each window about its peak, width pixels of it, back to the pulses and the products of
+// neighbouring pulses summed into the thread's gradient.
+static void gradient_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Autofocus *af = (Autofocus *)context;
+	int n = af->n_pulses, w = af->options.window;
+	float *f = af->scratch + (size_t)thread*SCRATCH*n, *h = f + 2*n, *scratch = h + 2*n;
+	double *gradient = af->gradient + (size_t)thread*2*n;
+	float dx = af->is_rows ? af->bp->grid.spacing[0] : af->bp->grid.spacing[1];
+
+	for (int64_t t = begin; t < end; t++)
+	{
+		const float complex *x = af->windows + t*w;
+		int first = af->peak[t] - af->width/2 > 0 ? af->peak[t] - af->width/2 : 0;
+		int last = first + af->width < w ? first + af->width : w;
+
+		//expanded about the peak itself, a peak off the centre taken back with the centre's phases
+		//would come back with the history of a point beside it, shifted along the pulses
+		frequencies(af, t, af->centre[2*t + 1] + af->peak[t] - w/2, f);
+		forward(x + first, last - first, first - af->peak[t], dx, f, n, scratch, (float complex *)h);
+
+		for (int k = 1; k < n; k++)
+		{
+			gradient[2*k] += h[2*k]*h[2*k - 2] + h[2*k + 1]*h[2*k - 1];
+			gradient[2*k + 1] += h[2*k + 1]*h[2*k - 2] - h[2*k]*h[2*k - 1];
+		}
+	}
+}
+
+// The next window, twice the width of the mean of the peaks centred down to FALL_DB, never wider
+// than the last.
+static int narrow(Autofocus *af)
+{
+	int w = af->options.window;
+	double *profile = calloc(2*w + 1, sizeof(double));
+
+	if (profile == NULL)
+		return FAIL;
+
+	for (int t = 0; t < af->n_targets; t++)
+	{
+		const float complex *x = af->windows + (size_t)t*w;
+		for (int i = 0; i < w; i++)
+			profile[i - af->peak[t] + w] += crealf(x[i])*crealf(x[i]) + cimagf(x[i])*cimagf(x[i]);
+	}
+
+	int reach = 0;
+	for (int d = -w; d <= w; d++)
+		if (profile[d + w] >= profile[w]*pow(10, -FALL_DB/10.0) && abs(d) > reach)
+			reach = abs(d);
+
+	int width = 2*(2*reach + 1);
+	width = width > af->options.min_window ? width : af->options.min_window;
+	af->width = width < af->width ? width : af->width;
+
+	free(profile);
+	return OK;
+}
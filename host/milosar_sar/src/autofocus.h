@@ -0,0 +1,70 @@
+#ifndef AUTOFOCUS_H
+#define AUTOFOCUS_H
+
+#include <stdint.h>
+#include <complex.h>
+
+#include "backproject.h"
+
+// Phase gradient autofocus of a backprojected image: the phase error of every pulse, to be taken
+// off its range line before focusing again.
+//
+// In a polar format image a range bin and the pulses are a Fourier pair. A backprojected image
+// is near enough to one along the track: pulse k adds to pixels a distance x along the track from
+// a point exp(-i 2 pi alpha (R_k(x) - R_k(0))), a tone of the rate its range changes with x and
+// a slow chirp of the range curvature, so a window about the point goes back to the pulses by a
+// nonuniform DFT with that phase, taken to second order in x.
+// Every image line along the track stands in for a range bin: the brightest targets lines of it
+// are taken, the window of window pixels about the brightest pixel of each goes back to its phase
+// history once, and then every iteration
+//
+//   - puts the estimate so far on the histories and brings them back to the image,
+//   - from the second iteration on, centres each window on its peak and narrows it to twice the
+//     width where the mean of the centred peaks is 10 dB down, min_window pixels at least,
+//   - takes the windowed peaks back to the pulses, with the phases about the peak rather than the
+//     centre, and sums h_k conj(h_(k - 1)) over the lines, the least squares gradient of the
+//     phase error, and
+//   - integrates the gradient, less its mean and linear trend, which only move the image.
+//
+// It stops after max_iterations or once an iteration's correction is under tolerance rms, and fails
+// as soon as a correction comes out larger than the last, keeping the estimate before it. The
+// lines run on the pool; the transforms run over the pulses with the phasors stepped pixel to
+// pixel, as plain loops over arrays that vectorize.
+typedef struct
+{
+  int targets;                      // image lines used, the brightest
+  int window;                       // [pixels] first window along the track
+  int min_window;                   // [pixels]
+  int max_iterations;
+  double tolerance;                 // [rad] rms of a correction that stops the iterations
+} AutofocusOptions;
+
+typedef struct
+{
+  Backproject *bp;                  // the image, its grid and phase model
+  AutofocusOptions options;
+  const double *position;           // [m] 3 per pulse
+  int n_pulses;
+  int is_rows;                      // windows along the image lines, else across them
+  int n_targets;
+  int *centre;                      // per target, line and pixel of its brightest pixel
+  float complex *history;           // per target, n_pulses of the first window
+  float complex *windows;           // per target, window samples of the image corrected
+  int *peak;                        // per target, in its window
+  int width;                        // [pixels] of the iteration's window
+  double *phase;                    // [rad] n_pulses, the error found
+  int iterations;                   // of the last autofocus_run(), those whose correction was kept
+  double correction;                // [rad] rms of the last correction kept
+  double band;                      // [cycles/m] spread of the pulses' frequencies along the track
+  double *gradient;                 // per thread, n_pulses complex sums
+  float *scratch;                   // per thread
+  int n_threads;
+} Autofocus;
+
+int autofocus_init(Autofocus *af, Backproject *bp, AutofocusOptions *options, const double *position, int n_pulses);
+int autofocus_run(Autofocus *af);
+void autofocus_free(Autofocus *af);
+int autofocus_write(const char *path, const double *phase, int64_t n_pulses, int64_t first_pri, int pri_step);
+int autofocus_read(const char *path, double *phase, int64_t n_pulses, int64_t first_pri, int pri_step);
+
+#endif  // AUTOFOCUS_H
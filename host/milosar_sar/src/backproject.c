@@ -0,0 +1,231 @@
+#include "backproject.h"
+#include "pool.h"
+#include "utils.h"
+#include <string.h>
+#include <math.h>
+
+#define SPEED_OF_LIGHT      299792458.0
+#define TILE_PIXELS         (BACKPROJECT_TILE*BACKPROJECT_TILE)
+
+// What one pulse needs to be added to the pixels of one tile, relative to the tile centre.
+typedef struct
+{
+	const float *re, *im;           // the pulse's line, bin -1 first
+	float ax, ay;                   // twice the centre less the antenna, east and north [m]
+	float rc, rc2;                  // [m] range of the centre and its square
+	float bin;                      // index of the centre's range in re and im
+	float phase;                    // [cycles] of the centre's range, modulo one
+	float inv_bin;                  // [1/m]
+	float alpha, beta;              // [cycles/m], [cycles/m^2]
+	float max_bin;                  // n_bins, the last zero bin
+} Pulse;
+
+static void tile_task(void *context, int64_t begin, int64_t end, int thread);
+static void add_row(const Pulse *p, float row_n, const float *dx, const float *dx2, float *sum_re, float *sum_im);
+
+int backproject_init(Backproject *bp, BackprojectGrid *grid, int max_pulses, int n_threads)
+{
+	memset(bp, 0, sizeof(*bp));
+	bp->grid = *grid;
+	bp->max_pulses = max_pulses;
+	bp->n_threads = pool_threads(n_threads);
+	bp->n_tiles_x = (grid->n_columns + BACKPROJECT_TILE - 1)/BACKPROJECT_TILE;
+	bp->n_tiles_y = (grid->n_rows + BACKPROJECT_TILE - 1)/BACKPROJECT_TILE;
+	bp->bins_stride = (grid->n_bins + 3 + 15)/16*16;
+	bp->image_stride = (grid->n_columns + 7)/8*8;
+
+	//the phase model in cycles, 2 (carrier + slope t) R/c - 2 slope R^2/c^2
+	bp->alpha = 2*(grid->carrier + grid->slope*grid->reference_time)/SPEED_OF_LIGHT;
+	bp->beta = 2*grid->slope/(SPEED_OF_LIGHT*SPEED_OF_LIGHT);
+
+	size_t line_bytes = (size_t)max_pulses*bp->bins_stride*sizeof(float);
+	size_t image_bytes = (size_t)grid->n_rows*bp->image_stride*sizeof(float complex);
+	bp->line_re = alloc_aligned(line_bytes);
+	bp->line_im = alloc_aligned(line_bytes);
+	bp->position = alloc_aligned((size_t)max_pulses*3*sizeof(double));
+	bp->image = alloc_aligned(image_bytes);
+	bp->scratch = alloc_aligned((size_t)bp->n_threads*2*TILE_PIXELS*sizeof(float));
+	if (bp->line_re == NULL || bp->line_im == NULL || bp->position == NULL || bp->image == NULL || bp->scratch == NULL)
+	{
+		backproject_free(bp);
+		return FAIL;
+	}
+
+	memset(bp->line_re, 0, line_bytes);
+	memset(bp->line_im, 0, line_bytes);
+	memset(bp->image, 0, image_bytes);
+	return OK;
+}
+
+// Line and antenna phase centre of pulse of the next block, the line turned back by phase [rad], a
+// phase error of the pulse found by autofocus. Bins past n_bins stay zero.
+void backproject_pulse(Backproject *bp, int pulse, const float complex *line, const double position[3], double phase)
+{
+	float *re = bp->line_re + pulse*bp->bins_stride + 1;
+	float *im = bp->line_im + pulse*bp->bins_stride + 1;
+	const float *x = (const float *)line;
+	float c = cos(phase), s = -sin(phase);
+
+	for (int k = 0; k < bp->grid.n_bins; k++)
+	{
+		re[k] = x[2*k]*c - x[2*k + 1]*s;
+		im[k] = x[2*k]*s + x[2*k + 1]*c;
+	}
+
+	memcpy(bp->position + 3*pulse, position, 3*sizeof(double));
+}
+
+// Adds pulses 0 up to n_pulses of the block into the image.
+void backproject_run(Backproject *bp, int n_pulses)
+{
+	bp->n_pulses = n_pulses;
+	pool_run(bp->n_threads, (int64_t)bp->n_tiles_x*bp->n_tiles_y, 1, tile_task, bp);
+}
+
+void backproject_free(Backproject *bp)
+{
+	free(bp->line_re);
+	free(bp->line_im);
+	free(bp->position);
+	free(bp->image);
+	free(bp->scratch);
+	memset(bp, 0, sizeof(*bp));
+}
+
+const char *backproject_isa(void)
+{
+#if defined(__AVX2__)
+	return "avx2";
+#else
+	return "c";
+#endif
+}
+
+// Every pulse of the block into tiles begin up to end, summed per tile in scratch first.
+static void tile_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Backproject *bp = (Backproject *)context;
+	BackprojectGrid *g = &bp->grid;
+	float *sum_re = bp->scratch + (size_t)thread*2*TILE_PIXELS, *sum_im = sum_re + TILE_PIXELS;
+	float dx[BACKPROJECT_TILE] __attribute__((aligned(ALIGNMENT)));
+	float dx2[BACKPROJECT_TILE] __attribute__((aligned(ALIGNMENT)));
+	float dy[BACKPROJECT_TILE];
+
+	//pixels from the centre of a tile, the same for every tile
+	for (int i = 0; i < BACKPROJECT_TILE; i++)
+	{
+		dx[i] = (i - (BACKPROJECT_TILE - 1)/2.0)*g->spacing[0];
+		dx2[i] = dx[i]*dx[i];
+		dy[i] = (i - (BACKPROJECT_TILE - 1)/2.0)*g->spacing[1];
+	}
+
+	for (int64_t t = begin; t < end; t++)
+	{
+		int column0 = (t % bp->n_tiles_x)*BACKPROJECT_TILE;
+		int row0 = (t/bp->n_tiles_x)*BACKPROJECT_TILE;
+		double east = g->origin[0] + (column0 + (BACKPROJECT_TILE - 1)/2.0)*g->spacing[0];
+		double north = g->origin[1] + (row0 + (BACKPROJECT_TILE - 1)/2.0)*g->spacing[1];
+
+		memset(sum_re, 0, 2*TILE_PIXELS*sizeof(float));
+
+		for (int k = 0; k < bp->n_pulses; k++)
+		{
+			const double *a = bp->position + 3*k;
+			double ex = east - a[0], ey = north - a[1], ez = g->origin[2] - a[2];
+			double rc = sqrt(ex*ex + ey*ey + ez*ez);
+			double cycles = bp->alpha*rc - bp->beta*rc*rc;
+
+			Pulse p;
+			p.re = bp->line_re + k*bp->bins_stride;
+			p.im = bp->line_im + k*bp->bins_stride;
+			p.ax = 2*ex;
+			p.ay = 2*ey;
+			p.rc = rc;
+			p.rc2 = rc*rc;
+			p.bin = (rc - g->range_start)/g->range_bin + 1;
+			p.phase = cycles - floor(cycles);
+			p.inv_bin = 1/g->range_bin;
+			p.alpha = bp->alpha;
+			p.beta = bp->beta;
+			p.max_bin = g->n_bins + 1;
+
+			for (int i = 0; i < BACKPROJECT_TILE; i++)
+				add_row(&p, p.ay*dy[i] + dy[i]*dy[i], dx, dx2, sum_re + i*BACKPROJECT_TILE, sum_im + i*BACKPROJECT_TILE);
+		}
+
+		//tiles on the far edges reach past the image
+		int n_rows = g->n_rows - row0 < BACKPROJECT_TILE ? g->n_rows - row0 : BACKPROJECT_TILE;
+		int n_columns = g->n_columns - column0 < BACKPROJECT_TILE ? g->n_columns - column0 : BACKPROJECT_TILE;
+		for (int i = 0; i < n_rows; i++)
+		{
+			float *pixel = (float *)(bp->image + (row0 + i)*bp->image_stride + column0);
+			for (int j = 0; j < n_columns; j++)
+			{
+				pixel[2*j] += sum_re[i*BACKPROJECT_TILE + j];
+				pixel[2*j + 1] += sum_im[i*BACKPROJECT_TILE + j];
+			}
+		}
+	}
+}
+
+#if defined(__AVX2__)
+// One row of a tile, 8 pixels per pass. R^2 - Rc^2 is row_n + ax*dx + dx^2, the interpolation
+// gathers the bins on either side of each pixel's range.
+static void add_row(const Pulse *p, float row_n, const float *dx, const float *dx2, float *sum_re, float *sum_im)
+{
+	const __m256 ax = _mm256_set1_ps(p->ax), rn = _mm256_set1_ps(row_n);
+	const __m256 rc = _mm256_set1_ps(p->rc), rc2 = _mm256_set1_ps(p->rc2);
+	const __m256 bin = _mm256_set1_ps(p->bin), inv_bin = _mm256_set1_ps(p->inv_bin);
+	const __m256 phase = _mm256_set1_ps(p->phase), alpha = _mm256_set1_ps(p->alpha), beta = _mm256_set1_ps(p->beta);
+	const __m256 zero = _mm256_setzero_ps(), max_bin = _mm256_set1_ps(p->max_bin);
+
+	for (int j = 0; j < BACKPROJECT_TILE; j += 8)
+	{
+		__m256 n = _mm256_add_ps(_mm256_add_ps(rn, _mm256_mul_ps(ax, _mm256_load_ps(dx + j))), _mm256_load_ps(dx2 + j));
+		__m256 r = _mm256_sqrt_ps(_mm256_add_ps(rc2, n));
+		__m256 dr = _mm256_div_ps(n, _mm256_add_ps(r, rc));
+
+		//linear interpolation between bins i and i + 1
+		__m256 f = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(bin, _mm256_mul_ps(dr, inv_bin)), zero), max_bin);
+		__m256i i = _mm256_cvttps_epi32(f);
+		__m256 w = _mm256_sub_ps(f, _mm256_cvtepi32_ps(i));
+		__m256 re0 = _mm256_i32gather_ps(p->re, i, 4), re1 = _mm256_i32gather_ps(p->re + 1, i, 4);
+		__m256 im0 = _mm256_i32gather_ps(p->im, i, 4), im1 = _mm256_i32gather_ps(p->im + 1, i, 4);
+		__m256 vr = _mm256_add_ps(re0, _mm256_mul_ps(w, _mm256_sub_ps(re1, re0)));
+		__m256 vi = _mm256_add_ps(im0, _mm256_mul_ps(w, _mm256_sub_ps(im1, im0)));
+
+		__m256 cq, sq;
+		__m256 cycles = _mm256_sub_ps(_mm256_add_ps(phase, _mm256_mul_ps(alpha, dr)), _mm256_mul_ps(beta, n));
+		backproject_turn8(cycles, &cq, &sq);
+
+		//times exp(-i 2 pi cycles)
+		__m256 out_re = _mm256_add_ps(_mm256_mul_ps(vr, cq), _mm256_mul_ps(vi, sq));
+		__m256 out_im = _mm256_sub_ps(_mm256_mul_ps(vi, cq), _mm256_mul_ps(vr, sq));
+		_mm256_store_ps(sum_re + j, _mm256_add_ps(_mm256_load_ps(sum_re + j), out_re));
+		_mm256_store_ps(sum_im + j, _mm256_add_ps(_mm256_load_ps(sum_im + j), out_im));
+	}
+}
+#else
+// One row of a tile, the AVX2 path pixel by pixel, written without branches so the compiler can
+// vectorise it where the target has gathers.
+static void add_row(const Pulse *p, float row_n, const float *dx, const float *dx2, float *sum_re, float *sum_im)
+{
+	for (int j = 0; j < BACKPROJECT_TILE; j++)
+	{
+		float n = row_n + p->ax*dx[j] + dx2[j];
+		float dr = n/(sqrtf(p->rc2 + n) + p->rc);
+
+		float f = fminf(fmaxf(p->bin + dr*p->inv_bin, 0), p->max_bin);
+		int i = (int)f;
+		float w = f - i;
+		float vr = p->re[i] + w*(p->re[i + 1] - p->re[i]);
+		float vi = p->im[i] + w*(p->im[i + 1] - p->im[i]);
+
+		float cq, sq;
+		backproject_turn(p->phase + p->alpha*dr - p->beta*n, &cq, &sq);
+
+		sum_re[j] += vr*cq + vi*sq;
+		sum_im[j] += vi*cq - vr*sq;
+	}
+}
+#endif
@@ -0,0 +1,108 @@
+#ifndef BACKPROJECT_H
+#define BACKPROJECT_H
+
+#include <stdint.h>
+#include <complex.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define BACKPROJECT_TILE    32      // pixels a side, a tile's sums stay in L1 over a block of pulses
+
+// Time domain backprojection of range compressed lines onto a grid on the plane z = origin[2].
+// Every pulse adds to every pixel its range line at the pixel's range, linearly interpolated, times
+// exp(-i phi(R)) with the dechirped beat phase of a point at range R,
+//
+//   phi(R) = 4 pi (carrier + slope*reference_time) R/c - 4 pi slope R^2/c^2
+//
+// the phase milosar_range leaves at the peak of a target, the stop and go model: the antenna is
+// taken not to move during a ramp.
+//
+// The image is cut into tiles of BACKPROJECT_TILE pixels a side and the pulses into blocks of up
+// to max_pulses. backproject_run() adds one block into the image, the tiles spread over the pool,
+// each owned by one thread for the block so no pixel is shared. The range to a tile's centre is
+// worked out in double per pulse, the pixels of the tile only differ from it by
+// dR = (R^2 - Rc^2)/(R + Rc) and are done in float, with AVX2 gathers where the build has them.
+// The lines of a block are kept as planes of real and imaginary parts with a zero bin before and
+// two after, so a range outside the line reads zeros and no pixel needs a bounds check.
+typedef struct
+{
+  int n_columns;                    // east
+  int n_rows;                       // north
+  double origin[3];                 // [m] east, north, up of pixel 0
+  double spacing[2];                // [m] east, north
+  int n_bins;                       // range bins used per line
+  double range_start;               // [m] of bin 0
+  double range_bin;                 // [m]
+  double carrier;                   // [Hz] at the start of the ramp
+  double slope;                     // [Hz/s] of the ramp
+  double reference_time;            // [s] into the ramp the line phases refer to
+} BackprojectGrid;
+
+typedef struct
+{
+  BackprojectGrid grid;
+  int n_tiles_x, n_tiles_y;
+  int max_pulses;
+  int n_pulses;                     // in the block
+  int64_t bins_stride;              // n_bins + 3, rounded up to a cache line
+  float *line_re, *line_im;         // block of lines, bin -1 first
+  double *position;                 // [m] 3 per pulse of the block
+  float complex *image;             // n_rows lines of image_stride
+  int64_t image_stride;
+  double alpha;                     // [cycles/m] of the phase model
+  double beta;                      // [cycles/m^2]
+  float *scratch;                   // per thread, a tile of sums
+  int n_threads;
+} Backproject;
+
+// cos and sin of cycles turns, polynomials over an eighth of a turn put back into their quadrant.
+static inline void backproject_turn(float cycles, float *c, float *s)
+{
+	float q = rintf(4*cycles);
+	float x = (cycles - 0.25f*q)*(float)(2*M_PI);
+	float x2 = x*x;
+	float sx = x*(1 + x2*(-1/6.0f + x2*(1/120.0f + x2*(-1/5040.0f))));
+	float cx = 1 + x2*(-0.5f + x2*(1/24.0f + x2*(-1/720.0f + x2*(1/40320.0f))));
+
+	int qi = (int)q;
+	float cq = qi & 1 ? sx : cx;
+	float sq = qi & 1 ? cx : sx;
+	*c = (qi + 1) & 2 ? -cq : cq;
+	*s = qi & 2 ? -sq : sq;
+}
+
+#if defined(__AVX2__)
+// backproject_turn() on 8 lanes, the quadrant put back by swapping and negating.
+static inline void backproject_turn8(__m256 cycles, __m256 *c, __m256 *s)
+{
+	const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+	__m256 q = _mm256_round_ps(_mm256_mul_ps(cycles, _mm256_set1_ps(4.0f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 x = _mm256_mul_ps(_mm256_sub_ps(cycles, _mm256_mul_ps(q, _mm256_set1_ps(0.25f))), _mm256_set1_ps(2*M_PI));
+	__m256 x2 = _mm256_mul_ps(x, x);
+	__m256 sx = _mm256_add_ps(_mm256_mul_ps(x2, _mm256_set1_ps(-1/5040.0f)), _mm256_set1_ps(1/120.0f));
+	sx = _mm256_add_ps(_mm256_mul_ps(x2, sx), _mm256_set1_ps(-1/6.0f));
+	sx = _mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(x2, sx), _mm256_set1_ps(1.0f)));
+	__m256 cx = _mm256_add_ps(_mm256_mul_ps(x2, _mm256_set1_ps(1/40320.0f)), _mm256_set1_ps(-1/720.0f));
+	cx = _mm256_add_ps(_mm256_mul_ps(x2, cx), _mm256_set1_ps(1/24.0f));
+	cx = _mm256_add_ps(_mm256_mul_ps(x2, cx), _mm256_set1_ps(-0.5f));
+	cx = _mm256_add_ps(_mm256_mul_ps(x2, cx), _mm256_set1_ps(1.0f));
+
+	__m256i qi = _mm256_cvtps_epi32(q);
+	__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(qi, one), one));
+	__m256 cos_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(qi, one), two), 30));
+	__m256 sin_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(qi, two), 30));
+	*c = _mm256_xor_ps(_mm256_blendv_ps(cx, sx, swap), cos_sign);
+	*s = _mm256_xor_ps(_mm256_blendv_ps(sx, cx, swap), sin_sign);
+}
+#endif
+
+int backproject_init(Backproject *bp, BackprojectGrid *grid, int max_pulses, int n_threads);
+void backproject_pulse(Backproject *bp, int pulse, const float complex *line, const double position[3], double phase);
+void backproject_run(Backproject *bp, int n_pulses);
+void backproject_free(Backproject *bp);
+const char *backproject_isa(void);
+
+#endif  // BACKPROJECT_H
@@ -0,0 +1,477 @@
+#include "capture.h"
+#include "colour.h"
+#include "ini.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PD_CLK              125e6
+#define N_COUNTER           75          // arm/milosar/src/synth.h
+#define RF_OUT_DIVIDER      4
+#define LINE_LEN            256
+#define MAX_DEVICES         16
+
+static int handler(void *user, const char *section, const char *name, const char *value);
+static const uint8_t *map_data(Capture *capture, const char *path, size_t *size);
+static int map_segments(Capture *capture, FILE *manifest);
+static int map_stripes(Capture *capture, FILE *manifest);
+static int fit_line(double *x, double *y, int n, double *offset, double *slope, double *rms, double *max);
+
+// path is the experiment directory or any file in it, summary.ini in it is read.
+int capture_open(Capture *capture, const char *path)
+{
+	char summary[CAPTURE_PATH_LEN + 16];
+	int n = strlen(path);
+
+	memset(capture, 0, sizeof(*capture));
+
+	if (n > 0 && path[n - 1] == '/')
+		snprintf(capture->dir, sizeof(capture->dir), "%s", path);
+	else if (strrchr(path, '.') > strrchr(path, '/'))
+	{
+		const char *slash = strrchr(path, '/');
+		snprintf(capture->dir, sizeof(capture->dir), "%.*s", slash != NULL ? (int)(slash - path + 1) : 0, path);
+	}
+	else
+		snprintf(capture->dir, sizeof(capture->dir), "%s/", path);
+
+	if (capture->dir[0] == '\0')
+		strcpy(capture->dir, "./");
+
+	//the directory is named after the capture time stamp, so is the data
+	char trimmed[CAPTURE_PATH_LEN];
+	snprintf(trimmed, sizeof(trimmed), "%s", capture->dir);
+	trimmed[strlen(trimmed) - 1] = '\0';
+	const char *base = strrchr(trimmed, '/');
+	snprintf(capture->name, sizeof(capture->name), "%s", base != NULL ? base + 1 : trimmed);
+
+	snprintf(summary, sizeof(summary), "%ssummary.ini", capture->dir);
+	if (ini_parse(summary, handler, capture) < 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not read %s\n", summary);
+		return FAIL;
+	}
+
+	if (capture->prf <= 0 || capture->presum_factor <= 0 || capture->end_index < capture->start_index)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "%s has no [dataset] and [integration] settings\n", summary);
+		return FAIL;
+	}
+
+	capture->switch_factor = capture->switch_mode == 3 ? 2 : 1;
+	if (capture->sample_rate <= 0)
+		capture->sample_rate = ADC_RATE/(capture->decimation_factor > 0 ? capture->decimation_factor : 1);
+	capture->n_samples = capture->end_index - capture->start_index + 1;
+	capture->bytes_per_pri = (int64_t)N_CHANNELS*BYTES_PER_WRITE*capture->n_samples;
+
+	//captures from before [capture] was written only have the planned size
+	capture->n_pris = (capture->stream_offset + capture->bytes)/capture->bytes_per_pri;
+
+	return OK;
+}
+
+static int handler(void *user, const char *section, const char *name, const char *value)
+{
+	Capture *c = (Capture *)user;
+
+	#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+
+	if (MATCH("dataset", "prf"))
+		c->prf = atoi(value);
+	else if (MATCH("dataset", "switch_mode"))
+		c->switch_mode = atoi(value);
+	else if (MATCH("dataset", "decimation_factor"))
+		c->decimation_factor = atoi(value);
+	else if (MATCH("dataset", "sampling_rate"))
+		c->sample_rate = atof(value);
+	else if (MATCH("dataset", "bytes") && c->bytes == 0)
+		c->bytes = atoll(value);
+	else if (MATCH("dataset", "channel_a_phase_increment"))
+		c->channel_a_phase_increment = atoi(value);
+	else if (MATCH("dataset", "channel_b_phase_increment"))
+		c->channel_b_phase_increment = atoi(value);
+	else if (MATCH("integration", "n_samples_per_pri"))
+		c->n_samples_per_pri = atoi(value);
+	else if (MATCH("integration", "n_pris"))
+		c->presum_factor = atoi(value);
+	else if (MATCH("integration", "start_index"))
+		c->start_index = atoi(value);
+	else if (MATCH("integration", "end_index"))
+		c->end_index = atoi(value);
+	else if (MATCH("tx_synth", "up_ramp_increment"))
+		c->up_ramp_increment = atoi(value);
+	else if (MATCH("tx_synth", "up_ramp_length"))
+		c->up_ramp_length = atoi(value);
+	else if (MATCH("tx_synth", "frequency_offset"))
+		c->frequency_offset = atof(value);
+	else if (MATCH("timing", "tcu_monotonic_ns"))
+		c->tcu_monotonic_ns = atoll(value);
+	else if (MATCH("timing", "tcu_realtime_ns"))
+		c->tcu_realtime_ns = atoll(value);
+	else if (MATCH("capture", "bytes"))
+		c->bytes = atoll(value);
+	else if (MATCH("capture", "first_block"))
+		c->first_block = atoi(value);
+	else if (MATCH("capture", "stream_offset"))
+		c->stream_offset = atoll(value);
+	else if (MATCH("capture", "continuous"))
+		c->is_continuous = atoi(value);
+
+	return 1;
+}
+
+// Indexes every block of the capture still on disk. A block listed in a manifest but missing or
+// short on disk is left NULL, the PRIs it holds read as missing.
+int capture_map(Capture *capture)
+{
+	char path[CAPTURE_PATH_LEN + 80];
+	FILE *manifest;
+	int status;
+
+	capture->n_blocks = capture->bytes/S2MB - capture->first_block;
+	if (capture->n_blocks <= 0 || (capture->blocks = calloc(capture->n_blocks, sizeof(uint8_t *))) == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Capture %s has no blocks on disk\n", capture->name);
+		return FAIL;
+	}
+
+	snprintf(path, sizeof(path), "%s%s", capture->dir, STRIPE_MANIFEST);
+	if ((manifest = fopen(path, "r")) != NULL)
+	{
+		status = map_stripes(capture, manifest);
+		fclose(manifest);
+		return status;
+	}
+
+	snprintf(path, sizeof(path), "%s%s", capture->dir, MANIFEST_FILE);
+	if ((manifest = fopen(path, "r")) != NULL)
+	{
+		status = map_segments(capture, manifest);
+		fclose(manifest);
+		return status;
+	}
+
+	//one file, block after block
+	size_t size;
+	snprintf(path, sizeof(path), "%s%s.bin", capture->dir, capture->name);
+	const uint8_t *data = map_data(capture, path, &size);
+	if (data == NULL)
+		return FAIL;
+
+	//summaries without [capture] only have the planned size
+	if (size/S2MB < capture->n_blocks)
+	{
+		capture->n_blocks = size/S2MB;
+		capture->bytes = (int64_t)(capture->first_block + capture->n_blocks)*S2MB;
+		capture->n_pris = (capture->stream_offset + capture->bytes)/capture->bytes_per_pri;
+	}
+
+	for (int i = 0; i < capture->n_blocks; i++)
+		capture->blocks[i] = data + (size_t)i*S2MB;
+
+	return OK;
+}
+
+static int map_segments(Capture *capture, FILE *manifest)
+{
+	char line[CAPTURE_PATH_LEN], name[CAPTURE_PATH_LEN], path[2*CAPTURE_PATH_LEN];
+	unsigned index, first_block, n_blocks, crc;
+	unsigned long long bytes;
+	size_t size;
+
+	while (fgets(line, sizeof(line), manifest) != NULL)
+	{
+		if (sscanf(line, "%u %u %u %llu %x %s", &index, &first_block, &n_blocks, &bytes, &crc, name) != 6)
+			continue;
+
+		snprintf(path, sizeof(path), "%s%s", capture->dir, name);
+		const uint8_t *data = map_data(capture, path, &size);
+		if (data == NULL)
+			continue;
+
+		if (size < SEGMENT_HEADER_SIZE || *(const uint32_t *)data != SEGMENT_MAGIC)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			fprintf(stderr, "%s is not a capture segment\n", path);
+			continue;
+		}
+
+		for (unsigned i = 0; i < n_blocks && SEGMENT_HEADER_SIZE + (i + 1)*(size_t)S2MB <= size; i++)
+		{
+			int64_t block = (int64_t)first_block + i - capture->first_block;
+			if (block >= 0 && block < capture->n_blocks)
+				capture->blocks[block] = data + SEGMENT_HEADER_SIZE + (size_t)i*S2MB;
+		}
+	}
+
+	return OK;
+}
+
+// The device paths are where the board mounted them, the files are also looked for in the
+// capture directory, where they are when copied off the cards.
+static int map_stripes(Capture *capture, FILE *manifest)
+{
+	char line[CAPTURE_PATH_LEN], name[CAPTURE_PATH_LEN], path[2*CAPTURE_PATH_LEN];
+	const uint8_t *devices[MAX_DEVICES] = {NULL};
+	size_t sizes[MAX_DEVICES] = {0};
+	int block_size = S2MB, device, block, index;
+	unsigned crc;
+
+	while (fgets(line, sizeof(line), manifest) != NULL)
+	{
+		if (sscanf(line, "# block_size %d", &block_size) == 1)
+			continue;
+
+		if (sscanf(line, "# device %d %s", &device, name) == 2 && device >= 0 && device < MAX_DEVICES)
+		{
+			const char *base = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+			snprintf(path, sizeof(path), "%s%s", capture->dir, base);
+			devices[device] = access(name, R_OK) == 0 ? map_data(capture, name, &sizes[device]) : map_data(capture, path, &sizes[device]);
+			continue;
+		}
+
+		if (sscanf(line, "%d %d %d %x", &block, &device, &index, &crc) != 4 || device < 0 || device >= MAX_DEVICES || devices[device] == NULL)
+			continue;
+
+		block -= capture->first_block;
+		if (block >= 0 && block < capture->n_blocks && (index + 1)*(size_t)block_size <= sizes[device] && block_size == S2MB)
+			capture->blocks[block] = devices[device] + (size_t)index*block_size;
+	}
+
+	return OK;
+}
+
+static const uint8_t *map_data(Capture *capture, const char *path, size_t *size)
+{
+	if (capture->n_files == CAPTURE_MAX_FILES)
+		return NULL;
+
+	uint8_t *data = map_file(path, size);
+	if (data == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not map %s\n", path);
+		return NULL;
+	}
+
+	//read front to back by every thread, and only once
+	madvise(data, *size, MADV_SEQUENTIAL);
+
+	capture->files[capture->n_files].data = data;
+	capture->files[capture->n_files].size = *size;
+	capture->n_files++;
+	return data;
+}
+
+// First PRI wholly on disk.
+int64_t capture_first_pri(Capture *capture)
+{
+	return (capture->stream_offset + (int64_t)capture->first_block*S2MB + capture->bytes_per_pri - 1)/capture->bytes_per_pri;
+}
+
+// Raw words of one PRI. A PRI inside one block is returned where it is mapped, one across a block
+// boundary is copied to scratch, bytes_per_pri long. NULL if any of it is not on disk.
+const uint8_t *capture_pri(Capture *capture, int64_t pri, uint8_t *scratch)
+{
+	int64_t byte = pri*capture->bytes_per_pri - capture->stream_offset;
+	int64_t block = byte/S2MB - capture->first_block;
+	int64_t offset = byte % S2MB;
+
+	if (byte < 0 || block < 0 || block >= capture->n_blocks || capture->blocks[block] == NULL)
+		return NULL;
+
+	if (offset + capture->bytes_per_pri <= S2MB)
+		return capture->blocks[block] + offset;
+
+	for (int64_t copied = 0; copied < capture->bytes_per_pri; block++)
+	{
+		if (block >= capture->n_blocks || capture->blocks[block] == NULL)
+			return NULL;
+
+		int64_t n = S2MB - offset < capture->bytes_per_pri - copied ? S2MB - offset : capture->bytes_per_pri - copied;
+		memcpy(scratch + copied, capture->blocks[block] + offset, n);
+		copied += n;
+		offset = 0;
+	}
+
+	return scratch;
+}
+
+void capture_unmap(Capture *capture)
+{
+	for (int i = 0; i < capture->n_files; i++)
+		unmap_file(capture->files[i].data, capture->files[i].size);
+
+	free(capture->blocks);
+	capture->blocks = NULL;
+	capture->n_blocks = 0;
+	capture->n_files = 0;
+}
+
+// Stored PRIs per second.
+double capture_pri_rate(Capture *capture)
+{
+	return (double)capture->prf/capture->presum_factor;
+}
+
+// Ramp bandwidth of the tx synth, as get_bandwidth() on the board.
+double capture_bandwidth(Capture *capture)
+{
+	uint64_t increment = (uint32_t)capture->up_ramp_increment & ~(1u << 31);
+
+	if (increment < (1u << 24) - 1)
+		return (increment*(double)capture->up_ramp_length*PD_CLK)/(1 << 26);
+	else
+		return ((increment - (double)(1u << 30))*capture->up_ramp_length*PD_CLK)/(1 << 26);
+}
+
+// Duration of the tx up ramp, its length counts phase detector clocks.
+double capture_sweep_time(Capture *capture)
+{
+	return capture->up_ramp_length/PD_CLK;
+}
+
+// Start of the tx ramp, the synth output above its integer-N frequency by the fractional part.
+double capture_carrier(Capture *capture)
+{
+	return PD_CLK*N_COUNTER/RF_OUT_DIVIDER + capture->frequency_offset;
+}
+
+// Fits the stream's byte count against the block times of timestamps.csv. Block b of the file
+// ends at byte stream_offset + (b + 1)*S2MB, seen late by the STS overshoot past the boundary.
+// PRI k ends at byte (k + 1)*bytes_per_pri, its presum window is the last presum_factor/prf of it.
+int capture_pri_clock(Capture *capture, PriClock *clock)
+{
+	double nominal = 1/capture_pri_rate(capture);
+	double bytes_per_second = capture->bytes_per_pri/nominal;
+	char path[CAPTURE_PATH_LEN + 32], line[LINE_LEN];
+
+	memset(clock, 0, sizeof(*clock));
+	clock->period = nominal;
+	clock->t0 = nominal/2;
+
+	snprintf(path, sizeof(path), "%stimestamps.csv", capture->dir);
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return OK;
+
+	int capacity = 1024, n = 0;
+	double *x = malloc(capacity*sizeof(double));
+	double *y = malloc(capacity*sizeof(double));
+	int64_t tcu_ns = capture->tcu_monotonic_ns;
+
+	while (x != NULL && y != NULL && fgets(line, sizeof(line), f) != NULL)
+	{
+		long long block, realtime_ns, monotonic_ns;
+		unsigned half, sts;
+
+		if (sscanf(line, "tcu,,,%lld,%lld", &realtime_ns, &monotonic_ns) == 2)
+		{
+			tcu_ns = monotonic_ns;
+			continue;
+		}
+
+		if (sscanf(line, "%lld,%u,%u,%lld,%lld", &block, &half, &sts, &realtime_ns, &monotonic_ns) != 5)
+			continue;
+
+		if (n == capacity)
+		{
+			capacity *= 2;
+			double *grown_x = realloc(x, capacity*sizeof(double));
+			double *grown_y = realloc(y, capacity*sizeof(double));
+			x = grown_x != NULL ? grown_x : x;
+			y = grown_y != NULL ? grown_y : y;
+			if (grown_x == NULL || grown_y == NULL)
+				break;
+		}
+
+		//byte count is the abscissa, seconds are kept small for the fit
+		x[n] = capture->stream_offset + (block + 1)*(double)S2MB;
+		y[n] = monotonic_ns*1e-9 - (sts*(uint64_t)BYTES_PER_WRITE % S2MB)/bytes_per_second;
+		n++;
+	}
+	fclose(f);
+
+	if (tcu_ns == 0 || n < 3 || x == NULL || y == NULL)
+	{
+		free(x);
+		free(y);
+		return OK;
+	}
+
+	capture->tcu_monotonic_ns = tcu_ns;
+	for (int i = 0; i < n; i++)
+		y[i] -= tcu_ns*1e-9;
+
+	double offset, slope;
+	if (fit_line(x, y, n, &offset, &slope, &clock->rms_us, &clock->max_us) != OK || slope <= 0)
+	{
+		free(x);
+		free(y);
+		return FAIL;
+	}
+
+	clock->period = slope*capture->bytes_per_pri;
+	clock->t0 = offset + clock->period - 0.5*nominal;
+	clock->n_blocks = n;
+	clock->rms_us *= 1e6;
+	clock->max_us *= 1e6;
+	clock->drift_ppm = (nominal/clock->period - 1)*1e6;
+
+	free(x);
+	free(y);
+	return OK;
+}
+
+// Least squares y = offset + slope*x, about the means so large abscissas keep their precision.
+static int fit_line(double *x, double *y, int n, double *offset, double *slope, double *rms, double *max)
+{
+	double mx = 0, my = 0, sxx = 0, sxy = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		mx += x[i];
+		my += y[i];
+	}
+	mx /= n;
+	my /= n;
+
+	for (int i = 0; i < n; i++)
+	{
+		sxx += (x[i] - mx)*(x[i] - mx);
+		sxy += (x[i] - mx)*(y[i] - my);
+	}
+
+	if (sxx == 0)
+		return FAIL;
+
+	*slope = sxy/sxx;
+	*offset = my - *slope*mx;
+
+	double sum = 0;
+	*max = 0;
+	for (int i = 0; i < n; i++)
+	{
+		double r = fabs(y[i] - *offset - *slope*x[i]);
+		sum += r*r;
+		if (r > *max)
+			*max = r;
+	}
+	*rms = sqrt(sum/n);
+
+	return OK;
+}
+
+void capture_print(Capture *capture)
+{
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Capture %s: %lld PRIs of %d samples at %.2f Hz, presum %d, switch mode %d, %.3f MHz sampling\n",
+	       capture->name, (long long)capture->n_pris, capture->n_samples, capture_pri_rate(capture),
+	       capture->presum_factor, capture->switch_mode, capture->sample_rate*1e-6);
+}
@@ -0,0 +1,103 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ADC_RATE            125e6
+#define BYTES_PER_WRITE     4
+#define N_CHANNELS          2
+#define S2MB                (2 << 20)   // DMA half, the capture block
+#define CAPTURE_PATH_LEN    512
+#define CAPTURE_MAX_FILES   4096
+
+#define SEGMENT_MAGIC       0x4753454D  // "MESG", arm/milosar/src/storage.h
+#define SEGMENT_HEADER_SIZE 64
+#define MANIFEST_FILE       "manifest.txt"
+#define STRIPE_MANIFEST     "stripe.txt"
+
+// A capture as the radar left it: the experiment directory with summary.ini, setup.ini,
+// timestamps.csv, gps.bin and the data as <time_stamp>.bin or segments listed in manifest.txt.
+// Every tool starts from capture_open() on the directory or on its summary.ini.
+//
+// A stored PRI is one integrated record of presum_factor transmitted pulses: n_samples range
+// samples from start_index to end_index, each N_CHANNELS words of BYTES_PER_WRITE bytes. With
+// switch_mode 3 consecutive stored PRIs alternate between RF1 and RF2, even PRIs of the stream
+// are RF1. A word holds the I sample in its low and the Q sample in its high 16 bits, both
+// signed, channel A first.
+//
+// capture_map() maps the data files read only and indexes them by capture block, whichever way
+// the board stored them: one file, segments with a header each, or blocks striped over devices.
+// PRIs are numbered from the TCU enable. Block 0 of the data begins stream_offset bytes into that
+// stream, where the board's first stored DMA half began, so PRIs before it and before first_block
+// are gone.
+typedef struct
+{
+  void *data;
+  size_t size;
+} CaptureFile;
+
+typedef struct
+{
+  char dir[CAPTURE_PATH_LEN];       // experiment directory, with trailing '/'
+  char name[64];                    // time stamp, also the data file name
+
+  int prf;                          // transmitted pulses per second
+  int presum_factor;
+  int switch_mode;
+  int switch_factor;                // 2 when interleaving RF1 and RF2
+  int decimation_factor;
+  double sample_rate;               // [Hz] after decimation
+  int n_samples_per_pri;            // samples of the whole PRI, stored or not
+  int start_index;
+  int end_index;
+  int n_samples;                    // stored range samples per PRI
+  int64_t bytes_per_pri;
+
+  int64_t bytes;                    // recorded, from [capture] or the planned size
+  int64_t n_pris;                   // PRIs of the stream up to the end of the data
+  int64_t stream_offset;            // [bytes] of the stream before block 0
+  int first_block;                  // capture block of the first byte still on disk
+  int is_continuous;
+
+  int channel_a_phase_increment;
+  int channel_b_phase_increment;
+  int up_ramp_increment;            // tx synth, for the ramp bandwidth
+  int up_ramp_length;
+  double frequency_offset;          // [Hz] of the tx synth above PD_CLK*N_COUNTER/RF_OUT_DIVIDER
+
+  int64_t tcu_monotonic_ns;         // TCU enable, 0 for captures without [timing]
+  int64_t tcu_realtime_ns;
+
+  const uint8_t **blocks;           // capture_map(), block first_block + i, NULL if missing
+  int n_blocks;
+  CaptureFile files[CAPTURE_MAX_FILES];
+  int n_files;
+} Capture;
+
+// Time of every stored PRI from the TCU enable on CLOCK_MONOTONIC: time = t0 + k*period at the
+// centre of the presum window of PRI k. Fitted to the DMA block times in timestamps.csv when the
+// capture has them, nominal from the PRF otherwise.
+typedef struct
+{
+  double t0;                        // [s]
+  double period;                    // [s]
+  int n_blocks;                     // block times fitted, 0 if nominal
+  double rms_us;                    // block time residual
+  double max_us;
+  double drift_ppm;                 // fitted against nominal period
+} PriClock;
+
+int capture_open(Capture *capture, const char *path);
+int capture_map(Capture *capture);
+const uint8_t *capture_pri(Capture *capture, int64_t pri, uint8_t *scratch);
+int64_t capture_first_pri(Capture *capture);
+void capture_unmap(Capture *capture);
+int capture_pri_clock(Capture *capture, PriClock *clock);
+double capture_pri_rate(Capture *capture);
+double capture_bandwidth(Capture *capture);
+double capture_sweep_time(Capture *capture);
+double capture_carrier(Capture *capture);
+void capture_print(Capture *capture);
+
+#endif  // CAPTURE_H
@@ -0,0 +1,78 @@
+#include "convert.h"
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// The words are I in the low and Q in the high half, so the int16 pairs of a channel's words are
+// already its complex samples in (re, im) order: deinterleave the words, widen, convert.
+void convert_pri(const uint8_t *words, int n_samples, float complex *a, float complex *b, float scale)
+{
+	float *fa = (float *)a, *fb = (float *)b;
+	int i = 0;
+
+#if defined(__AVX2__)
+	const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	const __m256 gain = _mm256_set1_ps(scale);
+
+	//4 samples of both channels per pass, A words to the low lane, B words to the high lane
+	for (; i + 4 <= n_samples; i += 4)
+	{
+		__m256i v = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)(words + 8*i)), order);
+		__m256 va = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+		__m256 vb = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+		_mm256_store_ps(fa + 2*i, _mm256_mul_ps(va, gain));
+		_mm256_store_ps(fb + 2*i, _mm256_mul_ps(vb, gain));
+	}
+#elif defined(__SSE2__)
+	const __m128 gain = _mm_set1_ps(scale);
+
+	//2 samples of both channels per pass, sign extended by unpacking onto themselves and shifting
+	for (; i + 2 <= n_samples; i += 2)
+	{
+		__m128i v = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(words + 8*i)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m128 va = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+		__m128 vb = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+		_mm_store_ps(fa + 2*i, _mm_mul_ps(va, gain));
+		_mm_store_ps(fb + 2*i, _mm_mul_ps(vb, gain));
+	}
+#elif defined(__ARM_NEON)
+	//4 samples of both channels per pass, vld2 deinterleaves the A and B words on the load
+	for (; i + 4 <= n_samples; i += 4)
+	{
+		uint32x4x2_t v = vld2q_u32((const uint32_t *)(words + 8*i));
+		int16x8_t va = vreinterpretq_s16_u32(v.val[0]);
+		int16x8_t vb = vreinterpretq_s16_u32(v.val[1]);
+		vst1q_f32(fa + 2*i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(va))), scale));
+		vst1q_f32(fa + 2*i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(va))), scale));
+		vst1q_f32(fb + 2*i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(vb))), scale));
+		vst1q_f32(fb + 2*i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(vb))), scale));
+	}
+#endif
+
+	for (; i < n_samples; i++)
+	{
+		int16_t s[4];
+		memcpy(s, words + 8*i, sizeof(s));
+		fa[2*i] = s[0]*scale;
+		fa[2*i + 1] = s[1]*scale;
+		fb[2*i] = s[2]*scale;
+		fb[2*i + 1] = s[3]*scale;
+	}
+}
+
+const char *convert_isa(void)
+{
+#if defined(__AVX2__)
+	return "avx2";
+#elif defined(__SSE2__)
+	return "sse2";
+#elif defined(__ARM_NEON)
+	return "neon";
+#else
+	return "c";
+#endif
+}
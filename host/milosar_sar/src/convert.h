@@ -0,0 +1,13 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+#include <complex.h>
+
+// Unpacks one stored PRI, n_samples pairs of channel A and B words, into complex floats per
+// channel, scaled by scale. SIMD for AVX2, SSE2 or NEON as the build targets, plain C otherwise.
+// a and b are LINES_ALIGN aligned, words need not be.
+void convert_pri(const uint8_t *words, int n_samples, float complex *a, float complex *b, float scale);
+const char *convert_isa(void);
+
+#endif  // CONVERT_H
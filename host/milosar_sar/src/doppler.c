@@ -0,0 +1,355 @@
+#include "doppler.h"
+#include "pool.h"
+#include "range.h"
+#include "utils.h"
+#include "window.h"
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define LOOK_CHUNK          64      // range lines claimed per thread at a time for the looks
+
+static void turn_task(void *context, int64_t begin, int64_t end, int thread);
+static void look_task(void *context, int64_t begin, int64_t end, int thread);
+static void fft_task(void *context, int64_t begin, int64_t end, int thread);
+static void fast_time(Doppler *doppler, int64_t line, float complex *z, float complex *work);
+static void estimate(Doppler *doppler);
+
+// Plans the blocks of the lines and creates the corner turn scratch at turn_path, unlinked once
+// mapped so it goes with the process.
+int doppler_init(Doppler *doppler, Lines *input, DopplerOptions *options, const char *turn_path, int n_threads)
+{
+	LinesHeader *h = input->header;
+	int bl = options->block_lines;
+
+	memset(doppler, 0, sizeof(*doppler));
+	doppler->input = input;
+	doppler->options = *options;
+	doppler->n_threads = pool_threads(n_threads);
+	doppler->n_doppler = fft_size(bl);
+	doppler->n_blocks = h->n_lines/bl;
+	doppler->n_tiles = (options->n_gates + DOPPLER_TILE - 1)/DOPPLER_TILE;
+	doppler->rate = 1/(h->period*h->pri_step);
+	doppler->is_looks = h->carrier > 0 && h->bandwidth != 0 && h->sweep_time > 0 && h->sample_rate > 0 && h->n_fft >= 2;
+
+	//whole blocks of gate series in the memory given, one at least
+	double block_bytes = (double)options->n_gates*lines_stride(bl, sizeof(float complex))*sizeof(float complex);
+	double band = floor(options->memory/block_bytes);
+	doppler->band_blocks = band < 1 ? 1 : band > doppler->n_blocks ? doppler->n_blocks : (int)band;
+
+	int n_fft = doppler->is_looks ? h->n_fft : 0;
+	int n = doppler->n_threads;
+	doppler->window = alloc_aligned(bl*sizeof(float));
+	doppler->estimates = alloc_aligned(doppler->n_blocks*sizeof(DopplerEstimate));
+	doppler->series = alloc_aligned((size_t)n*doppler->n_doppler*sizeof(float complex));
+	doppler->work = alloc_aligned((size_t)n*doppler->n_doppler*sizeof(float complex));
+	doppler->fast = alloc_aligned((size_t)n*3*n_fft*sizeof(float complex));
+	doppler->tile = alloc_aligned((size_t)n*DOPPLER_TILE*doppler->n_doppler*sizeof(float));
+	doppler->sums = alloc_aligned((size_t)n*doppler->band_blocks*sizeof(DopplerSums));
+	if (doppler->window == NULL || doppler->estimates == NULL || doppler->series == NULL || doppler->work == NULL ||
+	    doppler->fast == NULL || doppler->tile == NULL || doppler->sums == NULL || fft_plan(&doppler->plan, doppler->n_doppler) != OK ||
+	    (doppler->is_looks && fft_plan(&doppler->range_plan, n_fft) != OK))
+	{
+		doppler_free(doppler);
+		return FAIL;
+	}
+
+	//a tone of amplitude one peaks at one, as in range
+	window_make(options->window, options->window_parameter, bl, doppler->window);
+	for (int k = 0; k < bl; k++)
+		doppler->window[k] /= bl;
+
+	LinesHeader turn;
+	memset(&turn, 0, sizeof(turn));
+	turn.kind = LinesRange;
+	turn.n_lines = (int64_t)doppler->band_blocks*options->n_gates;
+	turn.n_samples = bl;
+	if (lines_create(&doppler->turn, turn_path, &turn) != OK)
+	{
+		doppler_free(doppler);
+		return FAIL;
+	}
+	unlink(turn_path);
+
+	return OK;
+}
+
+// Header of the map, from the input's.
+void doppler_header(Doppler *doppler, LinesHeader *header)
+{
+	LinesHeader *h = doppler->input->header;
+
+	memcpy(header, h, sizeof(*header));
+	header->kind = LinesDoppler;
+	header->n_lines = doppler->n_blocks*doppler->n_doppler;
+	header->n_samples = doppler->options.n_gates;
+	header->range_start = h->range_start + doppler->options.first_gate*h->range_bin;
+	header->doppler_bin = doppler->rate/doppler->n_doppler;
+	header->doppler_start = -(doppler->n_doppler/2)*header->doppler_bin;
+	header->n_doppler = doppler->n_doppler;
+	header->block_lines = doppler->options.block_lines;
+}
+
+// Every block into the map and the estimates, a band of blocks per pass through the scratch.
+void doppler_run(Doppler *doppler, Lines *map, int n_threads)
+{
+	int bl = doppler->options.block_lines;
+
+	doppler->map = map;
+	doppler->turn_time = doppler->look_time = doppler->fft_time = 0;
+
+	for (int64_t band = 0; band < doppler->n_blocks; band += doppler->band_blocks)
+	{
+		doppler->band = band;
+		doppler->band_n = doppler->n_blocks - band < doppler->band_blocks ? doppler->n_blocks - band : doppler->band_blocks;
+		memset(doppler->sums, 0, (size_t)doppler->n_threads*doppler->band_blocks*sizeof(DopplerSums));
+
+		int64_t n_lines = (int64_t)doppler->band_n*bl;
+		int64_t n_strips = (n_lines + DOPPLER_STRIP - 1)/DOPPLER_STRIP;
+
+		double start = now_seconds();
+		pool_run(n_threads, n_strips*doppler->n_tiles, 1, turn_task, doppler);
+		double turned = now_seconds();
+		if (doppler->is_looks)
+			pool_run(n_threads, n_lines, LOOK_CHUNK, look_task, doppler);
+		double looked = now_seconds();
+		pool_run(n_threads, (int64_t)doppler->band_n*doppler->n_tiles, 1, fft_task, doppler);
+
+		doppler->turn_time += turned - start;
+		doppler->look_time += looked - turned;
+		doppler->fft_time += now_seconds() - looked;
+		estimate(doppler);
+	}
+}
+
+void doppler_free(Doppler *doppler)
+{
+	free(doppler->window);
+	free(doppler->estimates);
+	free(doppler->series);
+	free(doppler->work);
+	free(doppler->fast);
+	free(doppler->tile);
+	free(doppler->sums);
+	fft_free(&doppler->plan);
+	fft_free(&doppler->range_plan);
+	if (doppler->turn.header != NULL)
+		lines_close(&doppler->turn);
+	memset(doppler, 0, sizeof(*doppler));
+}
+
+// Items are DOPPLER_STRIP lines of the band by DOPPLER_TILE gates, strip major. Square tiles go
+// through the stack, read a row per line and written a column per gate series.
+static void turn_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Doppler *doppler = (Doppler *)context;
+	int bl = doppler->options.block_lines, n_gates = doppler->options.n_gates;
+	int64_t n_lines = (int64_t)doppler->band_n*bl;
+	float complex tile[DOPPLER_TILE][DOPPLER_TILE];
+	int64_t row[DOPPLER_TILE], column[DOPPLER_TILE];
+
+	for (int64_t i = begin; i < end; i++)
+	{
+		int64_t first = i/doppler->n_tiles*DOPPLER_STRIP;
+		int64_t last = first + DOPPLER_STRIP < n_lines ? first + DOPPLER_STRIP : n_lines;
+		int g0 = i % doppler->n_tiles*DOPPLER_TILE;
+		int n_g = n_gates - g0 < DOPPLER_TILE ? n_gates - g0 : DOPPLER_TILE;
+
+		for (int64_t l0 = first; l0 < last; l0 += DOPPLER_TILE)
+		{
+			int n_l = last - l0 < DOPPLER_TILE ? last - l0 : DOPPLER_TILE;
+
+			for (int j = 0; j < n_l; j++)
+			{
+				const float complex *line = lines_line(doppler->input, doppler->band*bl + l0 + j);
+				memcpy(tile[j], line + doppler->options.first_gate + g0, n_g*sizeof(float complex));
+				row[j] = (l0 + j)/bl*n_gates + g0;
+				column[j] = (l0 + j) % bl;
+			}
+
+			for (int g = 0; g < n_g; g++)
+				for (int j = 0; j < n_l; j++)
+					lines_line(&doppler->turn, row[j] + g)[column[j]] = tile[j][g];
+		}
+	}
+}
+
+// Lines begin up to end of the band back in fast time, the power and mean time of each half of
+// the ramp and their lag one correlations with the line before in the block. z is the conjugate
+// of the fast time line, so the sums of z[k] conj(z[k - 1]) are conjugated in estimate().
+static void look_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Doppler *doppler = (Doppler *)context;
+	int bl = doppler->options.block_lines;
+	int n = doppler->range_plan.n;
+	float complex *now = doppler->fast + (size_t)thread*3*n, *last = now + n, *work = last + n;
+	DopplerSums *sums = doppler->sums + (size_t)thread*doppler->band_blocks;
+
+	for (int64_t l = begin; l < end; l++)
+	{
+		DopplerSums *s = &sums[l/bl];
+		int64_t line = doppler->band*bl + l;
+
+		fast_time(doppler, line, now, work);
+
+		//samples from n/2 on are before the middle one, the first half of the ramp
+		for (int half = 0; half < 2; half++)
+		{
+			const float *z = (const float *)(now + (half == 0 ? n/2 : 0));
+			float offset = half == 0 ? -n/2 : 0;
+			float power = 0, time = 0;
+
+			for (int t = 0; t < n/2; t++)
+			{
+				float p = z[2*t]*z[2*t] + z[2*t + 1]*z[2*t + 1];
+				power += p;
+				time += (t + offset)*p;
+			}
+
+			s->look_power[half] += power;
+			s->look_time[half] += time;
+		}
+
+		if (l % bl > 0)
+		{
+			if (l == begin)
+				fast_time(doppler, line - 1, last, work);
+
+			for (int half = 0; half < 2; half++)
+			{
+				const float *z1 = (const float *)(now + (half == 0 ? n/2 : 0));
+				const float *z0 = (const float *)(last + (half == 0 ? n/2 : 0));
+				float re = 0, im = 0;
+
+				for (int t = 0; t < n/2; t++)
+				{
+					re += z1[2*t]*z0[2*t] + z1[2*t + 1]*z0[2*t + 1];
+					im += z1[2*t + 1]*z0[2*t] - z1[2*t]*z0[2*t + 1];
+				}
+
+				s->look_lag[half] += re + I*im;
+			}
+		}
+
+		float complex *swap = now;
+		now = last;
+		last = swap;
+	}
+}
+
+// Items are a block of the band by DOPPLER_TILE gates. The gates' series are summed for the
+// centroid, windowed and transformed into the thread's tile, which goes into the map a run of
+// gates per Doppler line, zero Doppler in the middle of the block.
+static void fft_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Doppler *doppler = (Doppler *)context;
+	int bl = doppler->options.block_lines, n = doppler->n_doppler;
+	float complex *series = doppler->series + (size_t)thread*n;
+	float complex *work = doppler->work + (size_t)thread*n;
+	float *tile = doppler->tile + (size_t)thread*DOPPLER_TILE*n;
+	const float *w = doppler->window;
+
+	for (int64_t i = begin; i < end; i++)
+	{
+		int b = i/doppler->n_tiles;
+		int g0 = i % doppler->n_tiles*DOPPLER_TILE;
+		int n_g = doppler->options.n_gates - g0 < DOPPLER_TILE ? doppler->options.n_gates - g0 : DOPPLER_TILE;
+		DopplerSums *s = &doppler->sums[(size_t)thread*doppler->band_blocks + b];
+
+		for (int g = 0; g < n_g; g++)
+		{
+			const float *x = (const float *)lines_line(&doppler->turn, (int64_t)b*doppler->options.n_gates + g0 + g);
+			float *y = (float *)series;
+			double re = 0, im = 0, power = 0;
+
+			for (int k = 0; k < bl - 1; k++)
+			{
+				re += x[2*k + 2]*x[2*k] + x[2*k + 3]*x[2*k + 1];
+				im += x[2*k + 3]*x[2*k] - x[2*k + 2]*x[2*k + 1];
+			}
+			for (int k = 0; k < bl; k++)
+			{
+				power += x[2*k]*x[2*k] + x[2*k + 1]*x[2*k + 1];
+				y[2*k] = x[2*k]*w[k];
+				y[2*k + 1] = x[2*k + 1]*w[k];
+			}
+			memset(series + bl, 0, (n - bl)*sizeof(float complex));
+			s->lag += re + I*im;
+			s->power += power;
+
+			fft_forward(&doppler->plan, series, work);
+			range_db(series, tile + (size_t)g*n, n);
+		}
+
+		for (int d = 0; d < n; d++)
+		{
+			float *out = lines_float(doppler->map, (doppler->band + b)*n + (d + n/2) % n) + g0;
+			for (int g = 0; g < n_g; g++)
+				out[g] = tile[(size_t)g*n + d];
+		}
+	}
+}
+
+// Conjugate of a range line in fast time, from the middle sample of the ramp on: the bins as they
+// are stored, the rest zero, through the forward transform.
+static void fast_time(Doppler *doppler, int64_t line, float complex *z, float complex *work)
+{
+	const float *x = (const float *)lines_line(doppler->input, line);
+	float *y = (float *)z;
+	int n_bins = doppler->input->header->n_samples;
+
+	for (int k = 0; k < n_bins; k++)
+	{
+		y[2*k] = x[2*k];
+		y[2*k + 1] = -x[2*k + 1];
+	}
+	memset(z + n_bins, 0, (doppler->range_plan.n - n_bins)*sizeof(float complex));
+
+	fft_forward(&doppler->range_plan, z, work);
+}
+
+// Centroids of the blocks of the band from the sums of every thread. A half of the ramp sees the
+// carrier at its mean time, the centroid unwrapped is the turn between the halves' lag one phases
+// scaled from their difference in carrier to the carrier of the lines' phase reference.
+static void estimate(Doppler *doppler)
+{
+	LinesHeader *h = doppler->input->header;
+	double slope = h->bandwidth/h->sweep_time;
+	double carrier = h->carrier + slope*h->reference_time;
+
+	for (int b = 0; b < doppler->band_n; b++)
+	{
+		DopplerSums s;
+		memset(&s, 0, sizeof(s));
+		for (int t = 0; t < doppler->n_threads; t++)
+		{
+			DopplerSums *p = &doppler->sums[(size_t)t*doppler->band_blocks + b];
+			s.lag += p->lag;
+			s.power += p->power;
+			for (int half = 0; half < 2; half++)
+			{
+				s.look_lag[half] += p->look_lag[half];
+				s.look_time[half] += p->look_time[half];
+				s.look_power[half] += p->look_power[half];
+			}
+		}
+
+		DopplerEstimate *e = &doppler->estimates[doppler->band + b];
+		e->baseband = doppler->rate*carg(s.lag)/(2*M_PI);
+		e->coherence = s.power > 0 ? cabs(s.lag)/s.power : 0;
+		e->unwrapped = 0;
+		e->ambiguity = 0;
+
+		if (doppler->is_looks && s.look_power[0] > 0 && s.look_power[1] > 0)
+		{
+			double f0 = carrier + slope*s.look_time[0]/s.look_power[0]/h->sample_rate;
+			double f1 = carrier + slope*s.look_time[1]/s.look_power[1]/h->sample_rate;
+			double turn = carg(conj(s.look_lag[1])*s.look_lag[0]);
+
+			e->unwrapped = doppler->rate*turn/(2*M_PI)*carrier/(f1 - f0);
+			e->ambiguity = (int)lround((e->unwrapped - e->baseband)/doppler->rate);
+		}
+
+		e->centroid = e->baseband + e->ambiguity*doppler->rate;
+	}
+}
@@ -0,0 +1,91 @@
+#ifndef DOPPLER_H
+#define DOPPLER_H
+
+#include <stdint.h>
+#include <complex.h>
+
+#include "fft.h"
+#include "lines.h"
+
+#define DOPPLER_TILE        16      // range gates per transpose tile and per slow time FFT task
+#define DOPPLER_STRIP       512     // range lines per corner turn task, a page of samples per gate
+
+// Slow time spectra of range lines, a block of block_lines lines at a time: the range-Doppler map
+// and the Doppler centroid of every block.
+//
+// The lines are corner turned into a scratch file of gate series, a band of whole blocks at a time
+// sized to the memory given, so the turn streams however long the capture. A corner turn task
+// moves DOPPLER_STRIP lines of DOPPLER_TILE gates through a small tile, reading a cache line or
+// two from each range line and writing a page of samples to each gate series; tasks are taken
+// strip by strip, so the threads read the input once and in order. The series of a block are then
+// windowed, padded to n_doppler and transformed, DOPPLER_TILE gates per task, and written a tile
+// of gates at a time into each line of the map.
+//
+// The centroid is the phase of the lag one correlation of the series summed over the gates of the
+// map, which only knows it modulo the line rate. The ambiguity comes from splitting every range
+// line back into the first and the second half of its ramp: the centroid scales with the carrier,
+// so the difference of the two halves' lag one phases over their difference in frequency gives the
+// centroid unwrapped, coarsely, but well enough to pick the multiple of the rate.
+typedef struct
+{
+  int block_lines;                  // range lines per block
+  int first_gate, n_gates;          // range bins of the map
+  int window;                       // enum WindowKind, slow time
+  double window_parameter;
+  double memory;                    // [bytes] for the corner turn scratch
+} DopplerOptions;
+
+typedef struct
+{
+  double centroid;                  // [Hz] baseband + ambiguity*rate
+  double baseband;                  // [Hz] within the rate about zero
+  double unwrapped;                 // [Hz] from the two halves of the ramp, 0 if not known
+  int ambiguity;                    // rates from baseband to centroid
+  double coherence;                 // lag one correlation over power, 0 to 1
+} DopplerEstimate;
+
+typedef struct
+{
+  double complex lag;               // the gates of the map, sum of x[k + 1] conj(x[k])
+  double power;
+  double complex look_lag[2];       // first, second half of the ramp, every bin
+  double look_time[2];              // [samples] from the middle, power weighted sum
+  double look_power[2];
+} DopplerSums;
+
+typedef struct
+{
+  Lines *input;                     // complex range lines
+  Lines *map;                       // n_blocks blocks of n_doppler lines
+  Lines turn;                       // scratch, band_blocks*n_gates series of block_lines
+  DopplerOptions options;
+  int n_doppler;                    // slow time FFT
+  int64_t n_blocks;
+  int band_blocks;                  // blocks per pass through the scratch
+  int n_tiles;                      // of DOPPLER_TILE gates
+  double rate;                      // [Hz] of the lines
+  int is_looks;                     // the header has the ramp to split it
+  FftPlan plan;                     // n_doppler
+  FftPlan range_plan;               // n_fft of the lines, back to fast time for the looks
+  float *window;                    // block_lines, the unit tone peaks at one
+  DopplerEstimate *estimates;       // n_blocks
+  int n_threads;
+  double turn_time, look_time, fft_time;  // [s] of the last doppler_run()
+
+  //per thread
+  float complex *series;            // n_doppler
+  float complex *work;              // n_doppler
+  float complex *fast;              // 3 n_fft, this and the last line in fast time and the FFT's work
+  float *tile;                      // DOPPLER_TILE series of n_doppler in dB
+  DopplerSums *sums;                // band_blocks
+
+  int64_t band;                     // first block of the band being worked
+  int band_n;                       // its blocks
+} Doppler;
+
+int doppler_init(Doppler *doppler, Lines *input, DopplerOptions *options, const char *turn_path, int n_threads);
+void doppler_header(Doppler *doppler, LinesHeader *header);
+void doppler_run(Doppler *doppler, Lines *map, int n_threads);
+void doppler_free(Doppler *doppler);
+
+#endif  // DOPPLER_H
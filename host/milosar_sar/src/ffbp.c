@@ -0,0 +1,535 @@
+#include "ffbp.h"
+#include "colour.h"
+#include "pool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define SPEED_OF_LIGHT      299792458.0
+#define EDGE_POINTS         64      // along each edge of the image for the angles it spans
+#define MARGIN              2       // samples beyond the image on every side of a polar grid
+
+// A child as merge() sees it, a subimage or the line of a single pulse.
+typedef struct
+{
+	const Subimage *s;              // NULL for a pulse
+	const float *re, *im;           // the pulse's line, bin -1 first
+	double centre[3];
+	float e[3];                     // [m] parent centre less the child's
+	float e2;
+	float axis[3];
+	float r0, inv_dr;               // range of index 0 and its step
+	float u0, inv_du;
+	int n_r, n_u;
+} Child;
+
+static void polar_grid(const BackprojectGrid *g, Subimage *s, double length, double alpha_max, double oversample);
+static void aperture(Ffbp *ffbp, int first, int n, Subimage *s, double *length);
+static int reserve(Subimage *s);
+static void build(Ffbp *ffbp, int level, int first, int n, Subimage *out, int thread);
+static void merge(Ffbp *ffbp, Subimage *parent, Child *children, int n_children, int thread);
+static void merge_row(const Child *child, const float *vx, const float *vy, float vz, float r0, float dr, int n_r, float alpha,
+                      float beta, float *row);
+static float complex look(const Subimage *s, const double p[3], double *range);
+static void build_task(void *context, int64_t begin, int64_t end, int thread);
+static void image_task(void *context, int64_t begin, int64_t end, int thread);
+
+// Levels for options->levels 0 and the pulses of a subaperture put on the image, FAIL if the image
+// reaches across the track. The subapertures are taken as straight pieces of first to last.
+int ffbp_plan(FfbpOptions *options, BackprojectGrid *grid, double bandwidth, const double first[3], const double last[3], int64_t n_pulses)
+{
+	double track[3] = {last[0] - first[0], last[1] - first[1], last[2] - first[2]};
+	double span = sqrt(track[0]*track[0] + track[1]*track[1] + track[2]*track[2]);
+	double alpha_max = 2*(grid->carrier + fabs(bandwidth))/SPEED_OF_LIGHT;
+	double pixels = (double)grid->n_columns*grid->n_rows;
+	int factor = options->factor;
+
+	if (span <= 0 || factor < 2)
+		return FAIL;
+
+	//every corner on the same side of the track
+	int sides = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		double x = grid->origin[0] + (i & 1)*(grid->n_columns - 1)*grid->spacing[0] - first[0];
+		double y = grid->origin[1] + (i >> 1)*(grid->n_rows - 1)*grid->spacing[1] - first[1];
+		sides |= track[0]*y - track[1]*x > 0 ? 1 : 2;
+	}
+	if (sides == 3)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("The image reaches across the track, factorised backprojection needs it on one side\n");
+		return FAIL;
+	}
+
+	int levels = options->levels;
+	if (levels <= 0)
+	{
+		//merging into a parent pays while its grid is smaller than the image the children would go on
+		levels = 1;
+		for (int l = 2; l < FFBP_MAX_LEVELS && pow(factor, l) <= n_pulses; l++)
+		{
+			double pulses = pow(factor, l);
+			Subimage s;
+			memset(&s, 0, sizeof(s));
+			for (int k = 0; k < 3; k++)
+			{
+				s.centre[k] = (first[k] + last[k])/2;
+				s.axis[k] = track[k]/span;
+			}
+			polar_grid(grid, &s, span*pulses/n_pulses, alpha_max, options->oversample);
+			if ((double)s.n_r*s.n_u > pixels*(factor - 1)/factor)
+				break;
+			levels = l;
+		}
+	}
+
+	options->levels = levels < FFBP_MAX_LEVELS ? levels : FFBP_MAX_LEVELS - 1;
+	return (int)pow(factor, options->levels);
+}
+
+// Blocks of the backprojection are n_subapertures subapertures of pulses, bp->max_pulses of them.
+int ffbp_init(Ffbp *ffbp, Backproject *bp, FfbpOptions *options, double bandwidth, const double first[3], const double last[3])
+{
+	memset(ffbp, 0, sizeof(*ffbp));
+	ffbp->bp = bp;
+	ffbp->options = *options;
+	ffbp->pulses = (int)pow(options->factor, options->levels);
+	ffbp->alpha_max = 2*(bp->grid.carrier + fabs(bandwidth))/SPEED_OF_LIGHT;
+	ffbp->n_subapertures = (bp->max_pulses + ffbp->pulses - 1)/ffbp->pulses;
+
+	double span = sqrt((last[0] - first[0])*(last[0] - first[0]) + (last[1] - first[1])*(last[1] - first[1]) +
+	                   (last[2] - first[2])*(last[2] - first[2]));
+	for (int k = 0; k < 3; k++)
+		ffbp->track[k] = span > 0 ? (last[k] - first[k])/span : k == 0;
+
+	//no grid spans more range than the image's diagonal
+	double width = (bp->grid.n_columns - 1)*bp->grid.spacing[0], height = (bp->grid.n_rows - 1)*bp->grid.spacing[1];
+	ffbp->max_r = ((int)ceil(sqrt(width*width + height*height)/bp->grid.range_bin) + 2*MARGIN + 2 + 7)/8*8;
+
+	ffbp->top = calloc(ffbp->n_subapertures, sizeof(Subimage));
+	ffbp->scratch = calloc((size_t)bp->n_threads*FFBP_MAX_LEVELS*options->factor, sizeof(Subimage));
+	ffbp->points = alloc_aligned((size_t)bp->n_threads*2*ffbp->max_r*sizeof(float));
+	if (ffbp->top == NULL || ffbp->scratch == NULL || ffbp->points == NULL)
+	{
+		ffbp_free(ffbp);
+		return FAIL;
+	}
+
+	return OK;
+}
+
+// Adds pulses 0 up to n_pulses of the block into the image: the subapertures are built on all
+// threads, one each, then put on the image a row at a time.
+void ffbp_run(Ffbp *ffbp, int n_pulses)
+{
+	Backproject *bp = ffbp->bp;
+
+	bp->n_pulses = n_pulses;
+	int n = (n_pulses + ffbp->pulses - 1)/ffbp->pulses;
+	pool_run(bp->n_threads, n, 1, build_task, ffbp);
+	pool_run(bp->n_threads, bp->grid.n_rows, 1, image_task, ffbp);
+}
+
+void ffbp_free(Ffbp *ffbp)
+{
+	for (int i = 0; ffbp->top != NULL && i < ffbp->n_subapertures; i++)
+		free(ffbp->top[i].data);
+	for (int i = 0; ffbp->scratch != NULL && i < ffbp->bp->n_threads*FFBP_MAX_LEVELS*ffbp->options.factor; i++)
+		free(ffbp->scratch[i].data);
+
+	free(ffbp->top);
+	free(ffbp->scratch);
+	free(ffbp->points);
+	memset(ffbp, 0, sizeof(*ffbp));
+}
+
+// Ranges and angles of the image from the subaperture's centre and axis, with MARGIN samples over.
+static void polar_grid(const BackprojectGrid *g, Subimage *s, double length, double alpha_max, double oversample)
+{
+	double x0 = g->origin[0], x1 = x0 + (g->n_columns - 1)*g->spacing[0];
+	double y0 = g->origin[1], y1 = y0 + (g->n_rows - 1)*g->spacing[1];
+	double dz = g->origin[2] - s->centre[2];
+
+	//nearest point of the image, farthest corner
+	double nx = fmin(fmax(s->centre[0], x0), x1) - s->centre[0];
+	double ny = fmin(fmax(s->centre[1], y0), y1) - s->centre[1];
+	double r_min = sqrt(nx*nx + ny*ny + dz*dz), r_max = 0;
+	double u_min = 1, u_max = -1;
+
+	for (int e = 0; e < 4; e++)
+	{
+		for (int i = 0; i <= EDGE_POINTS; i++)
+		{
+			double t = (double)i/EDGE_POINTS;
+			double x = e < 2 ? x0 + t*(x1 - x0) : e == 2 ? x0 : x1;
+			double y = e < 2 ? (e == 0 ? y0 : y1) : y0 + t*(y1 - y0);
+			double v[3] = {x - s->centre[0], y - s->centre[1], dz};
+			double r = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+			double u = (v[0]*s->axis[0] + v[1]*s->axis[1] + v[2]*s->axis[2])/r;
+
+			r_max = fmax(r_max, r);
+			u_min = fmin(u_min, u);
+			u_max = fmax(u_max, u);
+		}
+	}
+
+	s->dr = g->range_bin;
+	s->r0 = r_min - MARGIN*s->dr;
+	s->n_r = (int)ceil((r_max - r_min)/s->dr) + 2*MARGIN + 1;
+
+	//the phase over a subaperture of length L turns alpha L cycles per unit of u
+	s->du = 1/(oversample*alpha_max*fmax(length, 1e-6));
+	s->du = fmin(s->du, 1.0);
+	s->u0 = u_min - MARGIN*s->du;
+	s->n_u = (int)ceil((u_max - u_min)/s->du) + 2*MARGIN + 1;
+
+	double mx = x0 + x1 - 2*s->centre[0], my = y0 + y1 - 2*s->centre[1];
+	s->side = s->axis[0]*my - s->axis[1]*mx > 0 ? 1 : -1;
+}
+
+// Centre and axis of pulses first up to first + n of the block, and the length they span.
+static void aperture(Ffbp *ffbp, int first, int n, Subimage *s, double *length)
+{
+	const double *p = ffbp->bp->position;
+	const double *a = p + 3*first, *b = p + 3*(first + n - 1);
+	double d[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+	double span = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+
+	memset(s->centre, 0, sizeof(s->centre));
+	for (int i = 0; i < n; i++)
+		for (int k = 0; k < 3; k++)
+			s->centre[k] += p[3*(first + i) + k]/n;
+
+	for (int k = 0; k < 3; k++)
+		s->axis[k] = span > 1e-6 ? d[k]/span : ffbp->track[k];
+
+	*length = n > 1 ? span*n/(n - 1) : 0;
+}
+
+static int reserve(Subimage *s)
+{
+	size_t n = (size_t)s->n_r*s->n_u;
+
+	if (n > s->capacity)
+	{
+		free(s->data);
+		s->data = alloc_aligned(n*sizeof(float complex));
+		s->capacity = s->data != NULL ? n : 0;
+		if (s->data == NULL)
+			return FAIL;
+	}
+
+	memset(s->data, 0, n*sizeof(float complex));
+	return OK;
+}
+
+// Subaperture of pulses first up to first + n at level, from factor children of factor^(level - 1)
+// pulses each, built into the thread's scratch for the level first.
+static void build(Ffbp *ffbp, int level, int first, int n, Subimage *out, int thread)
+{
+	Backproject *bp = ffbp->bp;
+	int factor = ffbp->options.factor;
+	int step = (int)pow(factor, level - 1);
+	Subimage *scratch = ffbp->scratch + ((size_t)thread*FFBP_MAX_LEVELS + level - 1)*factor;
+	Child children[FFBP_MAX_FACTOR];
+	int n_children = 0;
+	double length;
+
+	for (int c = first; c < first + n; c += step, n_children++)
+	{
+		int m = first + n - c < step ? first + n - c : step;
+		Child *child = &children[n_children];
+
+		if (m == 1)
+		{
+			//bin -1 is index 0
+			child->s = NULL;
+			child->re = bp->line_re + c*bp->bins_stride;
+			child->im = bp->line_im + c*bp->bins_stride;
+			child->r0 = bp->grid.range_start - bp->grid.range_bin;
+			child->inv_dr = 1/bp->grid.range_bin;
+			child->n_r = bp->grid.n_bins + 3;
+			memcpy(child->centre, bp->position + 3*c, sizeof(child->centre));
+		}
+		else
+		{
+			build(ffbp, level - 1, c, m, &scratch[n_children], thread);
+			child->s = &scratch[n_children];
+			child->r0 = child->s->r0;
+			child->inv_dr = 1/child->s->dr;
+			child->u0 = child->s->u0;
+			child->inv_du = 1/child->s->du;
+			child->n_r = child->s->n_r;
+			child->n_u = child->s->n_u;
+			memcpy(child->centre, child->s->centre, sizeof(child->centre));
+			for (int k = 0; k < 3; k++)
+				child->axis[k] = child->s->axis[k];
+		}
+	}
+
+	aperture(ffbp, first, n, out, &length);
+	polar_grid(&bp->grid, out, length, ffbp->alpha_max, ffbp->options.oversample);
+	if (reserve(out) != OK)
+	{
+		//a subaperture left out only costs its share of the image
+		out->n_r = out->n_u = 0;
+		return;
+	}
+
+	for (int c = 0; c < n_children; c++)
+	{
+		Child *child = &children[c];
+		for (int k = 0; k < 3; k++)
+			child->e[k] = out->centre[k] - child->centre[k];
+		child->e2 = child->e[0]*child->e[0] + child->e[1]*child->e[1] + child->e[2]*child->e[2];
+	}
+
+	merge(ffbp, out, children, n_children, thread);
+}
+
+// Every point of parent from its children, a row of angle at a time. A point at v from the
+// parent's centre, range r, is at v + e from a child's, e the parent's centre less the child's, so
+// its range r_c there has r_c^2 - r^2 = n = 2 v.e + e^2 and r - r_c = -n/(r + r_c) without the
+// large ranges cancelling. The child's sample is interpolated and turned by
+// exp(i 2 pi (phi(r) - phi(r_c))).
+static void merge(Ffbp *ffbp, Subimage *parent, Child *children, int n_children, int thread)
+{
+	Backproject *bp = ffbp->bp;
+	float dz = bp->grid.origin[2] - parent->centre[2];
+	float m = sqrtf(parent->axis[0]*parent->axis[0] + parent->axis[1]*parent->axis[1]);
+	float hx = parent->axis[0]/m, hy = parent->axis[1]/m, hz = parent->axis[2];
+	float *vx = ffbp->points + (size_t)thread*2*ffbp->max_r, *vy = vx + ffbp->max_r;
+
+	if (m < 1e-6f)
+		return;
+
+	for (int iu = 0; iu < parent->n_u; iu++)
+	{
+		float u = parent->u0 + iu*parent->du;
+		float *row = (float *)(parent->data + (size_t)iu*parent->n_r);
+
+		//the points of the image plane at u, on the image's side, none where the cone misses it
+		for (int ir = 0; ir < parent->n_r; ir++)
+		{
+			float r = parent->r0 + ir*parent->dr;
+			float a = (r*u - hz*dz)/m;
+			float b = parent->side*sqrtf(fmaxf(r*r - dz*dz - a*a, 0));
+			vx[ir] = a*hx - b*hy;
+			vy[ir] = a*hy + b*hx;
+		}
+
+		for (int c = 0; c < n_children; c++)
+			merge_row(&children[c], vx, vy, dz, parent->r0, parent->dr, parent->n_r, bp->alpha, bp->beta, row);
+
+		for (int ir = 0; ir < parent->n_r; ir++)
+		{
+			float r = parent->r0 + ir*parent->dr;
+			float a = (r*u - hz*dz)/m;
+			if (r*r - dz*dz - a*a < 0)
+				row[2*ir] = row[2*ir + 1] = 0;
+		}
+	}
+}
+
+// Point r of a row from one child, added to out.
+static inline void merge_point(const Child *child, float vx, float vy, float vz, float r, float alpha, float beta, float *out)
+{
+	float n = 2*(vx*child->e[0] + vy*child->e[1] + vz*child->e[2]) + child->e2;
+	float rc = sqrtf(r*r + n);
+	float dr = -n/(r + rc);
+	float fr = (rc - child->r0)*child->inv_dr;
+	float vr, vi;
+
+	if (child->s == NULL)
+	{
+		//a line, zero off its ends
+		fr = fminf(fmaxf(fr, 0), child->n_r - 2);
+		int i = (int)fr;
+		float w = fr - i;
+		vr = child->re[i] + w*(child->re[i + 1] - child->re[i]);
+		vi = child->im[i] + w*(child->im[i + 1] - child->im[i]);
+	}
+	else
+	{
+		float uc = ((vx + child->e[0])*child->axis[0] + (vy + child->e[1])*child->axis[1] + (vz + child->e[2])*child->axis[2])/rc;
+		float fu = (uc - child->u0)*child->inv_du;
+		if (fr < 0 || fu < 0 || fr > child->n_r - 1 || fu > child->n_u - 1)
+			return;
+
+		int i = (int)fr < child->n_r - 1 ? (int)fr : child->n_r - 2;
+		int j = (int)fu < child->n_u - 1 ? (int)fu : child->n_u - 2;
+		float wr = fr - i, wu = fu - j;
+		const float *s0 = (const float *)(child->s->data + (size_t)j*child->n_r + i);
+		const float *s1 = s0 + 2*child->n_r;
+		float r0 = s0[0] + wr*(s0[2] - s0[0]), i0 = s0[1] + wr*(s0[3] - s0[1]);
+		float r1 = s1[0] + wr*(s1[2] - s1[0]), i1 = s1[1] + wr*(s1[3] - s1[1]);
+		vr = r0 + wu*(r1 - r0);
+		vi = i0 + wu*(i1 - i0);
+	}
+
+	float c, s;
+	backproject_turn(alpha*dr + beta*n, &c, &s);
+	out[0] += vr*c - vi*s;
+	out[1] += vr*s + vi*c;
+}
+
+#if defined(__AVX2__)
+// merge_point() 8 points at a time, the corners of the interpolation gathered, points off a
+// child's grid masked out.
+static void merge_row(const Child *child, const float *vx, const float *vy, float vz, float r0, float dr, int n_r, float alpha,
+                      float beta, float *row)
+{
+	const __m256 ex = _mm256_set1_ps(2*child->e[0]), ey = _mm256_set1_ps(2*child->e[1]);
+	const __m256 ez = _mm256_set1_ps(2*vz*child->e[2] + child->e2);
+	const __m256 cr0 = _mm256_set1_ps(child->r0), inv_dr = _mm256_set1_ps(child->inv_dr);
+	const __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+	const __m256 zero = _mm256_setzero_ps(), max_r = _mm256_set1_ps(child->n_r - 2), last_r = _mm256_set1_ps(child->n_r - 1);
+	const __m256 ramp = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	int ir = 0;
+
+	for (; ir + 8 <= n_r; ir += 8)
+	{
+		__m256 px = _mm256_loadu_ps(vx + ir), py = _mm256_loadu_ps(vy + ir);
+		__m256 r = _mm256_add_ps(_mm256_set1_ps(r0 + ir*dr), _mm256_mul_ps(ramp, _mm256_set1_ps(dr)));
+		__m256 n = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, ex), _mm256_mul_ps(py, ey)), ez);
+		__m256 rc = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(r, r), n));
+		__m256 d = _mm256_div_ps(n, _mm256_add_ps(r, rc));
+		__m256 fr = _mm256_mul_ps(_mm256_sub_ps(rc, cr0), inv_dr);
+		__m256 vr, vi;
+
+		if (child->s == NULL)
+		{
+			fr = _mm256_min_ps(_mm256_max_ps(fr, zero), max_r);
+			__m256i i = _mm256_cvttps_epi32(fr);
+			__m256 w = _mm256_sub_ps(fr, _mm256_cvtepi32_ps(i));
+			__m256 re0 = _mm256_i32gather_ps(child->re, i, 4), re1 = _mm256_i32gather_ps(child->re + 1, i, 4);
+			__m256 im0 = _mm256_i32gather_ps(child->im, i, 4), im1 = _mm256_i32gather_ps(child->im + 1, i, 4);
+			vr = _mm256_add_ps(re0, _mm256_mul_ps(w, _mm256_sub_ps(re1, re0)));
+			vi = _mm256_add_ps(im0, _mm256_mul_ps(w, _mm256_sub_ps(im1, im0)));
+		}
+		else
+		{
+			__m256 uc = _mm256_mul_ps(_mm256_add_ps(px, _mm256_set1_ps(child->e[0])), _mm256_set1_ps(child->axis[0]));
+			uc = _mm256_add_ps(uc, _mm256_mul_ps(_mm256_add_ps(py, _mm256_set1_ps(child->e[1])), _mm256_set1_ps(child->axis[1])));
+			uc = _mm256_add_ps(uc, _mm256_set1_ps((vz + child->e[2])*child->axis[2]));
+			__m256 fu = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(uc, rc), _mm256_set1_ps(child->u0)), _mm256_set1_ps(child->inv_du));
+			__m256 last_u = _mm256_set1_ps(child->n_u - 1);
+			__m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(fr, zero, _CMP_GE_OQ), _mm256_cmp_ps(fr, last_r, _CMP_LE_OQ)),
+			                              _mm256_and_ps(_mm256_cmp_ps(fu, zero, _CMP_GE_OQ), _mm256_cmp_ps(fu, last_u, _CMP_LE_OQ)));
+
+			fr = _mm256_min_ps(_mm256_max_ps(fr, zero), last_r);
+			fu = _mm256_min_ps(_mm256_max_ps(fu, zero), last_u);
+			__m256 fi = _mm256_min_ps(_mm256_floor_ps(fr), max_r);
+			__m256 fj = _mm256_min_ps(_mm256_floor_ps(fu), _mm256_set1_ps(child->n_u - 2));
+			__m256 wr = _mm256_sub_ps(fr, fi), wu = _mm256_sub_ps(fu, fj);
+
+			//float index of the re of sample (j, i), the im follows it
+			const float *base = (const float *)child->s->data;
+			__m256i k = _mm256_slli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvtps_epi32(fj), _mm256_set1_epi32(child->n_r)),
+			                                               _mm256_cvtps_epi32(fi)), 1);
+			__m256i k1 = _mm256_add_epi32(k, _mm256_set1_epi32(2*child->n_r));
+			__m256 r00 = _mm256_i32gather_ps(base, k, 4), i00 = _mm256_i32gather_ps(base + 1, k, 4);
+			__m256 r01 = _mm256_i32gather_ps(base + 2, k, 4), i01 = _mm256_i32gather_ps(base + 3, k, 4);
+			__m256 r10 = _mm256_i32gather_ps(base, k1, 4), i10 = _mm256_i32gather_ps(base + 1, k1, 4);
+			__m256 r11 = _mm256_i32gather_ps(base + 2, k1, 4), i11 = _mm256_i32gather_ps(base + 3, k1, 4);
+			__m256 a_r = _mm256_add_ps(r00, _mm256_mul_ps(wr, _mm256_sub_ps(r01, r00)));
+			__m256 a_i = _mm256_add_ps(i00, _mm256_mul_ps(wr, _mm256_sub_ps(i01, i00)));
+			__m256 b_r = _mm256_add_ps(r10, _mm256_mul_ps(wr, _mm256_sub_ps(r11, r10)));
+			__m256 b_i = _mm256_add_ps(i10, _mm256_mul_ps(wr, _mm256_sub_ps(i11, i10)));
+			vr = _mm256_and_ps(_mm256_add_ps(a_r, _mm256_mul_ps(wu, _mm256_sub_ps(b_r, a_r))), inside);
+			vi = _mm256_and_ps(_mm256_add_ps(a_i, _mm256_mul_ps(wu, _mm256_sub_ps(b_i, a_i))), inside);
+		}
+
+		//times exp(i 2 pi (alpha (r - r_c) + beta n)), r - r_c is -d
+		__m256 c, s;
+		backproject_turn8(_mm256_sub_ps(_mm256_mul_ps(vb, n), _mm256_mul_ps(va, d)), &c, &s);
+		__m256 out_re = _mm256_sub_ps(_mm256_mul_ps(vr, c), _mm256_mul_ps(vi, s));
+		__m256 out_im = _mm256_add_ps(_mm256_mul_ps(vr, s), _mm256_mul_ps(vi, c));
+
+		//back to (re, im) pairs
+		__m256 lo = _mm256_unpacklo_ps(out_re, out_im), hi = _mm256_unpackhi_ps(out_re, out_im);
+		__m256 first = _mm256_permute2f128_ps(lo, hi, 0x20), second = _mm256_permute2f128_ps(lo, hi, 0x31);
+		_mm256_storeu_ps(row + 2*ir, _mm256_add_ps(_mm256_loadu_ps(row + 2*ir), first));
+		_mm256_storeu_ps(row + 2*ir + 8, _mm256_add_ps(_mm256_loadu_ps(row + 2*ir + 8), second));
+	}
+
+	for (; ir < n_r; ir++)
+		merge_point(child, vx[ir], vy[ir], vz, r0 + ir*dr, alpha, beta, row + 2*ir);
+}
+#else
+static void merge_row(const Child *child, const float *vx, const float *vy, float vz, float r0, float dr, int n_r, float alpha,
+                      float beta, float *row)
+{
+	for (int ir = 0; ir < n_r; ir++)
+		merge_point(child, vx[ir], vy[ir], vz, r0 + ir*dr, alpha, beta, row + 2*ir);
+}
+#endif
+
+// Sample of a top level subaperture at point p, bilinear in range and angle, and the range of p
+// from its centre. Zero off its grid.
+static float complex look(const Subimage *s, const double p[3], double *range)
+{
+	double v[3] = {p[0] - s->centre[0], p[1] - s->centre[1], p[2] - s->centre[2]};
+	*range = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+	double u = (v[0]*s->axis[0] + v[1]*s->axis[1] + v[2]*s->axis[2]) / *range;
+
+	double fr = (*range - s->r0)/s->dr, fu = (u - s->u0)/s->du;
+	if (fr < 0 || fu < 0 || fr > s->n_r - 1 || fu > s->n_u - 1)
+		return 0;
+
+	int ir = (int)fr < s->n_r - 1 ? (int)fr : s->n_r - 2;
+	int iu = (int)fu < s->n_u - 1 ? (int)fu : s->n_u - 2;
+	float wr = fr - ir, wu = fu - iu;
+	const float complex *d = s->data + (size_t)iu*s->n_r + ir;
+
+	return (1 - wu)*(d[0] + wr*(d[1] - d[0])) + wu*(d[s->n_r] + wr*(d[s->n_r + 1] - d[s->n_r]));
+}
+
+// Top level subapertures begin up to end of the block.
+static void build_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Ffbp *ffbp = (Ffbp *)context;
+
+	for (int64_t i = begin; i < end; i++)
+	{
+		int first = i*ffbp->pulses;
+		int n = ffbp->bp->n_pulses - first < ffbp->pulses ? ffbp->bp->n_pulses - first : ffbp->pulses;
+		build(ffbp, ffbp->options.levels, first, n, &ffbp->top[i], thread);
+	}
+}
+
+// Image rows begin up to end from every top level subaperture of the block, times exp(-i 2 pi phi(r)).
+static void image_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Ffbp *ffbp = (Ffbp *)context;
+	Backproject *bp = ffbp->bp;
+	BackprojectGrid *g = &bp->grid;
+	int n = (bp->n_pulses + ffbp->pulses - 1)/ffbp->pulses;
+
+	for (int64_t row = begin; row < end; row++)
+	{
+		float *pixel = (float *)(bp->image + row*bp->image_stride);
+
+		for (int i = 0; i < n; i++)
+		{
+			const Subimage *top = &ffbp->top[i];
+			if (top->n_u == 0)
+				continue;
+
+			for (int j = 0; j < g->n_columns; j++)
+			{
+				double p[3] = {g->origin[0] + j*g->spacing[0], g->origin[1] + row*g->spacing[1], g->origin[2]};
+				double r;
+				float complex v = look(top, p, &r);
+
+				double cycles = bp->alpha*r - bp->beta*r*r;
+				float c, s;
+				backproject_turn(cycles - floor(cycles), &c, &s);
+				pixel[2*j] += crealf(v)*c + cimagf(v)*s;
+				pixel[2*j + 1] += cimagf(v)*c - crealf(v)*s;
+			}
+		}
+	}
+}
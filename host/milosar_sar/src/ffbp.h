@@ -0,0 +1,69 @@
+#ifndef FFBP_H
+#define FFBP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <complex.h>
+
+#include "backproject.h"
+
+#define FFBP_MAX_LEVELS     16
+#define FFBP_MAX_FACTOR     16
+
+// Fast factorised backprojection, the same image as backproject_run() in far fewer operations for
+// long apertures.
+//
+// A subaperture image is kept on a polar grid about the subaperture's mean antenna position:
+// range r, and u the cosine of the angle between the line of sight and the subaperture's axis,
+// first to last pulse. A point of the grid is the point of the image plane at that range and
+// angle, on the side of the track the image lies. The phase of a point at range r is put back on
+// its samples, so the image is smooth in r and only varies in u as fast as the subaperture is
+// long: u is sampled oversample times finer than the Nyquist interval of the top of the ramp over
+// the subaperture length, r at the range bin.
+//
+// Single pulses are merged factor at a time into subapertures of level 1, those factor at a time
+// into level 2 and so on for levels levels, each point of a parent interpolated bilinearly from
+// its children; a subaperture of level levels is then interpolated onto the image. The merges of
+// one subaperture run depth first on one thread, so a thread holds at most factor children per
+// level. Finer angle sampling and fewer levels lower the phase error against exact backprojection
+// at the cost of speed, levels 0 chooses the most that keep a subaperture's grid smaller than the
+// image. The image must lie on one side of the track.
+typedef struct
+{
+  int factor;                       // subapertures merged into one, 2 up to FFBP_MAX_FACTOR
+  double oversample;                // angle samples per Nyquist interval
+  int levels;                       // merges before the image, 0 to choose
+} FfbpOptions;
+
+typedef struct
+{
+  double centre[3];                 // [m] mean antenna position
+  double axis[3];                   // unit, along the subaperture
+  int side;                         // 1 if the image is left of the axis, -1 right
+  double r0, dr;                    // [m]
+  double u0, du;
+  int n_r, n_u;
+  float complex *data;              // n_u rows of n_r ranges
+  size_t capacity;                  // samples allocated
+} Subimage;
+
+typedef struct
+{
+  Backproject *bp;                  // grid, phase model, the block of lines and the image
+  FfbpOptions options;
+  int pulses;                       // per subaperture put on the image, factor^levels
+  double track[3];                  // unit, the axis of a single pulse
+  double alpha_max;                 // [cycles/m] at the top of the ramp
+  int n_subapertures;               // of a block
+  Subimage *top;                    // n_subapertures
+  Subimage *scratch;                // factor per level per thread
+  int max_r;                        // ranges a polar grid can have
+  float *points;                    // per thread, a row of points of the image plane, east then north
+} Ffbp;
+
+int ffbp_plan(FfbpOptions *options, BackprojectGrid *grid, double bandwidth, const double first[3], const double last[3], int64_t n_pulses);
+int ffbp_init(Ffbp *ffbp, Backproject *bp, FfbpOptions *options, double bandwidth, const double first[3], const double last[3]);
+void ffbp_run(Ffbp *ffbp, int n_pulses);
+void ffbp_free(Ffbp *ffbp);
+
+#endif  // FFBP_H
@@ -0,0 +1,151 @@
+#include "fft.h"
+#include "utils.h"
+#include <string.h>
+#include <math.h>
+
+// Smallest power of two at least n.
+int fft_size(int n)
+{
+	int size = 1;
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+int fft_plan(FftPlan *plan, int n)
+{
+	memset(plan, 0, sizeof(*plan));
+
+	if (n < 2 || (n & (n - 1)) != 0 || n > (1 << FFT_MAX_LOG2))
+		return FAIL;
+
+	plan->n = n;
+	while ((1 << plan->log2n) < n)
+		plan->log2n++;
+
+	plan->twiddle = alloc_aligned(2*n*sizeof(float));
+	plan->real_twiddle = alloc_aligned(2*n*sizeof(float));
+	if (plan->twiddle == NULL || plan->real_twiddle == NULL)
+	{
+		fft_free(plan);
+		return FAIL;
+	}
+
+	//stage of length l has l/2 twiddles e^(-2 pi i p/l), stages from n down to 2, in double first
+	float *w = plan->twiddle;
+	for (int l = n; l >= 2; l >>= 1)
+	{
+		for (int p = 0; p < l/2; p++)
+		{
+			*w++ = cos(-2*M_PI*p/l);
+			*w++ = sin(-2*M_PI*p/l);
+		}
+	}
+
+	for (int k = 0; k < n; k++)
+	{
+		plan->real_twiddle[2*k] = cos(-M_PI*k/n);
+		plan->real_twiddle[2*k + 1] = sin(-M_PI*k/n);
+	}
+
+	return OK;
+}
+
+// In place, unscaled, e^(-i...) forward transform.
+void fft_forward(FftPlan *plan, float complex *data, float complex *work)
+{
+	float *x = (float *)data, *y = (float *)work;
+	const float *w = plan->twiddle;
+	int n = plan->n;
+
+	//length l transforms, s of them interleaved, half length m
+	for (int s = 1, l = n; l >= 2; s <<= 1, l >>= 1)
+	{
+		int m = l/2;
+
+		if (s == 1)
+		{
+			for (int p = 0; p < m; p++)
+			{
+				float ar = x[2*p], ai = x[2*p + 1], br = x[2*(p + m)], bi = x[2*(p + m) + 1];
+				float dr = ar - br, di = ai - bi;
+				y[4*p] = ar + br;
+				y[4*p + 1] = ai + bi;
+				y[4*p + 2] = dr*w[2*p] - di*w[2*p + 1];
+				y[4*p + 3] = dr*w[2*p + 1] + di*w[2*p];
+			}
+		}
+		else
+		{
+			for (int p = 0; p < m; p++)
+			{
+				const float wr = w[2*p], wi = w[2*p + 1];
+				const float *a = x + 2*s*p, *b = x + 2*s*(p + m);
+				float *even = y + 2*s*(2*p), *odd = y + 2*s*(2*p + 1);
+
+				//s interleaved butterflies with one twiddle, unit stride
+				for (int q = 0; q < 2*s; q += 2)
+				{
+					float dr = a[q] - b[q], di = a[q + 1] - b[q + 1];
+					even[q] = a[q] + b[q];
+					even[q + 1] = a[q + 1] + b[q + 1];
+					odd[q] = dr*wr - di*wi;
+					odd[q + 1] = dr*wi + di*wr;
+				}
+			}
+		}
+
+		w += l;
+		float *swap = x;
+		x = y;
+		y = swap;
+	}
+
+	if (x != (float *)data)
+		memcpy(data, x, n*sizeof(float complex));
+}
+
+// Even samples as the real and odd samples as the imaginary part of one n point transform, then
+// split into the spectrum of the 2n real samples. out holds n + 1 bins and may not be in.
+void fft_real(FftPlan *plan, const float *in, float complex *out, float complex *work)
+{
+	int n = plan->n;
+	float *z = (float *)out, *o = (float *)out;
+	const float *t = plan->real_twiddle;
+
+	memcpy(out, in, n*sizeof(float complex));
+	fft_forward(plan, out, work);
+
+	//X[k] = (Z[k] + Z*[n-k])/2 - i e^(-i pi k/n) (Z[k] - Z*[n-k])/2, pairs k and n - k at once
+	float z0r = z[0], z0i = z[1];
+	o[0] = z0r + z0i;
+	o[1] = 0;
+	o[2*n] = z0r - z0i;
+	o[2*n + 1] = 0;
+
+	for (int k = 1; k <= n/2; k++)
+	{
+		int j = n - k;
+		float ar = z[2*k], ai = z[2*k + 1], br = z[2*j], bi = z[2*j + 1];
+
+		float er = (ar + br)/2, ei = (ai - bi)/2;       // (Z[k] + Z*[j])/2
+		float fr = (ai + bi)/2, fi = (br - ar)/2;       // -i (Z[k] - Z*[j])/2
+		float wr = t[2*k], wi = t[2*k + 1];
+
+		o[2*k] = er + fr*wr - fi*wi;
+		o[2*k + 1] = ei + fr*wi + fi*wr;
+
+		//the same for j, with the conjugates swapped round and e^(-i pi j/n) = -conj(e^(-i pi k/n))
+		float gr = er, gi = -ei;
+		float hr = fr, hi = -fi;
+		o[2*j] = gr - (hr*wr + hi*wi);
+		o[2*j + 1] = gi - (hi*wr - hr*wi);
+	}
+}
+
+void fft_free(FftPlan *plan)
+{
+	free(plan->twiddle);
+	free(plan->real_twiddle);
+	memset(plan, 0, sizeof(*plan));
+}
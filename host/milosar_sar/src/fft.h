@@ -0,0 +1,29 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex.h>
+
+#define FFT_MAX_LOG2        24
+
+// Power of two FFTs with the twiddles of every stage worked out once in the plan. The transform
+// is a radix-2 Stockham, which sorts itself while it runs: no bit reversal pass, and every stage
+// reads and writes unit stride, so the butterfly loops vectorize. A plan is read only once made
+// and shared by all threads, each thread brings its own work buffer of n complex.
+//
+// fft_real() is a real transform of 2n samples through the complex plan of n, the spectrum of
+// the n + 1 non-negative frequencies is returned.
+typedef struct
+{
+  int n;
+  int log2n;
+  float *twiddle;                   // re, im of every stage, n - 1 in all
+  float *real_twiddle;              // e^(-i pi k/n), k < n, for fft_real()
+} FftPlan;
+
+int fft_plan(FftPlan *plan, int n);
+void fft_forward(FftPlan *plan, float complex *data, float complex *work);
+void fft_real(FftPlan *plan, const float *in, float complex *out, float complex *work);
+void fft_free(FftPlan *plan);
+int fft_size(int n);
+
+#endif  // FFT_H
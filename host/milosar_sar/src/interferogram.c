@@ -0,0 +1,197 @@
+#include "interferogram.h"
+#include "pool.h"
+#include "range.h"
+#include "utils.h"
+#include <string.h>
+#include <math.h>
+
+static void look_task(void *context, int64_t begin, int64_t end, int thread);
+static void balance(Interferogram *ifg);
+
+// Pairs the lines of a and b by PRI, both of the same pri_step, and plans the looks over the lines
+// they share.
+int interferogram_init(Interferogram *ifg, Lines *a, Lines *b, InterferogramOptions *options, int n_threads)
+{
+	LinesHeader *ha = a->header, *hb = b->header;
+	int step = ha->pri_step;
+
+	memset(ifg, 0, sizeof(*ifg));
+	ifg->input[0] = a;
+	ifg->input[1] = b;
+	ifg->options = *options;
+	ifg->n_threads = pool_threads(n_threads);
+
+	//the line of b nearest in PRI to line 0 of a, the one of the same number on a tie
+	int64_t ahead = ha->first_pri - hb->first_pri;
+	ifg->offset = (ahead + (ahead >= 0 ? 1 : -1)*(step - 1)/2)/step;
+	ifg->first = ifg->offset < 0 ? -ifg->offset : 0;
+	int64_t last = ha->n_lines < hb->n_lines - ifg->offset ? ha->n_lines : hb->n_lines - ifg->offset;
+	ifg->n_lines = last > ifg->first ? (last - ifg->first)/options->looks[0] : 0;
+	ifg->n_samples = options->n_gates/options->looks[1];
+
+	int bl = (int)lround((double)options->block_lines/options->looks[0]);
+	ifg->block_looks = bl > 1 ? bl : 1;
+	ifg->n_blocks = (ifg->n_lines + ifg->block_looks - 1)/ifg->block_looks;
+
+	ifg->plane = (options->n_gates + ALIGNMENT/sizeof(float) - 1)/(ALIGNMENT/sizeof(float))*(ALIGNMENT/sizeof(float));
+	ifg->accumulate = alloc_aligned((size_t)ifg->n_threads*4*ifg->plane*sizeof(float));
+	ifg->sums = alloc_aligned((ifg->n_lines + 1)*sizeof(InterferogramSums));
+	ifg->balance = alloc_aligned((ifg->n_blocks + 1)*sizeof(InterferogramBalance));
+	if (ifg->accumulate == NULL || ifg->sums == NULL || ifg->balance == NULL)
+	{
+		interferogram_free(ifg);
+		return FAIL;
+	}
+
+	//range phases to different carriers differ by a phase growing with range
+	double slope = ha->sweep_time > 0 ? ha->bandwidth/ha->sweep_time : 0;
+	double alpha_a = 2*(ha->carrier + slope*ha->reference_time)/SPEED_OF_LIGHT;
+	double alpha_b = 2*(hb->carrier + slope*hb->reference_time)/SPEED_OF_LIGHT;
+	if (ha->kind == LinesRange && ha->range_bin > 0 && alpha_a != alpha_b)
+	{
+		ifg->flatten = alloc_aligned(2*ifg->plane*sizeof(float));
+		if (ifg->flatten == NULL)
+		{
+			interferogram_free(ifg);
+			return FAIL;
+		}
+
+		for (int g = 0; g < options->n_gates; g++)
+		{
+			double range = ha->range_start + (options->first_gate + g)*ha->range_bin;
+			double cycles = (alpha_a - alpha_b)*range;
+			ifg->flatten[g] = cos(2*M_PI*(cycles - floor(cycles)));
+			ifg->flatten[ifg->plane + g] = sin(2*M_PI*(cycles - floor(cycles)));
+		}
+	}
+
+	return OK;
+}
+
+// Header of the interferogram or coherence, from a's.
+void interferogram_header(Interferogram *ifg, LinesHeader *header, int kind)
+{
+	LinesHeader *h = ifg->input[0]->header;
+	int *looks = ifg->options.looks;
+
+	memcpy(header, h, sizeof(*header));
+	header->kind = kind;
+	header->n_lines = ifg->n_lines;
+	header->n_samples = ifg->n_samples;
+	header->first_pri = h->first_pri + ifg->first*h->pri_step;
+	header->pri_step = h->pri_step*looks[0];
+	header->range_start = h->range_start + (ifg->options.first_gate + (looks[1] - 1)/2.0)*h->range_bin;
+	header->range_bin = h->range_bin*looks[1];
+	header->looks[0] = looks[0];
+	header->looks[1] = looks[1];
+}
+
+// Every output line and the imbalance of every block.
+void interferogram_run(Interferogram *ifg, Lines *interferogram, Lines *coherence, int n_threads)
+{
+	ifg->interferogram = interferogram;
+	ifg->coherence = coherence;
+	pool_run(n_threads, ifg->n_lines, 1, look_task, ifg);
+	balance(ifg);
+}
+
+void interferogram_free(Interferogram *ifg)
+{
+	free(ifg->flatten);
+	free(ifg->sums);
+	free(ifg->balance);
+	free(ifg->accumulate);
+	memset(ifg, 0, sizeof(*ifg));
+}
+
+// Output lines begin up to end: the products of looks[0] line pairs summed gate by gate, the
+// carrier phase taken off, then looks[1] gates summed into each sample.
+static void look_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Interferogram *ifg = (Interferogram *)context;
+	int n = ifg->n_samples*ifg->options.looks[1], looks = ifg->options.looks[0]*ifg->options.looks[1];
+	float *cross_re = ifg->accumulate + (size_t)thread*4*ifg->plane, *cross_im = cross_re + ifg->plane;
+	float *power_a = cross_im + ifg->plane, *power_b = power_a + ifg->plane;
+
+	for (int64_t o = begin; o < end; o++)
+	{
+		memset(cross_re, 0, 4*ifg->plane*sizeof(float));
+
+		for (int l = 0; l < ifg->options.looks[0]; l++)
+		{
+			int64_t line = ifg->first + o*ifg->options.looks[0] + l;
+			const float *a = (const float *)(lines_line(ifg->input[0], line) + ifg->options.first_gate);
+			const float *b = (const float *)(lines_line(ifg->input[1], line + ifg->offset) + ifg->options.first_gate);
+
+			for (int g = 0; g < n; g++)
+			{
+				float ar = a[2*g], ai = a[2*g + 1], br = b[2*g], bi = b[2*g + 1];
+				cross_re[g] += ar*br + ai*bi;
+				cross_im[g] += ai*br - ar*bi;
+				power_a[g] += ar*ar + ai*ai;
+				power_b[g] += br*br + bi*bi;
+			}
+		}
+
+		if (ifg->flatten != NULL)
+		{
+			const float *c = ifg->flatten, *s = ifg->flatten + ifg->plane;
+			for (int g = 0; g < n; g++)
+			{
+				float re = cross_re[g]*c[g] + cross_im[g]*s[g];
+				cross_im[g] = cross_im[g]*c[g] - cross_re[g]*s[g];
+				cross_re[g] = re;
+			}
+		}
+
+		float complex *out = lines_line(ifg->interferogram, o);
+		float *gamma = lines_float(ifg->coherence, o);
+		double sum_re = 0, sum_im = 0, sum_a = 0, sum_b = 0;
+
+		for (int j = 0; j < ifg->n_samples; j++)
+		{
+			float re = 0, im = 0, pa = 0, pb = 0;
+			for (int g = j*ifg->options.looks[1]; g < (j + 1)*ifg->options.looks[1]; g++)
+			{
+				re += cross_re[g];
+				im += cross_im[g];
+				pa += power_a[g];
+				pb += power_b[g];
+			}
+
+			out[j] = (re + I*im)/looks;
+			gamma[j] = pa*pb > 0 ? sqrtf((re*re + im*im)/(pa*pb)) : 0;
+			sum_re += re;
+			sum_im += im;
+			sum_a += pa;
+			sum_b += pb;
+		}
+
+		InterferogramSums *s = &ifg->sums[o];
+		s->cross = sum_re + I*sum_im;
+		s->power[0] = sum_a;
+		s->power[1] = sum_b;
+	}
+}
+
+// Phase, amplitude ratio and coherence of every block_looks output lines over all the gates.
+static void balance(Interferogram *ifg)
+{
+	for (int64_t k = 0; k < ifg->n_blocks; k++)
+	{
+		double complex cross = 0;
+		double power[2] = {0, 0};
+
+		for (int64_t o = k*ifg->block_looks; o < (k + 1)*ifg->block_looks && o < ifg->n_lines; o++)
+		{
+			cross += ifg->sums[o].cross;
+			power[0] += ifg->sums[o].power[0];
+			power[1] += ifg->sums[o].power[1];
+		}
+
+		InterferogramBalance *e = &ifg->balance[k];
+		e->phase = carg(cross);
+		e->amplitude = power[0] > 0 && power[1] > 0 ? 10*log10(power[0]/power[1]) : 0;
+		e->coherence = power[0]*power[1] > 0 ? cabs(cross)/sqrt(power[0]*power[1]) : 0;
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef INTERFEROGRAM_H
+#define INTERFEROGRAM_H
+
+#include <stdint.h>
+#include <complex.h>
+
+#include "lines.h"
+
+// Interferogram and coherence of two channels or switch states of a capture, and the phase and
+// amplitude imbalance between them over the capture.
+//
+// Line k of a pairs with the line of b nearest its PRI, line k + offset: the same PRI for channels
+// A and B, the next one for RF2 against RF1 when they interleave. Every output sample is the mean
+// of a conj(b) over looks[0] lines by looks[1] gates, and its coherence
+//
+//   |sum a conj(b)| / sqrt(sum |a|^2 sum |b|^2)
+//
+// over the same samples. When the two channels' range phases do not refer to the same carrier, the
+// phase that difference puts on every gate is taken off first, so a flat scene has a flat
+// interferogram. A task is one output line, read straight from both mapped files and summed gate
+// by gate in plain loops that vectorize, so the capture streams through however large. The sums
+// of every output line over the gates give the imbalance of every block_lines lines.
+typedef struct
+{
+  int looks[2];                     // lines, gates averaged per sample
+  int first_gate, n_gates;          // of the input lines
+  int block_lines;                  // range lines per imbalance estimate, rounded to whole looks
+} InterferogramOptions;
+
+typedef struct
+{
+  double phase;                     // [rad] of a against b
+  double amplitude;                 // [dB] of a against b
+  double coherence;                 // 0 to 1
+} InterferogramBalance;
+
+typedef struct
+{
+  double complex cross;             // sum of a conj(b) over the gates
+  double power[2];                  // a, b
+} InterferogramSums;
+
+typedef struct
+{
+  Lines *input[2];                  // a, b
+  Lines *interferogram;             // complex
+  Lines *coherence;                 // floats
+  InterferogramOptions options;
+  int64_t offset;                   // line of b paired with line 0 of a
+  int64_t first;                    // line of a of the first output line
+  int64_t n_lines;                  // output
+  int n_samples;                    // output
+  int block_looks;                  // output lines per imbalance estimate
+  int64_t n_blocks;
+  float *flatten;                   // cos, sin per gate of the carrier phase taken off, NULL if none
+  InterferogramSums *sums;          // per output line
+  InterferogramBalance *balance;    // n_blocks
+  int n_threads;
+
+  //per thread
+  float *accumulate;                // 4 planes of n_gates, a conj(b) re, im, |a|^2, |b|^2
+  int64_t plane;                    // floats per plane
+} Interferogram;
+
+int interferogram_init(Interferogram *ifg, Lines *a, Lines *b, InterferogramOptions *options, int n_threads);
+void interferogram_header(Interferogram *ifg, LinesHeader *header, int kind);
+void interferogram_run(Interferogram *ifg, Lines *interferogram, Lines *coherence, int n_threads);
+void interferogram_free(Interferogram *ifg);
+
+#endif  // INTERFEROGRAM_H
@@ -0,0 +1,118 @@
+#include "lines.h"
+#include "colour.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+_Static_assert(sizeof(LinesHeader) == LINES_HEADER_SIZE, "LinesHeader must be LINES_HEADER_SIZE bytes");
+
+// Samples per line for n_samples, rounded up to LINES_ALIGN bytes.
+int64_t lines_stride(int64_t n_samples, int sample_size)
+{
+	int64_t per_align = LINES_ALIGN/sample_size;
+	return (n_samples + per_align - 1)/per_align*per_align;
+}
+
+// Creates the file at its full size and maps it for writing. The layout fields of header are set
+// here from n_samples, n_lines and the sample size of its kind, the rest is copied as given.
+int lines_create(Lines *lines, const char *path, LinesHeader *header)
+{
+	memset(lines, 0, sizeof(*lines));
+
+	header->magic = LINES_MAGIC;
+	header->version = LINES_VERSION;
+	header->header_size = LINES_HEADER_SIZE;
+	int is_float = header->kind == LinesRangeDb || header->kind == LinesRangePhase || header->kind == LinesDoppler ||
+	               header->kind == LinesCoherence;
+	header->sample_size = is_float ? sizeof(float) : sizeof(float complex);
+	header->stride = lines_stride(header->n_samples, header->sample_size);
+
+	size_t size = LINES_HEADER_SIZE + header->n_lines*header->stride*header->sample_size;
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0 || ftruncate(fd, size) != 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not create %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return FAIL;
+	}
+
+	uint8_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not map %s\n", path);
+		return FAIL;
+	}
+
+	memcpy(data, header, sizeof(*header));
+	lines->header = (LinesHeader *)data;
+	lines->data = (float complex *)(data + LINES_HEADER_SIZE);
+	lines->size = size;
+	return OK;
+}
+
+int lines_map(Lines *lines, const char *path)
+{
+	memset(lines, 0, sizeof(*lines));
+
+	uint8_t *data = map_file(path, &lines->size);
+	if (data == NULL || lines->size < LINES_HEADER_SIZE)
+	{
+		unmap_file(data, lines->size);
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not map %s\n", path);
+		return FAIL;
+	}
+
+	//raw lines written before sample_size have zero there
+	LinesHeader *header = (LinesHeader *)data;
+	size_t sample_size = header->sample_size == 0 ? sizeof(float complex) : header->sample_size;
+	if (header->magic != LINES_MAGIC || header->version != LINES_VERSION || header->header_size != LINES_HEADER_SIZE ||
+	    (sample_size != sizeof(float) && sample_size != sizeof(float complex)) || header->stride < header->n_samples ||
+	    LINES_HEADER_SIZE + header->n_lines*header->stride*sample_size > lines->size)
+	{
+		unmap_file(data, lines->size);
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "%s is not a range line file of version %d\n", path, LINES_VERSION);
+		return FAIL;
+	}
+
+	lines->header = header;
+	lines->data = (float complex *)(data + LINES_HEADER_SIZE);
+	return OK;
+}
+
+float complex *lines_line(Lines *lines, int64_t line)
+{
+	return lines->data + line*lines->header->stride;
+}
+
+// Line of a magnitude or phase file.
+float *lines_float(Lines *lines, int64_t line)
+{
+	return (float *)lines->data + line*lines->header->stride;
+}
+
+// Waits for what was written to the mapping to reach the disk.
+int lines_sync(Lines *lines)
+{
+	return msync(lines->header, lines->size, MS_SYNC) == 0 ? OK : FAIL;
+}
+
+int lines_close(Lines *lines)
+{
+	int status = OK;
+
+	if (lines->header != NULL && munmap(lines->header, lines->size) != 0)
+		status = FAIL;
+
+	memset(lines, 0, sizeof(*lines));
+	return status;
+}
@@ -0,0 +1,89 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <complex.h>
+
+// Range lines of one channel and switch state, the format every processing step reads and
+// writes. A LinesHeader padded to LINES_HEADER_SIZE, then n_lines lines of stride samples,
+// n_samples of them used. Samples are complex floats (re, im), or floats for the magnitude and
+// phase kinds. The header size and the stride keep every line on a LINES_ALIGN boundary when the
+// file is mapped, so lines go straight into aligned vector loads.
+//
+// Line k is PRI first_pri + k*pri_step of the recorded stream, taken at t0 + that PRI times
+// period from the TCU enable, the same numbering and clock as nav.bin.
+//
+// An image is a grid on the plane z = origin[2] of nav.bin's east, north, up frame: line k is
+// north origin[1] + k*spacing[1], sample j east origin[0] + j*spacing[0].
+//
+// A range-Doppler map is blocks of n_doppler lines of power in dB, one block per block_lines
+// range lines from the first: line d of block b is Doppler doppler_start + d*doppler_bin over
+// lines b*block_lines onwards, sample j range gate range_start + j*range_bin.
+//
+// An interferogram of two channels is complex, its coherence floats from 0 to 1: line k is the mean
+// over looks[0] lines from PRI first_pri + k*pri_step, sample j over looks[1] gates about range
+// range_start + j*range_bin.
+
+#define LINES_MAGIC         0x534E4C4D  // "MLNS" little endian
+#define LINES_VERSION       1
+#define LINES_HEADER_SIZE   4096        // one page
+#define LINES_ALIGN         64          // bytes, the stride is a multiple of it
+
+enum LinesKind {LinesRaw = 0, LinesRange = 1, LinesRangeDb = 2, LinesRangePhase = 3, LinesImage = 4, LinesDoppler = 5,
+               LinesInterferogram = 6, LinesCoherence = 7};
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t kind;                    // enum LinesKind
+  int64_t n_lines;
+  int64_t n_samples;                // used per line
+  int64_t stride;                   // samples per line
+  int64_t first_pri;
+  int32_t pri_step;                 // switch_factor, 2 when RF1 and RF2 interleave
+  int32_t channel;                  // 0 A, 1 B
+  int32_t switch_state;             // 0 RF1, 1 RF2
+  int32_t start_index;              // of the first sample in the PRI
+  double t0;                        // [s] PRI clock
+  double period;                    // [s]
+  double sample_rate;               // [Hz] of the samples as stored
+  double bandwidth;                 // [Hz] of the tx ramp
+  double scale;                     // raw counts per unit
+  char capture[64];                 // time stamp of the capture
+  uint32_t sample_size;             // bytes, 8 complex, 4 for the magnitude, phase, Doppler and coherence kinds
+  uint32_t n_fft;                   // range FFT length, 0 for raw lines
+  double range_start;               // [m] of sample 0, range kinds
+  double range_bin;                 // [m] per sample, 0 if the ramp is not known
+  double sweep_time;                // [s] of the tx up ramp
+  double carrier;                   // [Hz] at the start of the tx ramp, 0 if not known
+  double reference_time;            // [s] into the ramp the range phases refer to, range kinds
+  double origin[3];                 // [m] east, north, up of pixel 0, image kind
+  double spacing[2];                // [m] east, north between pixels
+  int64_t n_pulses;                 // lines summed into every pixel
+  double doppler_start;             // [Hz] of line 0 of a block, Doppler kind
+  double doppler_bin;               // [Hz] between lines
+  int64_t n_doppler;                // lines per block
+  int64_t block_lines;              // range lines per block
+  int32_t looks[2];                 // lines, gates averaged per sample, interferogram kinds
+  uint8_t reserved[LINES_HEADER_SIZE - 304];
+} LinesHeader;
+
+typedef struct
+{
+  LinesHeader *header;
+  float complex *data;
+  size_t size;
+} Lines;
+
+int lines_create(Lines *lines, const char *path, LinesHeader *header);
+int lines_map(Lines *lines, const char *path);
+float complex *lines_line(Lines *lines, int64_t line);
+float *lines_float(Lines *lines, int64_t line);
+int64_t lines_stride(int64_t n_samples, int sample_size);
+int lines_sync(Lines *lines);
+int lines_close(Lines *lines);
+
+#endif  // LINES_H
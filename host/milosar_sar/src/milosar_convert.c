@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "colour.h"
+#include "convert.h"
+#include "lines.h"
+#include "pool.h"
+#include "utils.h"
+#include "version.h"
+
+#define CONVERT_CHUNK   256     // PRIs claimed per thread at a time
+
+typedef struct
+{
+	Capture *capture;
+	Lines lines[N_CHANNELS][2];     // channel, switch state
+	int is_channel[N_CHANNELS];
+	int64_t first_pri;
+	float scale;
+	uint8_t *scratch;               // per thread, a PRI across a block boundary
+	float complex *discard;         // per thread, the channel not written
+	int64_t n_missing;
+} Convert;
+
+void usage(void);
+static void convert_task(void *context, int64_t begin, int64_t end, int thread);
+
+//-----------------------------------------------------------------------------------------------
+// Unpacks the raw words of a capture into complex range lines, one file per channel and switch
+// state, raw_<channel>.lines or raw_<channel>_rf<state>.lines.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *output_dir = NULL;
+	const char *channels = "ab";
+	float scale = 1;
+	int n_threads = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:o:s:j:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': channels = optarg; break;
+		case 'o': output_dir = optarg; break;
+		case 's': scale = atof(optarg); break;
+		case 'j': n_threads = atoi(optarg); break;
+		default:  usage(); return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	static Capture capture;
+	if (capture_open(&capture, argv[optind]) != OK || capture_map(&capture) != OK)
+		return EXIT_FAILURE;
+	capture_print(&capture);
+
+	PriClock clock;
+	capture_pri_clock(&capture, &clock);
+
+	Convert convert;
+	memset(&convert, 0, sizeof(convert));
+	convert.capture = &capture;
+	convert.first_pri = capture_first_pri(&capture);
+	convert.scale = scale;
+	convert.is_channel[0] = strchr(channels, 'a') != NULL;
+	convert.is_channel[1] = strchr(channels, 'b') != NULL;
+
+	int64_t n_pris = capture.n_pris - convert.first_pri;
+	if (n_pris <= 0 || (!convert.is_channel[0] && !convert.is_channel[1]))
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Nothing to convert\n");
+		return EXIT_FAILURE;
+	}
+
+	n_threads = pool_threads(n_threads);
+	convert.scratch = alloc_aligned((size_t)n_threads*capture.bytes_per_pri);
+	convert.discard = alloc_aligned((size_t)n_threads*lines_stride(capture.n_samples, sizeof(float complex))*sizeof(float complex));
+	if (convert.scratch == NULL || convert.discard == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Out of memory for %d threads\n", n_threads);
+		return EXIT_FAILURE;
+	}
+
+	double start = now_seconds();
+
+	for (int c = 0; c < N_CHANNELS; c++)
+	{
+		for (int s = 0; s < capture.switch_factor && convert.is_channel[c]; s++)
+		{
+			char path[CAPTURE_PATH_LEN + 64];
+			if (capture.switch_factor == 1)
+				snprintf(path, sizeof(path), "%sraw_%c.lines", output_dir != NULL ? output_dir : capture.dir, 'a' + c);
+			else
+				snprintf(path, sizeof(path), "%sraw_%c_rf%d.lines", output_dir != NULL ? output_dir : capture.dir, 'a' + c, s + 1);
+
+			//first PRI of this switch state on disk
+			int64_t first = convert.first_pri + (s - convert.first_pri % capture.switch_factor + capture.switch_factor) % capture.switch_factor;
+
+			LinesHeader header;
+			memset(&header, 0, sizeof(header));
+			header.kind = LinesRaw;
+			header.n_lines = first < capture.n_pris ? (capture.n_pris - first + capture.switch_factor - 1)/capture.switch_factor : 0;
+			header.n_samples = capture.n_samples;
+			header.first_pri = first;
+			header.pri_step = capture.switch_factor;
+			header.channel = c;
+			header.switch_state = s;
+			header.start_index = capture.start_index;
+			header.t0 = clock.t0;
+			header.period = clock.period;
+			header.sample_rate = capture.sample_rate;
+			header.bandwidth = capture_bandwidth(&capture);
+			header.sweep_time = capture_sweep_time(&capture);
+			header.carrier = capture_carrier(&capture);
+			header.scale = scale;
+			snprintf(header.capture, sizeof(header.capture), "%s", capture.name);
+
+			if (lines_create(&convert.lines[c][s], path, &header) != OK)
+				return EXIT_FAILURE;
+
+			cprint("[**] ", BRIGHT, CYAN);
+			printf("%lld lines of channel %c%s to %s\n", (long long)header.n_lines, 'A' + c,
+			       capture.switch_factor == 1 ? "" : s == 0 ? " RF1" : " RF2", path);
+		}
+	}
+
+	pool_run(n_threads, n_pris, CONVERT_CHUNK, convert_task, &convert);
+
+	//the page cache takes the lines, closing waits for none of the writeback
+	int64_t bytes_out = 0;
+	for (int c = 0; c < N_CHANNELS; c++)
+	{
+		for (int s = 0; s < capture.switch_factor && convert.is_channel[c]; s++)
+		{
+			bytes_out += convert.lines[c][s].size;
+			lines_close(&convert.lines[c][s]);
+		}
+	}
+
+	double elapsed = now_seconds() - start;
+	double bytes_in = (double)n_pris*capture.bytes_per_pri;
+
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%lld PRIs in %.3f [s] on %d threads (%s), %.2f GB/s read, %.2f GB/s written\n", (long long)n_pris, elapsed,
+	       n_threads, convert_isa(), bytes_in/elapsed*1e-9, bytes_out/elapsed*1e-9);
+
+	if (convert.n_missing > 0)
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("%lld PRIs are not on disk and were written as zeros\n", (long long)convert.n_missing);
+	}
+
+	capture_unmap(&capture);
+	free(convert.scratch);
+	free(convert.discard);
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_convert %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_convert [-c a|b|ab] [-o dir/] [-s scale] [-j threads] <capture>\n");
+	fprintf(stderr, "  -c  channels to write (default ab)\n");
+	fprintf(stderr, "  -o  output directory, the capture by default\n");
+	fprintf(stderr, "  -s  multiplies the raw counts (default 1)\n");
+	fprintf(stderr, "  -j  threads, one per CPU by default\n");
+}
+
+// PRIs first_pri + begin up to first_pri + end of the stream, each to the line of its switch state.
+static void convert_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Convert *convert = (Convert *)context;
+	Capture *capture = convert->capture;
+	uint8_t *scratch = convert->scratch + (size_t)thread*capture->bytes_per_pri;
+	float complex *discard = convert->discard + (size_t)thread*lines_stride(capture->n_samples, sizeof(float complex));
+	int64_t n_missing = 0;
+
+	for (int64_t i = begin; i < end; i++)
+	{
+		int64_t pri = convert->first_pri + i;
+		int s = pri % capture->switch_factor;
+		Lines *a = &convert->lines[0][s], *b = &convert->lines[1][s];
+		int64_t line = (pri - (convert->is_channel[0] ? a : b)->header->first_pri)/capture->switch_factor;
+
+		float complex *line_a = convert->is_channel[0] ? lines_line(a, line) : discard;
+		float complex *line_b = convert->is_channel[1] ? lines_line(b, line) : discard;
+
+		const uint8_t *words = capture_pri(capture, pri, scratch);
+		if (words == NULL)
+		{
+			//a fresh file reads as zeros already
+			n_missing++;
+			continue;
+		}
+
+		convert_pri(words, capture->n_samples, line_a, line_b, convert->scale);
+	}
+
+	__atomic_add_fetch(&convert->n_missing, n_missing, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "colour.h"
+#include "doppler.h"
+#include "lines.h"
+#include "pool.h"
+#include "utils.h"
+#include "version.h"
+#include "window.h"
+
+#define DOPPLER_LINES       256     // range lines per block by default
+#define DOPPLER_MEMORY      1024    // [MB] of corner turn scratch by default
+
+void usage(void);
+static int write_centroids(const char *path, Doppler *doppler);
+static void bench(Doppler *doppler, Lines *map, int max_threads);
+
+//-----------------------------------------------------------------------------------------------
+// Range-Doppler maps and Doppler centroids of the range lines of milosar_range, a block of lines
+// at a time, to doppler_<channel>[_rf<state>].lines and .csv.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	DopplerOptions options = {DOPPLER_LINES, 0, -1, WindowHann, 0, DOPPLER_MEMORY*1e6};
+	int n_threads = 0;
+	int is_bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:g:w:M:o:j:Bh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'a': options.block_lines = atoi(optarg); break;
+		case 'M': options.memory = atof(optarg)*1e6; break;
+		case 'o': output = optarg; break;
+		case 'j': n_threads = atoi(optarg); break;
+		case 'B': is_bench = 1; break;
+		case 'g':
+			options.first_gate = atoi(optarg);
+			if (strchr(optarg, ':') != NULL)
+				options.n_gates = atoi(strchr(optarg, ':') + 1);
+			break;
+		case 'w':
+			if (window_parse(optarg, &options.window, &options.window_parameter) != OK)
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1 || options.block_lines < 0 || options.block_lines == 1 || options.memory <= 0)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[optind];
+	Lines input;
+	if (lines_map(&input, path) != OK)
+		return EXIT_FAILURE;
+
+	LinesHeader *in = input.header;
+	if (in->kind != LinesRange || in->period <= 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("%s is not complex range lines with a PRI period\n", path);
+		return EXIT_FAILURE;
+	}
+
+	//-a 0 is all the lines in one block
+	if (options.block_lines == 0)
+		options.block_lines = in->n_lines;
+	if (options.n_gates < 0 || options.first_gate + options.n_gates > in->n_samples)
+		options.n_gates = in->n_samples - options.first_gate;
+	if (options.first_gate < 0 || options.n_gates <= 0 || options.block_lines < 2 || in->n_lines < options.block_lines ||
+	    fft_size(options.block_lines) > 1 << FFT_MAX_LOG2)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Blocks of %d lines from gate %d do not fit in %lld lines of %lld bins\n", options.block_lines, options.first_gate,
+		       (long long)in->n_lines, (long long)in->n_samples);
+		return EXIT_FAILURE;
+	}
+
+	//doppler_a.lines for range_a.lines, the centroids in doppler_a.csv
+	const char *slash = strrchr(path, '/');
+	const char *name = slash != NULL ? slash + 1 : path;
+	char dir[CAPTURE_PATH_LEN], map_path[2*CAPTURE_PATH_LEN], csv_path[2*CAPTURE_PATH_LEN + 8], turn_path[2*CAPTURE_PATH_LEN + 8];
+	snprintf(dir, sizeof(dir), "%.*s", (int)(name - path), path);
+	if (output != NULL)
+		snprintf(map_path, sizeof(map_path), "%s", output);
+	else
+	{
+		if (strncmp(name, "range_", 6) == 0)
+			name += 6;
+		snprintf(map_path, sizeof(map_path), "%sdoppler_%s", dir, name);
+	}
+	const char *dot = strrchr(map_path, '.');
+	int stem = dot != NULL && strcmp(dot, ".lines") == 0 ? (int)(dot - map_path) : (int)strlen(map_path);
+	snprintf(csv_path, sizeof(csv_path), "%.*s.csv", stem, map_path);
+	snprintf(turn_path, sizeof(turn_path), "%s.turn", map_path);
+
+	static Doppler doppler;
+	if (doppler_init(&doppler, &input, &options, turn_path, n_threads) != OK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Out of memory for blocks of %d lines\n", options.block_lines);
+		return EXIT_FAILURE;
+	}
+
+	LinesHeader header;
+	Lines map;
+	doppler_header(&doppler, &header);
+	if (lines_create(&map, map_path, &header) != OK)
+		return EXIT_FAILURE;
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("%lld blocks of %d lines at %.2f [Hz], %d gates from %.1f [m], %d point FFT of %.3f [Hz] bins, %s window\n",
+	       (long long)doppler.n_blocks, options.block_lines, doppler.rate, options.n_gates, header.range_start, doppler.n_doppler,
+	       header.doppler_bin, window_name(options.window));
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Corner turn of %d block(s) at a time, %.1f [MB] of scratch\n", doppler.band_blocks,
+	       doppler.turn.size*1e-6);
+	if (!doppler.is_looks)
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("No carrier or ramp in the header, centroids are only known modulo the line rate\n");
+	}
+
+	if (is_bench)
+	{
+		bench(&doppler, &map, doppler.n_threads);
+		return EXIT_SUCCESS;
+	}
+
+	double start = now_seconds();
+	doppler_run(&doppler, &map, doppler.n_threads);
+	double elapsed = now_seconds() - start;
+
+	if (write_centroids(csv_path, &doppler) != OK)
+		return EXIT_FAILURE;
+
+	int64_t n_lines = doppler.n_blocks*options.block_lines;
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%lld lines in %.3f [s] on %d threads (corner turn %.3f, looks %.3f, FFTs %.3f), to %s\n", (long long)n_lines,
+	       elapsed, doppler.n_threads, doppler.turn_time, doppler.look_time, doppler.fft_time, map_path);
+
+	//spread of the centroid over the capture
+	double sum = 0, low = INFINITY, high = -INFINITY, coherence = 0;
+	int64_t n_ambiguous = 0;
+	for (int64_t b = 0; b < doppler.n_blocks; b++)
+	{
+		DopplerEstimate *e = &doppler.estimates[b];
+		sum += e->centroid;
+		low = fmin(low, e->centroid);
+		high = fmax(high, e->centroid);
+		coherence += e->coherence;
+		n_ambiguous += e->ambiguity != 0;
+	}
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Centroid %.2f [Hz] mean, %.2f to %.2f, coherence %.3f mean, %lld of %lld blocks beyond the line rate, to %s\n",
+	       sum/doppler.n_blocks, low, high, coherence/doppler.n_blocks, (long long)n_ambiguous, (long long)doppler.n_blocks,
+	       csv_path);
+
+	if (in->n_lines > n_lines)
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("The last %lld lines do not fill a block and are left out\n", (long long)(in->n_lines - n_lines));
+	}
+
+	lines_close(&map);
+	doppler_free(&doppler);
+	lines_close(&input);
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_doppler %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_doppler [-a lines] [-g first[:count]] [-w window[:parameter]] [-M MB] [-o map.lines]\n");
+	fprintf(stderr, "                       [-j threads] [-B] <range.lines>\n");
+	fprintf(stderr, "  -a  range lines per block (default %d), 0 for all of them in one\n", DOPPLER_LINES);
+	fprintf(stderr, "  -g  range gates of the map and centroid, all by default\n");
+	fprintf(stderr, "  -w  slow time window, rect, hann (default), hamming, blackman, kaiser[:beta] or taylor[:sidelobe dB]\n");
+	fprintf(stderr, "  -M  memory for the corner turn scratch (default %d)\n", DOPPLER_MEMORY);
+	fprintf(stderr, "  -o  output, doppler_<channel>.lines next to the lines by default, the centroids to .csv beside it\n");
+	fprintf(stderr, "  -j  threads, one per CPU by default\n");
+	fprintf(stderr, "  -B  benchmark against thread count\n");
+}
+
+// One row per block, its time the middle of the block on the PRI clock.
+static int write_centroids(const char *path, Doppler *doppler)
+{
+	LinesHeader *h = doppler->input->header;
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not create %s\n", path);
+		return FAIL;
+	}
+
+	fprintf(f, "block,first_pri,time,centroid,baseband,unwrapped,ambiguity,coherence\n");
+	for (int64_t b = 0; b < doppler->n_blocks; b++)
+	{
+		DopplerEstimate *e = &doppler->estimates[b];
+		int64_t pri = h->first_pri + b*doppler->options.block_lines*h->pri_step;
+		double time = h->t0 + (pri + (doppler->options.block_lines - 1)/2.0*h->pri_step)*h->period;
+
+		fprintf(f, "%lld,%lld,%.6f,%.3f,%.3f,%.3f,%d,%.4f\n", (long long)b, (long long)pri, time, e->centroid, e->baseband,
+		        e->unwrapped, e->ambiguity, e->coherence);
+	}
+
+	fclose(f);
+	return OK;
+}
+
+// The whole run on 1, 2, 4 up to max_threads, after a first run that reads the input into the page
+// cache, with the time of each pass and the speedup over one thread.
+static void bench(Doppler *doppler, Lines *map, int max_threads)
+{
+	int64_t n_lines = doppler->n_blocks*doppler->options.block_lines;
+	double bytes = n_lines*doppler->input->header->n_samples*sizeof(float complex);
+	double single = 0;
+
+	doppler_run(doppler, map, max_threads);
+
+	printf("%8s %10s %10s %10s %10s %12s %8s %8s\n", "threads", "turn [s]", "looks [s]", "FFTs [s]", "time [s]", "lines/s", "GB/s",
+	       "speedup");
+	for (int threads = 1; threads <= max_threads; threads = threads < max_threads && 2*threads > max_threads ? max_threads : 2*threads)
+	{
+		double start = now_seconds();
+		doppler_run(doppler, map, threads);
+		double elapsed = now_seconds() - start;
+
+		if (threads == 1)
+			single = elapsed;
+
+		printf("%8d %10.3f %10.3f %10.3f %10.3f %12.0f %8.2f %8.2f\n", threads, doppler->turn_time, doppler->look_time,
+		       doppler->fft_time, elapsed, n_lines/elapsed, bytes/elapsed*1e-9, single/elapsed);
+
+		if (threads == max_threads)
+			break;
+	}
+}
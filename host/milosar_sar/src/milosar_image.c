@@ -0,0 +1,619 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "autofocus.h"
+#include "backproject.h"
+#include "capture.h"
+#include "colour.h"
+#include "ffbp.h"
+#include "lines.h"
+#include "nav.h"
+#include "pool.h"
+#include "utils.h"
+#include "version.h"
+
+#define IMAGE_BLOCK         256     // pulses added to the image per pass over the tiles
+#define IMAGE_CHECKPOINT    600     // [s] between checkpoints by default
+#define LOAD_CHUNK          16      // pulses of a block claimed per thread at a time
+#define COMPARE_DB          20      // [dB] below the peak, pixels compared against exact backprojection
+#define AUTOFOCUS_TARGETS   32      // brightest image lines autofocus works on
+#define AUTOFOCUS_WINDOW    128     // [pixels] along the track, its first window
+#define AUTOFOCUS_CHECK     0.05    // [rad] rms of the error left against -T that passes
+
+typedef struct
+{
+	Lines *input;
+	Nav *nav;
+	Backproject *bp;
+	Ffbp *ffbp;                     // factorised, exact backprojection if NULL
+	int64_t first;                  // line of the first pulse of the block
+	int64_t start;                  // line of phase[0]
+	const double *phase;            // [rad] per pulse from start, taken off its line
+} Load;
+
+void usage(void);
+static int parse_doubles(const char *text, double *values, int n);
+static int focus(Load *load, int64_t first, int64_t count, LinesHeader *header, const char *part_path, double checkpoint);
+static void compare(Backproject *image, Backproject *exact);
+static int check_phase(const char *path, const double *phase, int64_t count, int64_t first_pri, int pri_step);
+static int resume(const char *path, LinesHeader *header, Backproject *bp);
+static int write_image(const char *path, LinesHeader *header, Backproject *bp);
+static int autofocus(Load *load, AutofocusOptions *options, int64_t first, int64_t count, LinesHeader *header, double *phase,
+                     int *is_converged);
+static void load_task(void *context, int64_t begin, int64_t end, int thread);
+
+//-----------------------------------------------------------------------------------------------
+// Focuses the range lines of milosar_range by time domain backprojection onto a grid of east,
+// north positions in the frame of nav.bin, to image_<channel>[_rf<state>].lines. Exact or fast
+// factorised, with a phase gradient autofocus pass if asked.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	const char *nav_path = NULL;
+	const char *phase_path = NULL;
+	const char *truth_path = NULL;
+	double extent[4], spacing[2] = {1, 1}, height = 0;
+	int64_t first = 0, count = -1;
+	int is_grid = 0, is_fresh = 0, is_ffbp = 0, is_compare = 0, is_autofocus = 0, n_threads = 0;
+	double checkpoint = IMAGE_CHECKPOINT;
+	FfbpOptions options = {4, 4, 0};
+	AutofocusOptions autofocus_options = {AUTOFOCUS_TARGETS, AUTOFOCUS_WINDOW, 32, 10, 0.01};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:d:z:n:p:o:j:C:Fm:k:u:L:EAe:T:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm': is_ffbp = strcmp(optarg, "ffbp") == 0; break;
+		case 'k': options.factor = atoi(optarg); break;
+		case 'u': options.oversample = atof(optarg); break;
+		case 'L': options.levels = atoi(optarg); break;
+		case 'E': is_compare = 1; break;
+		case 'e': phase_path = optarg; break;
+		case 'A': is_autofocus = 1; break;
+		case 'T': truth_path = optarg; break;
+		case 'g': is_grid = parse_doubles(optarg, extent, 4) == 4; break;
+		case 'z': height = atof(optarg); break;
+		case 'n': nav_path = optarg; break;
+		case 'o': output = optarg; break;
+		case 'j': n_threads = atoi(optarg); break;
+		case 'C': checkpoint = atof(optarg); break;
+		case 'F': is_fresh = 1; break;
+		case 'd':
+			if (parse_doubles(optarg, spacing, 2) == 1)
+				spacing[1] = spacing[0];
+			break;
+		case 'p':
+			first = atoll(optarg);
+			if (strchr(optarg, ':') != NULL)
+				count = atoll(strchr(optarg, ':') + 1);
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1 || !is_grid || spacing[0] <= 0 || spacing[1] <= 0 || extent[2] < extent[0] || extent[3] < extent[1] ||
+	    options.factor < 2 || options.factor > FFBP_MAX_FACTOR || options.oversample <= 0)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[optind];
+	Lines input;
+	if (lines_map(&input, path) != OK)
+		return EXIT_FAILURE;
+
+	LinesHeader *in = input.header;
+	if (in->kind != LinesRange)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("%s is not complex range lines\n", path);
+		return EXIT_FAILURE;
+	}
+	if (in->range_bin <= 0 || in->carrier <= 0 || in->sweep_time <= 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("%s has no range bin size or carrier, range compress it again\n", path);
+		return EXIT_FAILURE;
+	}
+
+	//nav.bin next to the lines unless told otherwise
+	const char *slash = strrchr(path, '/');
+	const char *name = slash != NULL ? slash + 1 : path;
+	char dir[CAPTURE_PATH_LEN], nav_default[CAPTURE_PATH_LEN + 16];
+	snprintf(dir, sizeof(dir), "%.*s", (int)(name - path), path);
+	snprintf(nav_default, sizeof(nav_default), "%s%s", dir, NAV_FILE);
+
+	Nav nav;
+	if (nav_map(&nav, nav_path != NULL ? nav_path : nav_default) != OK)
+		return EXIT_FAILURE;
+
+	if (count < 0 || first + count > in->n_lines)
+		count = in->n_lines - first;
+
+	//every pulse needs its antenna position
+	int64_t pri0 = in->first_pri + first*in->pri_step - nav.header->first_pri;
+	int64_t pri1 = pri0 + (count - 1)*in->pri_step;
+	if (first < 0 || count <= 0 || pri0 < 0 || pri1 >= nav.header->n_pris)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Pulses %lld to %lld are not all in %s\n", (long long)first, (long long)(first + count - 1),
+		       nav_path != NULL ? nav_path : nav_default);
+		return EXIT_FAILURE;
+	}
+
+	//range bins of positive beat frequencies only, -a lines hold the negative ones above n_fft/2
+	BackprojectGrid grid;
+	memset(&grid, 0, sizeof(grid));
+	grid.n_columns = (int)((extent[2] - extent[0])/spacing[0] + 1e-9) + 1;
+	grid.n_rows = (int)((extent[3] - extent[1])/spacing[1] + 1e-9) + 1;
+	grid.origin[0] = extent[0];
+	grid.origin[1] = extent[1];
+	grid.origin[2] = height;
+	grid.spacing[0] = spacing[0];
+	grid.spacing[1] = spacing[1];
+	grid.n_bins = in->n_fft > 0 && in->n_samples > in->n_fft/2 ? in->n_fft/2 : in->n_samples;
+	grid.range_start = in->range_start;
+	grid.range_bin = in->range_bin;
+	grid.carrier = in->carrier;
+	grid.slope = in->bandwidth/in->sweep_time;
+	grid.reference_time = in->reference_time;
+
+	//factorised blocks are a subaperture per thread
+	const double *track0 = nav.records[pri0].position, *track1 = nav.records[pri1].position;
+	int block = IMAGE_BLOCK;
+	if (is_ffbp)
+	{
+		int pulses = ffbp_plan(&options, &grid, in->bandwidth, track0, track1, count);
+		if (pulses == FAIL)
+			return EXIT_FAILURE;
+		block = pulses*pool_threads(n_threads);
+	}
+
+	static Backproject bp;
+	static Ffbp ffbp;
+	if (backproject_init(&bp, &grid, block, n_threads) != OK ||
+	    (is_ffbp && ffbp_init(&ffbp, &bp, &options, in->bandwidth, track0, track1) != OK))
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Out of memory for a %d x %d image\n", grid.n_columns, grid.n_rows);
+		return EXIT_FAILURE;
+	}
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("%d x %d pixels of %.3f x %.3f [m] at %.1f [m] up, %lld pulses of %d bins, carrier %.4f [GHz], %d threads (%s)\n",
+	       grid.n_columns, grid.n_rows, spacing[0], spacing[1], height, (long long)count, grid.n_bins, grid.carrier*1e-9,
+	       bp.n_threads, backproject_isa());
+	if (is_ffbp)
+	{
+		cprint("[**] ", BRIGHT, CYAN);
+		printf("Factorised, %d levels of %d, subapertures of %d pulses on the image, angles %.1f times Nyquist\n", options.levels,
+		       options.factor, ffbp.pulses, options.oversample);
+	}
+
+	//image_a.lines for range_a.lines
+	char image_path[2*CAPTURE_PATH_LEN], part_path[2*CAPTURE_PATH_LEN + 8], history_path[2*CAPTURE_PATH_LEN + 16];
+	if (output != NULL)
+		snprintf(image_path, sizeof(image_path), "%s", output);
+	else
+	{
+		if (strncmp(name, "range_", 6) == 0)
+			name += 6;
+		snprintf(image_path, sizeof(image_path), "%simage_%s", dir, name);
+	}
+	snprintf(part_path, sizeof(part_path), "%s.part", image_path);
+	const char *dot = strrchr(image_path, '.');
+	int stem = dot != NULL && strcmp(dot, ".lines") == 0 ? (int)(dot - image_path) : (int)strlen(image_path);
+	snprintf(history_path, sizeof(history_path), "%.*s_phase.csv", stem, image_path);
+
+	LinesHeader header;
+	memcpy(&header, in, sizeof(header));
+	header.kind = LinesImage;
+	header.n_lines = grid.n_rows;
+	header.n_samples = grid.n_columns;
+	header.first_pri = in->first_pri + first*in->pri_step;
+	header.n_fft = 0;
+	header.range_start = 0;
+	header.range_bin = 0;
+	header.reference_time = 0;
+	memcpy(header.origin, grid.origin, sizeof(header.origin));
+	memcpy(header.spacing, grid.spacing, sizeof(header.spacing));
+	header.n_pulses = 0;
+
+	if (!is_fresh && resume(part_path, &header, &bp) == OK && header.n_pulses > 0)
+	{
+		cprint("[**] ", BRIGHT, CYAN);
+		printf("Resuming from %s after %lld pulses\n", part_path, (long long)header.n_pulses);
+	}
+
+	//phase errors of the pulses, from -e and then from autofocus
+	double *phase = calloc(count, sizeof(double));
+	if (phase == NULL)
+		return EXIT_FAILURE;
+	if (phase_path != NULL)
+	{
+		int n = autofocus_read(phase_path, phase, count, header.first_pri, in->pri_step);
+		if (n == FAIL)
+			return EXIT_FAILURE;
+
+		cprint("[**] ", BRIGHT, n < count ? YELLOW : CYAN);
+		printf("Phase errors of %d of %lld pulses from %s\n", n, (long long)count, phase_path);
+	}
+
+	Load load = {&input, &nav, &bp, is_ffbp ? &ffbp : NULL, 0, first, phase};
+	int64_t start_pulses = header.n_pulses;
+	double start = now_seconds();
+	double pixels = (double)grid.n_columns*grid.n_rows;
+
+	if (focus(&load, first, count, &header, part_path, checkpoint) != OK)
+		return EXIT_FAILURE;
+
+	double elapsed = now_seconds() - start;
+	int64_t focused = header.n_pulses - start_pulses;
+
+	int is_converged = 1;
+	if (is_autofocus && (autofocus(&load, &autofocus_options, first, count, &header, phase, &is_converged) != OK ||
+	                     autofocus_write(history_path, phase, count, header.first_pri, in->pri_step) != OK))
+		return EXIT_FAILURE;
+
+	if (write_image(image_path, &header, &bp) != OK)
+		return EXIT_FAILURE;
+	unlink(part_path);
+
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%lld pulses in %.3f [s], %.3g pixel pulses/s, to %s\n", (long long)focused, elapsed, pixels*focused/elapsed, image_path);
+	if (is_autofocus)
+	{
+		cprint("[OK] ", BRIGHT, GREEN);
+		printf("Phase error history to %s\n", history_path);
+	}
+	if (truth_path != NULL && check_phase(truth_path, phase, count, header.first_pri, in->pri_step) != OK)
+		is_converged = 0;
+
+	if (is_compare)
+	{
+		static Backproject exact;
+		if (backproject_init(&exact, &grid, IMAGE_BLOCK, n_threads) != OK)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			printf("Out of memory for the exact image\n");
+			return EXIT_FAILURE;
+		}
+
+		LinesHeader exact_header = header;
+		Load exact_load = {&input, &nav, &exact, NULL, 0, first, phase};
+		exact_header.n_pulses = 0;
+		start = now_seconds();
+		focus(&exact_load, first, count, &exact_header, NULL, 0);
+		double exact_elapsed = now_seconds() - start;
+
+		cprint("[**] ", BRIGHT, CYAN);
+		printf("Exact backprojection in %.3f [s], %.3g pixel pulses/s, %.1f times the time\n", exact_elapsed,
+		       pixels*count/exact_elapsed, exact_elapsed/elapsed);
+		compare(&bp, &exact);
+		backproject_free(&exact);
+	}
+
+	if (is_ffbp)
+		ffbp_free(&ffbp);
+	backproject_free(&bp);
+	free(phase);
+	nav_unmap(&nav);
+	lines_close(&input);
+	return is_converged ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_image %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_image -g east0,north0,east1,north1 [-d spacing[,north]] [-z height] [-n nav.bin]\n");
+	fprintf(stderr, "                     [-p first[:count]] [-o image.lines] [-j threads] [-C seconds] [-F]\n");
+	fprintf(stderr, "                     [-m bp|ffbp] [-k factor] [-u oversample] [-L levels] [-E] [-A] [-e phase.csv] [-T truth.csv]\n");
+	fprintf(stderr, "                     <range.lines>\n");
+	fprintf(stderr, "  -g  corners of the grid [m] in the frame of nav.bin\n");
+	fprintf(stderr, "  -d  pixel spacing [m] (default 1), north the same unless given\n");
+	fprintf(stderr, "  -z  height of the grid [m] (default 0)\n");
+	fprintf(stderr, "  -n  antenna track, nav.bin next to the lines by default\n");
+	fprintf(stderr, "  -p  lines to focus, all by default\n");
+	fprintf(stderr, "  -o  output, image_<channel>.lines next to the lines by default\n");
+	fprintf(stderr, "  -j  threads, one per CPU by default\n");
+	fprintf(stderr, "  -C  seconds between checkpoints to <output>.part (default 600), 0 for none\n");
+	fprintf(stderr, "  -F  start afresh rather than from a checkpoint\n");
+	fprintf(stderr, "  -m  bp exact backprojection (default), ffbp fast factorised backprojection\n");
+	fprintf(stderr, "  -k  ffbp subapertures merged at a time (default 4)\n");
+	fprintf(stderr, "  -u  ffbp angle samples per Nyquist interval (default 4), finer is closer to exact\n");
+	fprintf(stderr, "  -L  ffbp merges before the image, by default the most that pay\n");
+	fprintf(stderr, "  -E  also focus exactly and print the time and error against it\n");
+	fprintf(stderr, "  -A  autofocus, estimate the phase error of every pulse from the image and focus again without it\n");
+	fprintf(stderr, "  -T  check the phase error taken off against a known one, as milosar_target -e writes, fail beyond %.2f [rad] rms\n",
+	        AUTOFOCUS_CHECK);
+	fprintf(stderr, "  -e  phase error of every pulse [rad] to take off, pri,phase as -A writes to <output>_phase.csv\n");
+}
+
+// Adds pulses header->n_pulses up to count into the image a block at a time, with a checkpoint to
+// part_path every checkpoint seconds if there is one.
+static int focus(Load *load, int64_t first, int64_t count, LinesHeader *header, const char *part_path, double checkpoint)
+{
+	Backproject *bp = load->bp;
+	int64_t start_pulses = header->n_pulses;
+	double start = now_seconds(), last = start;
+	double pixels = (double)bp->grid.n_columns*bp->grid.n_rows;
+
+	while (header->n_pulses < count)
+	{
+		int n = count - header->n_pulses < bp->max_pulses ? count - header->n_pulses : bp->max_pulses;
+		load->first = first + header->n_pulses;
+		pool_run(bp->n_threads, n, LOAD_CHUNK, load_task, load);
+		if (load->ffbp != NULL)
+			ffbp_run(load->ffbp, n);
+		else
+			backproject_run(bp, n);
+		header->n_pulses += n;
+
+		double now = now_seconds();
+		if (part_path != NULL && checkpoint > 0 && now - last >= checkpoint && header->n_pulses < count)
+		{
+			if (write_image(part_path, header, bp) != OK)
+				return FAIL;
+			last = now_seconds();
+
+			cprint("[**] ", BRIGHT, CYAN);
+			printf("%lld of %lld pulses, %.3g pixel pulses/s, checkpoint in %s\n", (long long)header->n_pulses, (long long)count,
+			       pixels*(header->n_pulses - start_pulses)/(now - start), part_path);
+		}
+	}
+
+	return OK;
+}
+
+// Phase errors of the pulses from the focused image, added to phase, and the image focused again
+// from nothing with them taken off. Without convergence that is done with the estimate of the
+// smallest correction and is_converged cleared, so the run still fails once it is written.
+static int autofocus(Load *load, AutofocusOptions *options, int64_t first, int64_t count, LinesHeader *header, double *phase,
+                     int *is_converged)
+{
+	static Autofocus af;
+	Backproject *bp = load->bp;
+	LinesHeader *in = load->input->header;
+	double *position = malloc(3*count*sizeof(double));
+
+	//the track decides which way the windows run, it must be in place before autofocus_init()
+	for (int64_t k = 0; position != NULL && k < count; k++)
+	{
+		int64_t record = in->first_pri + (first + k)*in->pri_step - load->nav->header->first_pri;
+		memcpy(position + 3*k, load->nav->records[record].position, 3*sizeof(double));
+	}
+
+	if (position == NULL || autofocus_init(&af, bp, options, position, count) != OK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Out of memory for autofocus of %lld pulses\n", (long long)count);
+		free(position);
+		return FAIL;
+	}
+
+	double spacing = af.is_rows ? bp->grid.spacing[0] : bp->grid.spacing[1];
+	if (af.band*spacing >= 1)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Autofocus needs pixels under %.3f [m] along the track for these pulses, the grid has %.3f [m]\n", 1/af.band, spacing);
+		autofocus_free(&af);
+		free(position);
+		return FAIL;
+	}
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Autofocus on the %d brightest %s, windows of %d pixels down to %d\n", af.n_targets, af.is_rows ? "rows" : "columns",
+	       af.options.window, af.options.min_window);
+
+	double start = now_seconds();
+	int status = autofocus_run(&af);
+	double elapsed = now_seconds() - start;
+
+	double rms = 0;
+	for (int64_t k = 0; k < count; k++)
+	{
+		phase[k] += af.phase[k];
+		rms += af.phase[k]*af.phase[k];
+	}
+
+	memset(bp->image, 0, bp->grid.n_rows*bp->image_stride*sizeof(float complex));
+	header->n_pulses = 0;
+	start = now_seconds();
+	focus(load, first, count, header, NULL, 0);
+
+	if (status == OK)
+	{
+		cprint("[OK] ", BRIGHT, GREEN);
+		printf("Phase error %.3f [rad] rms found in %d iterations, %.3f [s], image focused again in %.3f [s]\n", sqrt(rms/count),
+		       af.iterations, elapsed, now_seconds() - start);
+	}
+	else
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Autofocus did not converge to %.3f [rad] rms, image focused again with the %.3f [rad] rms of iteration %d, correction %.4f [rad] rms\n",
+		       options->tolerance, sqrt(rms/count), af.iterations, af.correction);
+	}
+	*is_converged = status == OK;
+
+	autofocus_free(&af);
+	free(position);
+	return OK;
+}
+
+// The phase error taken off the lines against the one of path, as milosar_target -e writes it, less
+// the mean and linear trend of the difference, which only move the image. FAIL beyond AUTOFOCUS_CHECK.
+static int check_phase(const char *path, const double *phase, int64_t count, int64_t first_pri, int pri_step)
+{
+	double *truth = calloc(count, sizeof(double));
+	if (truth == NULL || autofocus_read(path, truth, count, first_pri, pri_step) == FAIL)
+	{
+		free(truth);
+		return FAIL;
+	}
+
+	double sum = 0, sum_k = 0, sum_kk = 0, sum_k_error = 0;
+	for (int64_t k = 0; k < count; k++)
+	{
+		truth[k] -= phase[k];
+		sum += truth[k];
+		sum_k += k;
+		sum_kk += (double)k*k;
+		sum_k_error += k*truth[k];
+	}
+	double slope = (count*sum_k_error - sum_k*sum)/(count*sum_kk - sum_k*sum_k);
+	double mean = (sum - slope*sum_k)/count;
+
+	double rms = 0, worst = 0;
+	for (int64_t k = 0; k < count; k++)
+	{
+		double e = truth[k] - mean - slope*k;
+		rms += e*e;
+		worst = fabs(e) > worst ? fabs(e) : worst;
+	}
+	rms = sqrt(rms/count);
+	free(truth);
+
+	int status = rms < AUTOFOCUS_CHECK ? OK : FAIL;
+	cprint(status == OK ? "[OK] " : "[!!] ", BRIGHT, status == OK ? GREEN : RED);
+	printf("Phase error within %.4f [rad] rms and %.3f [rad] at most of %s\n", rms, worst, path);
+	return status;
+}
+
+// Phase of image against exact over the pixels within COMPARE_DB of the exact peak, and the error
+// of every pixel against that peak.
+static void compare(Backproject *image, Backproject *exact)
+{
+	BackprojectGrid *g = &exact->grid;
+	double peak = 0, sum = 0, sum_error = 0, max_phase = 0, max_error = 0;
+	int64_t n = 0;
+
+	for (int i = 0; i < g->n_rows; i++)
+		for (int j = 0; j < g->n_columns; j++)
+			peak = fmax(peak, cabsf(exact->image[i*exact->image_stride + j]));
+
+	for (int i = 0; i < g->n_rows; i++)
+	{
+		for (int j = 0; j < g->n_columns; j++)
+		{
+			float complex a = image->image[i*image->image_stride + j], b = exact->image[i*exact->image_stride + j];
+			double error = cabsf(a - b);
+			sum_error += error*error;
+			max_error = fmax(max_error, error);
+
+			if (cabsf(b) >= peak*pow(10, -COMPARE_DB/20.0))
+			{
+				double phase = fabs(cargf(a*conjf(b)))*180/M_PI;
+				sum += phase*phase;
+				max_phase = fmax(max_phase, phase);
+				n++;
+			}
+		}
+	}
+
+	double rms_error = sqrt(sum_error/((double)g->n_rows*g->n_columns));
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Phase error %.2f [deg] rms, %.2f [deg] at most over %lld pixels within %d dB of the peak\n", n > 0 ? sqrt(sum/n) : 0,
+	       max_phase, (long long)n, COMPARE_DB);
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Error %.1f [dB] rms, %.1f [dB] at most, against the peak\n", 20*log10(rms_error/peak + 1e-30), 20*log10(max_error/peak + 1e-30));
+}
+
+// Comma separated values, returns how many were read.
+static int parse_doubles(const char *text, double *values, int n)
+{
+	int i = 0;
+	char *end;
+
+	while (i < n)
+	{
+		values[i] = strtod(text, &end);
+		if (end == text)
+			break;
+		i++;
+		if (*end != ',')
+			break;
+		text = end + 1;
+	}
+
+	return i;
+}
+
+// Takes up the image of a checkpoint of the same grid and lines, its pulse count into header.
+static int resume(const char *path, LinesHeader *header, Backproject *bp)
+{
+	if (access(path, F_OK) != 0)
+		return FAIL;
+
+	Lines part;
+	if (lines_map(&part, path) != OK)
+		return FAIL;
+
+	LinesHeader *h = part.header;
+	if (h->kind != LinesImage || h->n_lines != header->n_lines || h->n_samples != header->n_samples ||
+	    h->first_pri != header->first_pri || h->pri_step != header->pri_step || h->channel != header->channel ||
+	    h->switch_state != header->switch_state || memcmp(h->origin, header->origin, sizeof(h->origin)) != 0 ||
+	    memcmp(h->spacing, header->spacing, sizeof(h->spacing)) != 0 || strcmp(h->capture, header->capture) != 0)
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("%s is of another grid or lines, starting afresh\n", path);
+		lines_close(&part);
+		return FAIL;
+	}
+
+	for (int64_t i = 0; i < h->n_lines; i++)
+		memcpy(bp->image + i*bp->image_stride, lines_line(&part, i), h->n_samples*sizeof(float complex));
+
+	header->n_pulses = h->n_pulses;
+	lines_close(&part);
+	return OK;
+}
+
+// Written beside path and renamed over it once on disk, so a crash leaves the last whole image.
+static int write_image(const char *path, LinesHeader *header, Backproject *bp)
+{
+	char tmp[2*CAPTURE_PATH_LEN + 16];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	Lines image;
+	if (lines_create(&image, tmp, header) != OK)
+		return FAIL;
+
+	for (int64_t i = 0; i < header->n_lines; i++)
+		memcpy(lines_line(&image, i), bp->image + i*bp->image_stride, header->n_samples*sizeof(float complex));
+
+	int status = lines_sync(&image);
+	lines_close(&image);
+
+	if (status != OK || rename(tmp, path) != 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not write %s\n", path);
+		unlink(tmp);
+		return FAIL;
+	}
+
+	return OK;
+}
+
+// Lines and antenna positions of the pulses of the next block.
+static void load_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Load *load = (Load *)context;
+	LinesHeader *in = load->input->header;
+
+	for (int64_t k = begin; k < end; k++)
+	{
+		int64_t line = load->first + k;
+		int64_t record = in->first_pri + line*in->pri_step - load->nav->header->first_pri;
+		backproject_pulse(load->bp, k, lines_line(load->input, line), load->nav->records[record].position,
+		                  load->phase[line - load->start]);
+	}
+}
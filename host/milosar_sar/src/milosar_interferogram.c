@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "colour.h"
+#include "interferogram.h"
+#include "lines.h"
+#include "pool.h"
+#include "utils.h"
+#include "version.h"
+
+#define BALANCE_LINES       256     // range lines per imbalance estimate by default
+#define LOOK_LINES          16      // lines averaged per sample by default
+
+void usage(void);
+static void channel_name(const char *path, char *name, size_t size);
+static int write_balance(const char *path, Interferogram *ifg);
+static void bench(Interferogram *ifg, Lines *interferogram, Lines *coherence, int max_threads);
+
+//-----------------------------------------------------------------------------------------------
+// Interferogram and coherence of two channels or switch states of a capture, their lines paired
+// by PRI, to ifg_<a>_<b>.lines and ifg_<a>_<b>_coherence.lines, and the phase and amplitude
+// imbalance between them over the capture to ifg_<a>_<b>.csv.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	InterferogramOptions options = {{LOOK_LINES, 1}, 0, -1, BALANCE_LINES};
+	int n_threads = 0;
+	int is_bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:g:a:o:j:Bh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'a': options.block_lines = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		case 'j': n_threads = atoi(optarg); break;
+		case 'B': is_bench = 1; break;
+		case 'l':
+			options.looks[0] = atoi(optarg);
+			options.looks[1] = strchr(optarg, ',') != NULL ? atoi(strchr(optarg, ',') + 1) : 1;
+			break;
+		case 'g':
+			options.first_gate = atoi(optarg);
+			if (strchr(optarg, ':') != NULL)
+				options.n_gates = atoi(strchr(optarg, ':') + 1);
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 2 || options.looks[0] < 1 || options.looks[1] < 1 || options.block_lines < 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	Lines input[2];
+	for (int i = 0; i < 2; i++)
+	{
+		if (lines_map(&input[i], argv[optind + i]) != OK)
+			return EXIT_FAILURE;
+
+		LinesHeader *h = input[i].header;
+		if ((h->kind != LinesRaw && h->kind != LinesRange) || h->pri_step < 1)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			printf("%s is not complex raw or range lines\n", argv[optind + i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	//the same capture, stored and compressed the same way
+	LinesHeader *ha = input[0].header, *hb = input[1].header;
+	if (ha->kind != hb->kind || strcmp(ha->capture, hb->capture) != 0 || ha->pri_step != hb->pri_step || ha->period != hb->period ||
+	    ha->n_samples != hb->n_samples || ha->n_fft != hb->n_fft || ha->range_start != hb->range_start || ha->range_bin != hb->range_bin)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("%s and %s are not lines of one capture with the same PRIs and range bins\n", argv[optind], argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+
+	if (options.n_gates < 0 || options.first_gate + options.n_gates > ha->n_samples)
+		options.n_gates = ha->n_samples - options.first_gate;
+	if (options.first_gate < 0 || options.n_gates < options.looks[1])
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Gates from %d in looks of %d do not fit in lines of %lld samples\n", options.first_gate, options.looks[1],
+		       (long long)ha->n_samples);
+		return EXIT_FAILURE;
+	}
+
+	//ifg_a_b.lines for range_a.lines and range_b.lines, next to the first
+	const char *path = argv[optind];
+	const char *slash = strrchr(path, '/');
+	char dir[CAPTURE_PATH_LEN], name[2][CAPTURE_PATH_LEN];
+	char ifg_path[4*CAPTURE_PATH_LEN], coherence_path[4*CAPTURE_PATH_LEN + 16], csv_path[4*CAPTURE_PATH_LEN + 8];
+	snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int)(slash + 1 - path) : 0, path);
+	channel_name(argv[optind], name[0], sizeof(name[0]));
+	channel_name(argv[optind + 1], name[1], sizeof(name[1]));
+	if (output != NULL)
+		snprintf(ifg_path, sizeof(ifg_path), "%s", output);
+	else
+		snprintf(ifg_path, sizeof(ifg_path), "%sifg_%s_%s.lines", dir, name[0], name[1]);
+	const char *dot = strrchr(ifg_path, '.');
+	int stem = dot != NULL && strcmp(dot, ".lines") == 0 ? (int)(dot - ifg_path) : (int)strlen(ifg_path);
+	snprintf(coherence_path, sizeof(coherence_path), "%.*s_coherence.lines", stem, ifg_path);
+	snprintf(csv_path, sizeof(csv_path), "%.*s.csv", stem, ifg_path);
+
+	static Interferogram ifg;
+	if (interferogram_init(&ifg, &input[0], &input[1], &options, n_threads) != OK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Out of memory for lines of %d gates\n", options.n_gates);
+		return EXIT_FAILURE;
+	}
+	if (ifg.n_lines == 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("%s and %s share fewer than %d PRIs\n", argv[optind], argv[optind + 1], options.looks[0]);
+		return EXIT_FAILURE;
+	}
+
+	LinesHeader header;
+	Lines interferogram, coherence;
+	interferogram_header(&ifg, &header, LinesInterferogram);
+	if (lines_create(&interferogram, ifg_path, &header) != OK)
+		return EXIT_FAILURE;
+	interferogram_header(&ifg, &header, LinesCoherence);
+	if (lines_create(&coherence, coherence_path, &header) != OK)
+		return EXIT_FAILURE;
+
+	int64_t lag = hb->first_pri + ifg.offset*hb->pri_step - ha->first_pri;
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Line k of %s with line k%+lld of %s, %+lld PRI(s) or %+.3f [ms] from it\n", name[0], (long long)ifg.offset, name[1],
+	       (long long)lag, lag*ha->period*1e3);
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("%lld line pairs of %d gates from %d, looks of %d lines by %d gates, %lld lines of %d samples\n",
+	       (long long)ifg.n_lines*options.looks[0], options.n_gates, options.first_gate, options.looks[0], options.looks[1],
+	       (long long)ifg.n_lines, ifg.n_samples);
+	if (ifg.flatten != NULL)
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("Carriers differ by %.0f [Hz], the phase that puts on every gate is taken off\n", ha->carrier - hb->carrier);
+	}
+
+	if (is_bench)
+	{
+		bench(&ifg, &interferogram, &coherence, ifg.n_threads);
+		return EXIT_SUCCESS;
+	}
+
+	double start = now_seconds();
+	interferogram_run(&ifg, &interferogram, &coherence, ifg.n_threads);
+	double elapsed = now_seconds() - start;
+
+	if (lines_sync(&interferogram) != OK || lines_sync(&coherence) != OK || write_balance(csv_path, &ifg) != OK)
+		return EXIT_FAILURE;
+
+	int64_t n_pairs = ifg.n_lines*options.looks[0];
+	double bytes = 2.0*n_pairs*options.n_gates*sizeof(float complex);
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%lld line pairs in %.3f [s] on %d threads, %.0f pairs/s, %.2f GB/s of input, to %s and %s\n", (long long)n_pairs,
+	       elapsed, ifg.n_threads, n_pairs/elapsed, bytes/elapsed*1e-9, ifg_path, coherence_path);
+
+	//the imbalance over the capture, and its spread about that block to block
+	double complex cross = 0;
+	double power[2] = {0, 0}, phase = 0, amplitude = 0, low = INFINITY, high = -INFINITY;
+	for (int64_t o = 0; o < ifg.n_lines; o++)
+	{
+		cross += ifg.sums[o].cross;
+		power[0] += ifg.sums[o].power[0];
+		power[1] += ifg.sums[o].power[1];
+	}
+	double mean_phase = carg(cross), mean_amplitude = power[0] > 0 && power[1] > 0 ? 10*log10(power[0]/power[1]) : 0;
+	for (int64_t k = 0; k < ifg.n_blocks; k++)
+	{
+		InterferogramBalance *e = &ifg.balance[k];
+		double d = remainder(e->phase - mean_phase, 2*M_PI);
+		phase += d*d;
+		amplitude += (e->amplitude - mean_amplitude)*(e->amplitude - mean_amplitude);
+		low = fmin(low, e->coherence);
+		high = fmax(high, e->coherence);
+	}
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Imbalance %.2f [deg] and %.2f [dB] of %s against %s, %.2f [deg] and %.2f [dB] rms over %lld blocks, coherence %.3f to %.3f, "
+	       "to %s\n", mean_phase*180/M_PI, mean_amplitude, name[0], name[1], sqrt(phase/ifg.n_blocks)*180/M_PI,
+	       sqrt(amplitude/ifg.n_blocks), (long long)ifg.n_blocks, low, high, csv_path);
+
+	lines_close(&interferogram);
+	lines_close(&coherence);
+	interferogram_free(&ifg);
+	lines_close(&input[0]);
+	lines_close(&input[1]);
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_interferogram %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_interferogram [-l lines[,gates]] [-g first[:count]] [-a lines] [-o ifg.lines] [-j threads] [-B]\n");
+	fprintf(stderr, "                             <a.lines> <b.lines>\n");
+	fprintf(stderr, "  -l  looks, lines and gates averaged per sample (default %d,1)\n", LOOK_LINES);
+	fprintf(stderr, "  -g  range gates, all by default\n");
+	fprintf(stderr, "  -a  range lines per imbalance estimate (default %d), rounded to whole looks\n", BALANCE_LINES);
+	fprintf(stderr, "  -o  output, ifg_<a>_<b>.lines next to a by default, _coherence.lines and .csv beside it\n");
+	fprintf(stderr, "  -j  threads, one per CPU by default\n");
+	fprintf(stderr, "  -B  benchmark against thread count\n");
+}
+
+// a_rf1 for .../range_a_rf1.lines.
+static void channel_name(const char *path, char *name, size_t size)
+{
+	const char *slash = strrchr(path, '/');
+	const char *base = slash != NULL ? slash + 1 : path;
+
+	if (strncmp(base, "range_", 6) == 0)
+		base += 6;
+	else if (strncmp(base, "raw_", 4) == 0)
+		base += 4;
+
+	const char *dot = strrchr(base, '.');
+	snprintf(name, size, "%.*s", dot != NULL && strcmp(dot, ".lines") == 0 ? (int)(dot - base) : (int)strlen(base), base);
+}
+
+// One row per block, its time the middle of the block on the PRI clock of a.
+static int write_balance(const char *path, Interferogram *ifg)
+{
+	LinesHeader *h = ifg->input[0]->header;
+	int64_t block_lines = (int64_t)ifg->block_looks*ifg->options.looks[0];
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not create %s\n", path);
+		return FAIL;
+	}
+
+	fprintf(f, "block,first_pri,time,phase,amplitude,coherence\n");
+	for (int64_t k = 0; k < ifg->n_blocks; k++)
+	{
+		InterferogramBalance *e = &ifg->balance[k];
+		int64_t first = ifg->first + k*block_lines;
+		int64_t n = ifg->first + ifg->n_lines*ifg->options.looks[0] - first < block_lines ?
+		            ifg->first + ifg->n_lines*ifg->options.looks[0] - first : block_lines;
+		int64_t pri = h->first_pri + first*h->pri_step;
+		double time = h->t0 + (pri + (n - 1)/2.0*h->pri_step)*h->period;
+
+		fprintf(f, "%lld,%lld,%.6f,%.6f,%.4f,%.4f\n", (long long)k, (long long)pri, time, e->phase, e->amplitude, e->coherence);
+	}
+
+	fclose(f);
+	return OK;
+}
+
+// The whole run on 1, 2, 4 up to max_threads, after a first run that reads the inputs into the page
+// cache, with the time of each pass and the speedup over one thread.
+static void bench(Interferogram *ifg, Lines *interferogram, Lines *coherence, int max_threads)
+{
+	int64_t n_pairs = ifg->n_lines*ifg->options.looks[0];
+	double bytes = 2.0*n_pairs*ifg->options.n_gates*sizeof(float complex);
+	double single = 0;
+
+	interferogram_run(ifg, interferogram, coherence, max_threads);
+
+	printf("%8s %10s %12s %8s %8s\n", "threads", "time [s]", "pairs/s", "GB/s", "speedup");
+	for (int threads = 1; threads <= max_threads; threads = threads < max_threads && 2*threads > max_threads ? max_threads : 2*threads)
+	{
+		double start = now_seconds();
+		interferogram_run(ifg, interferogram, coherence, threads);
+		double elapsed = now_seconds() - start;
+
+		if (threads == 1)
+			single = elapsed;
+
+		printf("%8d %10.3f %12.0f %8.2f %8.2f\n", threads, elapsed, n_pairs/elapsed, bytes/elapsed*1e-9, single/elapsed);
+
+		if (threads == max_threads)
+			break;
+	}
+}
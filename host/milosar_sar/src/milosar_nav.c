@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "colour.h"
+#include "nav.h"
+#include "pool.h"
+#include "utils.h"
+#include "version.h"
+
+#define PROCESS_NOISE   1.0     // [m^2/s^5] white jerk, a car or a light aircraft
+
+void usage(void);
+
+//-----------------------------------------------------------------------------------------------
+// Writes nav.bin, the antenna position and velocity of every stored PRI of a capture, from its
+// block times and GPS log.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *fixes_path = NULL;
+	const char *output = NULL;
+	NavOptions options = {NavRts, NavArrival, 0, PROCESS_NOISE, 0, {0, 0, 0}};
+	int n_threads = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:m:l:t:q:r:o:j:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'g': fixes_path = optarg; break;
+		case 'l': options.latency = atof(optarg); break;
+		case 'q': options.process_noise = atof(optarg); break;
+		case 'o': output = optarg; break;
+		case 'j': n_threads = atoi(optarg); break;
+		case 'm':
+			if (strcmp(optarg, "rts") == 0)
+				options.method = NavRts;
+			else if (strcmp(optarg, "spline") == 0)
+				options.method = NavSpline;
+			else if (strcmp(optarg, "linear") == 0)
+				options.method = NavLinear;
+			else
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (strcmp(optarg, "fix") != 0 && strcmp(optarg, "arrival") != 0)
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			options.time_source = strcmp(optarg, "fix") == 0 ? NavFixTime : NavArrival;
+			break;
+		case 'r':
+			if (sscanf(optarg, "%lf,%lf,%lf", &options.origin[0], &options.origin[1], &options.origin[2]) != 3)
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			options.is_origin = 1;
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	Capture capture;
+	if (capture_open(&capture, argv[optind]) != OK)
+		return EXIT_FAILURE;
+	capture_print(&capture);
+
+	char default_fixes[CAPTURE_PATH_LEN + 16], default_output[CAPTURE_PATH_LEN + 16];
+	snprintf(default_fixes, sizeof(default_fixes), "%s%s", capture.dir, "gps.bin");
+	snprintf(default_output, sizeof(default_output), "%s%s", capture.dir, NAV_FILE);
+	fixes_path = fixes_path != NULL ? fixes_path : default_fixes;
+	output = output != NULL ? output : default_output;
+
+	PriClock clock;
+	if (capture_pri_clock(&capture, &clock) != OK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not fit the PRI clock to the block times\n");
+		return EXIT_FAILURE;
+	}
+
+	if (clock.n_blocks > 0)
+	{
+		cprint("[OK] ", BRIGHT, GREEN);
+		printf("PRI clock from %d blocks: period %.3f [us], %+.3f [ppm], residual %.1f [us] rms, %.1f [us] largest\n",
+		       clock.n_blocks, clock.period*1e6, clock.drift_ppm, clock.rms_us, clock.max_us);
+	}
+	else
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("No block times, PRI clock is nominal from the PRF\n");
+	}
+
+	//PRIs of the recorded stream that are still on disk
+	int64_t first_pri = capture_first_pri(&capture);
+	if (capture.n_pris <= first_pri)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Capture has no PRIs on disk\n");
+		return EXIT_FAILURE;
+	}
+
+	double start = now_seconds();
+
+	NavFixes fixes;
+	if (nav_load(&fixes, fixes_path, &capture, &options) != OK)
+		return EXIT_FAILURE;
+
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%d fixes from %s, %.3f to %.3f [s]\n", fixes.n, fixes_path, fixes.time[0], fixes.time[fixes.n - 1]);
+
+	NavTrack track;
+	if (nav_fit(&track, &fixes, &options) != OK)
+		return EXIT_FAILURE;
+
+	double fitted = now_seconds();
+
+	NavHeader header;
+	memset(&header, 0, sizeof(header));
+	header.n_pris = capture.n_pris - first_pri;
+	header.first_pri = first_pri;
+	header.t0 = clock.t0;
+	header.period = clock.period;
+	memcpy(header.origin, fixes.origin, sizeof(header.origin));
+	header.tcu_monotonic_ns = capture.tcu_monotonic_ns;
+	header.tcu_realtime_ns = capture.tcu_realtime_ns;
+	header.method = options.method;
+	header.n_fixes = fixes.n;
+	header.latency = options.latency;
+	header.clock_rms_us = clock.rms_us;
+
+	if (nav_write(output, &track, &header, n_threads) != OK)
+		return EXIT_FAILURE;
+
+	double written = now_seconds();
+
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%s track, %.3f [m] rms against the fixes, fitted in %.1f [ms]\n", nav_method_name(options.method),
+	       track.rms_residual, (fitted - start)*1e3);
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%lld PRIs from %lld to %s in %.1f [ms] on %d threads, %.1f M PRIs/s\n", (long long)header.n_pris,
+	       (long long)first_pri, output, (written - fitted)*1e3, pool_threads(n_threads), header.n_pris/(written - fitted)*1e-6);
+
+	if (header.n_extrapolated > 0)
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("%lld PRIs are outside the fixes and continue the track in a straight line\n", (long long)header.n_extrapolated);
+	}
+
+	nav_free_track(&track);
+	nav_free_fixes(&fixes);
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_nav %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_nav [-g gps.bin|fixes.csv] [-m rts|spline|linear] [-t arrival|fix] [-l latency]\n");
+	fprintf(stderr, "                   [-q noise] [-r lat,lon,height] [-o nav.bin] [-j threads] <capture>\n");
+	fprintf(stderr, "  -g  fixes, gps.bin of the capture by default\n");
+	fprintf(stderr, "  -m  interpolation, Kalman smoothed (rts, default), cubic spline or linear\n");
+	fprintf(stderr, "  -t  place fixes by their arrival (default) or by the receiver fix time\n");
+	fprintf(stderr, "  -l  [s] receiver and gpsd latency taken off the arrival times\n");
+	fprintf(stderr, "  -q  [m^2/s^5] rts process noise (default %.1f)\n", PROCESS_NOISE);
+	fprintf(stderr, "  -r  tangent plane origin, the first fix by default\n");
+	fprintf(stderr, "  -o  output, nav.bin in the capture by default\n");
+	fprintf(stderr, "  -j  threads, one per CPU by default\n");
+}
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "colour.h"
+#include "convert.h"
+#include "lines.h"
+#include "pool.h"
+#include "range.h"
+#include "utils.h"
+#include "version.h"
+#include "window.h"
+
+#define RANGE_CHUNK     64      // lines claimed per thread at a time
+#define N_FORMATS       3       // complex, dB, phase
+#define BENCH_SIZES     4       // 1/8 up to the whole file
+
+typedef struct
+{
+	Capture *capture;               // raw words, or
+	Lines input;                    // lines from milosar_convert
+	int is_capture;
+	Range range;
+	int is_channel[N_CHANNELS];
+	int formats;                    // enum RangeOutput
+	int is_bench;                   // compress only, nothing is written
+	Lines out[N_FORMATS][N_CHANNELS][2];
+	int64_t first_pri;
+
+	//per thread
+	uint8_t *scratch;
+	float complex *raw;             // both channels of one PRI
+	float complex *spectrum;
+	float complex *work;
+	float *values;
+	int64_t raw_stride;
+	int64_t n_missing;
+} Job;
+
+static const char *suffixes[N_FORMATS] = {"", "_db", "_phase"};
+static const int kinds[N_FORMATS] = {LinesRange, LinesRangeDb, LinesRangePhase};
+
+void usage(void);
+static int open_outputs(Job *job, const char *dir, const char *base, PriClock *clock);
+static void close_outputs(Job *job);
+static void bench(Job *job, int64_t n_items, int max_threads, double bytes_per_item);
+static void range_task(void *context, int64_t begin, int64_t end, int thread);
+static void compress(Job *job, int thread, const float complex *line, int c, int s, int64_t index);
+
+//-----------------------------------------------------------------------------------------------
+// Range compresses a capture, straight from its raw words or from the lines of milosar_convert,
+// to range_<channel>[_rf<state>].lines with optional _db and _phase companions.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *output_dir = NULL;
+	const char *channels = "ab";
+	const char *formats = "c";
+	RangeOptions options = {WindowHann, 0, 1, 0, 0};
+	int n_threads = 0;
+	int is_bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:w:p:raf:o:j:Bh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': channels = optarg; break;
+		case 'p': options.pad = atof(optarg); break;
+		case 'r': options.is_real = 1; break;
+		case 'a': options.is_all = 1; break;
+		case 'f': formats = optarg; break;
+		case 'o': output_dir = optarg; break;
+		case 'j': n_threads = atoi(optarg); break;
+		case 'B': is_bench = 1; break;
+		case 'w':
+			if (window_parse(optarg, &options.window, &options.window_parameter) != OK)
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	static Job job;
+	static Capture capture;
+	const char *path = argv[optind];
+	const char *dot = strrchr(path, '.');
+	PriClock clock;
+	int n_samples;
+	double sample_rate, bandwidth, sweep_time;
+
+	job.is_bench = is_bench;
+	job.formats = (strchr(formats, 'c') ? RangeComplex : 0) | (strchr(formats, 'd') ? RangeDb : 0) | (strchr(formats, 'p') ? RangePhase : 0);
+	job.is_capture = dot == NULL || strcmp(dot, ".lines") != 0;
+
+	if (job.is_capture)
+	{
+		if (capture_open(&capture, path) != OK || capture_map(&capture) != OK)
+			return EXIT_FAILURE;
+		capture_print(&capture);
+		capture_pri_clock(&capture, &clock);
+
+		job.capture = &capture;
+		job.first_pri = capture_first_pri(&capture);
+		job.is_channel[0] = strchr(channels, 'a') != NULL;
+		job.is_channel[1] = strchr(channels, 'b') != NULL;
+		n_samples = capture.n_samples;
+		sample_rate = capture.sample_rate;
+		bandwidth = capture_bandwidth(&capture);
+		sweep_time = capture_sweep_time(&capture);
+	}
+	else
+	{
+		if (lines_map(&job.input, path) != OK)
+			return EXIT_FAILURE;
+
+		LinesHeader *header = job.input.header;
+		if (header->kind != LinesRaw)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			printf("%s is not raw lines\n", path);
+			return EXIT_FAILURE;
+		}
+
+		cprint("[**] ", BRIGHT, CYAN);
+		printf("Lines of capture %s: %lld of %lld samples, channel %c\n", header->capture, (long long)header->n_lines,
+		       (long long)header->n_samples, 'A' + header->channel);
+
+		job.is_channel[0] = 1;
+		n_samples = header->n_samples;
+		sample_rate = header->sample_rate;
+		bandwidth = header->bandwidth;
+		sweep_time = header->sweep_time;
+	}
+
+	if (range_init(&job.range, n_samples, sample_rate, bandwidth, sweep_time, &options) != OK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not plan a range FFT for %d samples\n", n_samples);
+		return EXIT_FAILURE;
+	}
+
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("%s FFT of %d, %s window, %d bins", options.is_real ? "Real" : "Complex", job.range.n_fft, window_name(options.window), job.range.n_bins);
+	if (job.range.range_bin > 0)
+		printf(" of %.3f [m] to %.1f [m]\n", job.range.range_bin, job.range.range_bin*job.range.n_bins);
+	else
+		printf(", no ramp bandwidth to label them in metres\n");
+
+	n_threads = pool_threads(n_threads);
+	int n_fft = job.range.n_fft;
+	job.raw_stride = lines_stride(n_samples, sizeof(float complex));
+	job.scratch = alloc_aligned((size_t)n_threads*(job.is_capture ? capture.bytes_per_pri : 1));
+	job.raw = alloc_aligned((size_t)n_threads*N_CHANNELS*job.raw_stride*sizeof(float complex));
+	job.spectrum = alloc_aligned((size_t)n_threads*lines_stride(n_fft + 1, sizeof(float complex))*sizeof(float complex));
+	job.work = alloc_aligned((size_t)n_threads*n_fft*sizeof(float complex));
+	job.values = alloc_aligned((size_t)n_threads*lines_stride(n_fft, sizeof(float))*sizeof(float));
+	if (job.scratch == NULL || job.raw == NULL || job.spectrum == NULL || job.work == NULL || job.values == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Out of memory for %d threads\n", n_threads);
+		return EXIT_FAILURE;
+	}
+
+	int64_t n_items = job.is_capture ? capture.n_pris - job.first_pri : job.input.header->n_lines;
+	double bytes_per_item = job.is_capture ? capture.bytes_per_pri : n_samples*sizeof(float complex);
+	if (n_items <= 0 || (!job.is_channel[0] && !job.is_channel[1]) || job.formats == 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Nothing to compress\n");
+		return EXIT_FAILURE;
+	}
+
+	if (is_bench)
+	{
+		bench(&job, n_items, n_threads, bytes_per_item);
+		return EXIT_SUCCESS;
+	}
+
+	//outputs next to the input unless told otherwise, named after it
+	char dir[CAPTURE_PATH_LEN], base[CAPTURE_PATH_LEN];
+	if (job.is_capture)
+	{
+		snprintf(dir, sizeof(dir), "%s", output_dir != NULL ? output_dir : capture.dir);
+		base[0] = '\0';
+	}
+	else
+	{
+		const char *slash = strrchr(path, '/');
+		const char *name = slash != NULL ? slash + 1 : path;
+		snprintf(dir, sizeof(dir), "%.*s", (int)(name - path), path);
+		if (output_dir != NULL)
+			snprintf(dir, sizeof(dir), "%s", output_dir);
+
+		//raw_a_rf1.lines to range_a_rf1.lines
+		if (strncmp(name, "raw_", 4) == 0)
+			name += 4;
+		snprintf(base, sizeof(base), "%.*s", (int)(strrchr(name, '.') - name), name);
+	}
+
+	double start = now_seconds();
+
+	if (open_outputs(&job, dir, base, &clock) != OK)
+		return EXIT_FAILURE;
+
+	pool_run(n_threads, n_items, RANGE_CHUNK, range_task, &job);
+	close_outputs(&job);
+
+	double elapsed = now_seconds() - start;
+
+	cprint("[OK] ", BRIGHT, GREEN);
+	int64_t n_lines = n_items*(job.is_channel[0] + job.is_channel[1]);
+	printf("%lld lines in %.3f [s] on %d threads, %.0f lines/s, %.2f GB/s of input\n", (long long)n_lines, elapsed, n_threads,
+	       n_lines/elapsed, n_items*bytes_per_item/elapsed*1e-9);
+
+	if (job.n_missing > 0)
+	{
+		cprint("[**] ", BRIGHT, YELLOW);
+		printf("%lld PRIs are not on disk and were written as zeros\n", (long long)job.n_missing);
+	}
+
+	range_free(&job.range);
+	free(job.scratch);
+	free(job.raw);
+	free(job.spectrum);
+	free(job.work);
+	free(job.values);
+	if (job.is_capture)
+		capture_unmap(&capture);
+	else
+		lines_close(&job.input);
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_range %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_range [-c a|b|ab] [-w window[:parameter]] [-p pad] [-r] [-a] [-f cdp] [-o dir/]\n");
+	fprintf(stderr, "                     [-j threads] [-B] <capture|raw.lines>\n");
+	fprintf(stderr, "  -c  channels of a capture (default ab)\n");
+	fprintf(stderr, "  -w  rect, hann (default), hamming, blackman, kaiser[:beta] or taylor[:sidelobe dB]\n");
+	fprintf(stderr, "  -p  zero padding, the FFT is the next power of two at least pad times the samples\n");
+	fprintf(stderr, "  -r  real FFT of the I samples\n");
+	fprintf(stderr, "  -a  keep the negative beat frequencies of a complex FFT\n");
+	fprintf(stderr, "  -f  c complex, d magnitude in dB, p phase, any of them (default c)\n");
+	fprintf(stderr, "  -o  output directory, next to the input by default\n");
+	fprintf(stderr, "  -j  threads, one per CPU by default\n");
+	fprintf(stderr, "  -B  benchmark against input size and thread count, nothing is written\n");
+}
+
+static int open_outputs(Job *job, const char *dir, const char *base, PriClock *clock)
+{
+	Capture *capture = job->capture;
+	int n_states = job->is_capture ? capture->switch_factor : 1;
+
+	for (int c = 0; c < N_CHANNELS; c++)
+	{
+		for (int s = 0; s < n_states && job->is_channel[c]; s++)
+		{
+			LinesHeader header;
+
+			if (job->is_capture)
+			{
+				//first PRI of this switch state on disk
+				int sf = capture->switch_factor;
+				int64_t first = job->first_pri + (s - job->first_pri % sf + sf) % sf;
+
+				memset(&header, 0, sizeof(header));
+				header.n_lines = first < capture->n_pris ? (capture->n_pris - first + sf - 1)/sf : 0;
+				header.first_pri = first;
+				header.pri_step = sf;
+				header.channel = c;
+				header.switch_state = s;
+				header.start_index = capture->start_index;
+				header.t0 = clock->t0;
+				header.period = clock->period;
+				header.sample_rate = capture->sample_rate;
+				header.bandwidth = capture_bandwidth(capture);
+				header.sweep_time = capture_sweep_time(capture);
+				header.carrier = capture_carrier(capture);
+				header.scale = 1;
+				snprintf(header.capture, sizeof(header.capture), "%s", capture->name);
+			}
+			else
+				memcpy(&header, job->input.header, sizeof(header));
+
+			header.n_samples = job->range.n_bins;
+			header.n_fft = job->range.n_fft;
+			header.range_start = 0;
+			header.range_bin = job->range.range_bin;
+			header.reference_time = (header.start_index + (job->range.n_samples - 1)/2.0)/header.sample_rate;
+
+			for (int f = 0; f < N_FORMATS; f++)
+			{
+				if (!(job->formats & (1 << f)))
+					continue;
+
+				char path[2*CAPTURE_PATH_LEN];
+				if (!job->is_capture)
+					snprintf(path, sizeof(path), "%srange_%s%s.lines", dir, base, suffixes[f]);
+				else if (n_states == 1)
+					snprintf(path, sizeof(path), "%srange_%c%s.lines", dir, 'a' + c, suffixes[f]);
+				else
+					snprintf(path, sizeof(path), "%srange_%c_rf%d%s.lines", dir, 'a' + c, s + 1, suffixes[f]);
+
+				header.kind = kinds[f];
+				if (lines_create(&job->out[f][c][s], path, &header) != OK)
+					return FAIL;
+
+				cprint("[**] ", BRIGHT, CYAN);
+				printf("%lld lines to %s\n", (long long)header.n_lines, path);
+			}
+		}
+	}
+
+	return OK;
+}
+
+static void close_outputs(Job *job)
+{
+	for (int f = 0; f < N_FORMATS; f++)
+		for (int c = 0; c < N_CHANNELS; c++)
+			for (int s = 0; s < 2; s++)
+				if (job->out[f][c][s].header != NULL)
+					lines_close(&job->out[f][c][s]);
+}
+
+// Compress only, on the first 1/8, 1/4, 1/2 and all of the input, on 1, 2, 4 up to max_threads.
+// The first pass reads the input into the page cache so every pass after it sees the same storage.
+static void bench(Job *job, int64_t n_items, int max_threads, double bytes_per_item)
+{
+	cprint("[**] ", BRIGHT, CYAN);
+	printf("Benchmark, %d channel(s), formats %s%s%s\n", job->is_channel[0] + job->is_channel[1],
+	       job->formats & RangeComplex ? "c" : "", job->formats & RangeDb ? "d" : "", job->formats & RangePhase ? "p" : "");
+
+	int lines_per_item = job->is_channel[0] + job->is_channel[1];
+	pool_run(max_threads, n_items, RANGE_CHUNK, range_task, job);
+
+	printf("%10s %8s %10s %12s %8s %8s\n", "size [MB]", "threads", "time [s]", "lines/s", "GB/s", "speedup");
+	for (int size = BENCH_SIZES - 1; size >= 0; size--)
+	{
+		int64_t n = n_items >> size;
+		double single = 0;
+
+		for (int threads = 1; threads <= max_threads; threads = threads < max_threads && 2*threads > max_threads ? max_threads : 2*threads)
+		{
+			double start = now_seconds();
+			pool_run(threads, n, RANGE_CHUNK, range_task, job);
+			double elapsed = now_seconds() - start;
+
+			if (threads == 1)
+				single = elapsed;
+
+			printf("%10.1f %8d %10.3f %12.0f %8.2f %8.2f\n", n*bytes_per_item*1e-6, threads, elapsed, n*lines_per_item/elapsed,
+			       n*bytes_per_item/elapsed*1e-9, single/elapsed);
+
+			if (threads == max_threads)
+				break;
+		}
+	}
+}
+
+// Capture items are PRIs of the stream from first_pri, both channels unpacked at once. Line items
+// are lines of the input.
+static void range_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Job *job = (Job *)context;
+	int64_t n_missing = 0;
+
+	for (int64_t i = begin; i < end; i++)
+	{
+		if (!job->is_capture)
+		{
+			compress(job, thread, lines_line(&job->input, i), 0, 0, i);
+			continue;
+		}
+
+		Capture *capture = job->capture;
+		int64_t pri = job->first_pri + i;
+		int s = pri % capture->switch_factor;
+		float complex *a = job->raw + (size_t)thread*N_CHANNELS*job->raw_stride, *b = a + job->raw_stride;
+
+		const uint8_t *words = capture_pri(capture, pri, job->scratch + (size_t)thread*capture->bytes_per_pri);
+		if (words == NULL)
+		{
+			n_missing++;
+			continue;
+		}
+
+		convert_pri(words, capture->n_samples, a, b, 1);
+
+		int64_t index = (pri - job->first_pri - (s - job->first_pri % capture->switch_factor + capture->switch_factor) % capture->switch_factor)/capture->switch_factor;
+		for (int c = 0; c < N_CHANNELS; c++)
+			if (job->is_channel[c])
+				compress(job, thread, c == 0 ? a : b, c, s, index);
+	}
+
+	__atomic_add_fetch(&job->n_missing, n_missing, __ATOMIC_RELAXED);
+}
+
+static void compress(Job *job, int thread, const float complex *line, int c, int s, int64_t index)
+{
+	Range *range = &job->range;
+	float complex *spectrum = job->spectrum + (size_t)thread*lines_stride(range->n_fft + 1, sizeof(float complex));
+	float complex *work = job->work + (size_t)thread*range->n_fft;
+	float *values = job->values + (size_t)thread*lines_stride(range->n_fft, sizeof(float));
+
+	range_compress(range, line, spectrum, work);
+
+	if (job->formats & RangeComplex && !job->is_bench)
+		memcpy(lines_line(&job->out[0][c][s], index), spectrum, range->n_bins*sizeof(float complex));
+
+	if (job->formats & RangeDb)
+		range_db(spectrum, job->is_bench ? values : lines_float(&job->out[1][c][s], index), range->n_bins);
+
+	if (job->formats & RangePhase)
+		range_phase(spectrum, job->is_bench ? values : lines_float(&job->out[2][c][s], index), range->n_bins);
+}
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "autofocus.h"
+#include "capture.h"
+#include "colour.h"
+#include "lines.h"
+#include "nav.h"
+#include "pool.h"
+#include "utils.h"
+#include "version.h"
+
+#define SPEED_OF_LIGHT      299792458.0
+#define MAX_TARGETS         64
+#define TARGET_CHUNK        16      // lines claimed per thread at a time
+#define ERROR_TERMS         8       // sinusoids over the track in a phase error history
+
+typedef struct
+{
+	Lines lines;
+	NavRecord *records;
+	int n_targets;
+	double target[MAX_TARGETS][4];  // east, north, up [m], amplitude
+	double carrier, slope, sample_rate, noise;
+	double *phase;                  // [rad] error per line, NULL for none
+	int start_index;
+} Target;
+
+void usage(void);
+static void target_task(void *context, int64_t begin, int64_t end, int thread);
+
+//-----------------------------------------------------------------------------------------------
+// Writes the dechirped lines of point targets seen from a straight track, raw_a.lines and the
+// nav.bin of the track, to check the focusing against targets whose positions are known.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	static Target target;
+	const char *output_dir = "./";
+	int64_t n_pulses = 2048;
+	int n_samples = 1122;
+	double bandwidth = 100e6, sweep_time = 8e-4, prf = 625;
+	double speed = 10, altitude = 100, offset = 0, phase_rms = 0;
+	int opt;
+
+	target.carrier = 2.34375e9;
+	target.sample_rate = 3.125e6;
+	target.start_index = 223;
+
+	while ((opt = getopt(argc, argv, "t:n:s:i:r:f:b:T:P:v:a:y:N:e:o:h")) != -1)
+	{
+		double *t = target.target[target.n_targets];
+
+		switch (opt)
+		{
+		case 'n': n_pulses = atoll(optarg); break;
+		case 's': n_samples = atoi(optarg); break;
+		case 'i': target.start_index = atoi(optarg); break;
+		case 'r': target.sample_rate = atof(optarg); break;
+		case 'f': target.carrier = atof(optarg); break;
+		case 'b': bandwidth = atof(optarg); break;
+		case 'T': sweep_time = atof(optarg); break;
+		case 'P': prf = atof(optarg); break;
+		case 'v': speed = atof(optarg); break;
+		case 'a': altitude = atof(optarg); break;
+		case 'y': offset = atof(optarg); break;
+		case 'N': target.noise = atof(optarg); break;
+		case 'e': phase_rms = atof(optarg); break;
+		case 'o': output_dir = optarg; break;
+		case 't':
+			t[3] = 1;
+			if (target.n_targets == MAX_TARGETS || sscanf(optarg, "%lf,%lf,%lf,%lf", &t[0], &t[1], &t[2], &t[3]) < 3)
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			target.n_targets++;
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc || target.n_targets == 0 || n_pulses <= 0 || n_samples <= 0 || prf <= 0 || sweep_time <= 0 || phase_rms < 0)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	target.slope = bandwidth/sweep_time;
+
+	//the output directory is made here if it does not exist yet, one level only
+	if (mkdir(output_dir, 0755) != 0 && errno != EEXIST)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not create %s\n", output_dir);
+		return EXIT_FAILURE;
+	}
+
+	char lines_path[CAPTURE_PATH_LEN + 32], nav_path[CAPTURE_PATH_LEN + 32], phase_path[CAPTURE_PATH_LEN + 32];
+	snprintf(lines_path, sizeof(lines_path), "%sraw_a.lines", output_dir);
+	snprintf(nav_path, sizeof(nav_path), "%s%s", output_dir, NAV_FILE);
+	snprintf(phase_path, sizeof(phase_path), "%sphase_a.csv", output_dir);
+
+	//a smooth phase error over the track, sinusoids of falling amplitude at random phases scaled to
+	//the rms asked for, and written out to check autofocus against
+	if (phase_rms > 0)
+	{
+		double turn[ERROR_TERMS], sum = 0;
+		uint64_t state = 0x2545F4914F6CDD1Dull;
+		for (int m = 0; m < ERROR_TERMS; m++)
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			turn[m] = (state >> 11)/9007199254740992.0;
+		}
+
+		target.phase = calloc(n_pulses, sizeof(double));
+		if (target.phase == NULL)
+			return EXIT_FAILURE;
+		for (int64_t k = 0; k < n_pulses; k++)
+		{
+			for (int m = 0; m < ERROR_TERMS; m++)
+				target.phase[k] += cos(2*M_PI*((m + 1)*(k + 0.5)/n_pulses + turn[m]))/(m + 1);
+			sum += target.phase[k]*target.phase[k];
+		}
+		for (int64_t k = 0; k < n_pulses; k++)
+			target.phase[k] *= phase_rms/sqrt(sum/n_pulses);
+
+		if (autofocus_write(phase_path, target.phase, n_pulses, 0, 1) != OK)
+			return EXIT_FAILURE;
+	}
+
+	LinesHeader header;
+	memset(&header, 0, sizeof(header));
+	header.kind = LinesRaw;
+	header.n_lines = n_pulses;
+	header.n_samples = n_samples;
+	header.pri_step = 1;
+	header.start_index = target.start_index;
+	header.period = 1/prf;
+	header.sample_rate = target.sample_rate;
+	header.bandwidth = bandwidth;
+	header.sweep_time = sweep_time;
+	header.carrier = target.carrier;
+	header.scale = 1;
+	snprintf(header.capture, sizeof(header.capture), "synthetic");
+
+	//the track runs east at altitude, centred on east 0
+	target.records = calloc(n_pulses, sizeof(NavRecord));
+	if (target.records == NULL || lines_create(&target.lines, lines_path, &header) != OK)
+		return EXIT_FAILURE;
+
+	for (int64_t k = 0; k < n_pulses; k++)
+	{
+		NavRecord *r = &target.records[k];
+		r->time = k/prf;
+		r->position[0] = speed*(k - (n_pulses - 1)/2.0)/prf;
+		r->position[1] = offset;
+		r->position[2] = altitude;
+		r->velocity[0] = speed;
+	}
+
+	pool_run(0, n_pulses, TARGET_CHUNK, target_task, &target);
+	lines_close(&target.lines);
+
+	NavHeader nav;
+	memset(&nav, 0, sizeof(nav));
+	nav.magic = NAV_MAGIC;
+	nav.version = NAV_VERSION;
+	nav.record_size = sizeof(NavRecord);
+	nav.header_size = NAV_HEADER_SIZE;
+	nav.n_pris = n_pulses;
+	nav.period = 1/prf;
+	nav.method = NavLinear;
+
+	FILE *f = fopen(nav_path, "wb");
+	if (f == NULL || fwrite(&nav, sizeof(nav), 1, f) != 1 || fwrite(target.records, sizeof(NavRecord), n_pulses, f) != (size_t)n_pulses)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not write %s\n", nav_path);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+	free(target.records);
+	free(target.phase);
+
+	cprint("[OK] ", BRIGHT, GREEN);
+	printf("%d target(s), %lld lines of %d samples to %s, track to %s\n", target.n_targets, (long long)n_pulses, n_samples,
+	       lines_path, nav_path);
+	if (phase_rms > 0)
+	{
+		cprint("[OK] ", BRIGHT, GREEN);
+		printf("Phase error of %.3f [rad] rms on the lines, to %s\n", phase_rms, phase_path);
+	}
+	return EXIT_SUCCESS;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_target %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_target -t east,north,up[,amplitude] [-t ...] [-n pulses] [-s samples] [-i start_index]\n");
+	fprintf(stderr, "                      [-r sample_rate] [-f carrier] [-b bandwidth] [-T sweep_time] [-P prf] [-v speed]\n");
+	fprintf(stderr, "                      [-a altitude] [-y north] [-N noise] [-e rms] [-o dir/]\n");
+	fprintf(stderr, "  -t  point target [m], amplitude 1 by default, up to %d\n", MAX_TARGETS);
+	fprintf(stderr, "  -n  lines (default 2048)\n");
+	fprintf(stderr, "  -s  samples per line from start_index (default 1122 from 223)\n");
+	fprintf(stderr, "  -r  sample rate [Hz] (default 3.125e6)\n");
+	fprintf(stderr, "  -f  carrier at the start of the ramp [Hz] (default 2.34375e9)\n");
+	fprintf(stderr, "  -b  ramp bandwidth [Hz] (default 100e6) over -T sweep time [s] (default 8e-4)\n");
+	fprintf(stderr, "  -P  lines per second (default 625)\n");
+	fprintf(stderr, "  -v  speed east [m/s] (default 10) at -a altitude [m] (default 100), -y north [m] (default 0)\n");
+	fprintf(stderr, "  -N  rms of complex white noise per sample (default 0)\n");
+	fprintf(stderr, "  -e  rms [rad] of a smooth phase error over the track on the targets, to phase_a.csv (default 0)\n");
+	fprintf(stderr, "  -o  output directory (default ./)\n");
+}
+
+// The beat of each target at delay tau is exp(i 2 pi (carrier tau + slope tau t - slope tau^2/2)),
+// t from the start of the ramp, the antenna held still for the ramp.
+static void target_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Target *target = (Target *)context;
+	int n_samples = target->lines.header->n_samples;
+
+	for (int64_t k = begin; k < end; k++)
+	{
+		float complex *line = lines_line(&target->lines, k);
+		const double *a = target->records[k].position;
+		uint64_t state = 0x9E3779B97F4A7C15ull*(k + 1);
+
+		for (int n = 0; n < target->n_targets; n++)
+		{
+			const double *t = target->target[n];
+			double range = sqrt((t[0] - a[0])*(t[0] - a[0]) + (t[1] - a[1])*(t[1] - a[1]) + (t[2] - a[2])*(t[2] - a[2]));
+			double tau = 2*range/SPEED_OF_LIGHT;
+			double phase0 = target->carrier*tau - target->slope*tau*tau/2;
+
+			for (int i = 0; i < n_samples; i++)
+			{
+				double time = (target->start_index + i)/target->sample_rate;
+				double cycles = phase0 + target->slope*tau*time;
+				line[i] += t[3]*cexp(2*M_PI*I*(cycles - floor(cycles)));
+			}
+		}
+
+		for (int i = 0; i < n_samples && target->phase != NULL; i++)
+			line[i] *= cexp(I*target->phase[k]);
+
+		//Box-Muller on a xorshift per line, so the noise is the same on any thread count
+		for (int i = 0; i < n_samples && target->noise > 0; i++)
+		{
+			double u[2];
+			for (int j = 0; j < 2; j++)
+			{
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				u[j] = ((state >> 11) + 1.0)/9007199254740993.0;
+			}
+			line[i] += target->noise*sqrt(-log(u[0]))*cexp(2*M_PI*I*u[1]);
+		}
+	}
+}
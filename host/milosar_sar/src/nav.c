@@ -0,0 +1,851 @@
+#include "nav.h"
+#include "colour.h"
+#include "gps_record.h"
+#include "pool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define WGS84_A             6378137.0
+#define WGS84_F             (1/298.257223563)
+#define SIGMA_95            1.96    // gpsd error estimates are 95 % bounds
+#define SIGMA_HORIZONTAL    5.0     // [m] when the receiver sent no estimate
+#define SIGMA_VERTICAL      10.0
+#define SIGMA_2D            1000.0  // altitude of a 2D fix is a held value
+#define SIGMA_VELOCITY      0.5     // [m/s]
+#define NAV_CHUNK           16384   // PRIs claimed per thread at a time
+#define NAV_BLOCK           1024    // PRIs evaluated per pass, fits the scratch in L1/L2
+#define LINE_LEN            1024
+#define MAX_COLUMNS         32
+
+_Static_assert(sizeof(NavHeader) == NAV_HEADER_SIZE, "NavHeader must be NAV_HEADER_SIZE bytes");
+_Static_assert(sizeof(NavRecord) == 48, "NavRecord must be 48 bytes");
+
+enum Column {ColTcu, ColTime, ColLatitude, ColLongitude, ColAltitude, ColVelN, ColVelE, ColVelD,
+             ColEpx, ColEpy, ColEpv, ColEps, ColMode, N_COLUMNS};
+static const char *column_names[N_COLUMNS] = {"tcu_s", "time", "latitude", "longitude", "altitude",
+                                              "vel_n", "vel_e", "vel_d", "epx", "epy", "epv", "eps", "mode"};
+
+typedef struct
+{
+	NavTrack *track;
+	NavRecord *records;
+	int64_t first_pri;
+	double t0;
+	double period;
+} Eval;
+
+static int alloc_fixes(NavFixes *fixes, int capacity);
+static int add_fix(NavFixes *fixes, NavOptions *options, double time, double *lla, double *ned, double *ep, double eps, int mode);
+static int load_gps(NavFixes *fixes, const char *path, Capture *capture, NavOptions *options);
+static int load_csv(NavFixes *fixes, const char *path, Capture *capture, NavOptions *options);
+static void to_ecef(double *lla, double *ecef);
+static void fit_linear(NavTrack *track, NavFixes *fixes, int axis);
+static void fit_spline(NavTrack *track, NavFixes *fixes, int axis);
+static int fit_rts(NavTrack *track, NavFixes *fixes, int axis, double q, double *variance);
+static void continue_ends(NavTrack *track, NavFixes *fixes);
+static int find_segment(NavTrack *track, double t);
+static void eval_point(NavTrack *track, double t, double *position);
+static void eval_task(void *context, int64_t begin, int64_t end, int thread);
+
+//-----------------------------------------------------------------------------------------------
+// Fixes
+//-----------------------------------------------------------------------------------------------
+
+// gps.bin, or a CSV with named columns as milosar_gps writes it. Any other source, an INS
+// solution for one, goes in as that CSV: tcu_s, latitude, longitude, altitude are required.
+int nav_load(NavFixes *fixes, const char *path, Capture *capture, NavOptions *options)
+{
+	const char *dot = strrchr(path, '.');
+	int status;
+
+	memset(fixes, 0, sizeof(*fixes));
+
+	if (dot != NULL && strcmp(dot, ".csv") == 0)
+		status = load_csv(fixes, path, capture, options);
+	else
+		status = load_gps(fixes, path, capture, options);
+
+	if (status == OK && fixes->n < 2)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "%s has %d usable fixes, at least 2 are needed\n", path, fixes->n);
+		return FAIL;
+	}
+
+	return status;
+}
+
+static int load_gps(NavFixes *fixes, const char *path, Capture *capture, NavOptions *options)
+{
+	FILE *f = fopen(path, "rb");
+	GpsHeader header;
+	GpsFix fix;
+
+	if (f == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not open %s\n", path);
+		return FAIL;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != GPS_MAGIC || header.version != GPS_VERSION ||
+			header.record_size != sizeof(GpsFix))
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "%s is not a milosar gps log of version %d\n", path, GPS_VERSION);
+		fclose(f);
+		return FAIL;
+	}
+
+	//the log and the summary were both written after the TCU enable, either has it
+	int64_t tcu_monotonic_ns = header.tcu_monotonic_ns != 0 ? header.tcu_monotonic_ns : capture->tcu_monotonic_ns;
+	int64_t tcu_realtime_ns = header.tcu_realtime_ns != 0 ? header.tcu_realtime_ns : capture->tcu_realtime_ns;
+
+	if (tcu_monotonic_ns == 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "%s has no TCU enable time\n", path);
+		fclose(f);
+		return FAIL;
+	}
+
+	if (alloc_fixes(fixes, 1024) != OK)
+	{
+		fclose(f);
+		return FAIL;
+	}
+
+	while (fread(&fix, sizeof(fix), 1, f) == 1)
+	{
+		double lla[3] = {fix.latitude, fix.longitude, fix.altitude};
+		double ned[3] = {fix.velocity[0], fix.velocity[1], fix.velocity[2]};
+		double ep[3] = {fix.epx, fix.epy, fix.epv};
+		double time = options->time_source == NavFixTime ? fix.time - tcu_realtime_ns*1e-9
+		                                                  : (fix.monotonic_ns - tcu_monotonic_ns)*1e-9 - options->latency;
+
+		if (add_fix(fixes, options, time, lla, ned, ep, fix.eps, fix.mode) != OK)
+		{
+			fclose(f);
+			return FAIL;
+		}
+	}
+
+	fclose(f);
+	return OK;
+}
+
+static int load_csv(NavFixes *fixes, const char *path, Capture *capture, NavOptions *options)
+{
+	FILE *f = fopen(path, "r");
+	char line[LINE_LEN];
+	int columns[N_COLUMNS];
+
+	if (f == NULL || fgets(line, sizeof(line), f) == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not read %s\n", path);
+		if (f != NULL)
+			fclose(f);
+		return FAIL;
+	}
+
+	//header names to column numbers, -1 for a column the file does not have
+	for (int i = 0; i < N_COLUMNS; i++)
+		columns[i] = -1;
+
+	int n_columns = 0;
+	for (char *name = strtok(line, ",\r\n"); name != NULL && n_columns < MAX_COLUMNS; name = strtok(NULL, ",\r\n"), n_columns++)
+	{
+		for (int i = 0; i < N_COLUMNS; i++)
+			if (strcmp(name, column_names[i]) == 0)
+				columns[i] = n_columns;
+	}
+
+	int time_column = options->time_source == NavFixTime ? ColTime : ColTcu;
+	if (columns[time_column] < 0 || columns[ColLatitude] < 0 || columns[ColLongitude] < 0 || columns[ColAltitude] < 0 ||
+			(options->time_source == NavFixTime && capture->tcu_realtime_ns == 0))
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "%s needs %s, latitude, longitude and altitude columns\n", path, column_names[time_column]);
+		fclose(f);
+		return FAIL;
+	}
+
+	if (alloc_fixes(fixes, 1024) != OK)
+	{
+		fclose(f);
+		return FAIL;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		double values[MAX_COLUMNS];
+		char *p = line;
+		int n = 0;
+
+		//empty fields are NAN, strtok would skip them
+		while (n < MAX_COLUMNS)
+		{
+			char *end;
+			values[n] = strtod(p, &end);
+			if (end == p)
+				values[n] = NAN;
+			n++;
+
+			p = strchr(end, ',');
+			if (p == NULL)
+				break;
+			p++;
+		}
+
+		#define VALUE(c) (columns[c] >= 0 && columns[c] < n ? values[columns[c]] : NAN)
+
+		double lla[3] = {VALUE(ColLatitude), VALUE(ColLongitude), VALUE(ColAltitude)};
+		double ned[3] = {VALUE(ColVelN), VALUE(ColVelE), VALUE(ColVelD)};
+		double ep[3] = {VALUE(ColEpx), VALUE(ColEpy), VALUE(ColEpv)};
+		double time = options->time_source == NavFixTime ? VALUE(ColTime) - capture->tcu_realtime_ns*1e-9 : VALUE(ColTcu) - options->latency;
+		int mode = columns[ColMode] >= 0 ? (int)VALUE(ColMode) : 3;
+
+		if (add_fix(fixes, options, time, lla, ned, ep, VALUE(ColEps), mode) != OK)
+		{
+			fclose(f);
+			return FAIL;
+		}
+	}
+
+	fclose(f);
+	return OK;
+}
+
+static int alloc_fixes(NavFixes *fixes, int capacity)
+{
+	double **arrays[] = {&fixes->time, &fixes->position[0], &fixes->position[1], &fixes->position[2],
+	                     &fixes->velocity[0], &fixes->velocity[1], &fixes->velocity[2],
+	                     &fixes->sigma[0], &fixes->sigma[1], &fixes->sigma[2], &fixes->sigma_velocity};
+
+	for (int i = 0; i < sizeof(arrays)/sizeof(arrays[0]); i++)
+	{
+		double *grown = realloc(*arrays[i], capacity*sizeof(double));
+		if (grown == NULL)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			fprintf(stderr, "Out of memory for %d fixes\n", capacity);
+			return FAIL;
+		}
+		*arrays[i] = grown;
+	}
+
+	return OK;
+}
+
+// Fixes without a position or out of time order are skipped, not an error.
+static int add_fix(NavFixes *fixes, NavOptions *options, double time, double *lla, double *ned, double *ep, double eps, int mode)
+{
+	static double origin_ecef[3];
+	int n = fixes->n;
+
+	if (mode < 2 || !isfinite(time) || !isfinite(lla[0]) || !isfinite(lla[1]))
+		return OK;
+
+	if (!isfinite(lla[2]))
+	{
+		if (mode > 2)
+			return OK;
+		lla[2] = 0;
+	}
+
+	if (n > 0 && time <= fixes->time[n - 1])
+		return OK;
+
+	//the tangent plane is fixed by the first fix unless an origin was given
+	if (n == 0)
+	{
+		memcpy(fixes->origin, options->is_origin ? options->origin : lla, sizeof(fixes->origin));
+		to_ecef(fixes->origin, origin_ecef);
+	}
+
+	if ((n & (n - 1)) == 0 && n >= 1024 && alloc_fixes(fixes, 2*n) != OK)
+		return FAIL;
+
+	double ecef[3], d[3];
+	to_ecef(lla, ecef);
+	for (int i = 0; i < 3; i++)
+		d[i] = ecef[i] - origin_ecef[i];
+
+	double lat = fixes->origin[0]*M_PI/180, lon = fixes->origin[1]*M_PI/180;
+	double sin_lat = sin(lat), cos_lat = cos(lat), sin_lon = sin(lon), cos_lon = cos(lon);
+
+	fixes->time[n] = time;
+	fixes->position[0][n] = -sin_lon*d[0] + cos_lon*d[1];
+	fixes->position[1][n] = -sin_lat*cos_lon*d[0] - sin_lat*sin_lon*d[1] + cos_lat*d[2];
+	fixes->position[2][n] = cos_lat*cos_lon*d[0] + cos_lat*sin_lon*d[1] + sin_lat*d[2];
+
+	//over a flight the local north of a fix and of the origin are the same to well below a mrad
+	fixes->velocity[0][n] = ned[1];
+	fixes->velocity[1][n] = ned[0];
+	fixes->velocity[2][n] = -ned[2];
+
+	fixes->sigma[0][n] = isfinite(ep[0]) && ep[0] > 0 ? ep[0]/SIGMA_95 : SIGMA_HORIZONTAL;
+	fixes->sigma[1][n] = isfinite(ep[1]) && ep[1] > 0 ? ep[1]/SIGMA_95 : SIGMA_HORIZONTAL;
+	fixes->sigma[2][n] = mode == 2 ? SIGMA_2D : isfinite(ep[2]) && ep[2] > 0 ? ep[2]/SIGMA_95 : SIGMA_VERTICAL;
+	fixes->sigma_velocity[n] = isfinite(eps) && eps > 0 ? eps/SIGMA_95 : SIGMA_VELOCITY;
+
+	fixes->n++;
+	return OK;
+}
+
+static void to_ecef(double *lla, double *ecef)
+{
+	double lat = lla[0]*M_PI/180, lon = lla[1]*M_PI/180;
+	double e2 = WGS84_F*(2 - WGS84_F);
+	double n = WGS84_A/sqrt(1 - e2*sin(lat)*sin(lat));
+
+	ecef[0] = (n + lla[2])*cos(lat)*cos(lon);
+	ecef[1] = (n + lla[2])*cos(lat)*sin(lon);
+	ecef[2] = (n*(1 - e2) + lla[2])*sin(lat);
+}
+
+void nav_free_fixes(NavFixes *fixes)
+{
+	free(fixes->time);
+	for (int i = 0; i < 3; i++)
+	{
+		free(fixes->position[i]);
+		free(fixes->velocity[i]);
+		free(fixes->sigma[i]);
+	}
+	free(fixes->sigma_velocity);
+	memset(fixes, 0, sizeof(*fixes));
+}
+
+//-----------------------------------------------------------------------------------------------
+// Track
+//-----------------------------------------------------------------------------------------------
+
+int nav_fit(NavTrack *track, NavFixes *fixes, NavOptions *options)
+{
+	int n = fixes->n;
+
+	memset(track, 0, sizeof(*track));
+	track->n_segments = n + 1;
+
+	int is_allocated = (track->knot = calloc(n + 1, sizeof(double))) != NULL;
+	for (int a = 0; a < 3; a++)
+		for (int i = 0; i < 4; i++)
+			is_allocated &= (track->c[a][i] = calloc(n + 1, sizeof(double))) != NULL;
+	is_allocated &= (track->sigma[0] = calloc(n + 1, sizeof(double))) != NULL;
+	is_allocated &= (track->sigma[1] = calloc(n + 1, sizeof(double))) != NULL;
+
+	double *variance = calloc(3*n, sizeof(double));
+	if (!is_allocated || variance == NULL)
+	{
+		free(variance);
+		nav_free_track(track);
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Out of memory for %d segments\n", n + 1);
+		return FAIL;
+	}
+
+	//segment i + 1 starts at fix i, segment 0 ends there
+	track->knot[0] = fixes->time[0];
+	for (int i = 0; i < n; i++)
+		track->knot[i + 1] = fixes->time[i];
+
+	for (int a = 0; a < 3; a++)
+	{
+		if (options->method == NavRts)
+		{
+			if (fit_rts(track, fixes, a, options->process_noise, variance + a*n) != OK)
+			{
+				free(variance);
+				nav_free_track(track);
+				return FAIL;
+			}
+		}
+		else
+		{
+			if (options->method == NavSpline)
+				fit_spline(track, fixes, a);
+			else
+				fit_linear(track, fixes, a);
+
+			for (int i = 0; i < n; i++)
+				variance[a*n + i] = fixes->sigma[a][i]*fixes->sigma[a][i];
+		}
+	}
+
+	//position error grows linearly between the knots, with the velocity error outside them
+	for (int i = 0; i < n; i++)
+	{
+		double s0 = sqrt(variance[i] + variance[n + i] + variance[2*n + i]);
+		track->sigma[0][i + 1] = s0;
+		if (i + 1 < n)
+		{
+			double s1 = sqrt(variance[i + 1] + variance[n + i + 1] + variance[2*n + i + 1]);
+			track->sigma[1][i + 1] = (s1 - s0)/(fixes->time[i + 1] - fixes->time[i]);
+		}
+	}
+	track->sigma[0][0] = track->sigma[0][1];
+	track->sigma[1][0] = sqrt(3)*fixes->sigma_velocity[0];
+	track->sigma[1][n] = sqrt(3)*fixes->sigma_velocity[n - 1];
+	free(variance);
+
+	continue_ends(track, fixes);
+
+	//rts smooths through the fixes, the interpolating methods only show evaluation error here
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		double p[3];
+		eval_point(track, fixes->time[i], p);
+		for (int a = 0; a < 3; a++)
+			sum += (p[a] - fixes->position[a][i])*(p[a] - fixes->position[a][i]);
+	}
+	track->rms_residual = sqrt(sum/n);
+
+	return OK;
+}
+
+static void fit_linear(NavTrack *track, NavFixes *fixes, int axis)
+{
+	double *t = fixes->time, *p = fixes->position[axis];
+
+	for (int i = 0; i + 1 < fixes->n; i++)
+	{
+		track->c[axis][0][i + 1] = p[i];
+		track->c[axis][1][i + 1] = (p[i + 1] - p[i])/(t[i + 1] - t[i]);
+	}
+}
+
+// Natural cubic spline, second derivatives from the tridiagonal system by the Thomas algorithm.
+static void fit_spline(NavTrack *track, NavFixes *fixes, int axis)
+{
+	int n = fixes->n;
+	double *t = fixes->time, *p = fixes->position[axis];
+	double *m = calloc(n, sizeof(double));
+	double *c = calloc(n, sizeof(double));
+	double *d = calloc(n, sizeof(double));
+
+	if (m == NULL || c == NULL || d == NULL)
+	{
+		free(m);
+		free(c);
+		free(d);
+		fit_linear(track, fixes, axis);
+		return;
+	}
+
+	//forward sweep over the interior knots, m[0] = m[n - 1] = 0
+	for (int i = 1; i + 1 < n; i++)
+	{
+		double h0 = t[i] - t[i - 1], h1 = t[i + 1] - t[i];
+		double rhs = 6*((p[i + 1] - p[i])/h1 - (p[i] - p[i - 1])/h0);
+		double diagonal = 2*(h0 + h1) - h0*c[i - 1];
+
+		c[i] = h1/diagonal;
+		d[i] = (rhs - h0*d[i - 1])/diagonal;
+	}
+
+	for (int i = n - 2; i >= 1; i--)
+		m[i] = d[i] - c[i]*m[i + 1];
+
+	for (int i = 0; i + 1 < n; i++)
+	{
+		double h = t[i + 1] - t[i];
+		track->c[axis][0][i + 1] = p[i];
+		track->c[axis][1][i + 1] = (p[i + 1] - p[i])/h - h*(2*m[i] + m[i + 1])/6;
+		track->c[axis][2][i + 1] = m[i]/2;
+		track->c[axis][3][i + 1] = (m[i + 1] - m[i])/(6*h);
+	}
+
+	free(m);
+	free(c);
+	free(d);
+}
+
+// Constant acceleration model, state position, velocity, acceleration, driven by white jerk of
+// spectral density q. Position and, where the receiver sent it, velocity are measured; they are
+// applied as two scalar updates. The smoothed states are joined by Hermite cubics, so the track
+// matches the smoothed position and velocity at every fix.
+static int fit_rts(NavTrack *track, NavFixes *fixes, int axis, double q, double *variance)
+{
+	int n = fixes->n;
+	double *t = fixes->time, *z = fixes->position[axis], *zv = fixes->velocity[axis];
+	double (*xf)[3] = malloc(n*sizeof(*xf));
+	double (*xp)[3] = malloc(n*sizeof(*xp));
+	double (*pf)[9] = malloc(n*sizeof(*pf));
+	double (*pp)[9] = malloc(n*sizeof(*pp));
+
+	if (xf == NULL || xp == NULL || pf == NULL || pp == NULL)
+	{
+		free(xf);
+		free(xp);
+		free(pf);
+		free(pp);
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Out of memory for the smoother\n");
+		return FAIL;
+	}
+
+	double x[3] = {z[0], isfinite(zv[0]) ? zv[0] : 0, 0};
+	double p[9] = {0};
+	p[0] = 1e6;
+	p[4] = 1e4;
+	p[8] = 1e2;
+
+	for (int k = 0; k < n; k++)
+	{
+		if (k > 0)
+		{
+			double h = t[k] - t[k - 1];
+			double f[9] = {1, h, h*h/2, 0, 1, h, 0, 0, 1};
+			double fp[9], predicted[9];
+
+			x[0] += h*x[1] + h*h/2*x[2];
+			x[1] += h*x[2];
+
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					fp[3*i + j] = f[3*i]*p[j] + f[3*i + 1]*p[3 + j] + f[3*i + 2]*p[6 + j];
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					predicted[3*i + j] = fp[3*i]*f[3*j] + fp[3*i + 1]*f[3*j + 1] + fp[3*i + 2]*f[3*j + 2];
+
+			double h2 = h*h, h3 = h2*h;
+			double noise[9] = {q*h3*h2/20, q*h2*h2/8, q*h3/6,
+			                   q*h2*h2/8,  q*h3/3,    q*h2/2,
+			                   q*h3/6,     q*h2/2,    q*h};
+			for (int i = 0; i < 9; i++)
+				p[i] = predicted[i] + noise[i];
+		}
+
+		memcpy(xp[k], x, sizeof(x));
+		memcpy(pp[k], p, sizeof(p));
+
+		//position, then velocity, each a scalar update with H picking one state
+		double measured[2] = {z[k], zv[k]};
+		double r[2] = {fixes->sigma[axis][k]*fixes->sigma[axis][k], fixes->sigma_velocity[k]*fixes->sigma_velocity[k]};
+		for (int m = 0; m < 2; m++)
+		{
+			if (!isfinite(measured[m]))
+				continue;
+
+			double s = p[4*m] + r[m];
+			double gain[3] = {p[m]/s, p[3 + m]/s, p[6 + m]/s};
+			double row[3] = {p[3*m], p[3*m + 1], p[3*m + 2]};
+			double innovation = measured[m] - x[m];
+
+			for (int i = 0; i < 3; i++)
+			{
+				x[i] += gain[i]*innovation;
+				for (int j = 0; j < 3; j++)
+					p[3*i + j] -= gain[i]*row[j];
+			}
+		}
+
+		memcpy(xf[k], x, sizeof(x));
+		memcpy(pf[k], p, sizeof(p));
+	}
+
+	//backward pass, xf and pf become the smoothed states
+	for (int k = n - 2; k >= 0; k--)
+	{
+		double h = t[k + 1] - t[k];
+		double f[9] = {1, h, h*h/2, 0, 1, h, 0, 0, 1};
+		double *a = pp[k + 1], inverse[9], pft[9], gain[9];
+
+		double det = a[0]*(a[4]*a[8] - a[5]*a[7]) - a[1]*(a[3]*a[8] - a[5]*a[6]) + a[2]*(a[3]*a[7] - a[4]*a[6]);
+		if (det == 0 || !isfinite(det))
+			continue;
+
+		inverse[0] = (a[4]*a[8] - a[5]*a[7])/det;
+		inverse[1] = (a[2]*a[7] - a[1]*a[8])/det;
+		inverse[2] = (a[1]*a[5] - a[2]*a[4])/det;
+		inverse[3] = (a[5]*a[6] - a[3]*a[8])/det;
+		inverse[4] = (a[0]*a[8] - a[2]*a[6])/det;
+		inverse[5] = (a[2]*a[3] - a[0]*a[5])/det;
+		inverse[6] = (a[3]*a[7] - a[4]*a[6])/det;
+		inverse[7] = (a[1]*a[6] - a[0]*a[7])/det;
+		inverse[8] = (a[0]*a[4] - a[1]*a[3])/det;
+
+		//gain = pf F' inverse(pp)
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				pft[3*i + j] = pf[k][3*i]*f[3*j] + pf[k][3*i + 1]*f[3*j + 1] + pf[k][3*i + 2]*f[3*j + 2];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				gain[3*i + j] = pft[3*i]*inverse[j] + pft[3*i + 1]*inverse[3 + j] + pft[3*i + 2]*inverse[6 + j];
+
+		double dx[3], dp[9], gdp[9];
+		for (int i = 0; i < 3; i++)
+			dx[i] = xf[k + 1][i] - xp[k + 1][i];
+		for (int i = 0; i < 9; i++)
+			dp[i] = pf[k + 1][i] - pp[k + 1][i];
+
+		for (int i = 0; i < 3; i++)
+			xf[k][i] += gain[3*i]*dx[0] + gain[3*i + 1]*dx[1] + gain[3*i + 2]*dx[2];
+
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				gdp[3*i + j] = gain[3*i]*dp[j] + gain[3*i + 1]*dp[3 + j] + gain[3*i + 2]*dp[6 + j];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				pf[k][3*i + j] += gdp[3*i]*gain[3*j] + gdp[3*i + 1]*gain[3*j + 1] + gdp[3*i + 2]*gain[3*j + 2];
+	}
+
+	for (int i = 0; i + 1 < n; i++)
+	{
+		double h = t[i + 1] - t[i];
+		double p0 = xf[i][0], v0 = xf[i][1], p1 = xf[i + 1][0], v1 = xf[i + 1][1];
+
+		track->c[axis][0][i + 1] = p0;
+		track->c[axis][1][i + 1] = v0;
+		track->c[axis][2][i + 1] = (3*(p1 - p0)/h - 2*v0 - v1)/h;
+		track->c[axis][3][i + 1] = (2*(p0 - p1)/h + v0 + v1)/(h*h);
+	}
+
+	for (int i = 0; i < n; i++)
+		variance[i] = pf[i][0] > 0 ? pf[i][0] : 0;
+
+	free(xf);
+	free(xp);
+	free(pf);
+	free(pp);
+	return OK;
+}
+
+// Straight lines before the first and after the last fix, with the velocity the track has there.
+// The last segment starts at the last fix, segment n - 1 is evaluated at its end for it.
+static void continue_ends(NavTrack *track, NavFixes *fixes)
+{
+	int n = fixes->n;
+	double h = fixes->time[n - 1] - fixes->time[n - 2];
+
+	for (int a = 0; a < 3; a++)
+	{
+		double *c0 = track->c[a][0], *c1 = track->c[a][1], *c2 = track->c[a][2], *c3 = track->c[a][3];
+
+		c0[0] = c0[1];
+		c1[0] = c1[1];
+
+		c0[n] = ((c3[n - 1]*h + c2[n - 1])*h + c1[n - 1])*h + c0[n - 1];
+		c1[n] = (3*c3[n - 1]*h + 2*c2[n - 1])*h + c1[n - 1];
+	}
+}
+
+// Segment holding t, the last with its knot at or before t.
+static int find_segment(NavTrack *track, double t)
+{
+	int low = 1, high = track->n_segments - 1;
+
+	if (t < track->knot[1])
+		return 0;
+
+	while (low < high)
+	{
+		int middle = (low + high + 1)/2;
+		if (track->knot[middle] <= t)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	return low;
+}
+
+static void eval_point(NavTrack *track, double t, double *position)
+{
+	int s = find_segment(track, t);
+	double u = t - track->knot[s];
+
+	for (int a = 0; a < 3; a++)
+		position[a] = ((track->c[a][3][s]*u + track->c[a][2][s])*u + track->c[a][1][s])*u + track->c[a][0][s];
+}
+
+void nav_free_track(NavTrack *track)
+{
+	free(track->knot);
+	for (int a = 0; a < 3; a++)
+		for (int i = 0; i < 4; i++)
+			free(track->c[a][i]);
+	free(track->sigma[0]);
+	free(track->sigma[1]);
+	memset(track, 0, sizeof(*track));
+}
+
+//-----------------------------------------------------------------------------------------------
+// Per-PRI table
+//-----------------------------------------------------------------------------------------------
+
+// Creates the file at its full size, maps it and fills the records on n_threads threads. header
+// comes with the capture fields set, the layout fields are set here.
+int nav_write(const char *path, NavTrack *track, NavHeader *header, int n_threads)
+{
+	size_t size = NAV_HEADER_SIZE + header->n_pris*sizeof(NavRecord);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0 || ftruncate(fd, size) != 0)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not create %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return FAIL;
+	}
+
+	uint8_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not map %s\n", path);
+		return FAIL;
+	}
+
+	header->magic = NAV_MAGIC;
+	header->version = NAV_VERSION;
+	header->record_size = sizeof(NavRecord);
+	header->header_size = NAV_HEADER_SIZE;
+	header->rms_residual = track->rms_residual;
+
+	//PRIs outside the fixes, the times are monotonic so these are the two ends
+	double first = track->knot[1], last = track->knot[track->n_segments - 1];
+	double t_begin = header->t0 + header->first_pri*header->period;
+	int64_t before = first > t_begin ? (int64_t)ceil((first - t_begin)/header->period) : 0;
+	int64_t after = header->n_pris - (int64_t)floor((last - t_begin)/header->period) - 1;
+	before = before < header->n_pris ? before : header->n_pris;
+	after = after > 0 ? (after < header->n_pris ? after : header->n_pris) : 0;
+	header->n_extrapolated = before + after < header->n_pris ? before + after : header->n_pris;
+
+	memcpy(data, header, sizeof(*header));
+
+	Eval eval = {track, (NavRecord *)(data + NAV_HEADER_SIZE), header->first_pri, header->t0, header->period};
+	pool_run(n_threads, header->n_pris, NAV_CHUNK, eval_task, &eval);
+
+	int status = munmap(data, size) == 0 ? OK : FAIL;
+	if (status != OK)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not write %s\n", path);
+	}
+
+	return status;
+}
+
+// Records begin up to end. PRI times are worked out in a block, then each run of PRIs inside one
+// segment is evaluated with the coefficients of that segment held in registers; the loop has no
+// branches or gathers and vectorizes. The results go from the block to the records afterwards.
+static void eval_task(void *context, int64_t begin, int64_t end, int thread)
+{
+	Eval *eval = (Eval *)context;
+	NavTrack *track = eval->track;
+	double t[NAV_BLOCK] __attribute__((aligned(ALIGNMENT)));
+	double p[3][NAV_BLOCK] __attribute__((aligned(ALIGNMENT)));
+	double v[3][NAV_BLOCK] __attribute__((aligned(ALIGNMENT)));
+	double s[NAV_BLOCK] __attribute__((aligned(ALIGNMENT)));
+
+	for (int64_t block = begin; block < end; block += NAV_BLOCK)
+	{
+		int n = end - block < NAV_BLOCK ? end - block : NAV_BLOCK;
+		double first = (double)(eval->first_pri + block);
+
+		for (int i = 0; i < n; i++)
+			t[i] = eval->t0 + (first + i)*eval->period;
+
+		int segment = find_segment(track, t[0]);
+		for (int i = 0; i < n; )
+		{
+			//run of PRIs before the next knot
+			int stop = i;
+			double next = segment + 1 < track->n_segments ? track->knot[segment + 1] : INFINITY;
+			while (stop < n && t[stop] < next)
+				stop++;
+
+			double knot = track->knot[segment];
+			double s0 = track->sigma[0][segment], s1 = track->sigma[1][segment];
+
+			for (int a = 0; a < 3; a++)
+			{
+				double c0 = track->c[a][0][segment], c1 = track->c[a][1][segment];
+				double c2 = track->c[a][2][segment], c3 = track->c[a][3][segment];
+				double *pa = p[a], *va = v[a];
+
+				for (int k = i; k < stop; k++)
+				{
+					double u = t[k] - knot;
+					pa[k] = ((c3*u + c2)*u + c1)*u + c0;
+					va[k] = (3*c3*u + 2*c2)*u + c1;
+				}
+			}
+
+			for (int k = i; k < stop; k++)
+				s[k] = s0 + s1*fabs(t[k] - knot);
+
+			i = stop;
+			segment++;
+		}
+
+		NavRecord *r = eval->records + block;
+		for (int i = 0; i < n; i++)
+		{
+			r[i].time = t[i];
+			r[i].position[0] = p[0][i];
+			r[i].position[1] = p[1][i];
+			r[i].position[2] = p[2][i];
+			r[i].velocity[0] = v[0][i];
+			r[i].velocity[1] = v[1][i];
+			r[i].velocity[2] = v[2][i];
+			r[i].sigma = s[i];
+		}
+	}
+}
+
+int nav_map(Nav *nav, const char *path)
+{
+	memset(nav, 0, sizeof(*nav));
+
+	uint8_t *data = map_file(path, &nav->size);
+	if (data == NULL || nav->size < NAV_HEADER_SIZE)
+	{
+		unmap_file(data, nav->size);
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Could not map %s\n", path);
+		return FAIL;
+	}
+
+	nav->header = (NavHeader *)data;
+	nav->records = (NavRecord *)(data + nav->header->header_size);
+
+	if (nav->header->magic != NAV_MAGIC || nav->header->version != NAV_VERSION || nav->header->record_size != sizeof(NavRecord) ||
+			nav->header->header_size + nav->header->n_pris*sizeof(NavRecord) > nav->size)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "%s is not a nav table of version %d\n", path, NAV_VERSION);
+		nav_unmap(nav);
+		return FAIL;
+	}
+
+	return OK;
+}
+
+void nav_unmap(Nav *nav)
+{
+	unmap_file(nav->header, nav->size);
+	memset(nav, 0, sizeof(*nav));
+}
+
+const char *nav_method_name(int method)
+{
+	switch (method)
+	{
+	case NavLinear: return "linear";
+	case NavSpline: return "spline";
+	case NavRts:    return "rts";
+	default:        return "unknown";
+	}
+}
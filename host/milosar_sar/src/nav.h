@@ -0,0 +1,110 @@
+#ifndef NAV_H
+#define NAV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "capture.h"
+
+// Antenna track of a capture, one record per stored PRI, the input of every focusing tool.
+//
+// nav.bin in the experiment directory is a NavHeader followed by n_pris NavRecords; record i is
+// PRI first_pri + i of the recorded stream, so it is found by index with the file mapped. Little
+// endian, no padding. Positions are east, north, up in metres in the tangent plane at the origin
+// on the WGS84 ellipsoid, times are seconds from the TCU enable on CLOCK_MONOTONIC.
+//
+// The fixes are reduced to one cubic per interval between knots and the cubics are evaluated at
+// the PRI times on all threads. The rts method smooths position and velocity per axis with a
+// constant acceleration Kalman filter and a Rauch-Tung-Striebel pass and joins the smoothed states
+// with Hermite cubics, spline is a natural cubic spline through the fixes, linear joins them with
+// straight lines. Before the first and after the last fix the track is continued in a straight line.
+
+#define NAV_MAGIC           0x5356414E  // "NAVS" little endian
+#define NAV_VERSION         1
+#define NAV_FILE            "nav.bin"
+#define NAV_HEADER_SIZE     256
+
+enum NavMethod {NavLinear = 0, NavSpline = 1, NavRts = 2};
+enum NavTime {NavArrival = 0, NavFixTime = 1};
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;             // sizeof(NavRecord)
+  uint32_t header_size;             // NAV_HEADER_SIZE, records start here
+  int64_t n_pris;
+  int64_t first_pri;
+  double t0;                        // PRI clock, time of PRI k is t0 + k*period
+  double period;
+  double origin[3];                 // latitude, longitude [deg], height [m]
+  int64_t tcu_monotonic_ns;
+  int64_t tcu_realtime_ns;
+  uint32_t method;                  // enum NavMethod
+  uint32_t n_fixes;                 // used
+  double latency;                   // [s] taken off the fix arrival times
+  double rms_residual;              // [m] track against the fixes
+  double clock_rms_us;              // PRI clock fit, 0 if nominal
+  int64_t n_extrapolated;           // PRIs outside the fixes
+  uint8_t reserved[NAV_HEADER_SIZE - 128];
+} NavHeader;
+
+typedef struct
+{
+  double time;                      // [s] from the TCU enable
+  double position[3];               // east, north, up [m]
+  float velocity[3];                // [m/s]
+  float sigma;                      // [m] position error estimate, 1 sigma
+} NavRecord;
+
+// Fixes in ENU, structure of arrays, filled by nav_load().
+typedef struct
+{
+  int n;
+  double origin[3];
+  double *time;
+  double *position[3];
+  double *velocity[3];              // NAN where the receiver sent none
+  double *sigma[3];                 // [m] per axis
+  double *sigma_velocity;
+} NavFixes;
+
+typedef struct
+{
+  int method;
+  int time_source;                  // enum NavTime
+  double latency;                   // [s]
+  double process_noise;             // [m^2/s^5] white jerk of the rts model
+  int is_origin;                    // origin given instead of the first fix
+  double origin[3];
+} NavOptions;
+
+// Track as cubics, p(t) = c[0] + c[1]*u + c[2]*u^2 + c[3]*u^3 with u = t - knot[i] on segment i.
+// Segment 0 and n_segments - 1 are the straight continuations outside the fixes.
+typedef struct
+{
+  int n_segments;
+  double *knot;
+  double *c[3][4];
+  double *sigma[2];                 // sigma = sigma[0] + sigma[1]*|u|
+  double rms_residual;
+} NavTrack;
+
+// Mapped nav.bin.
+typedef struct
+{
+  NavHeader *header;
+  NavRecord *records;
+  size_t size;
+} Nav;
+
+int nav_load(NavFixes *fixes, const char *path, Capture *capture, NavOptions *options);
+void nav_free_fixes(NavFixes *fixes);
+int nav_fit(NavTrack *track, NavFixes *fixes, NavOptions *options);
+void nav_free_track(NavTrack *track);
+int nav_write(const char *path, NavTrack *track, NavHeader *header, int n_threads);
+int nav_map(Nav *nav, const char *path);
+void nav_unmap(Nav *nav);
+const char *nav_method_name(int method);
+
+#endif  // NAV_H
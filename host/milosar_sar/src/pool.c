@@ -0,0 +1,81 @@
+#include "pool.h"
+#include "utils.h"
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct
+{
+	PoolTask task;
+	void *context;
+	int64_t n_items;
+	int64_t chunk;
+	volatile int64_t next;
+} Pool;
+
+typedef struct
+{
+	Pool *pool;
+	int thread;
+} Worker;
+
+static void *worker(void *arg);
+
+int pool_threads(int n_threads)
+{
+	if (n_threads <= 0)
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n_threads < 1)
+		return 1;
+
+	return n_threads < POOL_MAX_THREADS ? n_threads : POOL_MAX_THREADS;
+}
+
+int pool_run(int n_threads, int64_t n_items, int64_t chunk, PoolTask task, void *context)
+{
+	Pool pool = {task, context, n_items, chunk > 0 ? chunk : 1, 0};
+	pthread_t threads[POOL_MAX_THREADS];
+	Worker workers[POOL_MAX_THREADS];
+	int n_started = 1;
+
+	n_threads = pool_threads(n_threads);
+
+	//no more threads than chunks
+	if (n_threads > (n_items + pool.chunk - 1)/pool.chunk)
+		n_threads = (n_items + pool.chunk - 1)/pool.chunk;
+
+	for (int i = 1; i < n_threads; i++)
+	{
+		workers[i].pool = &pool;
+		workers[i].thread = i;
+		if (pthread_create(&threads[i], NULL, worker, &workers[i]) != 0)
+			break;
+		n_started++;
+	}
+
+	//a thread that could not start only costs speed, the others take its chunks
+	workers[0].pool = &pool;
+	workers[0].thread = 0;
+	worker(&workers[0]);
+
+	for (int i = 1; i < n_started; i++)
+		pthread_join(threads[i], NULL);
+
+	return OK;
+}
+
+static void *worker(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	Pool *pool = w->pool;
+
+	while (1)
+	{
+		int64_t begin = __atomic_fetch_add(&pool->next, pool->chunk, __ATOMIC_RELAXED);
+		if (begin >= pool->n_items)
+			return NULL;
+
+		int64_t end = begin + pool->chunk < pool->n_items ? begin + pool->chunk : pool->n_items;
+		pool->task(pool->context, begin, end, w->thread);
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+#define POOL_MAX_THREADS    256
+
+// Runs task over [begin, end) ranges of n_items on n_threads threads and returns when all items are
+// done. Threads claim the next chunk of items from a shared counter, so uneven work balances
+// itself; thread is the index of the running thread for per-thread scratch. The calling thread is
+// thread 0. n_threads 0 is one per online CPU.
+typedef void (*PoolTask)(void *context, int64_t begin, int64_t end, int thread);
+
+int pool_threads(int n_threads);
+int pool_run(int n_threads, int64_t n_items, int64_t chunk, PoolTask task, void *context);
+
+#endif  // POOL_H
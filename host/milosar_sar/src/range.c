@@ -0,0 +1,153 @@
+#include "range.h"
+#include "utils.h"
+#include "window.h"
+#include <string.h>
+#include <math.h>
+
+#define DB_FLOOR            1e-30f  // power of an empty bin, -300 dB
+
+static void centre(Range *range, float complex *spectrum);
+
+int range_init(Range *range, int n_samples, double sample_rate, double bandwidth, double sweep_time, RangeOptions *options)
+{
+	memset(range, 0, sizeof(*range));
+
+	range->n_samples = n_samples;
+	range->n_fft = fft_size((int)ceil(n_samples*(options->pad > 1 ? options->pad : 1)));
+	range->is_real = options->is_real;
+	range->n_bins = options->is_all && !options->is_real ? range->n_fft : range->n_fft/2;
+
+	range->window = alloc_aligned(n_samples*sizeof(float));
+	range->centre = alloc_aligned(range->n_bins*sizeof(float complex));
+	if (range->window == NULL || range->centre == NULL || fft_plan(&range->plan, options->is_real ? range->n_fft/2 : range->n_fft) != OK)
+	{
+		range_free(range);
+		return FAIL;
+	}
+
+	//unit peak for a unit tone: the coherent sum of n_samples is taken out with the window
+	window_make(options->window, options->window_parameter, n_samples, range->window);
+	for (int i = 0; i < n_samples; i++)
+		range->window[i] /= n_samples;
+
+	//a real tone of amplitude one splits into two halves
+	if (options->is_real)
+		for (int i = 0; i < n_samples; i++)
+			range->window[i] *= 2;
+
+	//a tone of bin k turns pi k (n - 1)/n_fft from the first sample to the middle one, negative
+	//frequencies the other way
+	for (int k = 0; k < range->n_bins; k++)
+	{
+		int f = k < range->n_fft/2 ? k : k - range->n_fft;
+		range->centre[k] = cexp(I*M_PI*f*(n_samples - 1)/range->n_fft);
+	}
+
+	if (bandwidth != 0 && sweep_time > 0)
+		range->range_bin = SPEED_OF_LIGHT*sample_rate*sweep_time/(2*fabs(bandwidth)*range->n_fft);
+
+	return OK;
+}
+
+// spectrum holds n_fft + 1 complex and is LINES_ALIGN aligned, the first n_bins are the result.
+void range_compress(Range *range, const float complex *line, float complex *spectrum, float complex *work)
+{
+	const float *w = range->window;
+	int n = range->n_samples;
+
+	if (range->is_real)
+	{
+		//the real samples go into work as floats, padded, and come out as the half spectrum
+		float *real = (float *)work + range->n_fft;
+		const float *in = (const float *)line;
+
+		for (int i = 0; i < n; i++)
+			real[i] = in[2*i]*w[i];
+		memset(real + n, 0, (range->n_fft - n)*sizeof(float));
+
+		fft_real(&range->plan, real, spectrum, work);
+		centre(range, spectrum);
+		return;
+	}
+
+	float *s = (float *)spectrum;
+	const float *in = (const float *)line;
+
+	for (int i = 0; i < n; i++)
+	{
+		s[2*i] = in[2*i]*w[i];
+		s[2*i + 1] = in[2*i + 1]*w[i];
+	}
+	memset(spectrum + n, 0, (range->n_fft - n)*sizeof(float complex));
+
+	fft_forward(&range->plan, spectrum, work);
+	centre(range, spectrum);
+}
+
+// 10 log10 of the power, log2 from the exponent bits and an atanh series on the mantissa, in
+// plain arithmetic so the loop vectorizes. Good to the float rounding of the result.
+void range_db(const float complex *x, float *db, int n)
+{
+	const float *v = (const float *)x;
+
+	for (int i = 0; i < n; i++)
+	{
+		float power = v[2*i]*v[2*i] + v[2*i + 1]*v[2*i + 1];
+		power = power > DB_FLOOR ? power : DB_FLOOR;
+
+		//power = m*2^e with m in [sqrt(0.5), sqrt(2)), ln m = 2 atanh((m - 1)/(m + 1))
+		int32_t bits;
+		memcpy(&bits, &power, sizeof(bits));
+		int32_t e = ((bits + 0x004AFB0D) >> 23) - 127;
+		bits -= e << 23;
+		float m;
+		memcpy(&m, &bits, sizeof(m));
+
+		float t = (m - 1)/(m + 1), t2 = t*t;
+		float ln = 2*t*(1 + t2*(1.0f/3 + t2*(1.0f/5 + t2*(1.0f/7 + t2*(1.0f/9)))));
+
+		db[i] = (10/M_LN10)*ln + (10*M_LN2/M_LN10)*e;
+	}
+}
+
+// atan2 from an odd minimax polynomial on [0, 1] and the octant, branch free, good to 1e-5 rad.
+void range_phase(const float complex *x, float *phase, int n)
+{
+	const float *v = (const float *)x;
+
+	for (int i = 0; i < n; i++)
+	{
+		float re = v[2*i], im = v[2*i + 1];
+		float ax = fabsf(re), ay = fabsf(im);
+		float high = ax > ay ? ax : ay, low = ax > ay ? ay : ax;
+		float a = high > 0 ? low/high : 0, s = a*a;
+
+		float r = a*(0.99997726f + s*(-0.33262347f + s*(0.19354346f + s*(-0.11643287f + s*(0.05265332f + s*-0.01172120f)))));
+		r = ay > ax ? (float)M_PI_2 - r : r;
+		r = re < 0 ? (float)M_PI - r : r;
+		phase[i] = im < 0 ? -r : r;
+	}
+}
+
+void range_free(Range *range)
+{
+	free(range->window);
+	free(range->centre);
+	fft_free(&range->plan);
+	memset(range, 0, sizeof(*range));
+}
+
+// Refers the phase of every bin to the middle sample of the line.
+static void centre(Range *range, float complex *spectrum)
+{
+	float *s = (float *)spectrum;
+	const float *c = (const float *)range->centre;
+
+	for (int k = 0; k < range->n_bins; k++)
+	{
+		float re = s[2*k]*c[2*k] - s[2*k + 1]*c[2*k + 1];
+		float im = s[2*k]*c[2*k + 1] + s[2*k + 1]*c[2*k];
+		s[2*k] = re;
+		s[2*k + 1] = im;
+	}
+}
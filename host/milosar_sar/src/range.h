@@ -0,0 +1,49 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <complex.h>
+
+#include "fft.h"
+
+#define SPEED_OF_LIGHT      299792458.0
+
+enum RangeOutput {RangeComplex = 1, RangeDb = 2, RangePhase = 4};
+
+// Range compression of dechirped FMCW lines. The tx and lo synths ramp together, so a target at
+// range R is a beat tone at 2*R*slope/c with slope = bandwidth/sweep_time, and its range profile
+// is the spectrum of the windowed line. The line is padded with zeros to n_fft, the next power
+// of two at least pad times its length.
+//
+// Complex lines keep the positive beat frequencies, n_fft/2 bins, or all n_fft with is_all.
+// is_real transforms the I samples alone, as a real FFT of half the size, n_fft/2 bins. Bin k is
+// at range k*range_bin. The window is scaled so a tone of amplitude one peaks at one, and the phase
+// of every bin is referred to the middle sample of the line: a tone's peak has the tone's phase at
+// that sample whatever bin it falls in, the time focusing takes for the whole line.
+typedef struct
+{
+  int window;                       // enum WindowKind
+  double window_parameter;
+  double pad;
+  int is_real;
+  int is_all;
+} RangeOptions;
+
+typedef struct
+{
+  int n_samples;
+  int n_fft;
+  int n_bins;
+  int is_real;
+  float *window;
+  float complex *centre;            // n_bins, turns each bin to the middle sample
+  FftPlan plan;                     // n_fft, n_fft/2 for real lines
+  double range_bin;                 // [m], 0 without bandwidth and sweep time
+} Range;
+
+int range_init(Range *range, int n_samples, double sample_rate, double bandwidth, double sweep_time, RangeOptions *options);
+void range_compress(Range *range, const float complex *line, float complex *spectrum, float complex *work);
+void range_db(const float complex *x, float *db, int n);
+void range_phase(const float complex *x, float *phase, int n);
+void range_free(Range *range);
+
+#endif  // RANGE_H
@@ -0,0 +1,58 @@
+#include "utils.h"
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+double now_seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+// Zeroed, ALIGNMENT aligned and a whole number of ALIGNMENT bytes, so vector loops can run over
+// the tail. Freed with free().
+void *alloc_aligned(size_t size)
+{
+	void *p;
+	size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+
+	if (posix_memalign(&p, ALIGNMENT, size > 0 ? size : ALIGNMENT) != 0)
+		return NULL;
+
+	memset(p, 0, size);
+	return p;
+}
+
+// Read only mapping of a whole file, NULL if it is missing or empty.
+void *map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	*size = st.st_size;
+	return data;
+}
+
+void unmap_file(void *data, size_t size)
+{
+	if (data != NULL)
+		munmap(data, size);
+}
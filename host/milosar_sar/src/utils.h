@@ -0,0 +1,17 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define OK    0
+#define FAIL  -1
+
+#define ALIGNMENT   64      // cache line, and the widest vector the kernels are built for
+
+double now_seconds(void);
+void *alloc_aligned(size_t size);
+void *map_file(const char *path, size_t *size);
+void unmap_file(void *data, size_t size);
+
+#endif
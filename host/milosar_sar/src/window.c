@@ -0,0 +1,118 @@
+#include "window.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define TAYLOR_NBAR         4
+
+static double bessel_i0(double x);
+
+// name or name:parameter, as kaiser:6 or taylor:35.
+int window_parse(const char *text, int *kind, double *parameter)
+{
+	const char *colon = strchr(text, ':');
+	int n = colon != NULL ? colon - text : (int)strlen(text);
+
+	*parameter = colon != NULL ? atof(colon + 1) : 0;
+
+	for (int k = WindowRect; k <= WindowTaylor; k++)
+	{
+		if ((int)strlen(window_name(k)) == n && strncmp(text, window_name(k), n) == 0)
+		{
+			*kind = k;
+			if (k == WindowKaiser && colon == NULL)
+				*parameter = 6;
+			if (k == WindowTaylor && colon == NULL)
+				*parameter = 35;
+			return OK;
+		}
+	}
+
+	return FAIL;
+}
+
+void window_make(int kind, double parameter, int n, float *w)
+{
+	double *v = malloc(n*sizeof(double));
+	double sum = 0;
+
+	if (v == NULL)
+	{
+		for (int i = 0; i < n; i++)
+			w[i] = 1;
+		return;
+	}
+
+	//Taylor coefficients, Carrara, Goodman and Majewski
+	double f[TAYLOR_NBAR] = {0};
+	if (kind == WindowTaylor)
+	{
+		double a = acosh(pow(10, parameter/20))/M_PI;
+		double sigma2 = TAYLOR_NBAR*TAYLOR_NBAR/(a*a + (TAYLOR_NBAR - 0.5)*(TAYLOR_NBAR - 0.5));
+
+		for (int m = 1; m < TAYLOR_NBAR; m++)
+		{
+			double numerator = 1, denominator = 1;
+			for (int i = 1; i < TAYLOR_NBAR; i++)
+			{
+				numerator *= 1 - m*m/(sigma2*(a*a + (i - 0.5)*(i - 0.5)));
+				if (i != m)
+					denominator *= 1 - (double)m*m/(i*i);
+			}
+			f[m] = (m % 2 ? 1 : -1)*numerator/(2*denominator);
+		}
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		double x = n > 1 ? (double)i/(n - 1) : 0.5;
+
+		switch (kind)
+		{
+		case WindowHann:     v[i] = 0.5 - 0.5*cos(2*M_PI*x); break;
+		case WindowHamming:  v[i] = 0.54 - 0.46*cos(2*M_PI*x); break;
+		case WindowBlackman: v[i] = 0.42 - 0.5*cos(2*M_PI*x) + 0.08*cos(4*M_PI*x); break;
+		case WindowKaiser:   v[i] = bessel_i0(parameter*sqrt(1 - (2*x - 1)*(2*x - 1)))/bessel_i0(parameter); break;
+		case WindowTaylor:
+			v[i] = 1;
+			for (int m = 1; m < TAYLOR_NBAR; m++)
+				v[i] += 2*f[m]*cos(2*M_PI*m*(x - 0.5)*(n - 1)/n);
+			break;
+		default:             v[i] = 1; break;
+		}
+		sum += v[i];
+	}
+
+	for (int i = 0; i < n; i++)
+		w[i] = sum > 0 ? v[i]*n/sum : 1;
+
+	free(v);
+}
+
+const char *window_name(int kind)
+{
+	switch (kind)
+	{
+	case WindowRect:     return "rect";
+	case WindowHann:     return "hann";
+	case WindowHamming:  return "hamming";
+	case WindowBlackman: return "blackman";
+	case WindowKaiser:   return "kaiser";
+	case WindowTaylor:   return "taylor";
+	default:             return "unknown";
+	}
+}
+
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+
+	for (int k = 1; k < 50 && term > 1e-12*sum; k++)
+	{
+		term *= (x/(2*k))*(x/(2*k));
+		sum += term;
+	}
+
+	return sum;
+}
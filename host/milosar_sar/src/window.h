@@ -0,0 +1,13 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+enum WindowKind {WindowRect = 0, WindowHann = 1, WindowHamming = 2, WindowBlackman = 3, WindowKaiser = 4, WindowTaylor = 5};
+
+// Tapers for the range and azimuth FFTs, normalised to a mean of one so the peak of a point
+// target keeps its height whatever the window. parameter is the Kaiser beta or the Taylor
+// sidelobe level in dB, the Taylor window uses 4 nearly constant sidelobes.
+int window_parse(const char *text, int *kind, double *parameter);
+void window_make(int kind, double parameter, int n, float *w);
+const char *window_name(int kind);
+
+#endif  // WINDOW_H
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "colour.h"
+#include "trace.h"
+#include "version.h"
+
+#define MAX_EVENTS  256
+
+//-----------------------------------------------------------------------------------------------
+// Local function definitions
+//-----------------------------------------------------------------------------------------------
+void usage(void);
+int convert(FILE *in, FILE *out, int is_summary);
+
+// Span statistics per event id, from matching begin and end records of one thread
+typedef struct
+{
+	uint64_t count;
+	double sum_us;
+	double max_us;
+	uint64_t n_instants;
+} EventStats;
+
+//-----------------------------------------------------------------------------------------------
+// Converts a milosar trace.bin dump to the Chrome trace event JSON format, which loads into
+// chrome://tracing and ui.perfetto.dev. Times are microseconds since the earliest record.
+//-----------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	int is_summary = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:sh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o': output = optarg; break;
+		case 's': is_summary = 1; break;
+		default:  usage(); return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	FILE *in = fopen(argv[optind], "rb");
+	if (in == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not open %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *out = output != NULL ? fopen(output, "w") : stdout;
+	if (out == NULL)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		printf("Could not open %s\n", output);
+		fclose(in);
+		return EXIT_FAILURE;
+	}
+
+	int status = convert(in, out, is_summary);
+
+	fclose(in);
+	if (out != stdout)
+		fclose(out);
+
+	return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "milosar_trace %s\n", MILOSAR_VERSION);
+	fprintf(stderr, "usage: milosar_trace [-o trace.json] [-s] trace.bin\n");
+	fprintf(stderr, "  -o  write the JSON here instead of stdout\n");
+	fprintf(stderr, "  -s  print per event span statistics to stderr\n");
+}
+
+int convert(FILE *in, FILE *out, int is_summary)
+{
+	TraceFileHeader header;
+
+	if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Not a milosar trace dump\n");
+		return -1;
+	}
+
+	if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord) || header.n_events > MAX_EVENTS)
+	{
+		cprint("[!!] ", BRIGHT, RED);
+		fprintf(stderr, "Unsupported trace version %d, record size %d\n", header.version, header.record_size);
+		return -1;
+	}
+
+	char names[MAX_EVENTS][TRACE_EVENT_LEN];
+	if (fread(names, TRACE_EVENT_LEN, header.n_events, in) != header.n_events)
+		return -1;
+	for (int i = 0; i < header.n_events; i++)
+		names[i][TRACE_EVENT_LEN - 1] = '\0';
+
+	//read every thread first, timestamps are made relative to the earliest record
+	TraceThreadHeader threads[TRACE_MAX_THREADS];
+	TraceRecord *records[TRACE_MAX_THREADS];
+	uint64_t t0 = UINT64_MAX;
+	int n_threads = header.n_threads < TRACE_MAX_THREADS ? header.n_threads : TRACE_MAX_THREADS;
+
+	for (int i = 0; i < n_threads; i++)
+	{
+		if (fread(&threads[i], sizeof(TraceThreadHeader), 1, in) != 1)
+			return -1;
+		threads[i].name[TRACE_NAME_LEN - 1] = '\0';
+
+		records[i] = malloc((threads[i].n_records + 1) * sizeof(TraceRecord));
+		if (records[i] == NULL || fread(records[i], sizeof(TraceRecord), threads[i].n_records, in) != threads[i].n_records)
+		{
+			cprint("[!!] ", BRIGHT, RED);
+			fprintf(stderr, "Trace truncated in thread %s\n", threads[i].name);
+			return -1;
+		}
+
+		if (threads[i].n_records > 0 && records[i][0].time_ns < t0)
+			t0 = records[i][0].time_ns;
+	}
+
+	EventStats stats[MAX_EVENTS];
+	memset(stats, 0, sizeof(stats));
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"cause\":%u,\"ns_per_event\":%.1f,\"start_realtime_ns\":%lld},\n",
+	        header.cause, header.ns_per_event, (long long)(t0 + header.realtime_offset_ns));
+	fprintf(out, "\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"milosar\"}}");
+
+	for (int i = 0; i < n_threads; i++)
+	{
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i, threads[i].name);
+
+		//open spans of this thread, begin and end nest per event id
+		uint64_t open[MAX_EVENTS][8];
+		int depth[MAX_EVENTS];
+		memset(depth, 0, sizeof(depth));
+
+		for (uint32_t j = 0; j < threads[i].n_records; j++)
+		{
+			TraceRecord *r = &records[i][j];
+			const char *name = r->id < header.n_events ? names[r->id] : "Unknown";
+			double ts = (r->time_ns - t0)*1e-3;
+
+			if (r->phase == TRACE_COUNTER_PHASE)
+				fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%d}}", name, ts, i, r->a);
+			else if (r->phase == TRACE_INSTANT_PHASE)
+				fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"a\":%d,\"b\":%d}}", name, ts, i, r->a, r->b);
+			else
+				fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"a\":%d,\"b\":%d}}", name, r->phase, ts, i, r->a, r->b);
+
+			if (r->id >= MAX_EVENTS)
+				continue;
+
+			if (r->phase == TRACE_INSTANT_PHASE)
+				stats[r->id].n_instants++;
+			else if (r->phase == TRACE_BEGIN_PHASE && depth[r->id] < 8)
+				open[r->id][depth[r->id]++] = r->time_ns;
+			else if (r->phase == TRACE_END_PHASE && depth[r->id] > 0)
+			{
+				double us = (r->time_ns - open[r->id][--depth[r->id]])*1e-3;
+				stats[r->id].count++;
+				stats[r->id].sum_us += us;
+				stats[r->id].max_us = us > stats[r->id].max_us ? us : stats[r->id].max_us;
+			}
+		}
+
+		free(records[i]);
+	}
+
+	fprintf(out, "\n]}\n");
+
+	if (is_summary)
+	{
+		fprintf(stderr, "cause %u, %.1f [ns] per event\n", header.cause, header.ns_per_event);
+		for (int i = 0; i < n_threads; i++)
+			fprintf(stderr, "thread %-16s %8u records, %u lost\n", threads[i].name, threads[i].n_records, threads[i].n_lost);
+
+		fprintf(stderr, "%-22s %8s %12s %12s %8s\n", "event", "spans", "mean [us]", "max [us]", "instants");
+		for (int i = 0; i < header.n_events; i++)
+			if (stats[i].count > 0 || stats[i].n_instants > 0)
+				fprintf(stderr, "%-22s %8llu %12.1f %12.1f %8llu\n", names[i], (unsigned long long)stats[i].count,
+				        stats[i].count > 0 ? stats[i].sum_us/stats[i].count : 0.0, stats[i].max_us, (unsigned long long)stats[i].n_instants);
+	}
+
+	return 0;
+}
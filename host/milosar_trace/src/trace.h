@@ -0,0 +1,148 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Binary event trace of the milosar threads, built in with "make TRACE=1". Without it every
+// TRACE_* macro expands to nothing and no trace code is linked.
+//
+// Each thread that calls TRACE_THREAD() owns a ring of TRACE_RING_EVENTS records and is its only
+// writer, so recording an event is a clock read and a 24 byte store with no lock or atomic
+// read-modify-write. A full ring overwrites its oldest records. The rings are dumped to
+// trace.bin in the experiment directory at the end of every session and to TRACE_CRASH_FILE on a
+// fatal signal. host/milosar_trace converts a dump to the Chrome trace event format.
+
+#define TRACE_MAGIC         0x45435254  // "TRCE" little endian
+#define TRACE_VERSION       1
+#define TRACE_MAX_THREADS   16
+#define TRACE_RING_EVENTS   8192        // per thread, power of two
+#define TRACE_NAME_LEN      16          // thread names
+#define TRACE_EVENT_LEN     32          // event names
+#define TRACE_FILE          "trace.bin"
+#define TRACE_CRASH_FILE    "/tmp/milosar_trace.bin"
+
+// Event ids, the names are written into every dump so old dumps stay readable.
+#define TRACE_EVENTS(X)     \
+  X(TraceSession)           \
+  X(TraceTcuEnable)         \
+  X(TraceDrain)             \
+  X(TraceCopy)              \
+  X(TraceWrite)             \
+  X(TraceOverrun)           \
+  X(TraceStale)             \
+  X(TraceCommit)            \
+  X(TraceSegmentComplete)   \
+  X(TraceSegmentDeleted)    \
+  X(TraceDiskWrite)         \
+  X(TraceStreamBlock)       \
+  X(TraceLed)               \
+  X(TraceButton)            \
+  X(TraceGpsFix)            \
+  X(TraceSynthReset)        \
+  X(TraceSynthFlash)        \
+  X(TraceSynthRegister)     \
+  X(TraceRamping)           \
+  X(TraceControl)           \
+  X(TraceQuicklook)
+
+#define TRACE_ENUM(name) name,
+enum TraceEvent {TRACE_EVENTS(TRACE_ENUM) N_TRACE_EVENTS};
+#undef TRACE_ENUM
+
+// Chrome trace event phases
+#define TRACE_BEGIN_PHASE   'B'
+#define TRACE_END_PHASE     'E'
+#define TRACE_INSTANT_PHASE 'i'
+#define TRACE_COUNTER_PHASE 'C'
+
+typedef struct
+{
+  uint64_t time_ns;           // CLOCK_MONOTONIC
+  uint16_t id;                // enum TraceEvent
+  uint16_t phase;
+  int32_t a;
+  int32_t b;
+  uint32_t reserved;
+} TraceRecord;
+
+// Dump layout: TraceFileHeader, n_events names of TRACE_EVENT_LEN bytes, then per thread a
+// TraceThreadHeader followed by its n_records records, oldest first. Little endian throughout.
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint16_t n_threads;
+  uint16_t n_events;
+  uint32_t cause;             // 0 at the end of a session, the signal number after a crash
+  int64_t realtime_offset_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC at the dump
+  double ns_per_event;        // cost of one event measured at startup
+} TraceFileHeader;
+
+typedef struct
+{
+  char name[TRACE_NAME_LEN];
+  uint32_t n_records;
+  uint32_t n_lost;            // records overwritten before this dump
+} TraceThreadHeader;
+
+#ifdef TRACE
+
+typedef struct
+{
+  char name[TRACE_NAME_LEN];
+  TraceRecord *records;
+  volatile uint64_t head;     // records ever written, only advanced by the owning thread
+  uint64_t start;             // head when the session started, earlier records are not dumped
+} TraceRing;
+
+extern __thread TraceRing *trace_ring;
+
+static inline void trace_event(int id, int phase, int32_t a, int32_t b)
+{
+  TraceRing *ring = trace_ring;
+  if (ring == NULL)
+    return;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  uint64_t head = ring->head;
+  TraceRecord *record = &ring->records[head & (TRACE_RING_EVENTS - 1)];
+  record->time_ns = (uint64_t)now.tv_sec*1000000000 + now.tv_nsec;
+  record->id = id;
+  record->phase = phase;
+  record->a = a;
+  record->b = b;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int init_trace(void);
+void trace_thread(const char *name);
+void trace_session_start(void);
+int trace_dump(const char *path, int cause);
+
+#define TRACE_INIT()                init_trace()
+#define TRACE_THREAD(name)          trace_thread(name)
+#define TRACE_SESSION_START()       trace_session_start()
+#define TRACE_DUMP(path)            trace_dump(path, 0)
+#define TRACE_BEGIN(id, a, b)       trace_event(id, TRACE_BEGIN_PHASE, a, b)
+#define TRACE_END(id, a, b)         trace_event(id, TRACE_END_PHASE, a, b)
+#define TRACE_INSTANT(id, a, b)     trace_event(id, TRACE_INSTANT_PHASE, a, b)
+#define TRACE_COUNTER(id, value)    trace_event(id, TRACE_COUNTER_PHASE, value, 0)
+
+#else
+
+#define TRACE_INIT()                ((void)0)
+#define TRACE_THREAD(name)          ((void)0)
+#define TRACE_SESSION_START()       ((void)0)
+#define TRACE_DUMP(path)            ((void)0)
+#define TRACE_BEGIN(id, a, b)       ((void)0)
+#define TRACE_END(id, a, b)         ((void)0)
+#define TRACE_INSTANT(id, a, b)     ((void)0)
+#define TRACE_COUNTER(id, value)    ((void)0)
+
+#endif  // TRACE
+
+#endif  // TRACE_H